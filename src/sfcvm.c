@@ -14,9 +14,12 @@
 
 #include <assert.h>
 #include <math.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "ucvm_model_dtypes.h"
 #include "sfcvm.h"
+#include "sfcvm_proj.h"
 #include "cJSON.h"
 
 #include "geomodelgrids/serial/cquery.h"
@@ -24,7 +27,173 @@
 
 #define ROUND_2_INT(f) ((int)(f >= 0.0 ? (f + 0.5) : (f - 0.5)))
 
+/* Points processed together by one pass of the query pipeline */
+#define SFCVM_BATCH 256
+
+/* Padding (degrees) around a footprint when it is put in the tile index */
+#define SFCVM_TILE_INDEX_MARGIN 0.05
+/* Cap on the tile index grid, per side */
+#define SFCVM_TILE_INDEX_MAX_CELLS 256
+
+/* Init snapshot file, see _write_init_snapshot */
+#define SFCVM_SNAPSHOT_MAGIC 0x53464353
+#define SFCVM_SNAPSHOT_VERSION 6
+/* Longest string held in a snapshot */
+#define SFCVM_SNAPSHOT_STR_MAX 4096
+/* Most data files a snapshot is trusted to hold */
+#define SFCVM_SNAPSHOT_TILES_MAX 65536
+/* Nanoseconds of a file mtime, an edit within the same second still changes it */
+#ifdef __APPLE__
+#define SFCVM_MTIME_NSEC(st) ((st).st_mtimespec.tv_nsec)
+#else
+#define SFCVM_MTIME_NSEC(st) ((st).st_mtim.tv_nsec)
+#endif
+
+/* CRS of the coordinates handed to a query object */
+#define SFCVM_CRS_UTM 0
+#define SFCVM_CRS_GEO 1
+/* model_crs, points projected by the library */
+#define SFCVM_CRS_NATIVE 2
+/* Input CRS the library can not project go to objects of their own, from here on */
+#define SFCVM_CRS_FIXED 3
+
+/* Step down levels remembered per column, see _step_query */
+#define SFCVM_STEP_MEMO 32
+
+/* Most input CRS declared through INPUT_CRS, see _input_crs */
+#define SFCVM_INPUT_CRS_MAX 16
+#define SFCVM_CRS_MAX (SFCVM_CRS_FIXED+SFCVM_INPUT_CRS_MAX)
+
+/* Query objects of one data_file entry, one per SFCVM_CRS_* */
+typedef struct sfcvm_tile_t {
+    char *filename;
+    void *query_object[SFCVM_CRS_MAX];
+    void *error_handler[SFCVM_CRS_MAX];
+    /* could not be opened, treated as holding no points */
+    int failed[SFCVM_CRS_MAX];
+} sfcvm_tile_t;
+
+/* Input CRS compiled once, entry i of the cache uses query object slot SFCVM_CRS_FIXED+i */
+typedef struct sfcvm_input_crs_t {
+    char *crs;
+    /* sfcvm_crs_kind_t */
+    int kind;
+    /* SFCVM_CRS_KIND_TMERC */
+    sfcvm_tmerc_t tm;
+    /* the input is in model_crs already and goes in as it is */
+    int native;
+} sfcvm_input_crs_t;
+
+/*
+ * Uniform lon/lat grid over the tile footprints. Each cell lists, in
+ * priority order, the tiles whose padded footprint box touches it, so a
+ * point only looks at the few tiles near it whatever the tile count.
+ */
+typedef struct sfcvm_tile_index_t {
+    double lon0;
+    double lat0;
+    double dlon;
+    double dlat;
+    int nx;
+    int ny;
+    /* tiles of cell c are cell_tiles[cell_start[c]..cell_start[c+1]-1] */
+    int *cell_start;
+    int *cell_tiles;
+    /* tiles without a footprint, the candidates off the grid */
+    int *open_tiles;
+    int open_cnt;
+    /* every tile in order, for UTM points */
+    int *all_tiles;
+} sfcvm_tile_index_t;
+
+/* Tiles that may hold a point, and the one it is routed to */
+typedef struct sfcvm_route_t {
+    const int *cand;
+    int cand_cnt;
+    /* position in cand of the tile in use, -1 if none holds the point */
+    int pos;
+    /* SFCVM_CRS_* of the query objects, x and y are in that CRS */
+    int crs;
+    double x;
+    double y;
+} sfcvm_route_t;
+
+/* Water step down levels of a column already queried, with their results */
+typedef struct sfcvm_step_memo_t {
+    double zSquashed[SFCVM_STEP_MEMO];
+    double values[SFCVM_STEP_MEMO][4];
+    int err[SFCVM_STEP_MEMO];
+    int cnt;
+} sfcvm_step_memo_t;
+
+/* A lon/lat location projected, routed and with its surface looked up */
+typedef struct sfcvm_column_t {
+    double longitude;
+    double latitude;
+    sfcvm_route_t route;
+    double zSurf;
+    double zTop;
+    /* outside of the model surface, or rejected by fast fail */
+    int outside;
+    /* step down levels, kept for columns queried more than once */
+    sfcvm_step_memo_t *memo;
+    int keep_memo;
+} sfcvm_column_t;
+
+/* Columns located once and queried at any number of depths, see sfcvm_columns_create */
+struct sfcvm_columns_t {
+    sfcvm_context_t ctx;
+    sfcvm_column_t *col;
+    int cnt;
+};
+
+/* State of a point while its block is being queried */
+typedef struct sfcvm_block_point_t {
+    double zSquashed;
+    double values[4];
+    sfcvm_route_t route;
+    sfcvm_column_t *col;
+    int model_i;
+    int err;
+    /* reached the model query, 0 if outside of the surface */
+    int queried;
+    /* still under water after sfcvm_water_max_step_limit steps */
+    int water_limit;
+} sfcvm_block_point_t;
+
+/* Batch correction, fills vp/vs/rho and sets hit[k] where it applies */
+typedef void (*sfcvm_correction_fn_t)(int cnt, const double *elevation, double *vp, double *vs, double *rho, int *hit);
+
+/* Entry of the zone_id correction registry */
+typedef struct sfcvm_correction_t {
+    const char *name;
+    /* 0 detailed, 1 regional */
+    int model_i;
+    int zone_id;
+    sfcvm_correction_fn_t fn;
+    /* points corrected, reported in debug mode */
+    int count;
+} sfcvm_correction_t;
+
+/* Under-water points of a block that still need to step down */
+typedef struct sfcvm_water_queue_t {
+    sfcvm_block_point_t *pt[SFCVM_BATCH];
+    double zSurf[SFCVM_BATCH];
+    double zTop[SFCVM_BATCH];
+    double dZ[SFCVM_BATCH];
+    double zSquashed[SFCVM_BATCH];
+    int cnt;
+} sfcvm_water_queue_t;
+
 int _processUCVMConfiguration(char *confstr);
+void _free_sfcvm_configuration(sfcvm_configuration_t *config);
+void _dump_sfcvm_configuration(sfcvm_configuration_t *config);
+void set_setSquashMinElev(double val);
+void set_setGabbro(int val);
+void set_setFastFail(int val);
+void set_setVsFloor(double val);
+void set_setQsVs(double val);
+void set_setQpQs(double val);
 
 /************ Constants and Variables ********/
 
@@ -59,16 +228,21 @@ int sfcvm_plugin=sfcvm_false;
 /* Values and order to be returned in queries.  */
 static const size_t sfcvm_numValues = 4;
 static const char* const sfcvm_valueNames[4] = { "Vp", "Vs", "density","zone_id" };
-// "San Leandro G" -- detailed
-int sfcvm_san_leandro_gabbro_type_id = 4; 
-// "Logan G"  -- detailed
-int sfcvm_logan_gabbro_type_id = 5; 
-// "GV gabbro" -- regional
-int sfcvm_gv_gabbro_type_id = 3; 
 
-// max is 10
-char* sfcvm_filenames[10];  
-int sfcvm_filenames_cnt;
+void _gabbro_batch(int cnt, const double *elevation, double *vp, double *vs, double *rho, int *hit);
+/* Corrections by zone_id, the zone_id numbering differs per model */
+sfcvm_correction_t sfcvm_corrections[] = {
+  { "San Leandro G", 0, 4, _gabbro_batch, 0 }, // detailed
+  { "Logan G", 0, 5, _gabbro_batch, 0 },       // detailed
+  { "GV gabbro", 1, 3, _gabbro_batch, 0 },     // regional
+};
+static const int sfcvm_corrections_cnt = sizeof(sfcvm_corrections)/sizeof(sfcvm_correction_t);
+
+// one per data_file entry, in query priority order
+sfcvm_tile_t *sfcvm_tiles=0;
+int sfcvm_tiles_cnt=0;
+int sfcvm_tiles_opened=0; // geographic and UTM query objects created so far
+sfcvm_tile_index_t sfcvm_tile_index;
 
 /* Coordinate reference system of points passed to queries.
 *
@@ -77,15 +251,18 @@ int sfcvm_filenames_cnt;
 i latitude, longitude, elevation in the WGS84 horizontal
 * datum. The elevation is with respect to the WGS84 ellipsoid.
 */
-// NAD83/UTM Zone 10N
-const char* const sfcvm_utm_crs = "EPSG:26910";
+// NAD83/UTM, zone from utm_zone in the config
+char sfcvm_utm_crs[32] = "EPSG:26910";
 // WGS84
 const char* const sfcvm_geo_crs = "EPSG:4326";
 
-void* sfcvm_geo_query_object=0;
-void* sfcvm_utm_query_object=0;
-void* sfcvm_geo_error_handler=0;
-void* sfcvm_utm_error_handler=0;
+// model_crs from the config, geographic points are projected into it in batches
+sfcvm_tmerc_t sfcvm_native_tm;
+int sfcvm_native=0;
+
+// input CRS declared on contexts, kept until finalize
+sfcvm_input_crs_t sfcvm_input_crs[SFCVM_INPUT_CRS_MAX];
+int sfcvm_input_crs_cnt=0;
 
 const size_t sfcvm_spaceDim = 3;
 
@@ -104,9 +281,14 @@ int sfcvm_water_step_count=0; // total number of location that needed to step do
 int sfcvm_water_max_step=0;   // max number of loops needed to find valid data
 int sfcvm_water_max_step_limit=30;   // put a limit to loops needed to find valid data
 int sfcvm_water_max_step_limit_count=0;   // number of location that hit the limit
+long sfcvm_water_step_shared=0;   // step down queries answered by an earlier point of the column
+long sfcvm_fastfail_count=0;   // points outside every footprint, never sent to geomodelgrids
 int sfcvm_water_step_in_detail=0;   // in detail region
 int sfcvm_water_step_in_regional=0;   // in regional region
 
+sfcvm_stats_t sfcvm_init_stats; // init stage timings, counters are filled by sfcvm_get_stats
+double sfcvm_open_seconds=0; // time spent creating query objects
+
 
 FILE *stderrfp;
 
@@ -114,20 +296,770 @@ int sfcvm_force_depth=0;
 
 double SFCVM_SquashMinElev=-45000.0;
 int SFCVM_Gabbro=1;
+int SFCVM_FastFail=0;
+// derived outputs, off until set
+double SFCVM_VsFloor=0;
+double SFCVM_QsVs=0;
+double SFCVM_QpQs=2;
+// squashing min elevation currently set on the query objects
+double sfcvm_live_squashminelev=0;
 
 // set in, sfcvm_setparam(int id, int param, ...)
 int sfcvm_zmode=SFCVM_ZMODE_DEPTH; // SFCVM_ZMODE_DEPTH or SFCVM_ZMODE_ELEVATION
 
+/* Monotonic clock in seconds, for the init stage timings */
+double _now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1.0e-9;
+}
+
+/* CRS string a query object is created with */
+const char *_crs_string(int crs) {
+    if(crs >= SFCVM_CRS_FIXED) return sfcvm_input_crs[crs-SFCVM_CRS_FIXED].crs;
+    if(crs == SFCVM_CRS_NATIVE) return sfcvm_configuration->model_crs;
+    return (crs == SFCVM_CRS_GEO) ? sfcvm_geo_crs : sfcvm_utm_crs;
+}
+
+/**
+ * Creates a query object of one data file. Each data file gets its own
+ * objects so a point is only tested against the tiles the index routes
+ * it to. Objects are created on first use, a job that stays in the
+ * detailed domain never loads the regional model.
+ *
+ * @param tile The tile to open.
+ * @param crs SFCVM_CRS_* of the points the object will take.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int _open_tile(sfcvm_tile_t *tile, int crs) {
+    const char *filenames[1];
+    filenames[0]=tile->filename;
+    double t0=_now();
+
+/* Create and initialize serial query object using the parameters stored in local variables.  */
+    void *query_object = geomodelgrids_squery_create();
+    if(query_object == NULL) {
+      tile->failed[crs]=1;
+      return UCVM_MODEL_CODE_ERROR;
+    }
+
+/** Log warnings and errors to "sfcvm_geo_error.log" or "sfcvm_utm_error.log". **/
+    void *error_handler = geomodelgrids_squery_getErrorHandler(query_object);
+//    geomodelgrids_cerrorhandler_setLogFilename(error_handler, geo ? "sfcvm_geo_error.log" : "sfcvm_utm_error.log");
+
+    int err=geomodelgrids_squery_initialize(query_object, filenames,
+                 1, sfcvm_valueNames, sfcvm_numValues, _crs_string(crs));
+    if(!err) {
+      err=geomodelgrids_squery_setSquashing(query_object, GEOMODELGRIDS_SQUASH_TOPOGRAPHY_BATHYMETRY);
+    }
+    if(err || error_handler == NULL) {
+      geomodelgrids_squery_destroy(&query_object);
+      // do not try again on every point
+      tile->failed[crs]=1;
+      fprintf(stderr,"SFCVM: unable to open data file %s in %s\n", tile->filename, _crs_string(crs));
+      return UCVM_MODEL_CODE_ERROR;
+    }
+    geomodelgrids_squery_setSquashMinElev(query_object, sfcvm_live_squashminelev);
+
+    tile->query_object[crs]=query_object;
+    tile->error_handler[crs]=error_handler;
+    // objects_total counts the geographic and UTM objects of each tile, not the input CRS ones
+    if(crs == SFCVM_CRS_UTM || crs == (sfcvm_native ? SFCVM_CRS_NATIVE : SFCVM_CRS_GEO)) sfcvm_tiles_opened++;
+    sfcvm_open_seconds+=_now()-t0;
+    return UCVM_MODEL_CODE_SUCCESS;
+}
+
+void _close_tile(sfcvm_tile_t *tile) {
+    for(int c=0; c<SFCVM_CRS_MAX; c++) {
+      if(tile->query_object[c]) geomodelgrids_squery_destroy(&tile->query_object[c]);
+      tile->query_object[c]=0;
+    }
+    free(tile->filename);
+    tile->filename=0;
+}
+
+/**
+ * Builds the uniform grid index over the footprints of the data files.
+ * Cell size follows the tile count, about 16 cells per footprinted tile.
+ * Data files without a footprint are candidates everywhere.
+ *
+ * @param idx The index to fill in.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int _build_tile_index(sfcvm_tile_index_t *idx) {
+    int ntiles=sfcvm_configuration->data_cnt;
+    int nfoot=0;
+    double lon_min=0, lon_max=0, lat_min=0, lat_max=0;
+
+    memset(idx, 0, sizeof(sfcvm_tile_index_t));
+    idx->all_tiles=(int *)malloc((ntiles > 0 ? ntiles : 1)*sizeof(int));
+    idx->open_tiles=(int *)malloc((ntiles > 0 ? ntiles : 1)*sizeof(int));
+    if(idx->all_tiles == NULL || idx->open_tiles == NULL) return UCVM_MODEL_CODE_ERROR;
+
+    for(int t=0; t<ntiles; t++) {
+      sfcvm_data_file_t *d=&sfcvm_configuration->data[t];
+      idx->all_tiles[t]=t;
+      if(d->footprint_cnt < 3) {
+        idx->open_tiles[idx->open_cnt++]=t;
+        continue;
+      }
+      for(int v=0; v<d->footprint_cnt; v++) {
+        double lon=d->footprint[2*v], lat=d->footprint[2*v+1];
+        if(nfoot == 0 && v == 0) { lon_min=lon_max=lon; lat_min=lat_max=lat; }
+        if(lon < lon_min) lon_min=lon;
+        if(lon > lon_max) lon_max=lon;
+        if(lat < lat_min) lat_min=lat;
+        if(lat > lat_max) lat_max=lat;
+      }
+      nfoot++;
+    }
+
+    // no footprints, every point goes through the open tiles
+    if(nfoot == 0) return UCVM_MODEL_CODE_SUCCESS;
+
+    int n=(int)ceil(sqrt((double)nfoot))*4;
+    if(n > SFCVM_TILE_INDEX_MAX_CELLS) n=SFCVM_TILE_INDEX_MAX_CELLS;
+    idx->nx=n;
+    idx->ny=n;
+    idx->lon0=lon_min-SFCVM_TILE_INDEX_MARGIN;
+    idx->lat0=lat_min-SFCVM_TILE_INDEX_MARGIN;
+    idx->dlon=(lon_max-lon_min+2*SFCVM_TILE_INDEX_MARGIN)/n;
+    idx->dlat=(lat_max-lat_min+2*SFCVM_TILE_INDEX_MARGIN)/n;
+
+    idx->cell_start=(int *)calloc(n*n+1, sizeof(int));
+    if(idx->cell_start == NULL) return UCVM_MODEL_CODE_ERROR;
+
+    // two passes over the tiles, count then fill, keeps each cell in priority order
+    for(int pass=0; pass<2; pass++) {
+      int *fill=NULL;
+      if(pass == 1) {
+        for(int c=0; c<n*n; c++) idx->cell_start[c+1]+=idx->cell_start[c];
+        idx->cell_tiles=(int *)malloc((idx->cell_start[n*n] > 0 ? idx->cell_start[n*n] : 1)*sizeof(int));
+        fill=(int *)malloc(n*n*sizeof(int));
+        if(idx->cell_tiles == NULL || fill == NULL) {
+          free(fill);
+          return UCVM_MODEL_CODE_ERROR;
+        }
+        memcpy(fill, idx->cell_start, n*n*sizeof(int));
+      }
+      for(int t=0; t<ntiles; t++) {
+        sfcvm_data_file_t *d=&sfcvm_configuration->data[t];
+        int ix0=0, ix1=n-1, iy0=0, iy1=n-1;
+        if(d->footprint_cnt >= 3) {
+          double b[4]={ d->footprint[0], d->footprint[0], d->footprint[1], d->footprint[1] };
+          for(int v=1; v<d->footprint_cnt; v++) {
+            if(d->footprint[2*v] < b[0]) b[0]=d->footprint[2*v];
+            if(d->footprint[2*v] > b[1]) b[1]=d->footprint[2*v];
+            if(d->footprint[2*v+1] < b[2]) b[2]=d->footprint[2*v+1];
+            if(d->footprint[2*v+1] > b[3]) b[3]=d->footprint[2*v+1];
+          }
+          ix0=(int)floor((b[0]-SFCVM_TILE_INDEX_MARGIN-idx->lon0)/idx->dlon);
+          ix1=(int)floor((b[1]+SFCVM_TILE_INDEX_MARGIN-idx->lon0)/idx->dlon);
+          iy0=(int)floor((b[2]-SFCVM_TILE_INDEX_MARGIN-idx->lat0)/idx->dlat);
+          iy1=(int)floor((b[3]+SFCVM_TILE_INDEX_MARGIN-idx->lat0)/idx->dlat);
+          if(ix0 < 0) ix0=0;
+          if(iy0 < 0) iy0=0;
+          if(ix1 > n-1) ix1=n-1;
+          if(iy1 > n-1) iy1=n-1;
+        }
+        for(int iy=iy0; iy<=iy1; iy++) {
+          for(int ix=ix0; ix<=ix1; ix++) {
+            int c=iy*n+ix;
+            if(pass == 0) {
+              idx->cell_start[c+1]++;
+              } else {
+                idx->cell_tiles[fill[c]++]=t;
+            }
+          }
+        }
+      }
+      free(fill);
+    }
+    return UCVM_MODEL_CODE_SUCCESS;
+}
+
+void _free_tile_index(sfcvm_tile_index_t *idx) {
+    free(idx->cell_start);
+    free(idx->cell_tiles);
+    free(idx->open_tiles);
+    free(idx->all_tiles);
+    memset(idx, 0, sizeof(sfcvm_tile_index_t));
+}
+
+/**
+ * Looks up the tiles that may hold a point, in priority order. A lookup
+ * is one grid cell, independent of the number of tiles. UTM points are
+ * not indexed and get every tile.
+ */
+void _tile_candidates(double lon, double lat, int geo, const int **cand, int *cnt) {
+    sfcvm_tile_index_t *idx=&sfcvm_tile_index;
+    if(!geo) {
+      *cand=idx->all_tiles;
+      *cnt=sfcvm_tiles_cnt;
+      return;
+    }
+    if(idx->nx > 0) {
+      int ix=(int)floor((lon-idx->lon0)/idx->dlon);
+      int iy=(int)floor((lat-idx->lat0)/idx->dlat);
+      if(ix >= 0 && ix < idx->nx && iy >= 0 && iy < idx->ny) {
+        int c=iy*idx->nx+ix;
+        *cand=&idx->cell_tiles[idx->cell_start[c]];
+        *cnt=idx->cell_start[c+1]-idx->cell_start[c];
+        return;
+      }
+    }
+    *cand=idx->open_tiles;
+    *cnt=idx->open_cnt;
+}
+
+/* Query object of a tile, opened here on first use, NULL if it can not be opened */
+void *_tile_query_object(int t, int crs) {
+    sfcvm_tile_t *tile=&sfcvm_tiles[t];
+    if(tile->query_object[crs] == NULL && !tile->failed[crs]) _open_tile(tile, crs);
+    return tile->query_object[crs];
+}
+
+void *_tile_error_handler(int t, int crs) {
+    return sfcvm_tiles[t].error_handler[crs];
+}
+
+/**
+ * Works out the query object CRS of a batch of points and their
+ * coordinates in it. When the library can project into model_crs, the
+ * geographic points of the batch are projected here in one pass and the
+ * model_crs objects take them as they are, geomodelgrids then has no
+ * transform to do on any of the calls for the point. Otherwise the
+ * EPSG:4326 objects take lat/lon.
+ *
+ * Without an input CRS each point is guessed to be lon/lat or UTM from
+ * its range. With one, the whole batch is taken in that CRS: transverse
+ * Mercator input, UTM in any zone or model_crs itself, is brought back
+ * to lon/lat by the library, a CRS it does not know goes as it is
+ * (x in longitude, y in latitude) to query objects created in that CRS.
+ *
+ * @param input_crs Entry of the input CRS cache, -1 to guess per point.
+ * @param lon Longitudes, or x, returned as longitudes where known.
+ * @param lat Latitudes, or y, returned as latitudes where known.
+ * @param n Number of points, at most SFCVM_BATCH.
+ * @param crs SFCVM_CRS_* of each point returned.
+ * @param x First coordinate handed to geomodelgrids returned.
+ * @param y Second coordinate handed to geomodelgrids returned.
+ */
+void _project_points(int input_crs, double *lon, double *lat, int n, int *crs, double *x, double *y) {
+    double glon[SFCVM_BATCH], glat[SFCVM_BATCH], gx[SFCVM_BATCH], gy[SFCVM_BATCH];
+    int gi[SFCVM_BATCH];
+    int gcnt=0;
+
+    if(input_crs >= 0) {
+      sfcvm_input_crs_t *in=&sfcvm_input_crs[input_crs];
+      if(in->kind == SFCVM_CRS_KIND_OTHER) {
+        for(int i=0; i<n; i++) {
+          crs[i]=SFCVM_CRS_FIXED+input_crs;
+          x[i]=lon[i];
+          y[i]=lat[i];
+        }
+        return;
+      }
+      if(in->native) {
+        // already in model coordinates, lon/lat are only needed for the tile index
+        memcpy(x, lon, n*sizeof(double));
+        memcpy(y, lat, n*sizeof(double));
+        sfcvm_tmerc_inverse(&sfcvm_native_tm, x, y, lon, lat, n);
+        for(int i=0; i<n; i++) crs[i]=SFCVM_CRS_NATIVE;
+        return;
+      }
+      if(in->kind == SFCVM_CRS_KIND_TMERC) sfcvm_tmerc_inverse(&in->tm, lon, lat, lon, lat, n);
+      for(int i=0; i<n; i++) {
+        crs[i]=sfcvm_native ? SFCVM_CRS_NATIVE : SFCVM_CRS_GEO;
+        x[i]=lat[i];
+        y[i]=lon[i];
+      }
+      if(sfcvm_native) sfcvm_tmerc_forward(&sfcvm_native_tm, lon, lat, x, y, n);
+      return;
+    }
+
+    for(int i=0; i<n; i++) {
+      int geo=((lon[i]<360.) && (fabs(lat[i])<90));
+      crs[i]=geo ? SFCVM_CRS_GEO : SFCVM_CRS_UTM;
+      x[i]=lat[i];
+      y[i]=lon[i];
+      if(geo && sfcvm_native) {
+        crs[i]=SFCVM_CRS_NATIVE;
+        glon[gcnt]=lon[i];
+        glat[gcnt]=lat[i];
+        gi[gcnt++]=i;
+      }
+    }
+    if(gcnt == 0) return;
+    sfcvm_tmerc_forward(&sfcvm_native_tm, glon, glat, gx, gy, gcnt);
+    for(int k=0; k<gcnt; k++) {
+      x[gi[k]]=gx[k];
+      y[gi[k]]=gy[k];
+    }
+}
+
+/* Points in these CRS come with lon/lat, for the tile index and the footprints */
+int _crs_has_lonlat(int crs) {
+    return (crs == SFCVM_CRS_GEO || crs == SFCVM_CRS_NATIVE);
+}
+
+/**
+ * Looks up an input CRS in the cache, compiling it on first use. A CRS
+ * the library can not project gets its own query objects, the one of the
+ * primary data file is opened here to make sure geomodelgrids takes it.
+ *
+ * @param crs EPSG code, PROJ string or anything else PROJ understands.
+ * @return Entry in the cache, -1 if the CRS can not be used.
+ */
+int _input_crs(const char *crs) {
+    for(int i=0; i<sfcvm_input_crs_cnt; i++) {
+      if(strcmp(sfcvm_input_crs[i].crs, crs) == 0) return i;
+    }
+    if(sfcvm_input_crs_cnt >= SFCVM_INPUT_CRS_MAX) return -1;
+
+    int id=sfcvm_input_crs_cnt;
+    sfcvm_input_crs_t *in=&sfcvm_input_crs[id];
+    memset(in, 0, sizeof(sfcvm_input_crs_t));
+    in->kind=sfcvm_crs_parse(&in->tm, crs);
+    in->native=(sfcvm_native && in->kind == SFCVM_CRS_KIND_TMERC &&
+                memcmp(&in->tm, &sfcvm_native_tm, sizeof(sfcvm_tmerc_t)) == 0);
+    in->crs=strdup(crs);
+    if(in->crs == NULL) return -1;
+
+    if(in->kind == SFCVM_CRS_KIND_OTHER && sfcvm_tiles_cnt > 0 &&
+          _tile_query_object(0, SFCVM_CRS_FIXED+id) == NULL) {
+      // the slot is handed out again, let it be retried
+      sfcvm_tiles[0].failed[SFCVM_CRS_FIXED+id]=0;
+      free(in->crs);
+      in->crs=NULL;
+      return -1;
+    }
+    sfcvm_input_crs_cnt++;
+    return id;
+}
+
+/* Position in the route of the first tile from start on that holds the point, or -1 */
+int _route_next(sfcvm_route_t *route, int start) {
+    for(int k=start; k<route->cand_cnt; k++) {
+      void *qo=_tile_query_object(route->cand[k], route->crs);
+      if(qo != NULL && geomodelgrids_squery_queryModelContains(qo, route->x, route->y) >= 0) return k;
+    }
+    return -1;
+}
+
+/**
+ * Routes a point to the first tile, in config order, that holds it. That
+ * is the tile geomodelgrids would have picked with all files in one
+ * query object. Tiles are looked up by lon/lat, queried at x/y from
+ * _project_points.
+ */
+void _route_point(sfcvm_route_t *route, int crs, double lon, double lat, double x, double y) {
+    route->crs=crs;
+    route->x=x;
+    route->y=y;
+    _tile_candidates(lon, lat, _crs_has_lonlat(crs), &route->cand, &route->cand_cnt);
+    route->pos=_route_next(route, 0);
+}
+
+/**
+ * Queries a routed point. A tile that fails passes the point on to the
+ * next tile that holds it, as geomodelgrids does over its model list.
+ * The error status is always reset before returning.
+ *
+ * @return 0 on success, nonzero when no tile could answer.
+ */
+int _route_query(sfcvm_route_t *route, double *values, double z) {
+    int pos=route->pos;
+    while(pos >= 0) {
+      int t=route->cand[pos];
+      int err=geomodelgrids_squery_query(_tile_query_object(t, route->crs), values, route->x, route->y, z);
+      if(!err) return 0;
+      geomodelgrids_cerrorhandler_resetStatus(_tile_error_handler(t, route->crs));
+      pos=_route_next(route, pos+1);
+    }
+    return 1;
+}
+
+/**
+ * Surface of a routed point from the tile it is routed to.
+ *
+ * @return 0 on success, 1 if the point is outside of the model.
+ */
+int _route_surface(sfcvm_route_t *route, double *surface, double *top) {
+
+  // no tile holds it, outside of the model without a failed query
+  if(route->pos < 0) return 1;
+
+  void *query_object=_tile_query_object(route->cand[route->pos], route->crs);
+  void *error_handler=_tile_error_handler(route->cand[route->pos], route->crs);
+
+  double topoBathyElev = geomodelgrids_squery_queryTopoBathyElevation(query_object, route->x, route->y);
+
+//if(sfcvm_ucvm_debug) { fprintf(stderrfp,">>>    surface: topoBathy %f\n", topoBathyElev); }
+
+  if( topoBathyElev == NODATA_VALUE ) { // outside of the model
+//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"        OUTside of MODEL by NODATA_VALUE surface..\n"); }
+      geomodelgrids_cerrorhandler_resetStatus(error_handler);
+      return 1;
+  }
+
+  // only asked once the point is known to be inside, saves a second error
+  double topoElev = geomodelgrids_squery_queryTopElevation(query_object, route->x, route->y);
+
+//if(sfcvm_ucvm_debug) { fprintf(stderrfp,">>>    surface: top %f\n", topoElev); }
+
+  if( topoElev == NODATA_VALUE ) { // outside of the model
+//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"        OUTside of MODEL by NODATA_VALUE top..\n"); }
+      geomodelgrids_cerrorhandler_resetStatus(error_handler);
+      return 1;
+  }
+
+  *top=topoElev;
+  *surface=topoBathyElev;
+  return 0;
+}
+
+/* Snapshot i/o, every call is a no-op once *err is set */
+void _snap_put(FILE *fp, const void *ptr, size_t size, int *err) {
+    if(!*err && size > 0 && fwrite(ptr, size, 1, fp) != 1) *err=1;
+}
+
+void _snap_get(FILE *fp, void *ptr, size_t size, int *err) {
+    if(!*err && size > 0 && fread(ptr, size, 1, fp) != 1) *err=1;
+}
+
+void _snap_put_str(FILE *fp, const char *str, int *err) {
+    int len=(int)strlen(str);
+    _snap_put(fp, &len, sizeof(int), err);
+    _snap_put(fp, str, len, err);
+}
+
+/* Reads back a string from _snap_put_str, NULL on error */
+char *_snap_get_str(FILE *fp, int *err) {
+    int len=-1;
+    _snap_get(fp, &len, sizeof(int), err);
+    if(*err || len < 0 || len > SFCVM_SNAPSHOT_STR_MAX) {
+      *err=1;
+      return NULL;
+    }
+    char *str=(char *)calloc(len+1, 1);
+    if(str == NULL) {
+      *err=1;
+      return NULL;
+    }
+    _snap_get(fp, str, len, err);
+    return str;
+}
+
+/* Reads back a string and checks it is the expected one */
+void _snap_check_str(FILE *fp, const char *expect, int *err) {
+    char *str=_snap_get_str(fp, err);
+    if(str != NULL && strcmp(str, expect) != 0) *err=1;
+    free(str);
+}
+
+/* mtime, to the nanosecond, and size of a file, the snapshot is stale once either changes */
+void _snap_put_stamp(FILE *fp, const char *file, int *err) {
+    struct stat st;
+    long long stamp[3];
+    if(*err || stat(file, &st) != 0) {
+      *err=1;
+      return;
+    }
+    stamp[0]=(long long)st.st_mtime;
+    stamp[1]=(long long)SFCVM_MTIME_NSEC(st);
+    stamp[2]=(long long)st.st_size;
+    _snap_put(fp, stamp, sizeof(stamp), err);
+}
+
+void _snap_check_stamp(FILE *fp, const char *file, int *err) {
+    struct stat st;
+    long long stamp[3];
+    _snap_get(fp, stamp, sizeof(stamp), err);
+    if(*err) return;
+    if(stat(file, &st) != 0 || stamp[0] != (long long)st.st_mtime ||
+       stamp[1] != (long long)SFCVM_MTIME_NSEC(st) || stamp[2] != (long long)st.st_size) *err=1;
+}
+
+/**
+ * Writes the init snapshot: the resolved configuration, the data file
+ * names and footprints, the data file index and the CRS the query objects
+ * use, stamped with the config and data files they came from. The file
+ * is written aside and renamed into place, so processes starting together
+ * never load a partial one. The geomodelgrids query objects themselves
+ * (HDF5 and PROJ state) can not be saved and are opened as usual.
+ *
+ * @param path The snapshot file.
+ * @param configfile The configuration file that was read.
+ * @param dir The sfcvm_init directory.
+ * @param label The sfcvm_init label.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int _write_init_snapshot(const char *path, const char *configfile, const char *dir, const char *label) {
+    sfcvm_configuration_t *config=sfcvm_configuration;
+    sfcvm_tile_index_t *idx=&sfcvm_tile_index;
+    int head[2]={ SFCVM_SNAPSHOT_MAGIC, SFCVM_SNAPSHOT_VERSION };
+    int err=0;
+
+    char *tmppath=(char *)malloc(strlen(path)+32);
+    if(tmppath == NULL) return UCVM_MODEL_CODE_ERROR;
+    sprintf(tmppath, "%s.%d", path, (int)getpid());
+    FILE *fp=fopen(tmppath, "wb");
+    if(fp == NULL) {
+      free(tmppath);
+      return UCVM_MODEL_CODE_ERROR;
+    }
+
+    _snap_put(fp, head, sizeof(head), &err);
+    _snap_put_str(fp, dir, &err);
+    _snap_put_str(fp, label, &err);
+    _snap_put_str(fp, configfile, &err);
+    _snap_put_stamp(fp, configfile, &err);
+    _snap_put_str(fp, sfcvm_geo_crs, &err);
+    _snap_put_str(fp, sfcvm_data_directory, &err);
+
+    _snap_put(fp, &config->utm_zone, sizeof(int), &err);
+    _snap_put_str(fp, config->model_dir, &err);
+    _snap_put_str(fp, config->model_crs, &err);
+    _snap_put(fp, &config->model_depth, sizeof(int), &err);
+    _snap_put(fp, &config->model_gabbro, sizeof(int), &err);
+    _snap_put(fp, &config->model_squashminelev, sizeof(double), &err);
+    _snap_put(fp, &config->model_fastfail, sizeof(int), &err);
+    _snap_put(fp, &config->model_vsfloor, sizeof(double), &err);
+    _snap_put(fp, &config->model_qsvs, sizeof(double), &err);
+    _snap_put(fp, &config->model_qpqs, sizeof(double), &err);
+    _snap_put(fp, &config->model_params, sizeof(int), &err);
+    _snap_put(fp, &config->data_cnt, sizeof(int), &err);
+    for(int t=0; t<config->data_cnt; t++) {
+      sfcvm_data_file_t *d=&config->data[t];
+      _snap_put_str(fp, d->label, &err);
+      _snap_put_str(fp, d->file, &err);
+      _snap_put(fp, &d->gridheight, sizeof(double), &err);
+      _snap_put(fp, &d->model, sizeof(int), &err);
+      _snap_put(fp, &d->footprint_cnt, sizeof(int), &err);
+      _snap_put(fp, d->footprint, 2*d->footprint_cnt*sizeof(double), &err);
+      _snap_put(fp, &d->grid, sizeof(sfcvm_grid_t), &err);
+      _snap_put_str(fp, sfcvm_tiles[t].filename, &err);
+      _snap_put_stamp(fp, sfcvm_tiles[t].filename, &err);
+    }
+
+    _snap_put(fp, &idx->lon0, sizeof(double), &err);
+    _snap_put(fp, &idx->lat0, sizeof(double), &err);
+    _snap_put(fp, &idx->dlon, sizeof(double), &err);
+    _snap_put(fp, &idx->dlat, sizeof(double), &err);
+    _snap_put(fp, &idx->nx, sizeof(int), &err);
+    _snap_put(fp, &idx->ny, sizeof(int), &err);
+    if(idx->nx > 0) {
+      int ncell=idx->nx*idx->ny;
+      _snap_put(fp, idx->cell_start, (ncell+1)*sizeof(int), &err);
+      _snap_put(fp, idx->cell_tiles, idx->cell_start[ncell]*sizeof(int), &err);
+    }
+    _snap_put(fp, &idx->open_cnt, sizeof(int), &err);
+    _snap_put(fp, idx->open_tiles, idx->open_cnt*sizeof(int), &err);
+
+    if(fclose(fp) != 0) err=1;
+    if(!err && rename(tmppath, path) != 0) err=1;
+    if(err) unlink(tmppath);
+    free(tmppath);
+    return err ? UCVM_MODEL_CODE_ERROR : UCVM_MODEL_CODE_SUCCESS;
+}
+
+/* Checks tile numbers read back from a snapshot */
+int _snap_tiles_valid(const int *tiles, int cnt, int ntiles) {
+    for(int i=0; i<cnt; i++) {
+      if(tiles[i] < 0 || tiles[i] >= ntiles) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Loads the init snapshot written by _write_init_snapshot in place of
+ * reading the configuration, locating the data files and building the
+ * index. Anything that does not match, a different install, an edited
+ * config or a replaced data file, rejects the snapshot and sfcvm_init
+ * goes the long way.
+ *
+ * @param path The snapshot file.
+ * @param dir The sfcvm_init directory.
+ * @param label The sfcvm_init label.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int _read_init_snapshot(const char *path, const char *dir, const char *label) {
+    FILE *fp=fopen(path, "rb");
+    if(fp == NULL) return UCVM_MODEL_CODE_ERROR;
+
+    sfcvm_configuration_t *config=sfcvm_init_configuration();
+    sfcvm_tile_index_t idx;
+    sfcvm_tile_t *tiles=NULL;
+    char *configfile=NULL, *datadir=NULL, *model_dir=NULL, *model_crs=NULL;
+    int head[2]={ 0, 0 };
+    int ntiles=0, err=(config == NULL);
+
+    memset(&idx, 0, sizeof(sfcvm_tile_index_t));
+    _snap_get(fp, head, sizeof(head), &err);
+    if(head[0] != SFCVM_SNAPSHOT_MAGIC || head[1] != SFCVM_SNAPSHOT_VERSION) err=1;
+    _snap_check_str(fp, dir, &err);
+    _snap_check_str(fp, label, &err);
+    configfile=_snap_get_str(fp, &err);
+    _snap_check_stamp(fp, configfile, &err);
+    _snap_check_str(fp, sfcvm_geo_crs, &err);
+    datadir=_snap_get_str(fp, &err);
+
+    if(!err) _snap_get(fp, &config->utm_zone, sizeof(int), &err);
+    model_dir=_snap_get_str(fp, &err);
+    model_crs=_snap_get_str(fp, &err);
+    if(!err) {
+      _snap_get(fp, &config->model_depth, sizeof(int), &err);
+      _snap_get(fp, &config->model_gabbro, sizeof(int), &err);
+      _snap_get(fp, &config->model_squashminelev, sizeof(double), &err);
+      _snap_get(fp, &config->model_fastfail, sizeof(int), &err);
+      _snap_get(fp, &config->model_vsfloor, sizeof(double), &err);
+      _snap_get(fp, &config->model_qsvs, sizeof(double), &err);
+      _snap_get(fp, &config->model_qpqs, sizeof(double), &err);
+      _snap_get(fp, &config->model_params, sizeof(int), &err);
+      _snap_get(fp, &ntiles, sizeof(int), &err);
+    }
+    if(!err && (ntiles < 0 || ntiles > SFCVM_SNAPSHOT_TILES_MAX)) err=1;
+    if(!err) {
+      config->data=(sfcvm_data_file_t *)calloc(ntiles > 0 ? ntiles : 1, sizeof(sfcvm_data_file_t));
+      tiles=(sfcvm_tile_t *)calloc(ntiles > 0 ? ntiles : 1, sizeof(sfcvm_tile_t));
+      if(config->data == NULL || tiles == NULL) err=1;
+      config->data_max=ntiles;
+    }
+    for(int t=0; t<ntiles && !err; t++) {
+      sfcvm_data_file_t *d=&config->data[t];
+      config->data_cnt=t+1;
+      d->label=_snap_get_str(fp, &err);
+      d->file=_snap_get_str(fp, &err);
+      _snap_get(fp, &d->gridheight, sizeof(double), &err);
+      _snap_get(fp, &d->model, sizeof(int), &err);
+      _snap_get(fp, &d->footprint_cnt, sizeof(int), &err);
+      if(!err && (d->footprint_cnt < 0 || d->footprint_cnt > SFCVM_FOOTPRINT_MAX)) err=1;
+      if(!err && d->footprint_cnt > 0) {
+        d->footprint=(double *)malloc(2*d->footprint_cnt*sizeof(double));
+        if(d->footprint == NULL) err=1;
+        _snap_get(fp, d->footprint, 2*d->footprint_cnt*sizeof(double), &err);
+      }
+      _snap_get(fp, &d->grid, sizeof(sfcvm_grid_t), &err);
+      tiles[t].filename=_snap_get_str(fp, &err);
+      _snap_check_stamp(fp, tiles[t].filename, &err);
+    }
+
+    _snap_get(fp, &idx.lon0, sizeof(double), &err);
+    _snap_get(fp, &idx.lat0, sizeof(double), &err);
+    _snap_get(fp, &idx.dlon, sizeof(double), &err);
+    _snap_get(fp, &idx.dlat, sizeof(double), &err);
+    _snap_get(fp, &idx.nx, sizeof(int), &err);
+    _snap_get(fp, &idx.ny, sizeof(int), &err);
+    if(!err && (idx.nx < 0 || idx.nx > SFCVM_TILE_INDEX_MAX_CELLS || idx.ny < 0 || idx.ny > SFCVM_TILE_INDEX_MAX_CELLS ||
+                (idx.nx > 0) != (idx.ny > 0))) err=1;
+    if(!err && idx.nx > 0) {
+      int ncell=idx.nx*idx.ny;
+      idx.cell_start=(int *)malloc((ncell+1)*sizeof(int));
+      if(idx.cell_start == NULL) err=1;
+      _snap_get(fp, idx.cell_start, (ncell+1)*sizeof(int), &err);
+      for(int c=0; c<ncell && !err; c++) {
+        if(idx.cell_start[0] != 0 || idx.cell_start[c+1] < idx.cell_start[c]) err=1;
+      }
+      if(!err && idx.cell_start[ncell] > (long)ncell*ntiles) err=1;
+      if(!err) {
+        idx.cell_tiles=(int *)malloc((idx.cell_start[ncell] > 0 ? idx.cell_start[ncell] : 1)*sizeof(int));
+        if(idx.cell_tiles == NULL) err=1;
+        _snap_get(fp, idx.cell_tiles, idx.cell_start[ncell]*sizeof(int), &err);
+        if(!err && !_snap_tiles_valid(idx.cell_tiles, idx.cell_start[ncell], ntiles)) err=1;
+      }
+    }
+    _snap_get(fp, &idx.open_cnt, sizeof(int), &err);
+    if(!err && (idx.open_cnt < 0 || idx.open_cnt > ntiles)) err=1;
+    if(!err) {
+      idx.open_tiles=(int *)malloc((ntiles > 0 ? ntiles : 1)*sizeof(int));
+      idx.all_tiles=(int *)malloc((ntiles > 0 ? ntiles : 1)*sizeof(int));
+      if(idx.open_tiles == NULL || idx.all_tiles == NULL) err=1;
+      _snap_get(fp, idx.open_tiles, idx.open_cnt*sizeof(int), &err);
+      if(!err && !_snap_tiles_valid(idx.open_tiles, idx.open_cnt, ntiles)) err=1;
+      for(int t=0; t<ntiles && !err; t++) idx.all_tiles[t]=t;
+    }
+    fclose(fp);
+
+    if(!err && (strlen(datadir) >= sizeof(sfcvm_data_directory) || strlen(model_dir) >= sizeof(config->model_dir) ||
+                strlen(model_crs) >= sizeof(config->model_crs))) err=1;
+    if(err) {
+      for(int t=0; tiles != NULL && t<ntiles; t++) free(tiles[t].filename);
+      free(tiles);
+      _free_tile_index(&idx);
+      if(config != NULL) _free_sfcvm_configuration(config);
+      } else {
+        strcpy(config->model_dir, model_dir);
+        strcpy(config->model_crs, model_crs);
+        strcpy(sfcvm_data_directory, datadir);
+        _free_sfcvm_configuration(sfcvm_configuration);
+        sfcvm_configuration=config;
+        sfcvm_tiles=tiles;
+        sfcvm_tiles_cnt=ntiles;
+        sfcvm_tile_index=idx;
+        // what the config file would have set
+        if(config->model_params & (1<<GABBRO)) set_setGabbro(config->model_gabbro);
+        if(config->model_params & (1<<FAST_FAIL)) set_setFastFail(config->model_fastfail);
+        if(config->model_params & (1<<SQUASH_MIN_ELEV)) set_setSquashMinElev(config->model_squashminelev);
+        if(config->model_params & (1<<VS_FLOOR)) set_setVsFloor(config->model_vsfloor);
+        if(config->model_params & (1<<QS_VS)) set_setQsVs(config->model_qsvs);
+        if(config->model_params & (1<<QP_QS)) set_setQpQs(config->model_qpqs);
+    }
+    free(configfile);
+    free(datadir);
+    free(model_dir);
+    free(model_crs);
+    return err ? UCVM_MODEL_CODE_ERROR : UCVM_MODEL_CODE_SUCCESS;
+}
+
+/**
+ * Builds the file name of each data file and checks it is there, the
+ * query objects are opened on first use.
+ *
+ * @param dir The directory in which UCVM has been installed.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int _locate_tiles(const char *dir) {
+    // dir/model/model_dir/data/model_dir/filename, one set of query objects per entry
+    sfcvm_tiles_cnt =sfcvm_configuration->data_cnt;
+    sfcvm_tiles = (sfcvm_tile_t *)calloc(sfcvm_tiles_cnt > 0 ? sfcvm_tiles_cnt : 1, sizeof(sfcvm_tile_t));
+    assert(sfcvm_tiles);
+    for(int i=0; i < sfcvm_tiles_cnt; i++) {
+       sfcvm_tile_t *tile=&sfcvm_tiles[i];
+       tile->filename= (char *)calloc(1,
+           strlen(dir)+(strlen(sfcvm_configuration->model_dir)*2)+strlen(sfcvm_configuration->data[i].file) +15);
+       sprintf(tile->filename,"%s/model/%s/data/%s/%s",
+           dir,
+           sfcvm_configuration->model_dir,
+           sfcvm_configuration->model_dir,
+           sfcvm_configuration->data[i].file);
+
+//if(sfcvm_ucvm_debug) fprintf(stderrfp,"using %s\n", tile->filename);
+       if(access(tile->filename, R_OK) != 0) {
+           fprintf(stderr,"SFCVM: missing data file %s\n", tile->filename);
+           return UCVM_MODEL_CODE_ERROR;
+       }
+    }
+    return UCVM_MODEL_CODE_SUCCESS;
+}
+
 /**
  * Initializes the SFCVM plugin model within the UCVM framework. In order to initialize
  * the model, we must provide the UCVM install path and optionally a place in memory
  * where the model already exists.
  *
+ * Each stage is timed, see sfcvm_get_stats. With $SFCVM_INIT_SNAPSHOT set
+ * to a file name, the configuration, data file names and index are loaded
+ * from that snapshot when it is current, and written to it otherwise.
+ *
  * @param dir The directory in which UCVM has been installed.
  * @param label A unique identifier for the velocity model.
  * @return Success or failure, if initialization was successful.
  */
 int sfcvm_init(const char *dir, const char *label) {
+    double t_init=_now();
+    double t0;
+    char *snapshot=getenv("SFCVM_INIT_SNAPSHOT");
 
     if(sfcvm_ucvm_debug) {
       stderrfp = fopen("sfcvm_debug.log", "w+");
@@ -135,122 +1067,165 @@ int sfcvm_init(const char *dir, const char *label) {
     }
     char configbuf[512];
 
+    memset(&sfcvm_init_stats, 0, sizeof(sfcvm_stats_t));
+    sfcvm_open_seconds=0;
+    sfcvm_tiles_opened=0;
+
     // Initialize variables.
     sfcvm_configuration = sfcvm_init_configuration();
     sfcvm_velocity_model = (sfcvm_model_t *)calloc(1, sizeof(sfcvm_model_t));
     sfcvm_config_string = (char *)calloc(SFCVM_CONFIG_MAX, sizeof(char));
 
-    // Configuration file location when built with UCVM
-    sprintf(configbuf, "%s/model/%s/data/config", dir, label);
-
-    // Read the configuration file.
-    if (sfcvm_read_configuration(configbuf, sfcvm_configuration) != UCVM_MODEL_CODE_SUCCESS) {
-
-           // Try another, when is running in standalone mode..
-       sprintf(configbuf, "%s/data/config", dir);
-       if (sfcvm_read_configuration(configbuf, sfcvm_configuration) != UCVM_MODEL_CODE_SUCCESS) {
-           sfcvm_print_error("No configuration file was found to read from.");
-           return UCVM_MODEL_CODE_ERROR;
+    t0=_now();
+    if(snapshot != NULL && _read_init_snapshot(snapshot, dir, label) == UCVM_MODEL_CODE_SUCCESS) {
+        sfcvm_init_stats.init_from_snapshot=1;
+        sfcvm_init_stats.init_snapshot_s=_now()-t0;
+        if(sfcvm_ucvm_debug) _dump_sfcvm_configuration(sfcvm_configuration);
+    } else {
+        // Configuration file location when built with UCVM
+        sprintf(configbuf, "%s/model/%s/data/config", dir, label);
+
+        // Read the configuration file.
+        if (sfcvm_read_configuration(configbuf, sfcvm_configuration) != UCVM_MODEL_CODE_SUCCESS) {
+
+               // Try another, when is running in standalone mode..
+           sprintf(configbuf, "%s/data/config", dir);
+           if (sfcvm_read_configuration(configbuf, sfcvm_configuration) != UCVM_MODEL_CODE_SUCCESS) {
+               sfcvm_print_error("No configuration file was found to read from.");
+               return UCVM_MODEL_CODE_ERROR;
+               } else {
+               // Set up the data directory.
+                   sprintf(sfcvm_data_directory, "%s/data/%s", dir, sfcvm_configuration->model_dir);
+           }
            } else {
-           // Set up the data directory.
-               sprintf(sfcvm_data_directory, "%s/data/%s", dir, sfcvm_configuration->model_dir);
-       }
-       } else {
-           // Set up the data directory.
-           sprintf(sfcvm_data_directory, "%s/model/%s/data/%s", dir, label, sfcvm_configuration->model_dir);
-    }
+               // Set up the data directory.
+               sprintf(sfcvm_data_directory, "%s/model/%s/data/%s", dir, label, sfcvm_configuration->model_dir);
+        }
+        sfcvm_init_stats.init_config_s=_now()-t0;
 
+        t0=_now();
+        if(_locate_tiles(dir) != UCVM_MODEL_CODE_SUCCESS) {
+            return UCVM_MODEL_CODE_ERROR;
+        }
+        sfcvm_init_stats.init_files_s=_now()-t0;
 
-    // dir/data/model_dir/filename
-    sfcvm_filenames_cnt =sfcvm_configuration->data_cnt;
-    if(sfcvm_filenames_cnt > 10) {
-        fprintf(stderr,"BADD");
-        exit(1);
+        t0=_now();
+        if(_build_tile_index(&sfcvm_tile_index) != UCVM_MODEL_CODE_SUCCESS) {
+            sfcvm_print_error("Unable to build the data file index.");
+            return UCVM_MODEL_CODE_ERROR;
+        }
+        sfcvm_init_stats.init_index_s=_now()-t0;
     }
 
-//
-//  TODO:  not sure if have more than 1 data files, which gridheight should we be using??
-//  need to check the boundary ?? -- actually geomodelgrid should expose API to retrieve that
-//  from the backend
-//
-    for(int i=0; i < sfcvm_filenames_cnt; i++) {
-       sfcvm_filenames[i]= (char *)calloc(1,
-           strlen(dir)+(strlen(sfcvm_configuration->model_dir)*2)+strlen(sfcvm_configuration->data_files[i]) +15);
-       sprintf(sfcvm_filenames[i],"%s/model/%s/data/%s/%s",
-           dir,
-           sfcvm_configuration->model_dir,
-           sfcvm_configuration->model_dir,
-           sfcvm_configuration->data_files[i]);
-
-//if(sfcvm_ucvm_debug) fprintf(stderrfp,"using %s\n", sfcvm_filenames[i]);
-/*
-       if( strcmp(sfcvm_configuration->data_labels[i],"sfcvm") == 0) {
-           sfcvm_grid_height_m = sfcvm_configuration->data_gridheights[i];
-       }
-       if( strcmp(sfcvm_configuration->data_labels[i],"regional") == 0) {
-           sfcvm_grid_height_regional_m = sfcvm_configuration->data_gridheights[i];
-       }
-*/
-    }
     sfcvm_total_height_m = sfcvm_configuration->model_depth;
+    sfcvm_live_squashminelev=SFCVM_SquashMinElev;
 
-/* Create and initialize serial query object using the parameters stored in local variables.  */
-    sfcvm_geo_query_object = geomodelgrids_squery_create();
-    assert(sfcvm_geo_query_object);
-
-// GEO
-/** Log warnings and errors to "sfcvm_geo_error.log". **/
-    sfcvm_geo_error_handler = geomodelgrids_squery_getErrorHandler(sfcvm_geo_query_object);
-    assert(sfcvm_geo_error_handler);
-//    geomodelgrids_cerrorhandler_setLogFilename(sfcvm_geo_error_handler, "sfcvm_geo_error.log");
-
-    int geo_err=geomodelgrids_squery_initialize(sfcvm_geo_query_object, sfcvm_filenames,
-                 sfcvm_filenames_cnt, sfcvm_valueNames, sfcvm_numValues, sfcvm_geo_crs);
-    assert(!geo_err);
-
-    int geo_setsquash=geomodelgrids_squery_setSquashing(sfcvm_geo_query_object, GEOMODELGRIDS_SQUASH_TOPOGRAPHY_BATHYMETRY);
-    assert(!geo_setsquash);
-    geomodelgrids_squery_setSquashMinElev(sfcvm_geo_query_object, SFCVM_SquashMinElev);
-
-// UTM
-/* Create and initialize serial query object using the parameters  stored in local variables.  */
-    sfcvm_utm_query_object = geomodelgrids_squery_create();
-    assert(sfcvm_utm_query_object);
-
-/** Log warnings and errors to "sfcvm_utm_error.log". **/
-    sfcvm_utm_error_handler = geomodelgrids_squery_getErrorHandler(sfcvm_utm_query_object);
-    assert(sfcvm_utm_error_handler);
-//    geomodelgrids_cerrorhandler_setLogFilename(sfcvm_utm_error_handler, "sfcvm_utm_error.log");
+    // UTM points guessed from their range are in the configured zone
+    if(sfcvm_configuration->utm_zone >= 1 && sfcvm_configuration->utm_zone <= 23) {
+        sprintf(sfcvm_utm_crs, "EPSG:269%02d", sfcvm_configuration->utm_zone);
+    }
+    sfcvm_input_crs_cnt=0;
+
+    // without a model_crs the library can project into, geomodelgrids projects every call
+    sfcvm_native=0;
+    if(sfcvm_configuration->model_crs[0] != '\0') {
+        if(sfcvm_tmerc_parse(&sfcvm_native_tm, sfcvm_configuration->model_crs) == UCVM_MODEL_CODE_SUCCESS) {
+            sfcvm_native=1;
+            } else {
+              fprintf(stderr,"SFCVM: model_crs is not a transverse Mercator, using %s\n", sfcvm_geo_crs);
+        }
+    }
 
-    int utm_err=geomodelgrids_squery_initialize(sfcvm_utm_query_object, sfcvm_filenames,
-                 sfcvm_filenames_cnt, sfcvm_valueNames, sfcvm_numValues, sfcvm_utm_crs);
-    assert(!utm_err);
+    // the primary data file is opened right away, most points end up there
+    t0=_now();
+    if(sfcvm_tiles_cnt > 0 && _open_tile(&sfcvm_tiles[0], sfcvm_native ? SFCVM_CRS_NATIVE : SFCVM_CRS_GEO) != UCVM_MODEL_CODE_SUCCESS) {
+        return UCVM_MODEL_CODE_ERROR;
+    }
+    sfcvm_init_stats.init_open_s=_now()-t0;
 
-    int utm_setsquash=geomodelgrids_squery_setSquashing(sfcvm_utm_query_object, GEOMODELGRIDS_SQUASH_TOPOGRAPHY_BATHYMETRY);
-    assert(!utm_setsquash);
-    geomodelgrids_squery_setSquashMinElev(sfcvm_utm_query_object, SFCVM_SquashMinElev);
+    // a stale or missing snapshot is replaced, failing to write it is not an error
+    if(snapshot != NULL && !sfcvm_init_stats.init_from_snapshot) {
+        t0=_now();
+        if(_write_init_snapshot(snapshot, configbuf, dir, label) != UCVM_MODEL_CODE_SUCCESS && sfcvm_ucvm_debug) {
+            fprintf(stderrfp,"unable to write the init snapshot %s\n", snapshot);
+        }
+        sfcvm_init_stats.init_snapshot_s=_now()-t0;
+    }
 
     // Let everyone know that we are initialized and ready for business.
     sfcvm_is_initialized = 1;
 
     sfcvm_query_count=0;
     sfcvm_gabbro_count=0;
+    for(int c=0; c<sfcvm_corrections_cnt; c++) sfcvm_corrections[c].count=0;
     sfcvm_query_count=0;
 
     sfcvm_water_count=0;
     sfcvm_water_step_count=0;
     sfcvm_water_max_step=0;
     sfcvm_water_max_step_limit_count=0;
+    sfcvm_water_step_shared=0;
+    sfcvm_fastfail_count=0;
 
     sfcvm_water_step_in_detail=0;
     sfcvm_water_step_in_regional=0;
 
+    sfcvm_init_stats.init_total_s=_now()-t_init;
+    if(sfcvm_ucvm_debug) {
+      fprintf(stderrfp,"INIT: %s\n", sfcvm_init_stats.init_from_snapshot ? "from snapshot" : "from config");
+      fprintf(stderrfp,"    config %.6f s, files %.6f s, index %.6f s\n", sfcvm_init_stats.init_config_s,
+                       sfcvm_init_stats.init_files_s, sfcvm_init_stats.init_index_s);
+      fprintf(stderrfp,"    open %.6f s, snapshot %.6f s, total %.6f s\n", sfcvm_init_stats.init_open_s,
+                       sfcvm_init_stats.init_snapshot_s, sfcvm_init_stats.init_total_s);
+    }
+
     return UCVM_MODEL_CODE_SUCCESS;
 }
 
+/**
+ * Returns the query counters and the sfcvm_init stage timings. Counters
+ * of forked workers stay in the workers.
+ *
+ * @param stats The stats to fill in.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_get_stats(sfcvm_stats_t *stats) {
+    if(stats == NULL || !sfcvm_is_initialized) return UCVM_MODEL_CODE_ERROR;
+    *stats=sfcvm_init_stats;
+    stats->query_count=sfcvm_query_count;
+    stats->gabbro_count=sfcvm_gabbro_count;
+    stats->water_count=sfcvm_water_count;
+    stats->water_step_count=sfcvm_water_step_count;
+    stats->water_limit_count=sfcvm_water_max_step_limit_count;
+    stats->water_max_step=sfcvm_water_max_step;
+    stats->water_step_shared=sfcvm_water_step_shared;
+    stats->fastfail_count=sfcvm_fastfail_count;
+    stats->objects_opened=sfcvm_tiles_opened;
+    stats->objects_total=2*sfcvm_tiles_cnt;
+    stats->lazy_open_s=sfcvm_open_seconds-sfcvm_init_stats.init_open_s;
+    return UCVM_MODEL_CODE_SUCCESS;
+}
+
+/**
+ * Pushes a squashing min elevation into the live query objects, only
+ * touches them when the value differs from what they already use.
+ */
+void _apply_squashMinElev(double val) {
+    if(!sfcvm_is_initialized || val == sfcvm_live_squashminelev) return;
+    // tiles not open yet pick the value up when they are opened
+    for(int t=0; t<sfcvm_tiles_cnt; t++) {
+      for(int c=0; c<SFCVM_CRS_MAX; c++) {
+        if(sfcvm_tiles[t].query_object[c]) geomodelgrids_squery_setSquashMinElev(sfcvm_tiles[t].query_object[c], val);
+      }
+    }
+    sfcvm_live_squashminelev=val;
+}
+
 void set_setSquashMinElev(double val) {
 //if(sfcvm_ucvm_debug) { fprintf(stderrfp,"sfcvm.c: SETTING new squashing min value (%lf)\n",val); }
     SFCVM_SquashMinElev=val;
+    // takes effect immediately if the model is already loaded
+    _apply_squashMinElev(val);
 }
 
 void set_setGabbro(int val) {
@@ -258,6 +1233,54 @@ void set_setGabbro(int val) {
     SFCVM_Gabbro=val;
 }
 
+void set_setFastFail(int val) {
+    SFCVM_FastFail=val;
+}
+
+void set_setVsFloor(double val) {
+    SFCVM_VsFloor=val;
+}
+
+void set_setQsVs(double val) {
+    SFCVM_QsVs=val;
+}
+
+void set_setQpQs(double val) {
+    SFCVM_QpQs=val;
+}
+
+/* Standard even-odd ray crossing test against a closed lon/lat polygon */
+int _in_polygon(const double *poly, int cnt, double lon, double lat) {
+    int c=0;
+    for(int i=0, j=cnt-1; i<cnt; j=i++) {
+      double xi=poly[2*i], yi=poly[2*i+1];
+      double xj=poly[2*j], yj=poly[2*j+1];
+      if(((yi > lat) != (yj > lat)) && (lon < (xj-xi)*(lat-yi)/(yj-yi)+xi)) c=!c;
+    }
+    return c;
+}
+
+/**
+ * Cheap domain check done in libsfcvm before any geomodelgrids call. A
+ * geographic point is inside when it falls in the footprint of any data
+ * file. Points in UTM, or near data files without a footprint, are
+ * always let through to the full query.
+ *
+ * @return 1 if the point may be in the model, 0 if it is surely outside.
+ */
+int _in_footprint(double lon, double lat) {
+    const int *cand;
+    int cnt;
+    if(!((lon<360.) && (fabs(lat)<90))) return 1;
+    _tile_candidates(lon, lat, 1, &cand, &cnt);
+    for(int k=0; k<cnt; k++) {
+      sfcvm_data_file_t *d=&sfcvm_configuration->data[cand[k]];
+      if(d->footprint_cnt < 3) return 1;
+      if(_in_polygon(d->footprint, d->footprint_cnt, lon, lat)) return 1;
+    }
+    return 0;
+}
+
 
 /**  
   * 
@@ -318,6 +1341,84 @@ fprintf(stderr,"sfcvm_setparam : UCVM_MODEL_PARAM_MODEL_CONF %ld\n",pval);
   return UCVM_MODEL_CODE_SUCCESS;
 }
 
+/* Fills a context with the current model parameters */
+static void _context_defaults(sfcvm_context_t *ctx) {
+    ctx->squash_min_elev=SFCVM_SquashMinElev;
+    ctx->gabbro=SFCVM_Gabbro;
+    ctx->fast_fail=SFCVM_FastFail;
+    ctx->input_crs=-1;
+    ctx->vs_floor=SFCVM_VsFloor;
+    ctx->qs_vs=SFCVM_QsVs;
+    ctx->qp_qs=SFCVM_QpQs;
+}
+
+/**
+ * Creates a query context that starts out with the current model parameters.
+ * Contexts with different settings can be queried side by side against the
+ * one model loaded by sfcvm_init.
+ *
+ * @return The new context, free with sfcvm_context_destroy.
+ */
+sfcvm_context_t *sfcvm_context_create() {
+    sfcvm_context_t *ctx=(sfcvm_context_t *)calloc(1, sizeof(sfcvm_context_t));
+    if(ctx == NULL) return NULL;
+    _context_defaults(ctx);
+    return ctx;
+}
+
+void sfcvm_context_destroy(sfcvm_context_t *ctx) {
+    free(ctx);
+}
+
+/*
+ * Setparam on a context, SQUASH_MIN_ELEV takes a double, GABBRO and FAST_FAIL an int,
+ * INPUT_CRS a CRS string, or NULL to go back to guessing lon/lat or UTM per point,
+ * VS_FLOOR, QS_VS and QP_QS a double
+ */
+int sfcvm_context_setparam(sfcvm_context_t *ctx, int param, ...)
+{
+  va_list ap;
+
+  va_start(ap, param);
+  switch (param) {
+    case SQUASH_MIN_ELEV:
+      ctx->squash_min_elev = va_arg(ap, double);
+      break;
+    case GABBRO:
+      ctx->gabbro = va_arg(ap, int);
+      break;
+    case FAST_FAIL:
+      ctx->fast_fail = va_arg(ap, int);
+      break;
+    case VS_FLOOR:
+      ctx->vs_floor = va_arg(ap, double);
+      break;
+    case QS_VS:
+      ctx->qs_vs = va_arg(ap, double);
+      break;
+    case QP_QS:
+      ctx->qp_qs = va_arg(ap, double);
+      break;
+    case INPUT_CRS: {
+      const char *crs = va_arg(ap, const char *);
+      int id=-1;
+      if(crs != NULL) {
+        if(!sfcvm_is_initialized || (id=_input_crs(crs)) < 0) {
+          va_end(ap);
+          return UCVM_MODEL_CODE_ERROR;
+        }
+      }
+      ctx->input_crs = id;
+      break;
+      }
+    default:
+      va_end(ap);
+      return UCVM_MODEL_CODE_ERROR;
+  }
+  va_end(ap);
+  return UCVM_MODEL_CODE_SUCCESS;
+}
+
 /**
 * Parse the configurations
 *
@@ -356,25 +1457,72 @@ to modify the near-surface gabbro regions in the East Bay and Gilroy
   Vp 4.2 to 5.7 km/s from depth=0 to 7.75km
   Vs = 0.7858 - 1.2344*Vp + 0.7949*Vp^2 - 0.1238*Vp^3 + 0.0064*Vp^4
   density = 2.4372 + 0.0761*Vp
+
+Works on a gathered batch of points with no branches in the loop, so the
+compiler can vectorize it. hit[k] is set for points above 7.75km, only
+those have vp/vs/rho (m/s, kg/m^3) filled in.
 **/
 static const double sfcvm_gabbro_vp_delta = ((5.7- 4.2) / 7.75);
-int _gabbro(double elevation, sfcvm_properties_t *data) {
-  double depth= (elevation == 0.0) ? 0.0 : ((0.0 - elevation)/1000); // turn into km
-                     //
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp, "\ndelta: %lf, diff\n", sfcvm_gabbro_vp_delta, (depth) * sfcvm_gabbro_vp_delta); }
-
-  if(depth < 7.750) {
-    double vp = 4.2 + (depth) * sfcvm_gabbro_vp_delta; 
-    double vs = 0.7858 - (1.2344 * vp) + (0.7949 * vp * vp) - (0.1238 * vp * vp * vp) + (0.0064 * vp * vp * vp * vp);
-    double rho = 2.4372 + (0.0761 * vp);
-    if(SFCVM_Gabbro) {
-      data->vp= vp * 1000;
-      data->vs= vs * 1000;
-      data->rho = rho * 1000;
-    }
-    sfcvm_gabbro_count++;
+void _gabbro_batch(int cnt, const double *elevation, double *vp, double *vs, double *rho, int *hit) {
+  for(int k=0; k<cnt; k++) {
+    double depth= (elevation[k] == 0.0) ? 0.0 : ((0.0 - elevation[k])/1000); // turn into km
+    double v = 4.2 + (depth) * sfcvm_gabbro_vp_delta; 
+    hit[k] = (depth < 7.750);
+    vp[k] = v * 1000;
+    vs[k] = (0.7858 + v * (-1.2344 + v * (0.7949 + v * (-0.1238 + v * 0.0064)))) * 1000;
+    rho[k] = (2.4372 + (0.0761 * v)) * 1000;
+  }
+}
+
+/* Index into sfcvm_corrections of the correction for a zone, or -1 */
+int _find_correction(int model_i, int zone_id) {
+  for(int c=0; c<sfcvm_corrections_cnt; c++) {
+    if(sfcvm_corrections[c].model_i == model_i && sfcvm_corrections[c].zone_id == zone_id) return c;
+  }
+  return -1;
+}
+
+/**
+ * Applies the zone corrections to a block of results. Points are grouped
+ * by correction and each group goes through its batch function once.
+ *
+ * @param corr Index into sfcvm_corrections per point, -1 for none.
+ * @param elevation Squashed elevation per point.
+ * @param apply 0 to only count the corrections, ctx->gabbro.
+ * @param data The block results, updated in place.
+ * @param status Set to SFCVM_STATUS_GABBRO_APPLIED where a correction was applied.
+ * @param numpoints Points in the block.
+ */
+void _apply_corrections(const int *corr, const double *elevation, int apply, sfcvm_properties_t *data,
+                        int *status, int numpoints) {
+  int idx[SFCVM_BATCH];
+  double elev[SFCVM_BATCH];
+  double vp[SFCVM_BATCH], vs[SFCVM_BATCH], rho[SFCVM_BATCH];
+  int hit[SFCVM_BATCH];
+
+  for(int c=0; c<sfcvm_corrections_cnt; c++) {
+    int cnt=0;
+    for(int i=0; i<numpoints; i++) {
+      if(corr[i] != c) continue;
+      idx[cnt]=i;
+      elev[cnt]=elevation[i];
+      cnt++;
+    }
+    if(cnt == 0) continue;
+
+    sfcvm_corrections[c].fn(cnt, elev, vp, vs, rho, hit);
+    for(int k=0; k<cnt; k++) {
+      if(!hit[k]) continue;
+      if(apply) {
+        data[idx[k]].vp=vp[k];
+        data[idx[k]].vs=vs[k];
+        data[idx[k]].rho=rho[k];
+        status[idx[k]]=SFCVM_STATUS_GABBRO_APPLIED;
+      }
+      sfcvm_corrections[c].count++;
+      sfcvm_gabbro_count++;
+    }
   }
-  return UCVM_MODEL_CODE_SUCCESS;
 }
 
 /** 
@@ -406,142 +1554,482 @@ double _zSquashed(int dimZ, double zMinSquashed, double zSurf, double zTop, doub
  * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
  */
 int sfcvm_query(sfcvm_point_t *points, sfcvm_properties_t *data, int numpoints) {
+    sfcvm_context_t ctx;
+    _context_defaults(&ctx);
+    return sfcvm_context_query_extra(&ctx, points, data, NULL, numpoints);
+}
 
-// NOTE: even though 3rd item in points struct is name 'depth', it could be depth in
-// elevation data model or depth in depth data model 
+/**
+ * Queries SFCVM at the given points and also returns the extra outputs
+ * requested in extra.
+ *
+ * @param points The points at which the queries will be made.
+ * @param data The data that will be returned (Vp, Vs, density, Qs, and/or Qp).
+ * @param extra The extra outputs to fill in, or NULL.
+ * @param numpoints The total number of points to query.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_query_extra(sfcvm_point_t *points, sfcvm_properties_t *data, sfcvm_extra_t *extra, int numpoints) {
+    sfcvm_context_t ctx;
+    _context_defaults(&ctx);
+    return sfcvm_context_query_extra(&ctx, points, data, extra, numpoints);
+}
 
-    double values[sfcvm_numValues];
-    double entry_latitude;
-    double entry_longitude;
+/**
+ * Queries one step down level of a water point. The levels are fixed by
+ * the column, every point stepping down it visits the same ones, so a
+ * level another point of the column already queried is taken from the
+ * column memo.
+ *
+ * @return 0 on success, nonzero when no tile could answer.
+ */
+int _step_query(sfcvm_block_point_t *bp, double zSquashed) {
+    sfcvm_column_t *c=bp->col;
+    sfcvm_step_memo_t *m=c->memo;
+
+    if(m != NULL) {
+      for(int k=0; k<m->cnt; k++) {
+        if(m->zSquashed[k] != zSquashed) continue;
+        memcpy(bp->values, m->values[k], sizeof(bp->values));
+        sfcvm_water_step_shared++;
+        return m->err[k];
+      }
+    }
+
+    int err=_route_query(&bp->route, bp->values, zSquashed);
+    if(c->keep_memo) {
+      if(m == NULL) m=c->memo=(sfcvm_step_memo_t *)calloc(1, sizeof(sfcvm_step_memo_t));
+      if(m != NULL && m->cnt < SFCVM_STEP_MEMO) {
+        m->zSquashed[m->cnt]=zSquashed;
+        memcpy(m->values[m->cnt], bp->values, sizeof(bp->values));
+        m->err[m->cnt]=err;
+        m->cnt++;
+      }
+    }
+    return err;
+}
 
+/**
+ * Steps all under-water points of a block down together. Each pass moves
+ * every pending point one logical grid level down, with the _zLogical and
+ * _zSquashed math done over the whole queue, then queries the new levels.
+ * Points that found valid data or failed drop out of the queue. Every
+ * point follows exactly the sequence of levels of a per-point search.
+ *
+ * @param q The pending water points of a block.
+ * @param zMinSquashed Squashing min elevation of the query.
+ */
+void _water_step_down(sfcvm_water_queue_t *q, double zMinSquashed) {
     int dimZ = sfcvm_total_height_m;
-    double zPhysical; 
-    double zSquashed; 
-    double zMinSquashed = SFCVM_SquashMinElev;
-    double zLogical;
-    double zTop;
-    double zSurf;
-    // could be either sfcvm_grid_height_m, or sfcvm_grid_height_regional_m
-    double dZ;
+    double zLogical[SFCVM_BATCH];
+    int step_cnt=0;
+
+    while(q->cnt > 0 && step_cnt < sfcvm_water_max_step_limit) {
+
+// could be either sfcvm_grid_height_m, or sfcvm_grid_height_regional_m
+      for(int k=0; k<q->cnt; k++) {
+        zLogical[k]= _zLogical(dimZ, zMinSquashed, q->zSurf[k], q->zTop[k], q->zSquashed[k], q->dZ[k]);
+        q->zSquashed[k]= _zSquashed(dimZ, zMinSquashed, q->zSurf[k], q->zTop[k], q->dZ[k], zLogical[k]);
+      }
+
+      int active=0;
+      for(int k=0; k<q->cnt; k++) {
+        sfcvm_block_point_t *bp=q->pt[k];
+        bp->err = _step_query(bp, q->zSquashed[k]);
+        bp->zSquashed = q->zSquashed[k];
+
+        if(bp->err) continue;
+        if(bp->values[0]>0 && bp->values[1]>0) continue;
+
+        // still in the water, keep it for the next pass
+        q->pt[active]=bp;
+        q->zSurf[active]=q->zSurf[k];
+        q->zTop[active]=q->zTop[k];
+        q->dZ[active]=q->dZ[k];
+        q->zSquashed[active]=q->zSquashed[k];
+        active++;
+      }
+      q->cnt=active;
+
+      if(q->cnt > 0 && step_cnt > sfcvm_water_max_step) { sfcvm_water_max_step=step_cnt; }
+      step_cnt++;
+    } // while loop
+
+    if(step_cnt >= sfcvm_water_max_step_limit ) {
+       sfcvm_water_max_step_limit_count += q->cnt;
+       for(int k=0; k<q->cnt; k++) q->pt[k]->water_limit=1;
+    }
+}
+
+/**
+ * Projects, routes and looks up the surface of at most SFCVM_BATCH
+ * locations, the part of a query that only depends on lon/lat.
+ *
+ * @param ctx The query context.
+ * @param lon Longitudes, or x in the input CRS.
+ * @param lat Latitudes, or y in the input CRS.
+ * @param n Number of locations.
+ * @param col The columns filled in.
+ */
+void _locate_columns(sfcvm_context_t *ctx, const double *lon, const double *lat, int n, sfcvm_column_t *col) {
+    double glon[SFCVM_BATCH], glat[SFCVM_BATCH], x[SFCVM_BATCH], y[SFCVM_BATCH];
+    int crs[SFCVM_BATCH];
+
+    // the whole block goes into query object coordinates at once
+    memcpy(glon, lon, n*sizeof(double));
+    memcpy(glat, lat, n*sizeof(double));
+    _project_points(ctx->input_crs, glon, glat, n, crs, x, y);
+
+    for(int i=0; i<n; i++) {
+      sfcvm_column_t *c=&col[i];
+      c->longitude=glon[i];
+      c->latitude=glat[i];
+      c->outside=1;
+      c->memo=NULL;
+      c->keep_memo=0;
+
+      // outside of every footprint, no need to ask geomodelgrids
+      if(ctx->fast_fail && _crs_has_lonlat(crs[i]) && !_in_footprint(c->longitude, c->latitude)) {
+        sfcvm_fastfail_count++;
+        continue;
+      }
+
+      _route_point(&c->route, crs[i], c->longitude, c->latitude, x[i], y[i]);
+      if(_route_surface(&c->route, &c->zSurf, &c->zTop) != 0) continue;
+      c->outside=0;
+    }
+}
+
+/* The slots of extra from point start on, all NULL if extra is */
+void _extra_from(const sfcvm_extra_t *extra, int start, sfcvm_extra_t *out) {
+    memset(out, 0, sizeof(sfcvm_extra_t));
+    if(extra == NULL) return;
+    if(extra->zone_id) out->zone_id=&extra->zone_id[start];
+    if(extra->model_i) out->model_i=&extra->model_i[start];
+    if(extra->status) out->status=&extra->status[start];
+    if(extra->mu) out->mu=&extra->mu[start];
+    if(extra->lambda) out->lambda=&extra->lambda[start];
+}
+
+/**
+ * Derived outputs of a block, made in the same pass as its model values.
+ * The Vs floor raises slower rock to it at its Vp/Vs ratio, water is
+ * left alone. The Q relations and the moduli then come from the final
+ * values, and points without data get -1.
+ *
+ * @param ctx The query context, its vs_floor, qs_vs and qp_qs.
+ * @param data The block results, updated in place.
+ * @param st Status of each point.
+ * @param mu Returns the shear moduli, may be NULL.
+ * @param lambda Returns Lame's first parameters, may be NULL.
+ * @param numpoints Points in the block.
+ */
+void _derive_block(sfcvm_context_t *ctx, sfcvm_properties_t *data, const int *st, double *mu, double *lambda,
+                   int numpoints) {
+    for(int i=0; i<numpoints; i++) {
+      sfcvm_properties_t *d=&data[i];
+      int nodata=(st[i] == SFCVM_STATUS_OUTSIDE || st[i] == SFCVM_STATUS_QUERY_ERROR ||
+                  d->vp <= NODATA_VALUE || d->vs <= NODATA_VALUE || d->rho <= NODATA_VALUE);
+      if(!nodata && d->vs > 0 && d->vs < ctx->vs_floor) {
+        d->vp*=ctx->vs_floor/d->vs;
+        d->vs=ctx->vs_floor;
+      }
+      if(ctx->qs_vs > 0) {
+        d->qs=(!nodata && d->vs > 0) ? ctx->qs_vs*d->vs : -1;
+        d->qp=(!nodata && d->vs > 0) ? ctx->qp_qs*d->qs : -1;
+      }
+      if(mu) mu[i]=nodata ? -1 : d->rho*d->vs*d->vs;
+      if(lambda) lambda[i]=nodata ? -1 : d->rho*(d->vp*d->vp-2*d->vs*d->vs);
+    }
+}
+
+/**
+ * Queries one block of at most SFCVM_BATCH points on located columns.
+ * Land points are resolved by their first query, points under water are
+ * gathered and stepped down together by _water_step_down.
+ *
+ * @param ctx The query context.
+ * @param col Column of each point, several points may share one.
+ * @param depth Depth of each point.
+ */
+void _query_columns(sfcvm_context_t *ctx, sfcvm_column_t **col, const double *depth, sfcvm_properties_t *data,
+                    const sfcvm_extra_t *extra, int numpoints) {
+    int *zone_id=extra->zone_id;
+    int *model_i=extra->model_i;
 
-    void *query_object;
-    void *error_handler;
+// NOTE: even though 3rd item in points struct is name 'depth', it could be depth in
+// elevation data model or depth in depth data model 
+
+    sfcvm_block_point_t block[SFCVM_BATCH];
+    sfcvm_water_queue_t water;
+    double zMinSquashed = ctx->squash_min_elev;
+
+    water.cnt=0;
 
     for(int i=0; i<numpoints; i++) {
+      sfcvm_block_point_t *bp=&block[i];
+      sfcvm_column_t *c=col[i];
       sfcvm_query_count++;
       data[i].vp=-1;
       data[i].vs=-1;
       data[i].rho=-1;
+      bp->queried=0;
+      bp->water_limit=0;
 
       /* Force depth mode if directed and point is above surface */
       /* Setup point to query */
-      entry_longitude=points[i].longitude;
-      entry_latitude=points[i].latitude;
-
-
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp, "\nsfcvm_query: USING lat(%lf)) lon(%lf) depth(%lf)\n", points[i].latitude, points[i].longitude, points[i].depth); }
-
-      if((entry_longitude<360.) && (fabs(entry_latitude)<90)) {
-      // GEO;
-        query_object= sfcvm_geo_query_object;
-        error_handler = sfcvm_geo_error_handler;
-        } else { // UTM;
-          query_object= sfcvm_utm_query_object;
-          error_handler= sfcvm_utm_error_handler;
-      }
-
-      int rc=sfcvm_getsurface(entry_longitude, entry_latitude, &zSurf, &zTop);
-      if( rc != 0) {
-        continue;
-      } 
+      if(c->outside) continue;
+      bp->route=c->route;
+      bp->col=c;
+      double zSurf=c->zSurf;
 
 //if(sfcvm_ucvm_debug) { fprintf(stderrfp,"\n with zSurf : %f\n", zSurf); }
 
-      if( zSurf == NODATA_VALUE ) { // outside of the model
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"        OUTside of MODEL by NODATA_VALUE surface..\n"); }
-        geomodelgrids_cerrorhandler_resetStatus(error_handler);
-        continue;
-      }
-
       // Since it is squashed.. the surface has moved to sea level
-      if (points[i].depth - 0 < 0.01) { 
-        zSquashed= -1.0 ;
+      if (depth[i] - 0 < 0.01) { 
+        bp->zSquashed= -1.0 ;
         } else {
-          zSquashed= 0.0 - points[i].depth;
+          bp->zSquashed= 0.0 - depth[i];
       }
 
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"       zSquashed.. %lf\n", zSquashed); }
+//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"       zSquashed.. %lf\n", bp->zSquashed); }
 
-      int err;
-      err = geomodelgrids_squery_query(query_object, values, entry_latitude, entry_longitude, zSquashed);
+      bp->err = _route_query(&bp->route, bp->values, bp->zSquashed);
       // model_i = 0, in detail area, model_i = 1, in regional area
-      int model_i=geomodelgrids_squery_queryModelContains(query_object, entry_latitude, entry_longitude);
+      sfcvm_data_file_t *dfile=&sfcvm_configuration->data[bp->route.cand[bp->route.pos]];
+      bp->model_i=dfile->model;
+      bp->queried=1;
 
       if(zSurf < 0) sfcvm_water_count++;
       // special case -- under the water
-      if( (zSurf < 0 && err) ||
-            ((zSurf < 0 || zSquashed < zSurf) && (values[0] != NODATA_VALUE) && (values[1] == NODATA_VALUE))) {
+      if( (zSurf < 0 && bp->err) ||
+            ((zSurf < 0 || bp->zSquashed < zSurf) && (bp->values[0] != NODATA_VALUE) && (bp->values[1] == NODATA_VALUE))) {
         sfcvm_water_step_count++;     
-        dZ=sfcvm_configuration->data_gridheights[model_i];
 
-	if(model_i == 0) {
+	if(bp->model_i == 0) {
           sfcvm_water_step_in_detail++;
           } else {
             sfcvm_water_step_in_regional++;
         }
 
-        int step_cnt =0;
-        while(step_cnt < sfcvm_water_max_step_limit) {
+        // a point that failed here fails every step
+        if(bp->err) continue;
 
-// could be either sfcvm_grid_height_m, or sfcvm_grid_height_regional_m
-          zLogical= _zLogical(dimZ, zMinSquashed, zSurf, zTop, zSquashed, dZ);
-          zSquashed= _zSquashed(dimZ, zMinSquashed, zSurf, zTop, dZ, zLogical);
+        water.pt[water.cnt]=bp;
+        water.zSurf[water.cnt]=zSurf;
+        water.zTop[water.cnt]=c->zTop;
+        water.dZ[water.cnt]=dfile->gridheight;
+        water.zSquashed[water.cnt]=bp->zSquashed;
+        water.cnt++;
+        } else { // good catch the first time
+//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"WATER: good, 1st at (%lf %lf %lf)\n", c->longitude, c->latitude, bp->zSquashed); }
+      }
+    }
 
-          err = geomodelgrids_squery_query(query_object, values, entry_latitude, entry_longitude, zSquashed);
+    _water_step_down(&water, zMinSquashed);
 
-          if(err) break;
-          if(values[0]>0 && values[1]>0) break;
+    int corr[SFCVM_BATCH];
+    double elevation[SFCVM_BATCH];
+    int st[SFCVM_BATCH];
+    for(int i=0; i<numpoints; i++) {
+      sfcvm_block_point_t *bp=&block[i];
+      corr[i]=-1;
+      st[i]=SFCVM_STATUS_OUTSIDE;
+      if(zone_id) zone_id[i]=-1;
+      if(model_i) model_i[i]=-1;
+      if(!bp->queried) continue;
+
+      if(model_i) model_i[i]=bp->model_i;
+      st[i]=SFCVM_STATUS_QUERY_ERROR;
+      if(!bp->err) {
+        st[i]=(bp->water_limit) ? SFCVM_STATUS_WATER_LIMIT : SFCVM_STATUS_OK;
+        int typeid= ROUND_2_INT(bp->values[3]);
+        data[i].vp=bp->values[0];
+        data[i].vs=bp->values[1];
+        data[i].rho=bp->values[2];
+        if(zone_id && bp->values[3] != NODATA_VALUE) zone_id[i]=typeid;
 
-          if(step_cnt > sfcvm_water_max_step) { sfcvm_water_max_step=step_cnt; }
-           step_cnt++;
-        } // while loop
+// Nakata and Pitarka gabbro correction, near-surface gabbro regions in the East Bay and Gilroy in the SFCVM
+        corr[i]=_find_correction(bp->model_i, typeid);
+        elevation[i]=bp->zSquashed;
 
-        if(step_cnt >= sfcvm_water_max_step_limit ) {
-           sfcvm_water_max_step_limit_count++;
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"   THIS IS BAD >> %d : at %lf %lf %lf", step_cnt, entry_longitude, entry_latitude, zSquashed); }
-        }
+//if(sfcvm_ucvm_debug) { fprintf(stderrfp," RESULT from calling squery ==> vp(%f) vs(%f) rho(%f) \n\n",bp->values[0], bp->values[1], bp->values[2]); }
+      }
+    }
 
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"    done(%d) : at %lf %lf %lf \n", step_cnt, entry_longitude, entry_latitude, zSquashed); }
+    _apply_corrections(corr, elevation, ctx->gabbro, data, st, numpoints);
+    _derive_block(ctx, data, st, extra->mu, extra->lambda, numpoints);
+    if(extra->status) memcpy(extra->status, st, numpoints*sizeof(int));
+}
 
-        } else { // good catch the first time
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"WATER: good, 1st at (%lf %lf %lf)\n", entry_longitude, entry_latitude, zSquashed); }
-      }
+/* Queries one block of at most SFCVM_BATCH points, each in a column of its own */
+void _query_block(sfcvm_context_t *ctx, sfcvm_point_t *points, sfcvm_properties_t *data,
+                  const sfcvm_extra_t *extra, int numpoints) {
+    sfcvm_column_t col[SFCVM_BATCH];
+    sfcvm_column_t *colp[SFCVM_BATCH];
+    double lon[SFCVM_BATCH], lat[SFCVM_BATCH], depth[SFCVM_BATCH];
 
-      if(!err) {
-        data[i].vp=values[0];
-        data[i].vs=values[1];
-        data[i].rho=values[2];
+    for(int i=0; i<numpoints; i++) {
+      lon[i]=points[i].longitude;
+      lat[i]=points[i].latitude;
+      depth[i]=points[i].depth;
+      colp[i]=&col[i];
+    }
+    _locate_columns(ctx, lon, lat, numpoints, col);
+    _query_columns(ctx, colp, depth, data, extra, numpoints);
+}
 
-// Nakata and Pitarka gabbro correction, near-surface gabbro regions in the East Bay and Gilroy in the SFCVM
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"At b %lf %lf type(%lf) -- vp(%lf) vs(%lf)\n", entry_longitude, entry_latitude, values[3], values[0], values[1]); }
+/**
+ * Queries SFCVM at the given points with the settings of a context.
+ *
+ * @param ctx The query context.
+ * @param points The points at which the queries will be made.
+ * @param data The data that will be returned (Vp, Vs, density, Qs, and/or Qp).
+ * @param numpoints The total number of points to query.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_context_query(sfcvm_context_t *ctx, sfcvm_point_t *points, sfcvm_properties_t *data, int numpoints) {
+    return sfcvm_context_query_extra(ctx, points, data, NULL, numpoints);
+}
 
-        int typeid= ROUND_2_INT(values[3]);
-        if( (model_i == 0 && ((typeid == sfcvm_san_leandro_gabbro_type_id) || (typeid == sfcvm_logan_gabbro_type_id )))
-           || (model_i == 1 && (typeid == sfcvm_gv_gabbro_type_id)) ) {
-if(sfcvm_ucvm_debug) { fprintf(stderrfp,"GABBRO: found: at %lf %lf\n", entry_longitude, entry_latitude); }
-           _gabbro(zSquashed,&data[i]);
-        } else {
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"GABBRO: no: at %lf %lf %lf\n", entry_longitude, entry_latitude, values[3]); }
-        }
+/**
+ * Queries SFCVM at the given points with the settings of a context. The
+ * zone_id, source model and status come out of the same model query that
+ * gives the velocities, filling them in costs nothing extra.
+ *
+ * @param ctx The query context.
+ * @param points The points at which the queries will be made.
+ * @param data The data that will be returned (Vp, Vs, density, Qs, and/or Qp).
+ * @param extra The extra outputs to fill in, or NULL.
+ * @param numpoints The total number of points to query.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_context_query_extra(sfcvm_context_t *ctx, sfcvm_point_t *points, sfcvm_properties_t *data,
+                              sfcvm_extra_t *extra, int numpoints) {
+    sfcvm_extra_t block;
 
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"  At %lf %lf type(%lf) -- vp(%lf)vs(%lf)\n", entry_longitude, entry_latitude, values[3], data[i].vp, data[i].vs); }
+    // set before the model was last initialized
+    if(ctx->input_crs >= sfcvm_input_crs_cnt) return UCVM_MODEL_CODE_ERROR;
 
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp," RESULT from calling squery ==> vp(%f) vs(%f) rho(%f) \n\n",values[0], values[1], values[2]); }
-        } else { // need to reset the error handler
-             geomodelgrids_cerrorhandler_resetStatus(error_handler);
-      }    
-  }
-  return UCVM_MODEL_CODE_SUCCESS;
+    _apply_squashMinElev(ctx->squash_min_elev);
+
+    for(int start=0; start<numpoints; start+=SFCVM_BATCH) {
+      int cnt=numpoints-start;
+      if(cnt > SFCVM_BATCH) cnt=SFCVM_BATCH;
+      _extra_from(extra, start, &block);
+      _query_block(ctx, &points[start], &data[start], &block, cnt);
+    }
+    return UCVM_MODEL_CODE_SUCCESS;
+}
+
+/**
+ * Locates columns for repeated queries. Each location is projected,
+ * routed to its data file and has its surface looked up once here, the
+ * queries down the column then only ask for the model values. Results
+ * are the same as sfcvm_context_query_extra at the column's location.
+ *
+ * @param ctx The query context, its settings are copied.
+ * @param lon Longitudes, or x in the input CRS of ctx.
+ * @param lat Latitudes, or y in the input CRS of ctx.
+ * @param ncols Number of columns.
+ * @return The columns, free with sfcvm_columns_destroy, NULL on failure.
+ */
+sfcvm_columns_t *sfcvm_columns_create(sfcvm_context_t *ctx, const double *lon, const double *lat, int ncols) {
+    if(!sfcvm_is_initialized || ctx->input_crs >= sfcvm_input_crs_cnt) return NULL;
+
+    sfcvm_columns_t *cols=(sfcvm_columns_t *)malloc(sizeof(sfcvm_columns_t));
+    if(cols == NULL) return NULL;
+    cols->ctx=*ctx;
+    cols->cnt=ncols;
+    cols->col=(sfcvm_column_t *)malloc((ncols > 0 ? ncols : 1)*sizeof(sfcvm_column_t));
+    if(cols->col == NULL) {
+      free(cols);
+      return NULL;
+    }
+
+    _apply_squashMinElev(ctx->squash_min_elev);
+    for(int start=0; start<ncols; start+=SFCVM_BATCH) {
+      int cnt=ncols-start;
+      if(cnt > SFCVM_BATCH) cnt=SFCVM_BATCH;
+      _locate_columns(&cols->ctx, &lon[start], &lat[start], cnt, &cols->col[start]);
+    }
+    for(int c=0; c<ncols; c++) cols->col[c].keep_memo=1;
+    return cols;
+}
+
+void sfcvm_columns_destroy(sfcvm_columns_t *cols) {
+    if(cols == NULL) return;
+    for(int c=0; c<cols->cnt; c++) free(cols->col[c].memo);
+    free(cols->col);
+    free(cols);
+}
+
+/**
+ * Surface of a column, as sfcvm_getsurface.
+ *
+ * @return 0 on success, 1 if the column is outside of the model.
+ */
+int sfcvm_columns_surface(sfcvm_columns_t *cols, int c, double *surface, double *top) {
+    if(c < 0 || c >= cols->cnt || cols->col[c].outside) return 1;
+    *surface=cols->col[c].zSurf;
+    *top=cols->col[c].zTop;
+    return 0;
+}
+
+/* Grid height at the top of the data file a column is routed to, 0 if it is outside */
+double sfcvm_columns_gridheight(sfcvm_columns_t *cols, int c) {
+    if(c < 0 || c >= cols->cnt || cols->col[c].outside) return 0;
+    sfcvm_route_t *route=&cols->col[c].route;
+    return sfcvm_configuration->data[route->cand[route->pos]].gridheight;
+}
+
+/**
+ * Queries points on located columns, point i at depth[i] in column
+ * col[i]. Points of any columns may be mixed in one call.
+ *
+ * @param cols Columns from sfcvm_columns_create.
+ * @param col Column of each point.
+ * @param depth Depth of each point.
+ * @param data The data that will be returned (Vp, Vs, density).
+ * @param extra The extra outputs to fill in, or NULL.
+ * @param numpoints The total number of points to query.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_columns_query(sfcvm_columns_t *cols, const int *col, const double *depth, sfcvm_properties_t *data,
+                        sfcvm_extra_t *extra, int numpoints) {
+    sfcvm_extra_t block;
+    sfcvm_column_t *colp[SFCVM_BATCH];
+
+    for(int i=0; i<numpoints; i++) {
+      if(col[i] < 0 || col[i] >= cols->cnt) return UCVM_MODEL_CODE_ERROR;
+    }
+    _apply_squashMinElev(cols->ctx.squash_min_elev);
+
+    for(int start=0; start<numpoints; start+=SFCVM_BATCH) {
+      int cnt=numpoints-start;
+      if(cnt > SFCVM_BATCH) cnt=SFCVM_BATCH;
+      for(int i=0; i<cnt; i++) colp[i]=&cols->col[col[start+i]];
+      _extra_from(extra, start, &block);
+      _query_columns(&cols->ctx, colp, &depth[start], &data[start], &block, cnt);
+    }
+    return UCVM_MODEL_CODE_SUCCESS;
+}
+
+/**
+ * Opens every data file for both coordinate systems now instead of on
+ * first use. Call before forking workers, so they share the query objects
+ * copy-on-write instead of each opening its own.
+ *
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_preload() {
+    int rc=UCVM_MODEL_CODE_SUCCESS;
+    if(!sfcvm_is_initialized) return UCVM_MODEL_CODE_ERROR;
+    for(int t=0; t<sfcvm_tiles_cnt; t++) {
+      if(_tile_query_object(t, sfcvm_native ? SFCVM_CRS_NATIVE : SFCVM_CRS_GEO) == NULL) rc=UCVM_MODEL_CODE_ERROR;
+      if(_tile_query_object(t, SFCVM_CRS_UTM) == NULL) rc=UCVM_MODEL_CODE_ERROR;
+    }
+    return rc;
 }
 
 /**
@@ -549,39 +2037,19 @@ if(sfcvm_ucvm_debug) { fprintf(stderrfp,"GABBRO: found: at %lf %lf\n", entry_lon
  **/
 int sfcvm_getsurface(double entry_longitude, double entry_latitude, 
                                double *surface, double *top) {
-  void *query_object;
-  void *error_handler;
-
-  if((entry_longitude<360.) && (fabs(entry_latitude)<90)) {
-      // GEO;
-        query_object= sfcvm_geo_query_object;
-        error_handler = sfcvm_geo_error_handler;
-        } else { // UTM;
-          query_object= sfcvm_utm_query_object;
-          error_handler= sfcvm_utm_error_handler;
-  }
-
-  double topoElev = geomodelgrids_squery_queryTopElevation(query_object, entry_latitude, entry_longitude);
-  double topoBathyElev = geomodelgrids_squery_queryTopoBathyElevation(query_object, entry_latitude, entry_longitude);
-
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp,">>>    surface: top %f\n", topoElev); }
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp,">>>    surface: topoBathy %f\n", topoBathyElev); }
+  sfcvm_route_t route;
 
-  if( topoBathyElev == NODATA_VALUE ) { // outside of the model
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"        OUTside of MODEL by NODATA_VALUE surface..\n"); }
-      geomodelgrids_cerrorhandler_resetStatus(error_handler);
-      return 1;
+  if(SFCVM_FastFail && !_in_footprint(entry_longitude, entry_latitude)) {
+    sfcvm_fastfail_count++;
+    return 1;
   }
 
-  if( topoElev == NODATA_VALUE ) { // outside of the model
-//if(sfcvm_ucvm_debug) { fprintf(stderrfp,"        OUTside of MODEL by NODATA_VALUE top..\n"); }
-      geomodelgrids_cerrorhandler_resetStatus(error_handler);
-      return 1;
-  }
+  int crs;
+  double x, y;
 
-  *top=topoElev;
-  *surface=topoBathyElev;
-  return 0;
+  _project_points(-1, &entry_longitude, &entry_latitude, 1, &crs, &x, &y);
+  _route_point(&route, crs, entry_longitude, entry_latitude, x, y);
+  return _route_surface(&route, surface, top);
 }
 
 void sfcvm_setdebug() {
@@ -591,9 +2059,11 @@ void sfcvm_setdebug() {
 void _free_sfcvm_configuration(sfcvm_configuration_t *config) {
 
   for(int i=0; i< config->data_cnt; i++) {
-      free(config->data_labels[i]);
-      free(config->data_files[i]);
+      free(config->data[i].label);
+      free(config->data[i].file);
+      free(config->data[i].footprint);
   }
+  free(config->data);
   free(config);
 }
 
@@ -603,8 +2073,13 @@ void _dump_sfcvm_configuration(sfcvm_configuration_t *config) {
     fprintf(stderrfp,"    depth : %d\n", config->model_depth);
     fprintf(stderrfp,"    gabbro : %d\n", config->model_gabbro);
     fprintf(stderrfp,"    squashminelev : %lf\n", config->model_squashminelev);
+    fprintf(stderrfp,"    fastfail : %d\n", config->model_fastfail);
+    fprintf(stderrfp,"    vsfloor : %lf\n", config->model_vsfloor);
+    fprintf(stderrfp,"    qsvs : %lf qpqs : %lf\n", config->model_qsvs, config->model_qpqs);
+    fprintf(stderrfp,"    model_crs : %s\n", config->model_crs);
     for(int i=0; i< config->data_cnt; i++) {
-       fprintf(stderrfp,"    <%d>  %s: %s\n",i,config->data_labels[i], config->data_files[i]);
+       fprintf(stderrfp,"    <%d>  %s: %s (model %d, footprint %d vertices)\n",i,config->data[i].label,
+                        config->data[i].file, config->data[i].model, config->data[i].footprint_cnt);
     }
 }
 
@@ -621,22 +2096,33 @@ int sfcvm_finalize() {
     free(sfcvm_velocity_model);
     free(sfcvm_config_string);
 
-/* Destroy query object. */
-    geomodelgrids_squery_destroy(&sfcvm_geo_query_object);
-    sfcvm_geo_query_object=0;
-
-    geomodelgrids_squery_destroy(&sfcvm_utm_query_object);
-    sfcvm_utm_query_object=0;
+/* Destroy query objects. */
+    int tiles_cnt=sfcvm_tiles_cnt;
+    for(int t=0; t<sfcvm_tiles_cnt; t++) {
+      _close_tile(&sfcvm_tiles[t]);
+    }
+    free(sfcvm_tiles);
+    sfcvm_tiles=0;
+    sfcvm_tiles_cnt=0;
+    sfcvm_native=0;
+    for(int i=0; i<sfcvm_input_crs_cnt; i++) free(sfcvm_input_crs[i].crs);
+    sfcvm_input_crs_cnt=0;
+    _free_tile_index(&sfcvm_tile_index);
 
     if(sfcvm_ucvm_debug) { 
      fprintf(stderrfp,"DONE:\n"); 
      fprintf(stderrfp,"    total query count=(%d)\n",sfcvm_query_count);
      fprintf(stderrfp,"    total gabbro count=(%d)\n",sfcvm_gabbro_count);
+     for(int c=0; c<sfcvm_corrections_cnt; c++) {
+       fprintf(stderrfp,"      %s (zone_id %d) count=(%d)\n",sfcvm_corrections[c].name,
+                        sfcvm_corrections[c].zone_id, sfcvm_corrections[c].count);
+     }
      fprintf(stderrfp,"    total water count=(%d)\n",sfcvm_water_count);
      fprintf(stderrfp,"    total water step count=(%d)\n",sfcvm_water_step_count);
      fprintf(stderrfp,"    water step in detail =(%d)\n",sfcvm_water_step_in_detail);
      fprintf(stderrfp,"    water step in regional =(%d)\n",sfcvm_water_step_in_regional);
      fprintf(stderrfp,"    max water step =(%d)\n",sfcvm_water_max_step);
+     fprintf(stderrfp,"    query objects opened =(%d of %d)\n",sfcvm_tiles_opened, 2*tiles_cnt);
 
      fclose(stderrfp);
     }
@@ -701,9 +2187,24 @@ char* _search(char *str, char *label, char** vptr) {
 * Parse the sfcvm data configurations
 *
 * {"LABEL":"sfcvm","FILE":"USGS_SFCVM_v21-1_detailed.h5","GRIDHEIGHT":25}
+*
+* optional, "MODEL": 0 detailed or 1 regional, defaults to the entry index,
+* "FOOTPRINT": [[lon,lat],...] and the lattice of the file in model_crs,
+* "GRID": {"ORIGIN":[x,y],"AZIMUTH":deg,"RESOLUTION":[dx,dy],"POINTS":[nx,ny]}
 **/
 int _processSFCVMConfiguration(sfcvm_configuration_t *config, char *confstr,int idx) {
 
+  if(idx >= config->data_max) {
+    int max=(config->data_max > 0) ? config->data_max*2 : 16;
+    sfcvm_data_file_t *data=(sfcvm_data_file_t *)realloc(config->data, max*sizeof(sfcvm_data_file_t));
+    if(data == NULL) return UCVM_MODEL_CODE_ERROR;
+    config->data=data;
+    config->data_max=max;
+  }
+  sfcvm_data_file_t *dfile=&config->data[idx];
+  memset(dfile, 0, sizeof(sfcvm_data_file_t));
+  dfile->model=idx;
+
   cJSON *confjson = cJSON_Parse(confstr);
   if(confjson == NULL)
   {
@@ -713,17 +2214,68 @@ int _processSFCVMConfiguration(sfcvm_configuration_t *config, char *confstr,int
       return UCVM_MODEL_CODE_ERROR;
     }
   }
-  cJSON *label = cJSON_GetObjectItemCaseSensitive(confjson, "LABEL");
-  if(cJSON_IsString(label)){
-    config->data_labels[idx]=strdup(label->valuestring);
-  }
   cJSON *file = cJSON_GetObjectItemCaseSensitive(confjson, "FILE");
-  if(cJSON_IsString(file)){
-    config->data_files[idx]=strdup(file->valuestring);
+  if(!cJSON_IsString(file)){
+    cJSON_Delete(confjson);
+    return UCVM_MODEL_CODE_ERROR;
   }
+  dfile->file=strdup(file->valuestring);
+  cJSON *label = cJSON_GetObjectItemCaseSensitive(confjson, "LABEL");
+  dfile->label=strdup(cJSON_IsString(label) ? label->valuestring : file->valuestring);
   cJSON *gridheight = cJSON_GetObjectItemCaseSensitive(confjson, "GRIDHEIGHT");
   if(cJSON_IsNumber(gridheight)){
-    config->data_gridheights[idx]=gridheight->valuedouble;
+    dfile->gridheight=gridheight->valuedouble;
+  }
+  cJSON *model = cJSON_GetObjectItemCaseSensitive(confjson, "MODEL");
+  if(cJSON_IsNumber(model)){
+    dfile->model=model->valueint;
+  }
+  // optional, [[lon,lat],...] polygon enclosing the data file
+  cJSON *footprint = cJSON_GetObjectItemCaseSensitive(confjson, "FOOTPRINT");
+  int vcnt=cJSON_GetArraySize(footprint);
+  if(cJSON_IsArray(footprint) && vcnt >= 3 && vcnt <= SFCVM_FOOTPRINT_MAX){
+    double *poly=(double *)malloc(2*vcnt*sizeof(double));
+    int n=0;
+    if(poly == NULL) {
+      free(dfile->file);
+      free(dfile->label);
+      cJSON_Delete(confjson);
+      return UCVM_MODEL_CODE_ERROR;
+    }
+    cJSON *vertex;
+    cJSON_ArrayForEach(vertex, footprint) {
+      cJSON *lon=cJSON_GetArrayItem(vertex, 0);
+      cJSON *lat=cJSON_GetArrayItem(vertex, 1);
+      if(!cJSON_IsNumber(lon) || !cJSON_IsNumber(lat)) break;
+      poly[2*n]=lon->valuedouble;
+      poly[2*n+1]=lat->valuedouble;
+      n++;
+    }
+    if(n == vcnt) {
+      dfile->footprint=poly;
+      dfile->footprint_cnt=vcnt;
+      } else {
+        free(poly);
+    }
+  }
+  // optional, the horizontal lattice, taken only when complete
+  cJSON *grid = cJSON_GetObjectItemCaseSensitive(confjson, "GRID");
+  if(cJSON_IsObject(grid)){
+    cJSON *origin=cJSON_GetObjectItemCaseSensitive(grid, "ORIGIN");
+    cJSON *azimuth=cJSON_GetObjectItemCaseSensitive(grid, "AZIMUTH");
+    cJSON *res=cJSON_GetObjectItemCaseSensitive(grid, "RESOLUTION");
+    cJSON *points=cJSON_GetObjectItemCaseSensitive(grid, "POINTS");
+    if(cJSON_IsNumber(azimuth) && cJSON_IsNumber(cJSON_GetArrayItem(origin, 0)) && cJSON_IsNumber(cJSON_GetArrayItem(origin, 1)) &&
+       cJSON_IsNumber(cJSON_GetArrayItem(res, 0)) && cJSON_IsNumber(cJSON_GetArrayItem(res, 1)) &&
+       cJSON_IsNumber(cJSON_GetArrayItem(points, 0)) && cJSON_IsNumber(cJSON_GetArrayItem(points, 1))) {
+      dfile->grid.x0=cJSON_GetArrayItem(origin, 0)->valuedouble;
+      dfile->grid.y0=cJSON_GetArrayItem(origin, 1)->valuedouble;
+      dfile->grid.azimuth=azimuth->valuedouble;
+      dfile->grid.dx=cJSON_GetArrayItem(res, 0)->valuedouble;
+      dfile->grid.dy=cJSON_GetArrayItem(res, 1)->valuedouble;
+      dfile->grid.nx=cJSON_GetArrayItem(points, 0)->valueint;
+      dfile->grid.ny=cJSON_GetArrayItem(points, 1)->valueint;
+    }
   }
   cJSON_Delete(confjson);
   return UCVM_MODEL_CODE_SUCCESS;
@@ -775,6 +2327,7 @@ sfcvm_configuration_t *sfcvm_init_configuration() {
     config->model_depth = 4500;
     config->model_gabbro = 1;
     config->model_squashminelev = -4500;
+    config->model_qpqs = 2;
     config->data_cnt=0;
     return config;
 }
@@ -820,12 +2373,37 @@ int sfcvm_read_configuration(char *file, sfcvm_configuration_t *config) {
                    } else {
                      config->model_gabbro = 0;
                 }
+                config->model_params |= 1<<GABBRO;
                 set_setGabbro(config->model_gabbro);
+            } else if (strcmp(key, "fastfail") == 0) {
+                config->model_fastfail = (strcmp(value,"on") == 0);
+                config->model_params |= 1<<FAST_FAIL;
+                set_setFastFail(config->model_fastfail);
             } else if (strcmp(key, "squashminelev") == 0) {
                 config->model_squashminelev = atol(value);
+                config->model_params |= 1<<SQUASH_MIN_ELEV;
                 set_setSquashMinElev(config->model_squashminelev);
+            } else if (strcmp(key, "vsfloor") == 0) {
+                config->model_vsfloor = atof(value);
+                config->model_params |= 1<<VS_FLOOR;
+                set_setVsFloor(config->model_vsfloor);
+            } else if (strcmp(key, "qsvs") == 0) {
+                config->model_qsvs = atof(value);
+                config->model_params |= 1<<QS_VS;
+                set_setQsVs(config->model_qsvs);
+            } else if (strcmp(key, "qpqs") == 0) {
+                config->model_qpqs = atof(value);
+                config->model_params |= 1<<QP_QS;
+                set_setQpQs(config->model_qpqs);
             } else if (strcmp(key, "model_dir") == 0) {
                 sprintf(config->model_dir, "%s", value);
+            } else if (strcmp(key, "model_crs") == 0) {
+                if (strlen(value) >= sizeof(config->model_crs)) {
+                    sfcvm_print_error("model_crs in the configuration file is too long.");
+                    fclose(fp);
+                    return UCVM_MODEL_CODE_ERROR;
+                }
+                strcpy(config->model_crs, value);
             } else if (strcmp(key, "data_file") == 0) {
                 // value is in json format 
 //if(sfcvm_ucvm_debug) fprintf(stderrfp," value  is: (%s)\n", value);
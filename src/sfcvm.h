@@ -28,11 +28,27 @@
 typedef enum { SFCVM_ZMODE_ELEVATION = 0, 
                SFCVM_ZMODE_DEPTH } zmode_t;
 
-typedef enum { SQUASH_MIN_ELEV = 0 } sfcvm_model_param_t;
+typedef enum { SQUASH_MIN_ELEV = 0,
+               GABBRO = 1,
+               FAST_FAIL = 2,
+               INPUT_CRS = 3,
+               VS_FLOOR = 4,
+               QS_VS = 5,
+               QP_QS = 6 } sfcvm_model_param_t;
+
+/** Per point outcome of a query, see sfcvm_extra_t */
+typedef enum { SFCVM_STATUS_OK = 0,         /* model values returned */
+               SFCVM_STATUS_OUTSIDE,        /* outside of the model surface, vp/vs/rho are -1 */
+               SFCVM_STATUS_WATER_LIMIT,    /* water step down gave up, values of the last step */
+               SFCVM_STATUS_QUERY_ERROR,    /* geomodelgrids query failed, vp/vs/rho are -1 */
+               SFCVM_STATUS_GABBRO_APPLIED  /* model values with the gabbro correction */
+             } sfcvm_status_t;
 
 
 #define NODATA_VALUE -1.0e+20
 #define SFCVM_CONFIG_MAX 1000
+/** Max number of vertices of a data file footprint */
+#define SFCVM_FOOTPRINT_MAX 64
 
 // Structures
 /** Defines a point (latitude, longitude, and depth) in WGS84 format */
@@ -53,33 +69,158 @@ typedef struct sfcvm_properties_t {
 	double vs;
 	/** Density in g/m^3 */
 	double rho;
-        /** NOT USED from basic_property_t */
+        /** P-wave quality factor, from the QP_QS relation, left as is when it is off */
         double qp;
-        /** NOT USED from basic_property_t */
+        /** S-wave quality factor, from the QS_VS relation, left as is when it is off */
         double qs;
 } sfcvm_properties_t;
 
+/** Horizontal lattice of a data file in model_crs, see the GRID key of a data_file */
+typedef struct sfcvm_grid_t {
+	/** Easting of the origin */
+	double x0;
+	/** Northing of the origin */
+	double y0;
+	/** Azimuth of the y axis, degrees clockwise from north */
+	double azimuth;
+	/** Resolution along x, 0 if the data file has no GRID */
+	double dx;
+	/** Resolution along y */
+	double dy;
+	/** Points along x */
+	int nx;
+	/** Points along y */
+	int ny;
+} sfcvm_grid_t;
+
+/** One data_file entry of the configuration, a whole model or a tile of one. */
+typedef struct sfcvm_data_file_t {
+	/** Label of the entry */
+	char *label;
+	/** File name in the model directory */
+	char *file;
+	/** Grid height at the top of the file, in meters */
+	double gridheight;
+	/** lon/lat polygon enclosing the file, NULL if not given */
+	double *footprint;
+	/** Number of footprint vertices */
+	int footprint_cnt;
+	/** Source model, 0 = detailed, 1 = regional */
+	int model;
+	/** Lattice of the file, dx 0 if not given */
+	sfcvm_grid_t grid;
+} sfcvm_data_file_t;
+
 /** The SFCVM configuration structure. */
 typedef struct sfcvm_configuration_t {
 	/** The zone of UTM projection */
 	int utm_zone;
 	/** The model directory */
 	char model_dir[1000];
+	/** CRS of the model grids, a PROJ string, empty if not given */
+	char model_crs[1000];
 	/** The model depth */
 	int model_depth;
 	/** The model gabbro */
 	int model_gabbro;
 	/** The model squashminelev */
 	double model_squashminelev;
+	/** The model vsfloor, 0 = off */
+	double model_vsfloor;
+	/** The model qsvs, Qs per m/s of Vs, 0 = off */
+	double model_qsvs;
+	/** The model qpqs, Qp over Qs */
+	double model_qpqs;
 
-        /* raw model datafile */
-        char *data_labels[10];
-        char *data_files[10];
-        double data_gridheights[10];
+        /* raw model datafiles, in query priority order */
+        sfcvm_data_file_t *data;
         int data_cnt;
+        int data_max;
+        /* check points against the footprints before querying, 1 = on */
+        int model_fastfail;
+        /* sfcvm_model_param_t bits of the parameters the file sets */
+        int model_params;
 
 } sfcvm_configuration_t;
 
+/** Query settings scoped to a caller, all contexts share the one loaded model. */
+typedef struct sfcvm_context_t {
+	/** Minimum elevation (m) above which topography is squashed */
+	double squash_min_elev;
+	/** Apply the gabbro correction, 1 = on, 0 = off */
+	int gabbro;
+	/** Reject points outside the footprints without a model query, 1 = on */
+	int fast_fail;
+	/** CRS of the points set with INPUT_CRS, -1 to guess lon/lat or UTM per point */
+	int input_crs;
+	/** Lowest Vs (m/s) returned, slower rock is raised to it at its Vp/Vs ratio, 0 = off */
+	double vs_floor;
+	/** Qs = qs_vs*Vs, with Vs in m/s, 0 leaves qp and qs alone */
+	double qs_vs;
+	/** Qp = qp_qs*Qs */
+	double qp_qs;
+} sfcvm_context_t;
+
+/**
+ * Optional per point outputs returned next to sfcvm_properties_t, as
+ * arrays of numpts entries. Slots left NULL are not filled in.
+ */
+typedef struct sfcvm_extra_t {
+	/** zone_id of the geologic unit, -1 where there is no data */
+	int *zone_id;
+	/** Source model, 0 = detailed, 1 = regional, -1 = outside */
+	int *model_i;
+	/** How the point was resolved, a sfcvm_status_t */
+	int *status;
+	/** Shear modulus rho*vs^2 in Pa, -1 where there is no data */
+	double *mu;
+	/** Lame's first parameter rho*vp^2-2*mu in Pa, -1 where there is no data */
+	double *lambda;
+} sfcvm_extra_t;
+
+/** Columns located once for repeated queries, see sfcvm_columns_create */
+typedef struct sfcvm_columns_t sfcvm_columns_t;
+
+/** Counters of the loaded model and the time spent in each sfcvm_init stage. */
+typedef struct sfcvm_stats_t {
+	/** Points queried */
+	long query_count;
+	/** Points given a gabbro correction */
+	long gabbro_count;
+	/** Points under water */
+	long water_count;
+	/** Points that needed the water step down */
+	long water_step_count;
+	/** Points that gave up after sfcvm_water_max_step_limit steps */
+	long water_limit_count;
+	/** Step down queries answered by an earlier point of the same column */
+	long water_step_shared;
+	/** Most steps one point needed */
+	int water_max_step;
+	/** Points outside every footprint, answered without a query, see FAST_FAIL */
+	long fastfail_count;
+	/** Geographic (or model_crs) and UTM query objects opened so far, out of objects_total */
+	int objects_opened;
+	/** Two query objects, geographic and UTM, per data file, INPUT_CRS objects are not counted */
+	int objects_total;
+	/** 1 when init was restored from the snapshot in $SFCVM_INIT_SNAPSHOT */
+	int init_from_snapshot;
+	/** Seconds reading the configuration */
+	double init_config_s;
+	/** Seconds locating the data files */
+	double init_files_s;
+	/** Seconds building the data file index */
+	double init_index_s;
+	/** Seconds opening the primary data file */
+	double init_open_s;
+	/** Seconds loading or writing the snapshot */
+	double init_snapshot_s;
+	/** Seconds in sfcvm_init */
+	double init_total_s;
+	/** Seconds opening data files on first use after init */
+	double lazy_open_s;
+} sfcvm_stats_t;
+
 /** The model structure which points to available portions of the model. */
 typedef struct sfcvm_model_t {
 	/** A pointer to the Vp data either in memory or disk. Null if does not exist. */
@@ -141,8 +282,38 @@ int sfcvm_finalize();
 int sfcvm_version(char *ver, int len);
 /** Queries the model */
 int sfcvm_query(sfcvm_point_t *points, sfcvm_properties_t *data, int numpts);
+/** Opens every data file now instead of on first use */
+int sfcvm_preload();
 /** Setparam*/
 int sfcvm_setparam(int, int, ...);
+/** Returns the counters and init timings */
+int sfcvm_get_stats(sfcvm_stats_t *stats);
+
+/** Creates a query context from the current model parameters */
+sfcvm_context_t *sfcvm_context_create();
+/** Frees a query context */
+void sfcvm_context_destroy(sfcvm_context_t *ctx);
+/** Sets a sfcvm_model_param_t parameter on a query context */
+int sfcvm_context_setparam(sfcvm_context_t *ctx, int param, ...);
+/** Queries the model with the settings of a context */
+int sfcvm_context_query(sfcvm_context_t *ctx, sfcvm_point_t *points, sfcvm_properties_t *data, int numpts);
+/** Queries the model and fills the requested extra outputs */
+int sfcvm_query_extra(sfcvm_point_t *points, sfcvm_properties_t *data, sfcvm_extra_t *extra, int numpts);
+/** Queries the model with a context and fills the requested extra outputs */
+int sfcvm_context_query_extra(sfcvm_context_t *ctx, sfcvm_point_t *points, sfcvm_properties_t *data,
+                              sfcvm_extra_t *extra, int numpts);
+
+/** Projects, routes and looks up the surface of columns once */
+sfcvm_columns_t *sfcvm_columns_create(sfcvm_context_t *ctx, const double *lon, const double *lat, int ncols);
+/** Frees columns */
+void sfcvm_columns_destroy(sfcvm_columns_t *cols);
+/** Surface of a column, 1 if it is outside of the model */
+int sfcvm_columns_surface(sfcvm_columns_t *cols, int c, double *surface, double *top);
+/** Grid height at the top of the data file of a column, 0 if it is outside */
+double sfcvm_columns_gridheight(sfcvm_columns_t *cols, int c);
+/** Queries points on located columns */
+int sfcvm_columns_query(sfcvm_columns_t *cols, const int *col, const double *depth, sfcvm_properties_t *data,
+                        sfcvm_extra_t *extra, int numpoints);
 
 // Non-UCVM Helper Functions
 /** Reads the configuration file. */
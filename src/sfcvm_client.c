@@ -0,0 +1,283 @@
+/**
+ * @file sfcvm_client.c
+ * @brief Thin client of the sfcvmd query daemon.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Provides sfcvm_init, sfcvm_query, sfcvm_query_extra, sfcvm_setparam,
+ * sfcvm_getsurface and sfcvm_finalize with the same signatures as libsfcvm, so a tool switches
+ * to a running sfcvmd by linking libsfcvm_client.a instead of libsfcvm.a.
+ * The daemon socket is taken from $SFCVMD_SOCKET, or SFCVMD_DEFAULT_SOCKET.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ucvm_model_dtypes.h"
+#include "sfcvm.h"
+#include "sfcvmd.h"
+#include "cJSON.h"
+
+int sfcvm_is_initialized = 0;
+
+int sfcvm_client_fd=-1;
+int sfcvm_client_debug=0;
+
+/* Sends one request header */
+int _client_request(int op, int count, int param, double value) {
+    sfcvmd_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic=SFCVMD_MAGIC;
+    hdr.op=op;
+    hdr.count=count;
+    hdr.param=param;
+    hdr.value=value;
+    return sfcvmd_writen(sfcvm_client_fd, &hdr, sizeof(hdr));
+}
+
+/* Reads a reply header, returns the daemon's return code */
+int _client_reply(int op, int count) {
+    sfcvmd_header_t hdr;
+    if(sfcvmd_readn(sfcvm_client_fd, &hdr, sizeof(hdr))) return UCVM_MODEL_CODE_ERROR;
+    if(hdr.magic != SFCVMD_MAGIC || hdr.op != op || hdr.count != count) return UCVM_MODEL_CODE_ERROR;
+    return hdr.param;
+}
+
+/**
+ * Connects to the sfcvmd daemon, which has already loaded the model.
+ *
+ * @param dir Unused, kept for the libsfcvm signature.
+ * @param label Unused, kept for the libsfcvm signature.
+ * @return Success or failure, if the daemon could be reached.
+ */
+int sfcvm_init(const char *dir, const char *label) {
+    struct sockaddr_un addr;
+    char *sockpath=getenv("SFCVMD_SOCKET");
+    if(sockpath == NULL) sockpath=SFCVMD_DEFAULT_SOCKET;
+
+    if(strlen(sockpath) >= sizeof(addr.sun_path)) {
+      sfcvm_print_error("sfcvmd socket path is too long.");
+      return UCVM_MODEL_CODE_ERROR;
+    }
+
+    sfcvm_client_fd=socket(AF_UNIX, SOCK_STREAM, 0);
+    if(sfcvm_client_fd < 0) return UCVM_MODEL_CODE_ERROR;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family=AF_UNIX;
+    strcpy(addr.sun_path, sockpath);
+    if(connect(sfcvm_client_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      close(sfcvm_client_fd);
+      sfcvm_client_fd=-1;
+      sfcvm_print_error("Unable to connect to sfcvmd, is the daemon running?");
+      return UCVM_MODEL_CODE_ERROR;
+    }
+
+    sfcvm_is_initialized = 1;
+    return UCVM_MODEL_CODE_SUCCESS;
+}
+
+/**
+ * Queries the daemon at the given points, large batches are split into
+ * SFCVMD_MAX_BATCH sized requests.
+ *
+ * @param points The points at which the queries will be made.
+ * @param data The data that will be returned (Vp, Vs, density).
+ * @param numpoints The total number of points to query.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_query(sfcvm_point_t *points, sfcvm_properties_t *data, int numpoints) {
+    if(sfcvm_client_fd < 0) return UCVM_MODEL_CODE_ERROR;
+
+    for(int start=0; start<numpoints; start+=SFCVMD_MAX_BATCH) {
+      int cnt=numpoints-start;
+      if(cnt > SFCVMD_MAX_BATCH) cnt=SFCVMD_MAX_BATCH;
+
+      if(_client_request(SFCVMD_OP_QUERY, cnt, 0, 0) ||
+            sfcvmd_writen(sfcvm_client_fd, &points[start], cnt*sizeof(sfcvm_point_t))) {
+        return UCVM_MODEL_CODE_ERROR;
+      }
+      int rc=_client_reply(SFCVMD_OP_QUERY, cnt);
+      if(sfcvmd_readn(sfcvm_client_fd, &data[start], cnt*sizeof(sfcvm_properties_t))) {
+        return UCVM_MODEL_CODE_ERROR;
+      }
+      if(rc != UCVM_MODEL_CODE_SUCCESS) return rc;
+    }
+    return UCVM_MODEL_CODE_SUCCESS;
+}
+
+/**
+ * Queries the daemon at the given points and fills the requested extra
+ * outputs, large batches are split into SFCVMD_MAX_BATCH sized requests.
+ *
+ * @param points The points at which the queries will be made.
+ * @param data The data that will be returned (Vp, Vs, density).
+ * @param extra The extra outputs to fill in, or NULL.
+ * @param numpoints The total number of points to query.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_query_extra(sfcvm_point_t *points, sfcvm_properties_t *data, sfcvm_extra_t *extra, int numpoints) {
+    if(extra == NULL) return sfcvm_query(points, data, numpoints);
+    if(sfcvm_client_fd < 0) return UCVM_MODEL_CODE_ERROR;
+
+    sfcvmd_extra_t *recs=(sfcvmd_extra_t *)malloc(
+              (numpoints < SFCVMD_MAX_BATCH ? numpoints : SFCVMD_MAX_BATCH)*sizeof(sfcvmd_extra_t)+1);
+    if(recs == NULL) return UCVM_MODEL_CODE_ERROR;
+
+    int rc=UCVM_MODEL_CODE_SUCCESS;
+    for(int start=0; start<numpoints && rc == UCVM_MODEL_CODE_SUCCESS; start+=SFCVMD_MAX_BATCH) {
+      int cnt=numpoints-start;
+      if(cnt > SFCVMD_MAX_BATCH) cnt=SFCVMD_MAX_BATCH;
+
+      if(_client_request(SFCVMD_OP_QUERY_EXTRA, cnt, 0, 0) ||
+            sfcvmd_writen(sfcvm_client_fd, &points[start], cnt*sizeof(sfcvm_point_t))) {
+        rc=UCVM_MODEL_CODE_ERROR;
+        break;
+      }
+      rc=_client_reply(SFCVMD_OP_QUERY_EXTRA, cnt);
+      if(sfcvmd_readn(sfcvm_client_fd, &data[start], cnt*sizeof(sfcvm_properties_t)) ||
+            sfcvmd_readn(sfcvm_client_fd, recs, cnt*sizeof(sfcvmd_extra_t))) {
+        rc=UCVM_MODEL_CODE_ERROR;
+        break;
+      }
+      for(int i=0; i<cnt; i++) {
+        if(extra->zone_id) extra->zone_id[start+i]=recs[i].zone_id;
+        if(extra->model_i) extra->model_i[start+i]=recs[i].model_i;
+        if(extra->status) extra->status[start+i]=recs[i].status;
+        // the moduli come from the values as the daemon returned them, -1 where there is no data
+        sfcvm_properties_t *d=&data[start+i];
+        int nodata=(d->vp < 0 || d->vs < 0 || d->rho < 0);
+        if(extra->mu) extra->mu[start+i]=nodata ? -1 : d->rho*d->vs*d->vs;
+        if(extra->lambda) extra->lambda[start+i]=nodata ? -1 : d->rho*(d->vp*d->vp-2*d->vs*d->vs);
+      }
+    }
+    free(recs);
+    return rc;
+}
+
+/**
+ * Queries the daemon for the surface
+ **/
+int sfcvm_getsurface(double entry_longitude, double entry_latitude,
+                               double *surface, double *top) {
+    sfcvm_point_t pt;
+    sfcvmd_surface_t surf;
+
+    if(sfcvm_client_fd < 0) return 1;
+    pt.longitude=entry_longitude;
+    pt.latitude=entry_latitude;
+    pt.depth=0;
+    if(_client_request(SFCVMD_OP_GETSURFACE, 1, 0, 0) ||
+          sfcvmd_writen(sfcvm_client_fd, &pt, sizeof(pt)) ||
+          _client_reply(SFCVMD_OP_GETSURFACE, 1) != UCVM_MODEL_CODE_SUCCESS ||
+          sfcvmd_readn(sfcvm_client_fd, &surf, sizeof(surf))) {
+      return 1;
+    }
+    *surface=surf.surface;
+    *top=surf.top;
+    return surf.rc;
+}
+
+/* Forwards a model parameter to this connection's context on the daemon */
+int _client_setparam(int param, double value) {
+    if(sfcvm_client_fd < 0) return UCVM_MODEL_CODE_ERROR;
+    if(_client_request(SFCVMD_OP_SETPARAM, 0, param, value)) return UCVM_MODEL_CODE_ERROR;
+    return _client_reply(SFCVMD_OP_SETPARAM, 0);
+}
+
+/*
+ * Setparam, forwarded to this connection's state on the daemon. As in
+ * libsfcvm the query mode and force depth are kept but queries take
+ * depth, callers turn elevations into depths with sfcvm_getsurface.
+ */
+int sfcvm_setparam(int id, int param, ...)
+{
+  va_list ap;
+  char *pstr;
+  double pval;
+  int rc=UCVM_MODEL_CODE_SUCCESS;
+
+  va_start(ap, param);
+  switch (param) {
+    case UCVM_MODEL_PARAM_MODEL_CONF:
+      pstr = va_arg(ap, char *);
+      pval = va_arg(ap, double);
+      if (strcmp(pstr, "SquashMinElev") == 0) {
+        rc=_client_setparam(SQUASH_MIN_ELEV, pval);
+      }
+      break;
+    case UCVM_MODEL_PARAM_CONF_BLOB: {
+      // libsfcvm takes a blob without SQUASH_MIN_ELEV and leaves the squashing alone
+      cJSON *confjson = cJSON_Parse(va_arg(ap, char *));
+      cJSON *squash_min_elev = cJSON_GetObjectItemCaseSensitive(confjson, "SQUASH_MIN_ELEV");
+      if(cJSON_IsNumber(squash_min_elev)) {
+        rc=_client_setparam(SQUASH_MIN_ELEV, squash_min_elev->valuedouble);
+      }
+      cJSON_Delete(confjson);
+      break;
+      }
+    case UCVM_MODEL_PARAM_FORCE_DEPTH_ABOVE_SURF:
+      rc=_client_setparam(SFCVMD_PARAM_FORCE_DEPTH, va_arg(ap, int));
+      break;
+    case UCVM_MODEL_PARAM_PLUGIN_MODE:
+      rc=_client_setparam(SFCVMD_PARAM_PLUGIN_MODE, 1);
+      break;
+    case UCVM_MODEL_PARAM_QUERY_MODE:
+      rc=_client_setparam(SFCVMD_PARAM_QUERY_MODE, va_arg(ap, int));
+      break;
+    default:
+      break;
+  }
+  va_end(ap);
+  return rc;
+}
+
+/**
+ * Closes the connection, the daemon keeps the model loaded.
+ *
+ * @return UCVM_MODEL_CODE_SUCCESS
+ */
+int sfcvm_finalize() {
+    if(sfcvm_client_fd >= 0) {
+      _client_request(SFCVMD_OP_CLOSE, 0, 0, 0);
+      close(sfcvm_client_fd);
+      sfcvm_client_fd=-1;
+    }
+    sfcvm_is_initialized = 0;
+    return UCVM_MODEL_CODE_SUCCESS;
+}
+
+/* The daemon loaded every data file before serving */
+int sfcvm_preload() {
+    return (sfcvm_client_fd < 0) ? UCVM_MODEL_CODE_ERROR : UCVM_MODEL_CODE_SUCCESS;
+}
+
+/* Counters live in the daemon, none are kept here */
+int sfcvm_get_stats(sfcvm_stats_t *stats) {
+    if(stats != NULL) memset(stats, 0, sizeof(sfcvm_stats_t));
+    return UCVM_MODEL_CODE_ERROR;
+}
+
+int sfcvm_version(char *ver, int len)
+{
+  return UCVM_MODEL_CODE_SUCCESS;
+}
+
+void sfcvm_setdebug() {
+   sfcvm_client_debug=1;
+}
+
+/*
+ * @param err The error string to print out to stderr.
+ */
+void sfcvm_print_error(char *err) {
+    fprintf(stderr, "An error has occurred while executing SFCVM. The error was:\n\n");
+    fprintf(stderr, "%s", err);
+    fprintf(stderr, "\n\nPlease contact software@scec.org and describe both the error and a bit\n");
+    fprintf(stderr, "about the computer you are running SFCVM on (Linux, Mac, etc.).\n");
+}
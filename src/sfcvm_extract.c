@@ -0,0 +1,2040 @@
+/**
+ * @file sfcvm_extract.c
+ * @brief Extraction of regular products from an initialized SFCVM.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Products are cut into tiles of whole columns, rows of a slice for
+ * example, and the tiles go to forked workers through sfcvm_parallel_run,
+ * costliest first as sfcvm_tile_costs estimates them.
+ * Each tile locates its columns once and queries them in batches.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "ucvm_model_dtypes.h"
+#include "sfcvm.h"
+#include "sfcvm_parallel.h"
+#include "sfcvm_extract.h"
+
+/* Stations of a section per tile of work */
+#define SFCVM_SECTION_TILE 16
+/* Mean Earth radius, meters, for distances along a trace */
+#define SFCVM_EARTH_RADIUS 6371008.8
+
+/* Coarse levels a site scan queries per column per batch */
+#define SFCVM_SITE_SCAN_LEVELS 8
+
+/* Tiles a volume reduction is cut into, fixed so sums do not depend on the workers */
+#define SFCVM_REDUCE_TILES 64
+/* Most points a reduction queries in one batch */
+#define SFCVM_REDUCE_BATCH 65536
+
+/* Most octree cells queried in one batch */
+#define SFCVM_OCTREE_BATCH 4096
+/* Bytes copied at a time when the octree parts are joined */
+#define SFCVM_OCTREE_COPY (1<<20)
+
+/* Elements per tile of a cell average */
+#define SFCVM_CELL_TILE 32
+/* Paths per tile of work */
+#define SFCVM_PATH_TILE 16
+/* Sampling step of a model whose data files give no grid height */
+#define SFCVM_PATH_STEP 25.0
+
+static const char* const sfcvm_field_names[] = { "vp", "vs", "rho", "zone_id", "vs30", "z1.0", "z2.5" };
+static const int sfcvm_field_names_cnt = sizeof(sfcvm_field_names)/sizeof(sfcvm_field_names[0]);
+
+int sfcvm_field_count(int fields) {
+    int cnt=0;
+    for(int f=0; f<sfcvm_field_names_cnt; f++) {
+      if(fields & (1<<f)) cnt++;
+    }
+    return cnt;
+}
+
+int sfcvm_field_parse(const char *str) {
+    char buf[256];
+    int fields=0;
+
+    if(strlen(str) >= sizeof(buf)) return 0;
+    strcpy(buf, str);
+    for(char *tok=strtok(buf, ","); tok != NULL; tok=strtok(NULL, ",")) {
+      int f;
+      for(f=0; f<sfcvm_field_names_cnt; f++) {
+        if(strcmp(tok, sfcvm_field_names[f]) == 0) break;
+      }
+      if(f == sfcvm_field_names_cnt) return 0;
+      fields |= (1<<f);
+    }
+    return fields;
+}
+
+/* Current model parameters when no context is given */
+static void _extract_context(sfcvm_context_t *ctx, sfcvm_context_t *out) {
+    if(ctx != NULL) {
+      *out=*ctx;
+      return;
+    }
+    sfcvm_context_t *def=sfcvm_context_create();
+    if(def != NULL) {
+      *out=*def;
+      sfcvm_context_destroy(def);
+    }
+}
+
+/* Bands stored as float32 when no encoding is given */
+static const sfcvm_encoding_t sfcvm_encoding_float32 = { SFCVM_ENCODING_FLOAT32, 1.0, 0.0 };
+
+int sfcvm_encoding_parse(const char *str, sfcvm_encoding_t *enc) {
+    char name[16];
+    double scale=1.0, offset=0.0;
+
+    int n=sscanf(str, "%15[^,],%lf,%lf", name, &scale, &offset);
+    if(n < 1) return UCVM_MODEL_CODE_ERROR;
+    if(strcmp(name, "float32") == 0 && n == 1) {
+      *enc=sfcvm_encoding_float32;
+      return UCVM_MODEL_CODE_SUCCESS;
+    }
+    if(strcmp(name, "uint16") != 0 || !(scale > 0)) return UCVM_MODEL_CODE_ERROR;
+    enc->kind=SFCVM_ENCODING_UINT16;
+    enc->scale=scale;
+    enc->offset=offset;
+    return UCVM_MODEL_CODE_SUCCESS;
+}
+
+/* Bytes of one value of field bit f */
+static size_t _value_size(const sfcvm_encoding_t *enc, int f) {
+    if(enc == NULL || enc->kind == SFCVM_ENCODING_FLOAT32) return sizeof(float);
+    return (f == SFCVM_FIELD_ZONE_ID) ? sizeof(uint8_t) : sizeof(uint16_t);
+}
+
+size_t sfcvm_encoded_size(int fields, const sfcvm_encoding_t *enc) {
+    size_t size=0;
+    for(int f=0; f<sfcvm_field_names_cnt; f++) {
+      if(fields & (1<<f)) size+=_value_size(enc, 1<<f);
+    }
+    return size;
+}
+
+/* An encoding is valid when it is one of sfcvm_encoding_kind_t with a positive uint16 scale */
+static int _encoding_valid(const sfcvm_encoding_t *enc) {
+    if(enc == NULL || enc->kind == SFCVM_ENCODING_FLOAT32) return 1;
+    return enc->kind == SFCVM_ENCODING_UINT16 && enc->scale > 0;
+}
+
+static uint16_t _encode_uint16(const sfcvm_encoding_t *enc, double v) {
+    if(v < 0) return SFCVM_UINT16_NODATA;
+    double q=floor((v-enc->offset)/enc->scale+0.5);
+    if(q < 0) q=0;
+    if(q > SFCVM_UINT16_NODATA-1) q=SFCVM_UINT16_NODATA-1;
+    return (uint16_t)q;
+}
+
+/* Value of field bit f of a result */
+static double _field_value(const sfcvm_properties_t *data, const int *zone_id, int i, int f) {
+    switch(f) {
+      case SFCVM_FIELD_VP: return data[i].vp;
+      case SFCVM_FIELD_VS: return data[i].vs;
+      case SFCVM_FIELD_RHO: return data[i].rho;
+      default: return zone_id[i];
+    }
+}
+
+/**
+ * Stores the selected fields of n results in an encoding. Band b holds
+ * stride values, point i goes to value first+i*step of it. Bands follow
+ * each other, so with integer bands of different sizes a band starts
+ * stride times the bytes of the bands before it into out.
+ */
+static void _store_fields(int fields, const sfcvm_encoding_t *enc, const sfcvm_properties_t *data,
+                          const int *zone_id, int n, void *out, size_t stride, size_t first, size_t step) {
+    char *band=(char *)out;
+
+    for(int f=SFCVM_FIELD_VP; f<=SFCVM_FIELD_ZONE_ID; f<<=1) {
+      if(!(fields & f)) continue;
+      size_t vsize=_value_size(enc, f);
+      if(vsize == sizeof(float)) {
+        float *o=(float *)band+first;
+        for(int i=0; i<n; i++) o[i*step]=(float)_field_value(data, zone_id, i, f);
+      } else if(f == SFCVM_FIELD_ZONE_ID) {
+        uint8_t *o=(uint8_t *)band+first;
+        for(int i=0; i<n; i++) {
+          o[i*step]=(zone_id[i] >= 0 && zone_id[i] < SFCVM_UINT8_NODATA) ? (uint8_t)zone_id[i] : SFCVM_UINT8_NODATA;
+        }
+      } else {
+        uint16_t *o=(uint16_t *)band+first;
+        for(int i=0; i<n; i++) o[i*step]=_encode_uint16(enc, _field_value(data, zone_id, i, f));
+      }
+      band+=stride*vsize;
+    }
+}
+
+/**
+ * Queries ncols columns at nz regular levels each, point c*nz+k is level
+ * k of column c. The columns are located once, elevations are turned into
+ * depths on the surface found then, and the levels of a column go down
+ * in one batch so water points share their step down levels.
+ *
+ * @param ctx Query context.
+ * @param lon Longitudes of the columns.
+ * @param lat Latitudes of the columns.
+ * @param ncols Number of columns.
+ * @param z0 First depth, or elevation.
+ * @param dz Level spacing.
+ * @param nz Number of levels.
+ * @param zmode SFCVM_ZMODE_DEPTH or SFCVM_ZMODE_ELEVATION.
+ * @param data Returns ncols*nz results.
+ * @param zone_id Returns ncols*nz zone_ids.
+ * @param status Returns ncols*nz sfcvm_status_t, NULL if not needed.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+static int _query_column_levels(sfcvm_context_t *ctx, const double *lon, const double *lat, int ncols,
+                                double z0, double dz, int nz, int zmode,
+                                sfcvm_properties_t *data, int *zone_id, int *status) {
+    int n=ncols*nz;
+    int rc=UCVM_MODEL_CODE_ERROR;
+    double *depth=(double *)malloc(n*sizeof(double));
+    int *col=(int *)malloc(n*sizeof(int));
+    sfcvm_columns_t *cols=NULL;
+
+    if(depth != NULL && col != NULL) cols=sfcvm_columns_create(ctx, lon, lat, ncols);
+    if(cols != NULL) {
+      for(int c=0; c<ncols; c++) {
+        double surface=0, top;
+        // elevation to depth on the surface the column already has
+        int elev=(zmode == SFCVM_ZMODE_ELEVATION && sfcvm_columns_surface(cols, c, &surface, &top) == 0);
+        for(int k=0; k<nz; k++) {
+          col[c*nz+k]=c;
+          depth[c*nz+k]=elev ? surface-(z0+k*dz) : z0+k*dz;
+        }
+      }
+
+      sfcvm_extra_t extra;
+      memset(&extra, 0, sizeof(extra));
+      extra.zone_id=zone_id;
+      extra.status=status;
+      rc=sfcvm_columns_query(cols, col, depth, data, &extra, n);
+    }
+
+    sfcvm_columns_destroy(cols);
+    free(depth);
+    free(col);
+    return rc;
+}
+
+typedef struct sfcvm_slice_job_t {
+    sfcvm_context_t ctx;
+    const sfcvm_slice_t *slice;
+    int fields;
+    sfcvm_encoding_t enc;
+    void *out;
+} sfcvm_slice_job_t;
+
+/* One row of a slice, its columns are located and queried as one batch */
+static int _slice_row(long row, void *arg) {
+    sfcvm_slice_job_t *job=(sfcvm_slice_job_t *)arg;
+    const sfcvm_slice_t *s=job->slice;
+    int nx=s->nx;
+    int rc=UCVM_MODEL_CODE_ERROR;
+
+    double *lon=(double *)malloc(nx*sizeof(double));
+    double *lat=(double *)malloc(nx*sizeof(double));
+    int *zone_id=(int *)malloc(nx*sizeof(int));
+    sfcvm_properties_t *data=(sfcvm_properties_t *)malloc(nx*sizeof(sfcvm_properties_t));
+
+    if(lon != NULL && lat != NULL && zone_id != NULL && data != NULL) {
+      for(int i=0; i<nx; i++) {
+        lon[i]=s->lon0+i*s->dlon;
+        lat[i]=s->lat0+row*s->dlat;
+      }
+      rc=_query_column_levels(&job->ctx, lon, lat, nx, s->z, 0, 1, s->zmode, data, zone_id, NULL);
+    }
+    if(rc == UCVM_MODEL_CODE_SUCCESS) {
+      _store_fields(job->fields, &job->enc, data, zone_id, nx, job->out, (size_t)nx*s->ny, (size_t)row*nx, 1);
+    }
+
+    free(lon);
+    free(lat);
+    free(zone_id);
+    free(data);
+    return (rc == UCVM_MODEL_CODE_SUCCESS) ? 0 : 1;
+}
+
+/* Cost sample of a slice row */
+static void _slice_point(long row, double f, void *arg, double *x, double *y) {
+    const sfcvm_slice_t *s=((sfcvm_slice_job_t *)arg)->slice;
+    *x=s->lon0+(int)(f*(s->nx-1)+0.5)*s->dlon;
+    *y=s->lat0+row*s->dlat;
+}
+
+/**
+ * Extracts a horizontal slice. Rows are handed to the workers, every row
+ * is located and queried as one batch. In elevation mode the depth of a
+ * point comes from the surface found when its column was located, no
+ * second surface lookup is made. Each row is encoded into out as soon as
+ * it is queried.
+ *
+ * @param ctx Query context, NULL for the current model parameters.
+ * @param slice The lattice.
+ * @param fields sfcvm_field_t bits, 0 for SFCVM_FIELDS_DEFAULT.
+ * @param enc Encoding of the bands, NULL for float32.
+ * @param out Returns one band of ny*nx values per field, rows of nx.
+ * @param nworkers Number of worker processes, 1 runs in the caller.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_extract_slice_encoded(sfcvm_context_t *ctx, const sfcvm_slice_t *slice, int fields,
+                                const sfcvm_encoding_t *enc, void *out, int nworkers) {
+    sfcvm_slice_job_t job;
+
+    if(slice->nx <= 0 || slice->ny <= 0 || !_encoding_valid(enc)) return UCVM_MODEL_CODE_ERROR;
+    if(fields == 0) fields=SFCVM_FIELDS_DEFAULT;
+    if(fields & ~SFCVM_FIELDS_ALL) return UCVM_MODEL_CODE_ERROR;
+
+    _extract_context(ctx, &job.ctx);
+    job.slice=slice;
+    job.fields=fields;
+    job.enc=(enc != NULL) ? *enc : sfcvm_encoding_float32;
+    job.out=out;
+
+    size_t size=sfcvm_encoded_size(fields, enc)*slice->nx*slice->ny;
+    if(nworkers > 1 && slice->ny > 1) {
+      job.out=sfcvm_parallel_alloc(size);
+      if(job.out == NULL) return UCVM_MODEL_CODE_ERROR;
+    }
+
+    double *cost=sfcvm_tile_costs(&job.ctx, slice->ny, nworkers, _slice_point, &job);
+    int rc=sfcvm_parallel_run(slice->ny, cost, nworkers, _slice_row, &job);
+    free(cost);
+    if(job.out != out) {
+      if(rc == UCVM_MODEL_CODE_SUCCESS) memcpy(out, job.out, size);
+      sfcvm_parallel_free(job.out);
+    }
+    return rc;
+}
+
+int sfcvm_extract_slice(sfcvm_context_t *ctx, const sfcvm_slice_t *slice, int fields, float *out, int nworkers) {
+    return sfcvm_extract_slice_encoded(ctx, slice, fields, NULL, out, nworkers);
+}
+
+void sfcvm_slice_header(const sfcvm_slice_t *slice, int fields, sfcvm_raster_header_t *hdr) {
+    memset(hdr, 0, sizeof(sfcvm_raster_header_t));
+    memcpy(hdr->magic, SFCVM_RASTER_MAGIC, sizeof(hdr->magic));
+    hdr->version=SFCVM_RASTER_VERSION;
+    hdr->kind=SFCVM_RASTER_SLICE;
+    hdr->nx=slice->nx;
+    hdr->ny=slice->ny;
+    hdr->fields=(fields == 0) ? SFCVM_FIELDS_DEFAULT : fields;
+    hdr->zmode=slice->zmode;
+    hdr->x0=slice->lon0;
+    hdr->dx=slice->dlon;
+    hdr->y0=slice->lat0;
+    hdr->dy=slice->dlat;
+    hdr->z=slice->z;
+    hdr->nodata=-1.0;
+    sfcvm_raster_encoding(hdr, NULL);
+}
+
+void sfcvm_raster_encoding(sfcvm_raster_header_t *hdr, const sfcvm_encoding_t *enc) {
+    if(enc == NULL) enc=&sfcvm_encoding_float32;
+    hdr->encoding=enc->kind;
+    hdr->scale=enc->scale;
+    hdr->offset=enc->offset;
+}
+
+/* Great circle distance in meters, on the mean Earth radius */
+static double _distance(double lon1, double lat1, double lon2, double lat2) {
+    double p1=lat1*M_PI/180, p2=lat2*M_PI/180;
+    double dp=p2-p1, dl=(lon2-lon1)*M_PI/180;
+    double h=sin(dp/2)*sin(dp/2)+cos(p1)*cos(p2)*sin(dl/2)*sin(dl/2);
+    return 2*SFCVM_EARTH_RADIUS*asin(sqrt(h));
+}
+
+/**
+ * Resamples a section's polyline into stations every spacing meters,
+ * from the first vertex on. Distances are great circle, a station is
+ * placed by linear interpolation of lon/lat within its segment.
+ *
+ * @param section The section.
+ * @param lon Returns the longitudes, NULL to only count the stations.
+ * @param lat Returns the latitudes.
+ * @return The number of stations, 0 if the section is not valid.
+ */
+int sfcvm_section_stations(const sfcvm_section_t *section, double *lon, double *lat) {
+    if(section->nvert < 1 || section->spacing <= 0) return 0;
+
+    if(section->nvert == 1) {
+      if(lon != NULL) {
+        lon[0]=section->lon[0];
+        lat[0]=section->lat[0];
+      }
+      return 1;
+    }
+
+    int n=0;
+    double start=0;  // trace distance at the start of the segment
+    double next=0;   // trace distance of the next station
+    for(int v=0; v+1<section->nvert; v++) {
+      double len=_distance(section->lon[v], section->lat[v], section->lon[v+1], section->lat[v+1]);
+      // a station a rounding error past the end of the segment stays on it
+      while(next <= start+len+1.0e-6*section->spacing) {
+        if(lon != NULL) {
+          double f=(len > 0) ? (next-start)/len : 0;
+          if(f > 1) f=1;
+          lon[n]=section->lon[v]+f*(section->lon[v+1]-section->lon[v]);
+          lat[n]=section->lat[v]+f*(section->lat[v+1]-section->lat[v]);
+        }
+        n++;
+        next=n*section->spacing;
+      }
+      start+=len;
+    }
+    return n;
+}
+
+typedef struct sfcvm_section_job_t {
+    sfcvm_context_t ctx;
+    const sfcvm_section_t *section;
+    const double *lon;
+    const double *lat;
+    int nstations;
+    int fields;
+    sfcvm_encoding_t enc;
+    void *out;
+} sfcvm_section_job_t;
+
+/* SFCVM_SECTION_TILE stations of a section, every depth of each */
+static int _section_tile(long tile, void *arg) {
+    sfcvm_section_job_t *job=(sfcvm_section_job_t *)arg;
+    const sfcvm_section_t *sec=job->section;
+    int first=(int)tile*SFCVM_SECTION_TILE;
+    int cnt=job->nstations-first;
+    if(cnt > SFCVM_SECTION_TILE) cnt=SFCVM_SECTION_TILE;
+
+    int n=cnt*sec->nz;
+    int rc=UCVM_MODEL_CODE_ERROR;
+    int *zone_id=(int *)malloc(n*sizeof(int));
+    sfcvm_properties_t *data=(sfcvm_properties_t *)malloc(n*sizeof(sfcvm_properties_t));
+
+    if(zone_id != NULL && data != NULL) {
+      rc=_query_column_levels(&job->ctx, &job->lon[first], &job->lat[first], cnt,
+                              sec->z0, sec->dz, sec->nz, sec->zmode, data, zone_id, NULL);
+    }
+    if(rc == UCVM_MODEL_CODE_SUCCESS) {
+      // column c of the tile is column first+c of every row
+      size_t stride=(size_t)job->nstations*sec->nz;
+      for(int c=0; c<cnt; c++) {
+        _store_fields(job->fields, &job->enc, &data[c*sec->nz], &zone_id[c*sec->nz], sec->nz,
+                      job->out, stride, first+c, job->nstations);
+      }
+    }
+
+    free(zone_id);
+    free(data);
+    return (rc == UCVM_MODEL_CODE_SUCCESS) ? 0 : 1;
+}
+
+/* Cost sample of a tile of stations */
+static void _section_point(long tile, double f, void *arg, double *x, double *y) {
+    sfcvm_section_job_t *job=(sfcvm_section_job_t *)arg;
+    int first=(int)tile*SFCVM_SECTION_TILE;
+    int cnt=job->nstations-first;
+    if(cnt > SFCVM_SECTION_TILE) cnt=SFCVM_SECTION_TILE;
+    int i=first+(int)(f*(cnt-1)+0.5);
+    *x=job->lon[i];
+    *y=job->lat[i];
+}
+
+/**
+ * Extracts a vertical section. The polyline is resampled into stations,
+ * see sfcvm_section_stations, and every station is a column: one
+ * surface lookup serves all of its depths, and the step down levels of
+ * water points are shared down the column. Groups of stations are handed
+ * to the workers.
+ *
+ * @param ctx Query context, NULL for the current model parameters.
+ * @param section The section.
+ * @param fields sfcvm_field_t bits, 0 for SFCVM_FIELDS_DEFAULT.
+ * @param enc Encoding of the bands, NULL for float32.
+ * @param out Returns one band of nz*nstations values per field, a row per depth.
+ * @param nworkers Number of worker processes, 1 runs in the caller.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_extract_section_encoded(sfcvm_context_t *ctx, const sfcvm_section_t *section, int fields,
+                                  const sfcvm_encoding_t *enc, void *out, int nworkers) {
+    sfcvm_section_job_t job;
+
+    int ns=sfcvm_section_stations(section, NULL, NULL);
+    if(ns <= 0 || section->nz <= 0 || !_encoding_valid(enc)) return UCVM_MODEL_CODE_ERROR;
+    if(fields == 0) fields=SFCVM_FIELDS_DEFAULT;
+    if(fields & ~SFCVM_FIELDS_ALL) return UCVM_MODEL_CODE_ERROR;
+
+    double *lon=(double *)malloc(ns*sizeof(double));
+    double *lat=(double *)malloc(ns*sizeof(double));
+    if(lon == NULL || lat == NULL) {
+      free(lon);
+      free(lat);
+      return UCVM_MODEL_CODE_ERROR;
+    }
+    sfcvm_section_stations(section, lon, lat);
+
+    _extract_context(ctx, &job.ctx);
+    job.section=section;
+    job.lon=lon;
+    job.lat=lat;
+    job.nstations=ns;
+    job.fields=fields;
+    job.enc=(enc != NULL) ? *enc : sfcvm_encoding_float32;
+    job.out=out;
+
+    long ntiles=(ns+SFCVM_SECTION_TILE-1)/SFCVM_SECTION_TILE;
+    size_t size=sfcvm_encoded_size(fields, enc)*ns*section->nz;
+    int rc=UCVM_MODEL_CODE_SUCCESS;
+    if(nworkers > 1 && ntiles > 1) {
+      job.out=sfcvm_parallel_alloc(size);
+      if(job.out == NULL) rc=UCVM_MODEL_CODE_ERROR;
+    }
+
+    if(rc == UCVM_MODEL_CODE_SUCCESS) {
+      double *cost=sfcvm_tile_costs(&job.ctx, ntiles, nworkers, _section_point, &job);
+      rc=sfcvm_parallel_run(ntiles, cost, nworkers, _section_tile, &job);
+      free(cost);
+    }
+    if(job.out != out && job.out != NULL) {
+      if(rc == UCVM_MODEL_CODE_SUCCESS) memcpy(out, job.out, size);
+      sfcvm_parallel_free(job.out);
+    }
+    free(lon);
+    free(lat);
+    return rc;
+}
+
+int sfcvm_extract_section(sfcvm_context_t *ctx, const sfcvm_section_t *section, int fields, float *out, int nworkers) {
+    return sfcvm_extract_section_encoded(ctx, section, fields, NULL, out, nworkers);
+}
+
+void sfcvm_section_header(const sfcvm_section_t *section, int fields, sfcvm_raster_header_t *hdr) {
+    memset(hdr, 0, sizeof(sfcvm_raster_header_t));
+    memcpy(hdr->magic, SFCVM_RASTER_MAGIC, sizeof(hdr->magic));
+    hdr->version=SFCVM_RASTER_VERSION;
+    hdr->kind=SFCVM_RASTER_SECTION;
+    hdr->nx=sfcvm_section_stations(section, NULL, NULL);
+    hdr->ny=section->nz;
+    hdr->fields=(fields == 0) ? SFCVM_FIELDS_DEFAULT : fields;
+    hdr->zmode=section->zmode;
+    hdr->x0=0;
+    hdr->dx=section->spacing;
+    hdr->y0=section->z0;
+    hdr->dy=section->dz;
+    hdr->z=0;
+    hdr->nodata=-1.0;
+    sfcvm_raster_encoding(hdr, NULL);
+}
+
+/* Search state of one column of a site scan, depths are in steps of dz */
+typedef struct sfcvm_site_scan_t {
+    /* last step, zmax */
+    int last;
+    /* coarse stride in steps, about one grid cell */
+    int stride;
+    /* next coarse step to query, -1 once the coarse scan is over */
+    int next;
+    /* coarse step queried before the current one */
+    int prev;
+    /* per threshold, the first step at or over it is in (lo, hi], hi -1 until found */
+    int lo[2];
+    int hi[2];
+} sfcvm_site_scan_t;
+
+static const double sfcvm_site_vs[2]={ SFCVM_Z1P0_VS, SFCVM_Z2P5_VS };
+
+/**
+ * Site parameters of n locations. Each location is one column: the top
+ * 30 m go down in one batch for Vs30, then the column is scanned a grid
+ * cell at a time until Vs reaches both thresholds, and each crossing is
+ * narrowed to a single dz step by bisection. Vs2.5 at a depth means Vs1.0
+ * there too, so Z2.5 is never above Z1.0 and one scan serves both. The
+ * columns go through the query pipeline together, a batch per round.
+ *
+ * Vs between grid nodes is interpolated linearly, so within a cell the
+ * steps at or over a threshold follow all the steps below it, and the
+ * bisection lands on the step sampling at every dz would find first.
+ * Only Vs going over a threshold and back under it inside one cell can
+ * be missed.
+ *
+ * @param ctx Query context, NULL for the current model parameters.
+ * @param lon Longitudes of the locations.
+ * @param lat Latitudes of the locations.
+ * @param n Number of locations.
+ * @param opts Search options, NULL for the defaults.
+ * @param site Returns the site parameters.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_site_params(sfcvm_context_t *ctx, const double *lon, const double *lat, int n,
+                      const sfcvm_site_opts_t *opts, sfcvm_site_t *site) {
+    sfcvm_context_t sctx;
+    sfcvm_site_opts_t o;
+
+    if(opts != NULL) {
+      o=*opts;
+      } else {
+        o.dz=SFCVM_SITE_DZ;
+        o.zmax=SFCVM_SITE_ZMAX;
+        o.vs30_layers=SFCVM_SITE_VS30_LAYERS;
+    }
+    if(n <= 0 || o.dz <= 0 || o.zmax < 0 || o.vs30_layers < 1) return UCVM_MODEL_CODE_ERROR;
+    _extract_context(ctx, &sctx);
+
+    // one round queries at most this many points per column
+    int per_col=SFCVM_SITE_SCAN_LEVELS+o.vs30_layers;
+    sfcvm_site_scan_t *scan=(sfcvm_site_scan_t *)malloc(n*sizeof(sfcvm_site_scan_t));
+    int *col=(int *)malloc((size_t)n*per_col*sizeof(int));
+    int *step=(int *)malloc((size_t)n*per_col*sizeof(int));
+    double *depth=(double *)malloc((size_t)n*per_col*sizeof(double));
+    sfcvm_properties_t *data=(sfcvm_properties_t *)malloc((size_t)n*per_col*sizeof(sfcvm_properties_t));
+    sfcvm_columns_t *cols=NULL;
+    int rc=UCVM_MODEL_CODE_ERROR;
+
+    if(scan != NULL && col != NULL && step != NULL && depth != NULL && data != NULL) {
+      cols=sfcvm_columns_create(&sctx, lon, lat, n);
+    }
+    if(cols != NULL) {
+      int last=(int)floor(o.zmax/o.dz+1.0e-9);
+      double h=30.0/o.vs30_layers;
+
+      // round 0, the Vs30 layers of every column at their mid depths
+      int cnt=0;
+      for(int c=0; c<n; c++) {
+        double surface, top;
+        sfcvm_site_scan_t *sc=&scan[c];
+        site[c].vs30=-1;
+        site[c].z1p0=-1;
+        site[c].z2p5=-1;
+        sc->next=-1;
+        sc->prev=-1;
+        for(int t=0; t<2; t++) {
+          sc->lo[t]=-1;
+          sc->hi[t]=-1;
+        }
+        if(sfcvm_columns_surface(cols, c, &surface, &top) != 0) continue;
+
+        sc->last=last;
+        sc->stride=(int)floor(sfcvm_columns_gridheight(cols, c)/o.dz+1.0e-9);
+        if(sc->stride < 1) sc->stride=1;
+        sc->next=0;
+        for(int k=0; k<o.vs30_layers; k++) {
+          col[cnt]=c;
+          depth[cnt]=(k+0.5)*h;
+          cnt++;
+        }
+      }
+      rc=sfcvm_columns_query(cols, col, depth, data, NULL, cnt);
+      for(int i=0; i<cnt && rc == UCVM_MODEL_CODE_SUCCESS; i+=o.vs30_layers) {
+        double slowness=0;
+        int ok=1;
+        for(int k=0; k<o.vs30_layers; k++) {
+          if(data[i+k].vs <= 0) ok=0;
+            else slowness+=h/data[i+k].vs;
+        }
+        if(ok) site[col[i]].vs30=30.0/slowness;
+      }
+
+      // scan and bisection rounds until every column is done
+      while(rc == UCVM_MODEL_CODE_SUCCESS) {
+        cnt=0;
+        for(int c=0; c<n; c++) {
+          sfcvm_site_scan_t *sc=&scan[c];
+          if(sc->next >= 0) {
+            for(int l=0; l<SFCVM_SITE_SCAN_LEVELS && sc->next >= 0; l++) {
+              col[cnt]=c;
+              step[cnt]=sc->next;
+              cnt++;
+              // the coarse scan always ends on the last step
+              if(sc->next == sc->last) sc->next=-1;
+                else sc->next=(sc->next+sc->stride < sc->last) ? sc->next+sc->stride : sc->last;
+            }
+            continue;
+          }
+          for(int t=0; t<2; t++) {
+            if(sc->hi[t] < 0 || sc->hi[t]-sc->lo[t] <= 1) continue;
+            col[cnt]=c;
+            step[cnt]=(sc->lo[t]+sc->hi[t])/2;
+            cnt++;
+          }
+        }
+        if(cnt == 0) break;
+
+        for(int i=0; i<cnt; i++) depth[i]=step[i]*o.dz;
+        rc=sfcvm_columns_query(cols, col, depth, data, NULL, cnt);
+        if(rc != UCVM_MODEL_CODE_SUCCESS) break;
+
+        for(int i=0; i<cnt; i++) {
+          sfcvm_site_scan_t *sc=&scan[col[i]];
+          int coarse=(sc->hi[0] < 0 || sc->hi[1] < 0) && step[i] > sc->prev;
+          for(int t=0; t<2; t++) {
+            int over=(data[i].vs >= sfcvm_site_vs[t]);
+            if(coarse && sc->hi[t] < 0) {
+              if(over) {
+                sc->lo[t]=sc->prev;
+                sc->hi[t]=step[i];
+              }
+              } else if(sc->hi[t] >= 0 && step[i] > sc->lo[t] && step[i] < sc->hi[t]) {
+                if(over) sc->hi[t]=step[i];
+                  else sc->lo[t]=step[i];
+            }
+          }
+          if(coarse) sc->prev=step[i];
+        }
+        // a scan that found both crossings stops, its extra coarse levels are ignored
+        for(int c=0; c<n; c++) {
+          if(scan[c].hi[0] >= 0 && scan[c].hi[1] >= 0) scan[c].next=-1;
+        }
+      }
+
+      for(int c=0; c<n && rc == UCVM_MODEL_CODE_SUCCESS; c++) {
+        if(scan[c].hi[0] >= 0) site[c].z1p0=scan[c].hi[0]*o.dz;
+        if(scan[c].hi[1] >= 0) site[c].z2p5=scan[c].hi[1]*o.dz;
+      }
+    }
+
+    sfcvm_columns_destroy(cols);
+    free(scan);
+    free(col);
+    free(step);
+    free(depth);
+    free(data);
+    return rc;
+}
+
+typedef struct sfcvm_site_job_t {
+    sfcvm_context_t ctx;
+    const sfcvm_slice_t *lattice;
+    const sfcvm_site_opts_t *opts;
+    float *out;
+} sfcvm_site_job_t;
+
+/* One row of a site map */
+static int _site_row(long row, void *arg) {
+    sfcvm_site_job_t *job=(sfcvm_site_job_t *)arg;
+    const sfcvm_slice_t *g=job->lattice;
+    int nx=g->nx;
+    if(nx <= 0) return 1;
+
+    double *lon=(double *)malloc(nx*sizeof(double));
+    double *lat=(double *)malloc(nx*sizeof(double));
+    sfcvm_site_t *site=(sfcvm_site_t *)malloc(nx*sizeof(sfcvm_site_t));
+    if(lon == NULL || lat == NULL || site == NULL) {
+      free(lon);
+      free(lat);
+      free(site);
+      return 1;
+    }
+
+    for(int i=0; i<nx; i++) {
+      lon[i]=g->lon0+i*g->dlon;
+      lat[i]=g->lat0+row*g->dlat;
+    }
+    int rc=sfcvm_site_params(&job->ctx, lon, lat, nx, job->opts, site);
+    if(rc == UCVM_MODEL_CODE_SUCCESS) {
+      size_t band=(size_t)nx*g->ny;
+      float *out=&job->out[row*nx];
+      for(int i=0; i<nx; i++) {
+        out[i]=(float)site[i].vs30;
+        out[band+i]=(float)site[i].z1p0;
+        out[2*band+i]=(float)site[i].z2p5;
+      }
+    }
+
+    free(lon);
+    free(lat);
+    free(site);
+    return (rc == UCVM_MODEL_CODE_SUCCESS) ? 0 : 1;
+}
+
+/* Cost sample of a site map row */
+static void _site_point(long row, double f, void *arg, double *x, double *y) {
+    const sfcvm_slice_t *g=((sfcvm_site_job_t *)arg)->lattice;
+    *x=g->lon0+(int)(f*(g->nx-1)+0.5)*g->dlon;
+    *y=g->lat0+row*g->dlat;
+}
+
+/**
+ * Site parameters on a lon/lat lattice, see sfcvm_site_params. Rows are
+ * handed to the workers, the depth and elevation of the lattice are not
+ * used.
+ *
+ * @param ctx Query context, NULL for the current model parameters.
+ * @param lattice The lattice.
+ * @param opts Search options, NULL for the defaults.
+ * @param out Returns the vs30, z1.0 and z2.5 bands of ny*nx floats.
+ * @param nworkers Number of worker processes, 1 runs in the caller.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_extract_site_map(sfcvm_context_t *ctx, const sfcvm_slice_t *lattice, const sfcvm_site_opts_t *opts,
+                           float *out, int nworkers) {
+    sfcvm_site_job_t job;
+
+    if(lattice->nx <= 0 || lattice->ny <= 0) return UCVM_MODEL_CODE_ERROR;
+
+    _extract_context(ctx, &job.ctx);
+    job.lattice=lattice;
+    job.opts=opts;
+    job.out=out;
+
+    size_t size=(size_t)3*lattice->nx*lattice->ny*sizeof(float);
+    if(nworkers > 1 && lattice->ny > 1) {
+      job.out=(float *)sfcvm_parallel_alloc(size);
+      if(job.out == NULL) return UCVM_MODEL_CODE_ERROR;
+    }
+
+    double *cost=sfcvm_tile_costs(&job.ctx, lattice->ny, nworkers, _site_point, &job);
+    int rc=sfcvm_parallel_run(lattice->ny, cost, nworkers, _site_row, &job);
+    free(cost);
+    if(job.out != out) {
+      if(rc == UCVM_MODEL_CODE_SUCCESS) memcpy(out, job.out, size);
+      sfcvm_parallel_free(job.out);
+    }
+    return rc;
+}
+
+void sfcvm_site_map_header(const sfcvm_slice_t *lattice, sfcvm_raster_header_t *hdr) {
+    sfcvm_slice_header(lattice, SFCVM_FIELDS_SITE, hdr);
+    hdr->kind=SFCVM_RASTER_SITE;
+    hdr->zmode=SFCVM_ZMODE_DEPTH;
+    hdr->z=0;
+}
+
+void sfcvm_reduction_init(sfcvm_reduction_t *red, double lo, double hi, int nbins) {
+    memset(red, 0, sizeof(sfcvm_reduction_t));
+    red->lo=lo;
+    red->hi=hi;
+    red->nbins=(nbins < 0) ? 0 : (nbins > SFCVM_REDUCE_MAX_BINS) ? SFCVM_REDUCE_MAX_BINS : nbins;
+}
+
+int sfcvm_reduce_bands(const sfcvm_volume_t *vol, int band_levels) {
+    if(vol->nz <= 0) return 0;
+    if(band_levels <= 0 || band_levels >= vol->nz) return 1;
+    return (vol->nz+band_levels-1)/band_levels;
+}
+
+/* Adds one value */
+static void _reduce_add(sfcvm_reduction_t *red, double v) {
+    if(red->count == 0 || v < red->min) red->min=v;
+    if(red->count == 0 || v > red->max) red->max=v;
+    red->count++;
+    red->sum+=v;
+    if(red->nbins > 0) {
+      double b=(v-red->lo)/(red->hi-red->lo)*red->nbins;
+      int bin=(b < 0) ? 0 : (b >= red->nbins) ? red->nbins-1 : (int)b;
+      red->bins[bin]++;
+    }
+}
+
+/* Adds the value of a point, points outside of the model and NODATA_VALUE cells only count as nodata */
+static void _reduce_value(sfcvm_reduction_t *red, int nodata, double v) {
+    if(nodata || v <= NODATA_VALUE) red->nodata++;
+      else _reduce_add(red, v);
+}
+
+/* Merges the counts of src into red, both have the same histogram */
+static void _reduce_merge(sfcvm_reduction_t *red, const sfcvm_reduction_t *src) {
+    if(src->count > 0) {
+      if(red->count == 0 || src->min < red->min) red->min=src->min;
+      if(red->count == 0 || src->max > red->max) red->max=src->max;
+    }
+    red->count+=src->count;
+    red->nodata+=src->nodata;
+    red->sum+=src->sum;
+    for(int b=0; b<red->nbins; b++) red->bins[b]+=src->bins[b];
+}
+
+typedef struct sfcvm_reduce_job_t {
+    sfcvm_context_t ctx;
+    const sfcvm_volume_t *vol;
+    int fields;
+    int band_levels;
+    int nred;
+    /* reductions as the caller set them up, cleared copies start each tile */
+    const sfcvm_reduction_t *init;
+    /* nred reductions per tile */
+    sfcvm_reduction_t *part;
+    long ntiles;
+} sfcvm_reduce_job_t;
+
+/**
+ * Reduces the rows of one tile. Columns are queried in batches of whole
+ * columns and the values go straight into the reductions of the tile.
+ */
+static int _reduce_tile(long tile, void *arg) {
+    sfcvm_reduce_job_t *job=(sfcvm_reduce_job_t *)arg;
+    const sfcvm_volume_t *v=job->vol;
+    int nf=sfcvm_field_count(job->fields);
+    int nz=v->nz;
+    int row0=(int)(tile*v->ny/job->ntiles), row1=(int)((tile+1)*v->ny/job->ntiles);
+    long ncols=(long)(row1-row0)*v->nx;
+    int batch=(nz >= SFCVM_REDUCE_BATCH) ? 1 : SFCVM_REDUCE_BATCH/nz;
+    sfcvm_reduction_t *red=&job->part[tile*job->nred];
+    int rc=UCVM_MODEL_CODE_SUCCESS;
+
+    if(batch > ncols) batch=(int)ncols;
+    for(int r=0; r<job->nred; r++) {
+      sfcvm_reduction_init(&red[r], job->init[r].lo, job->init[r].hi, job->init[r].nbins);
+    }
+
+    double *lon=(double *)malloc(batch*sizeof(double));
+    double *lat=(double *)malloc(batch*sizeof(double));
+    int *zone_id=(int *)malloc((size_t)batch*nz*sizeof(int));
+    int *status=(int *)malloc((size_t)batch*nz*sizeof(int));
+    sfcvm_properties_t *data=(sfcvm_properties_t *)malloc((size_t)batch*nz*sizeof(sfcvm_properties_t));
+    if(lon == NULL || lat == NULL || zone_id == NULL || status == NULL || data == NULL) {
+      rc=UCVM_MODEL_CODE_ERROR;
+    }
+
+    for(long first=0; first<ncols && rc == UCVM_MODEL_CODE_SUCCESS; first+=batch) {
+      int cnt=(ncols-first < batch) ? (int)(ncols-first) : batch;
+      for(int c=0; c<cnt; c++) {
+        long k=first+c;
+        lon[c]=v->lon0+(k%v->nx)*v->dlon;
+        lat[c]=v->lat0+(row0+k/v->nx)*v->dlat;
+      }
+      rc=_query_column_levels(&job->ctx, lon, lat, cnt, v->z0, v->dz, nz, v->zmode, data, zone_id, status);
+      if(rc != UCVM_MODEL_CODE_SUCCESS) break;
+
+      for(int c=0; c<cnt; c++) {
+        for(int k=0; k<nz; k++) {
+          int p=c*nz+k;
+          sfcvm_reduction_t *rb=&red[(job->band_levels > 0 ? k/job->band_levels : 0)*nf];
+          int nodata=(status[p] == SFCVM_STATUS_OUTSIDE || status[p] == SFCVM_STATUS_QUERY_ERROR);
+          int f=0;
+          if(job->fields & SFCVM_FIELD_VP) _reduce_value(&rb[f++], nodata, data[p].vp);
+          if(job->fields & SFCVM_FIELD_VS) _reduce_value(&rb[f++], nodata, data[p].vs);
+          if(job->fields & SFCVM_FIELD_RHO) _reduce_value(&rb[f++], nodata, data[p].rho);
+          if(job->fields & SFCVM_FIELD_ZONE_ID) _reduce_value(&rb[f++], nodata, zone_id[p]);
+        }
+      }
+    }
+
+    free(lon);
+    free(lat);
+    free(zone_id);
+    free(status);
+    free(data);
+    return (rc == UCVM_MODEL_CODE_SUCCESS) ? 0 : 1;
+}
+
+/* Cost sample of a reduction tile, along the diagonal of its rows */
+static void _reduce_point(long tile, double f, void *arg, double *x, double *y) {
+    sfcvm_reduce_job_t *job=(sfcvm_reduce_job_t *)arg;
+    const sfcvm_volume_t *v=job->vol;
+    int row0=(int)(tile*v->ny/job->ntiles), row1=(int)((tile+1)*v->ny/job->ntiles);
+    *x=v->lon0+(int)(f*(v->nx-1)+0.5)*v->dlon;
+    *y=v->lat0+(row0+(int)(f*(row1-row0-1)+0.5))*v->dlat;
+}
+
+/**
+ * Reduces the fields of a volume without keeping its points. The volume
+ * is cut into a fixed number of tiles of whole rows, each tile reduces
+ * into its own copy of the reductions and the copies are merged in tile
+ * order, so the results do not depend on the number of workers. The
+ * levels of a column are queried together, as in a section.
+ *
+ * @param ctx Query context, NULL for the current model parameters.
+ * @param vol The volume.
+ * @param fields sfcvm_field_t bits out of SFCVM_FIELDS_ALL, 0 for SFCVM_FIELDS_DEFAULT.
+ * @param band_levels Levels per depth band, 0 for one band over all levels.
+ * @param red nbands*nfields reductions, fields in bit order within a band.
+ *            The histogram of each is set with sfcvm_reduction_init beforehand.
+ * @param nworkers Number of worker processes, 1 runs in the caller.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_reduce_volume(sfcvm_context_t *ctx, const sfcvm_volume_t *vol, int fields, int band_levels,
+                        sfcvm_reduction_t *red, int nworkers) {
+    sfcvm_reduce_job_t job;
+
+    if(vol->nx <= 0 || vol->ny <= 0 || vol->nz <= 0) return UCVM_MODEL_CODE_ERROR;
+    if(fields == 0) fields=SFCVM_FIELDS_DEFAULT;
+    if(fields & ~SFCVM_FIELDS_ALL) return UCVM_MODEL_CODE_ERROR;
+    if(band_levels >= vol->nz) band_levels=0;
+
+    _extract_context(ctx, &job.ctx);
+    job.vol=vol;
+    job.fields=fields;
+    job.band_levels=band_levels;
+    job.nred=sfcvm_reduce_bands(vol, band_levels)*sfcvm_field_count(fields);
+    job.init=red;
+    job.ntiles=(vol->ny < SFCVM_REDUCE_TILES) ? vol->ny : SFCVM_REDUCE_TILES;
+
+    size_t size=(size_t)job.ntiles*job.nred*sizeof(sfcvm_reduction_t);
+    if(nworkers > 1 && job.ntiles > 1) {
+      job.part=(sfcvm_reduction_t *)sfcvm_parallel_alloc(size);
+    } else {
+      job.part=(sfcvm_reduction_t *)malloc(size);
+    }
+    if(job.part == NULL) return UCVM_MODEL_CODE_ERROR;
+
+    double *cost=sfcvm_tile_costs(&job.ctx, job.ntiles, nworkers, _reduce_point, &job);
+    int rc=sfcvm_parallel_run(job.ntiles, cost, nworkers, _reduce_tile, &job);
+    free(cost);
+    if(rc == UCVM_MODEL_CODE_SUCCESS) {
+      for(int r=0; r<job.nred; r++) {
+        sfcvm_reduction_init(&red[r], red[r].lo, red[r].hi, red[r].nbins);
+        for(long t=0; t<job.ntiles; t++) _reduce_merge(&red[r], &job.part[t*job.nred+r]);
+      }
+    }
+
+    if(nworkers > 1 && job.ntiles > 1) {
+      sfcvm_parallel_free(job.part);
+    } else {
+      free(job.part);
+    }
+    return rc;
+}
+
+double sfcvm_reduction_mean(const sfcvm_reduction_t *red) {
+    return (red->count > 0) ? red->sum/red->count : -1.0;
+}
+
+/**
+ * Percentile of a reduction, interpolated inside the histogram bin it
+ * falls in, so it is exact to one bin width. Without a histogram only
+ * the 0th and 100th percentiles, min and max, are known.
+ *
+ * @param red The reduction.
+ * @param pct Percentile, 0 to 100.
+ * @return The value, clamped to min and max, or -1 when there are no points.
+ */
+double sfcvm_reduction_percentile(const sfcvm_reduction_t *red, double pct) {
+    if(red->count == 0) return -1.0;
+    if(pct <= 0 || red->nbins == 0) return (pct < 100) ? red->min : red->max;
+    if(pct >= 100) return red->max;
+
+    double target=pct/100.0*red->count;
+    double width=(red->hi-red->lo)/red->nbins;
+    long below=0;
+    double v=red->max;
+    for(int b=0; b<red->nbins; b++) {
+      if(below+red->bins[b] >= target) {
+        v=red->lo+(b+(target-below)/red->bins[b])*width;
+        break;
+      }
+      below+=red->bins[b];
+    }
+    if(v < red->min) v=red->min;
+    if(v > red->max) v=red->max;
+    return v;
+}
+
+/* Morton key of a corner, bits of x, y and z interleaved from x up */
+static uint64_t _morton(uint32_t x, uint32_t y, uint32_t z) {
+    uint64_t key=0;
+    for(int b=0; b<SFCVM_OCTREE_MAX_LEVEL; b++) {
+      key |= (uint64_t)((x>>b)&1)<<(3*b) | (uint64_t)((y>>b)&1)<<(3*b+1) | (uint64_t)((z>>b)&1)<<(3*b+2);
+    }
+    return key;
+}
+
+static int _compare_octant(const void *a, const void *b) {
+    const sfcvm_octant_t *oa=(const sfcvm_octant_t *)a, *ob=(const sfcvm_octant_t *)b;
+    uint64_t ka=_morton(oa->x, oa->y, oa->z), kb=_morton(ob->x, ob->y, ob->z);
+    return (ka > kb) - (ka < kb);
+}
+
+/* Appends an octant to a growing array, returns 0 on success */
+static int _octant_push(sfcvm_octant_t **arr, long *cnt, long *cap, const sfcvm_octant_t *o) {
+    if(*cnt == *cap) {
+      long ncap=(*cap > 0) ? 2*(*cap) : 64;
+      sfcvm_octant_t *n=(sfcvm_octant_t *)realloc(*arr, ncap*sizeof(sfcvm_octant_t));
+      if(n == NULL) return 1;
+      *arr=n;
+      *cap=ncap;
+    }
+    (*arr)[(*cnt)++]=*o;
+    return 0;
+}
+
+/* File a tile of an octree writes its leaves to before they are joined */
+static void _octree_part(const char *file, long tile, char *part, size_t len) {
+    snprintf(part, len, "%s.part%ld", file, tile);
+}
+
+typedef struct sfcvm_octree_job_t {
+    sfcvm_context_t ctx;
+    const sfcvm_octree_t *oct;
+    const char *file;
+    /* leaves written by each tile */
+    long *count;
+} sfcvm_octree_job_t;
+
+/**
+ * Queries the centers of n cells of root cell (rx, ry, rz) and sorts
+ * them into leaves and the children of the cells that are split. Each
+ * center is a column of its own.
+ */
+static int _octree_level(sfcvm_octree_job_t *job, int rx, int ry, int rz, sfcvm_octant_t *cell, int n,
+                         sfcvm_octant_t **next, long *nnext, long *capnext,
+                         sfcvm_octant_t **leaf, long *nleaf, long *capleaf) {
+    const sfcvm_octree_t *o=job->oct;
+    double tick=o->size/(double)(1<<o->max_level);
+    double x[SFCVM_OCTREE_BATCH], y[SFCVM_OCTREE_BATCH], depth[SFCVM_OCTREE_BATCH];
+    int col[SFCVM_OCTREE_BATCH], status[SFCVM_OCTREE_BATCH];
+    sfcvm_properties_t data[SFCVM_OCTREE_BATCH];
+
+    for(int i=0; i<n; i++) {
+      double half=0.5*(1<<(o->max_level-cell[i].level));
+      x[i]=o->x0+rx*o->size+(cell[i].x+half)*tick;
+      y[i]=o->y0+ry*o->size+(cell[i].y+half)*tick;
+      depth[i]=o->z0+rz*o->size+(cell[i].z+half)*tick;
+      col[i]=i;
+    }
+    sfcvm_columns_t *cols=sfcvm_columns_create(&job->ctx, x, y, n);
+    if(cols == NULL) return UCVM_MODEL_CODE_ERROR;
+    sfcvm_extra_t extra;
+    memset(&extra, 0, sizeof(extra));
+    extra.status=status;
+    int rc=sfcvm_columns_query(cols, col, depth, data, &extra, n);
+    sfcvm_columns_destroy(cols);
+    if(rc != UCVM_MODEL_CODE_SUCCESS) return rc;
+
+    for(int i=0; i<n && rc == UCVM_MODEL_CODE_SUCCESS; i++) {
+      sfcvm_octant_t *c=&cell[i];
+      double h=o->size/(double)(1<<c->level);
+      double vs=(data[i].vs > o->vs_floor) ? data[i].vs : o->vs_floor;
+      int nodata=(status[i] == SFCVM_STATUS_OUTSIDE || status[i] == SFCVM_STATUS_QUERY_ERROR);
+
+      if(!nodata && c->level < o->max_level && h > vs/(o->fmax*o->ppw)) {
+        uint32_t e=1u<<(o->max_level-c->level-1);
+        for(int k=0; k<8 && rc == UCVM_MODEL_CODE_SUCCESS; k++) {
+          sfcvm_octant_t child=*c;
+          child.x+=(k&1)*e;
+          child.y+=((k>>1)&1)*e;
+          child.z+=((k>>2)&1)*e;
+          child.level++;
+          if(_octant_push(next, nnext, capnext, &child)) rc=UCVM_MODEL_CODE_ERROR;
+        }
+      } else {
+        c->vp=(float)data[i].vp;
+        c->vs=(float)data[i].vs;
+        c->rho=(float)data[i].rho;
+        if(_octant_push(leaf, nleaf, capleaf, c)) rc=UCVM_MODEL_CODE_ERROR;
+      }
+    }
+    return rc;
+}
+
+/**
+ * Refines one root cell level by level, every level is queried in
+ * batches, then writes its leaves in Morton order to the part file of
+ * the tile.
+ */
+static int _octree_tile(long tile, void *arg) {
+    sfcvm_octree_job_t *job=(sfcvm_octree_job_t *)arg;
+    const sfcvm_octree_t *o=job->oct;
+    int rx=(int)(tile%o->nx), ry=(int)((tile/o->nx)%o->ny), rz=(int)(tile/((long)o->nx*o->ny));
+    sfcvm_octant_t *cur=NULL, *next=NULL, *leaf=NULL;
+    long ncur=0, capcur=0, nnext=0, capnext=0, nleaf=0, capleaf=0;
+    sfcvm_octant_t root;
+    char part[2100];
+    int rc;
+
+    memset(&root, 0, sizeof(root));
+    rc=_octant_push(&cur, &ncur, &capcur, &root) ? UCVM_MODEL_CODE_ERROR : UCVM_MODEL_CODE_SUCCESS;
+    while(ncur > 0 && rc == UCVM_MODEL_CODE_SUCCESS) {
+      nnext=0;
+      for(long first=0; first<ncur && rc == UCVM_MODEL_CODE_SUCCESS; first+=SFCVM_OCTREE_BATCH) {
+        int cnt=(ncur-first < SFCVM_OCTREE_BATCH) ? (int)(ncur-first) : SFCVM_OCTREE_BATCH;
+        rc=_octree_level(job, rx, ry, rz, &cur[first], cnt, &next, &nnext, &capnext, &leaf, &nleaf, &capleaf);
+      }
+      sfcvm_octant_t *t=cur;
+      cur=next;
+      next=t;
+      ncur=nnext;
+      long tc=capcur;
+      capcur=capnext;
+      capnext=tc;
+    }
+
+    if(rc == UCVM_MODEL_CODE_SUCCESS) {
+      qsort(leaf, nleaf, sizeof(sfcvm_octant_t), _compare_octant);
+      for(long i=0; i<nleaf; i++) {
+        leaf[i].x+=(uint32_t)rx<<o->max_level;
+        leaf[i].y+=(uint32_t)ry<<o->max_level;
+        leaf[i].z+=(uint32_t)rz<<o->max_level;
+      }
+      _octree_part(job->file, tile, part, sizeof(part));
+      FILE *fp=fopen(part, "wb");
+      if(fp == NULL || fwrite(leaf, sizeof(sfcvm_octant_t), nleaf, fp) != (size_t)nleaf) rc=UCVM_MODEL_CODE_ERROR;
+      if(fp != NULL && fclose(fp) != 0) rc=UCVM_MODEL_CODE_ERROR;
+      job->count[tile]=nleaf;
+    }
+
+    free(cur);
+    free(next);
+    free(leaf);
+    return (rc == UCVM_MODEL_CODE_SUCCESS) ? 0 : 1;
+}
+
+/* Appends a part file to an open file and removes it */
+static int _octree_join(FILE *fp, const char *part, char *buf) {
+    FILE *in=fopen(part, "rb");
+    int rc=UCVM_MODEL_CODE_SUCCESS;
+    size_t n;
+
+    if(in == NULL) return UCVM_MODEL_CODE_ERROR;
+    while((n=fread(buf, 1, SFCVM_OCTREE_COPY, in)) > 0) {
+      if(fwrite(buf, 1, n, fp) != n) {
+        rc=UCVM_MODEL_CODE_ERROR;
+        break;
+      }
+    }
+    fclose(in);
+    unlink(part);
+    return rc;
+}
+
+/* Cost sample of a root cell, along its horizontal diagonal */
+static void _octree_point(long tile, double f, void *arg, double *x, double *y) {
+    const sfcvm_octree_t *o=((sfcvm_octree_job_t *)arg)->oct;
+    int rx=(int)(tile%o->nx), ry=(int)((tile/o->nx)%o->ny);
+    *x=o->x0+(rx+f)*o->size;
+    *y=o->y0+(ry+f)*o->size;
+}
+
+/**
+ * Builds an octree mesh top down. A cell is queried at its center and
+ * split when it is too coarse for the shortest wavelength there, see
+ * sfcvm_octree_t, so queries are only made at cells the mesh creates and
+ * a cell is never queried twice. Each root cell is a tile of work, it is
+ * refined one level at a time with the level queried in batches, and its
+ * leaves go to a part file that is joined into the output in root cell
+ * order once all tiles are done.
+ *
+ * @param ctx Query context, NULL for the current model parameters.
+ * @param oct The mesh.
+ * @param file Output, a sfcvm_octree_header_t and the leaves.
+ * @param nworkers Number of worker processes, 1 runs in the caller.
+ * @param nleaves Returns the number of leaves, may be NULL.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_extract_octree(sfcvm_context_t *ctx, const sfcvm_octree_t *oct, const char *file, int nworkers,
+                         long *nleaves) {
+    sfcvm_octree_job_t job;
+    sfcvm_octree_header_t hdr;
+    char part[2100];
+
+    if(oct->nx <= 0 || oct->ny <= 0 || oct->nz <= 0 || oct->size <= 0) return UCVM_MODEL_CODE_ERROR;
+    if(oct->fmax <= 0 || oct->ppw <= 0) return UCVM_MODEL_CODE_ERROR;
+    if(oct->max_level < 0 || oct->max_level > SFCVM_OCTREE_MAX_LEVEL) return UCVM_MODEL_CODE_ERROR;
+    // corners in ticks have to fit in 32 bits
+    int maxroot=(oct->nx > oct->ny) ? oct->nx : oct->ny;
+    if(oct->nz > maxroot) maxroot=oct->nz;
+    if(((uint64_t)maxroot<<oct->max_level) > UINT32_MAX) return UCVM_MODEL_CODE_ERROR;
+    if(strlen(file) > 2000) return UCVM_MODEL_CODE_ERROR;
+
+    long ntiles=(long)oct->nx*oct->ny*oct->nz;
+    _extract_context(ctx, &job.ctx);
+    job.oct=oct;
+    job.file=file;
+    int shared=(nworkers > 1 && ntiles > 1);
+    job.count=(long *)(shared ? sfcvm_parallel_alloc(ntiles*sizeof(long)) : malloc(ntiles*sizeof(long)));
+    if(job.count == NULL) return UCVM_MODEL_CODE_ERROR;
+
+    double *cost=sfcvm_tile_costs(&job.ctx, ntiles, nworkers, _octree_point, &job);
+    int rc=sfcvm_parallel_run(ntiles, cost, nworkers, _octree_tile, &job);
+    free(cost);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SFCVM_OCTREE_MAGIC, sizeof(hdr.magic));
+    hdr.version=SFCVM_OCTREE_VERSION;
+    hdr.nx=oct->nx;
+    hdr.ny=oct->ny;
+    hdr.nz=oct->nz;
+    hdr.max_level=oct->max_level;
+    hdr.x0=oct->x0;
+    hdr.y0=oct->y0;
+    hdr.z0=oct->z0;
+    hdr.size=oct->size;
+    hdr.fmax=oct->fmax;
+    hdr.ppw=oct->ppw;
+    for(long t=0; t<ntiles && rc == UCVM_MODEL_CODE_SUCCESS; t++) hdr.nleaves+=job.count[t];
+
+    FILE *fp=NULL;
+    char *buf=NULL;
+    if(rc == UCVM_MODEL_CODE_SUCCESS) {
+      fp=fopen(file, "wb");
+      buf=(char *)malloc(SFCVM_OCTREE_COPY);
+      if(fp == NULL || buf == NULL || fwrite(&hdr, sizeof(hdr), 1, fp) != 1) rc=UCVM_MODEL_CODE_ERROR;
+    }
+    // join the parts, or clear them up after a failure
+    for(long t=0; t<ntiles; t++) {
+      _octree_part(file, t, part, sizeof(part));
+      if(rc == UCVM_MODEL_CODE_SUCCESS) rc=_octree_join(fp, part, buf);
+        else unlink(part);
+    }
+    if(fp != NULL && fclose(fp) != 0) rc=UCVM_MODEL_CODE_ERROR;
+    free(buf);
+
+    if(shared) {
+      sfcvm_parallel_free(job.count);
+    } else {
+      free(job.count);
+    }
+    if(nleaves != NULL) *nleaves=(rc == UCVM_MODEL_CODE_SUCCESS) ? (long)hdr.nleaves : 0;
+    return rc;
+}
+
+void sfcvm_element_box(sfcvm_element_t *el, double x0, double x1, double y0, double y1, double z0, double z1) {
+    for(int c=0; c<8; c++) {
+      el->x[c]=(c&1) ? x1 : x0;
+      el->y[c]=(c&2) ? y1 : y0;
+      el->depth[c]=(c&4) ? z1 : z0;
+    }
+}
+
+/**
+ * Maps the reference point u, v, w in [0,1] into an element, trilinear
+ * in the corners, and returns the volume factor, |det J|, there.
+ */
+static double _element_map(const sfcvm_element_t *el, double u, double v, double w,
+                           double *x, double *y, double *depth) {
+    double p[3]={0, 0, 0}, J[3][3]={{0}};
+    for(int c=0; c<8; c++) {
+      double fu=(c&1) ? u : 1-u, fv=(c&2) ? v : 1-v, fw=(c&4) ? w : 1-w;
+      double su=(c&1) ? 1 : -1, sv=(c&2) ? 1 : -1, sw=(c&4) ? 1 : -1;
+      double dn[3]={ su*fv*fw, fu*sv*fw, fu*fv*sw };
+      double X[3]={ el->x[c], el->y[c], el->depth[c] };
+      for(int a=0; a<3; a++) {
+        p[a]+=fu*fv*fw*X[a];
+        for(int b=0; b<3; b++) J[a][b]+=X[a]*dn[b];
+      }
+    }
+    *x=p[0];
+    *y=p[1];
+    *depth=p[2];
+    return fabs(J[0][0]*(J[1][1]*J[2][2]-J[1][2]*J[2][1])
+               -J[0][1]*(J[1][0]*J[2][2]-J[1][2]*J[2][0])
+               +J[0][2]*(J[1][0]*J[2][1]-J[1][1]*J[2][0]));
+}
+
+/* An element with vertical sides, all samples at one u, v share a column */
+static int _element_vertical(const sfcvm_element_t *el) {
+    for(int c=0; c<4; c++) {
+      if(el->x[c] != el->x[c+4] || el->y[c] != el->y[c+4]) return 0;
+    }
+    return 1;
+}
+
+typedef struct sfcvm_cell_job_t {
+    sfcvm_context_t ctx;
+    const sfcvm_element_t *el;
+    int n;
+    int order;
+    sfcvm_properties_t *data;
+    double *coverage;
+} sfcvm_cell_job_t;
+
+/**
+ * Averages the elements of one tile. All of their samples are located
+ * and queried as one batch, an element with vertical sides has a column
+ * per order^2 samples in plan, otherwise every sample is its own column.
+ */
+static int _cell_tile(long tile, void *arg) {
+    sfcvm_cell_job_t *job=(sfcvm_cell_job_t *)arg;
+    int order=job->order, per=order*order*order;
+    int first=(int)(tile*SFCVM_CELL_TILE);
+    int cnt=(job->n-first < SFCVM_CELL_TILE) ? job->n-first : SFCVM_CELL_TILE;
+    if(cnt <= 0 || order <= 0) return 1;
+    int npts=cnt*per;
+    int rc=UCVM_MODEL_CODE_ERROR;
+
+    double *lon=(double *)malloc(npts*sizeof(double));
+    double *lat=(double *)malloc(npts*sizeof(double));
+    double *depth=(double *)malloc(npts*sizeof(double));
+    double *weight=(double *)malloc(npts*sizeof(double));
+    int *col=(int *)malloc(npts*sizeof(int));
+    int *status=(int *)malloc(npts*sizeof(int));
+    sfcvm_properties_t *data=(sfcvm_properties_t *)malloc(npts*sizeof(sfcvm_properties_t));
+    if(lon == NULL || lat == NULL || depth == NULL || weight == NULL || col == NULL || status == NULL || data == NULL) {
+      free(lon);
+      free(lat);
+      free(depth);
+      free(weight);
+      free(col);
+      free(status);
+      free(data);
+      return 1;
+    }
+
+    int ncols=0;
+    for(int e=0; e<cnt; e++) {
+      const sfcvm_element_t *el=&job->el[first+e];
+      int vertical=_element_vertical(el);
+      for(int j=0; j<order; j++) {
+        for(int i=0; i<order; i++) {
+          for(int k=0; k<order; k++) {
+            int p=e*per+(j*order+i)*order+k;
+            double x, y;
+            weight[p]=_element_map(el, (i+0.5)/order, (j+0.5)/order, (k+0.5)/order, &x, &y, &depth[p]);
+            if(k == 0 || !vertical) {
+              lon[ncols]=x;
+              lat[ncols]=y;
+              ncols++;
+            }
+            col[p]=ncols-1;
+          }
+        }
+      }
+    }
+    sfcvm_columns_t *cols=sfcvm_columns_create(&job->ctx, lon, lat, ncols);
+    if(cols != NULL) {
+      sfcvm_extra_t extra;
+      memset(&extra, 0, sizeof(extra));
+      extra.status=status;
+      rc=sfcvm_columns_query(cols, col, depth, data, &extra, npts);
+    }
+
+    for(int e=0; e<cnt && rc == UCVM_MODEL_CODE_SUCCESS; e++) {
+      // rho is averaged, mu and the P wave modulus by their inverses
+      double wall=0, w=0, rho=0, imu=0, im=0;
+      int zmu=0, zm=0;
+      for(int p=e*per; p<(e+1)*per; p++) {
+        sfcvm_properties_t *d=&data[p];
+        wall+=weight[p];
+        if(status[p] == SFCVM_STATUS_OUTSIDE || status[p] == SFCVM_STATUS_QUERY_ERROR) continue;
+        if(d->vp <= NODATA_VALUE || d->vs <= NODATA_VALUE || d->rho <= NODATA_VALUE) continue;
+        double mu=d->rho*d->vs*d->vs, m=d->rho*d->vp*d->vp;
+        w+=weight[p];
+        rho+=weight[p]*d->rho;
+        if(mu > 0) imu+=weight[p]/mu;
+          else zmu=1;
+        if(m > 0) im+=weight[p]/m;
+          else zm=1;
+      }
+      sfcvm_properties_t *out=&job->data[first+e];
+      memset(out, 0, sizeof(sfcvm_properties_t));
+      if(w > 0 && rho > 0) {
+        rho/=w;
+        out->rho=rho;
+        out->vs=zmu ? 0 : sqrt(w/imu/rho);
+        out->vp=zm ? 0 : sqrt(w/im/rho);
+      } else {
+        out->vp=out->vs=out->rho=-1;
+      }
+      if(job->coverage != NULL) job->coverage[first+e]=(wall > 0) ? w/wall : 0;
+    }
+
+    sfcvm_columns_destroy(cols);
+    free(lon);
+    free(lat);
+    free(depth);
+    free(weight);
+    free(col);
+    free(status);
+    free(data);
+    return (rc == UCVM_MODEL_CODE_SUCCESS) ? 0 : 1;
+}
+
+/* Cost sample of a tile of elements, the center of one of them */
+static void _cell_point(long tile, double f, void *arg, double *x, double *y) {
+    sfcvm_cell_job_t *job=(sfcvm_cell_job_t *)arg;
+    int first=(int)(tile*SFCVM_CELL_TILE);
+    int cnt=(job->n-first < SFCVM_CELL_TILE) ? job->n-first : SFCVM_CELL_TILE;
+    const sfcvm_element_t *el=&job->el[first+(int)(f*(cnt-1)+0.5)];
+    *x=*y=0;
+    for(int c=0; c<8; c++) {
+      *x+=el->x[c]/8;
+      *y+=el->y[c]/8;
+    }
+}
+
+/**
+ * Material of elements averaged over their volume, for meshes coarser
+ * than the model. Each element is sampled at the centers of order^3
+ * equal cells of its reference cube, weighted by the volume they map
+ * to. Density is the arithmetic mean, the shear and P wave moduli,
+ * rho*vs^2 and rho*vp^2, are harmonic means, and vs and vp come back
+ * from the mean moduli and density. A sample with vs of 0, water, makes
+ * the mean shear modulus 0. Samples outside of the model are left out.
+ *
+ * @param ctx Query context, NULL for the current model parameters.
+ * @param el The elements.
+ * @param n Number of elements.
+ * @param order Samples per edge, 1 to SFCVM_CELL_MAX_ORDER.
+ * @param data Returns the averaged vp, vs and rho, -1 for elements with no sample in the model.
+ * @param coverage Returns the fraction of each element inside of the model, may be NULL.
+ * @param nworkers Number of worker processes, 1 runs in the caller.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_cell_average(sfcvm_context_t *ctx, const sfcvm_element_t *el, int n, int order,
+                       sfcvm_properties_t *data, double *coverage, int nworkers) {
+    sfcvm_cell_job_t job;
+
+    if(n <= 0 || order < 1 || order > SFCVM_CELL_MAX_ORDER) return UCVM_MODEL_CODE_ERROR;
+
+    _extract_context(ctx, &job.ctx);
+    job.el=el;
+    job.n=n;
+    job.order=order;
+    job.data=data;
+    job.coverage=coverage;
+
+    long ntiles=(n+SFCVM_CELL_TILE-1)/SFCVM_CELL_TILE;
+    int shared=(nworkers > 1 && ntiles > 1);
+    if(shared) {
+      job.data=(sfcvm_properties_t *)sfcvm_parallel_alloc(n*sizeof(sfcvm_properties_t));
+      job.coverage=(coverage != NULL) ? (double *)sfcvm_parallel_alloc(n*sizeof(double)) : NULL;
+      if(job.data == NULL || (coverage != NULL && job.coverage == NULL)) {
+        if(job.data != NULL) sfcvm_parallel_free(job.data);
+        if(job.coverage != NULL) sfcvm_parallel_free(job.coverage);
+        return UCVM_MODEL_CODE_ERROR;
+      }
+    }
+
+    double *cost=sfcvm_tile_costs(&job.ctx, ntiles, nworkers, _cell_point, &job);
+    int rc=sfcvm_parallel_run(ntiles, cost, nworkers, _cell_tile, &job);
+    free(cost);
+    if(shared) {
+      if(rc == UCVM_MODEL_CODE_SUCCESS) {
+        memcpy(data, job.data, n*sizeof(sfcvm_properties_t));
+        if(coverage != NULL) memcpy(coverage, job.coverage, n*sizeof(double));
+      }
+      sfcvm_parallel_free(job.data);
+      if(job.coverage != NULL) sfcvm_parallel_free(job.coverage);
+    }
+    return rc;
+}
+
+/**
+ * The lattice of a data file, as its GRID in the configuration gives it,
+ * and the grid height at its top.
+ *
+ * @param label Label of the data_file entry.
+ * @param grid Returns the lattice.
+ * @param gridheight Returns the grid height, may be NULL.
+ * @return UCVM_MODEL_CODE_SUCCESS, or UCVM_MODEL_CODE_ERROR if there is no such file or it has no GRID.
+ */
+int sfcvm_native_grid(const char *label, sfcvm_grid_t *grid, double *gridheight) {
+    if(!sfcvm_is_initialized) return UCVM_MODEL_CODE_ERROR;
+    for(int t=0; t<sfcvm_configuration->data_cnt; t++) {
+      sfcvm_data_file_t *d=&sfcvm_configuration->data[t];
+      if(strcmp(d->label, label) != 0) continue;
+      if(d->grid.dx <= 0 || d->grid.dy <= 0 || d->grid.nx <= 0 || d->grid.ny <= 0) return UCVM_MODEL_CODE_ERROR;
+      *grid=d->grid;
+      if(gridheight != NULL) *gridheight=d->gridheight;
+      return UCVM_MODEL_CODE_SUCCESS;
+    }
+    return UCVM_MODEL_CODE_ERROR;
+}
+
+typedef struct sfcvm_native_job_t {
+    sfcvm_context_t ctx;
+    const sfcvm_grid_t *grid;
+    double z0;
+    double dz;
+    int nz;
+    int fields;
+    sfcvm_encoding_t enc;
+    int fd;
+} sfcvm_native_job_t;
+
+/**
+ * One row of a native lattice, in batches of whole columns. Each batch
+ * is written straight to its place in the file, so a worker holds no
+ * more than one batch.
+ */
+static int _native_row(long row, void *arg) {
+    sfcvm_native_job_t *job=(sfcvm_native_job_t *)arg;
+    const sfcvm_grid_t *g=job->grid;
+    int nx=g->nx, nz=job->nz;
+    size_t psize=sfcvm_encoded_size(job->fields, &job->enc);
+    int batch=(nz >= SFCVM_REDUCE_BATCH) ? 1 : SFCVM_REDUCE_BATCH/nz;
+    double az=g->azimuth*M_PI/180;
+    off_t rowoff=(off_t)sizeof(sfcvm_native_header_t)+(off_t)row*nx*nz*psize;
+    int rc=UCVM_MODEL_CODE_SUCCESS;
+
+    if(batch > nx) batch=nx;
+    double *x=(double *)malloc(batch*sizeof(double));
+    double *y=(double *)malloc(batch*sizeof(double));
+    int *zone_id=(int *)malloc((size_t)batch*nz*sizeof(int));
+    sfcvm_properties_t *data=(sfcvm_properties_t *)malloc((size_t)batch*nz*sizeof(sfcvm_properties_t));
+    char *buf=(char *)malloc((size_t)batch*nz*psize);
+    if(x == NULL || y == NULL || zone_id == NULL || data == NULL || buf == NULL) rc=UCVM_MODEL_CODE_ERROR;
+
+    for(int first=0; first<nx && rc == UCVM_MODEL_CODE_SUCCESS; first+=batch) {
+      int cnt=(nx-first < batch) ? nx-first : batch;
+      for(int c=0; c<cnt; c++) {
+        double u=(first+c)*g->dx, v=row*g->dy;
+        x[c]=g->x0+u*cos(az)+v*sin(az);
+        y[c]=g->y0-u*sin(az)+v*cos(az);
+      }
+      rc=_query_column_levels(&job->ctx, x, y, cnt, job->z0, job->dz, nz, SFCVM_ZMODE_DEPTH, data, zone_id, NULL);
+      if(rc != UCVM_MODEL_CODE_SUCCESS) break;
+
+      size_t n=(size_t)cnt*nz;
+      _store_fields(job->fields, &job->enc, data, zone_id, (int)n, buf, n, 0, 1);
+      // a band starts after the earlier bands of the batch in buf and of the row in the file
+      size_t before=0;
+      for(int f=SFCVM_FIELD_VP; f<=SFCVM_FIELD_ZONE_ID && rc == UCVM_MODEL_CODE_SUCCESS; f<<=1) {
+        if(!(job->fields & f)) continue;
+        size_t vsize=_value_size(&job->enc, f);
+        off_t off=rowoff+(off_t)before*nx*nz+(off_t)first*nz*vsize;
+        if(pwrite(job->fd, &buf[before*n], n*vsize, off) != (ssize_t)(n*vsize)) rc=UCVM_MODEL_CODE_ERROR;
+        before+=vsize;
+      }
+    }
+
+    free(x);
+    free(y);
+    free(zone_id);
+    free(data);
+    free(buf);
+    return (rc == UCVM_MODEL_CODE_SUCCESS) ? 0 : 1;
+}
+
+/* Cost sample of a row of a native lattice */
+static void _native_point(long row, double f, void *arg, double *x, double *y) {
+    const sfcvm_grid_t *g=((sfcvm_native_job_t *)arg)->grid;
+    double az=g->azimuth*M_PI/180;
+    double u=(int)(f*(g->nx-1)+0.5)*g->dx, v=row*g->dy;
+    *x=g->x0+u*cos(az)+v*sin(az);
+    *y=g->y0-u*sin(az)+v*cos(az);
+}
+
+/**
+ * Exports the fields at the nodes of a lattice in model_crs, with no
+ * projection and no interpolation between nodes when the lattice is the
+ * one of a data file, see sfcvm_native_grid. Columns are located once
+ * and their levels queried together. The queries take depth below the
+ * surface as the squashed elevation, so levels dz apart from the surface
+ * land on the model levels of a file with that grid height. As in
+ * sfcvm_query, a level at the surface is taken 1 m down. Rows go to the
+ * workers, which write into the file where the row belongs.
+ *
+ * @param ctx Query context, NULL for the current model parameters. Its input CRS is not used.
+ * @param grid The lattice.
+ * @param z0 Depth of the first level.
+ * @param dz Level spacing.
+ * @param nz Number of levels.
+ * @param fields sfcvm_field_t bits out of SFCVM_FIELDS_ALL, 0 for SFCVM_FIELDS_DEFAULT.
+ * @param enc Encoding of the bands, NULL for float32.
+ * @param file Output, a sfcvm_native_header_t and the rows.
+ * @param nworkers Number of worker processes, 1 runs in the caller.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_extract_native(sfcvm_context_t *ctx, const sfcvm_grid_t *grid, double z0, double dz, int nz,
+                         int fields, const sfcvm_encoding_t *enc, const char *file, int nworkers) {
+    sfcvm_native_job_t job;
+    sfcvm_native_header_t hdr;
+
+    if(!sfcvm_is_initialized || grid->nx <= 0 || grid->ny <= 0 || nz <= 0) return UCVM_MODEL_CODE_ERROR;
+    if(!_encoding_valid(enc)) return UCVM_MODEL_CODE_ERROR;
+    if(fields == 0) fields=SFCVM_FIELDS_DEFAULT;
+    if(fields & ~SFCVM_FIELDS_ALL) return UCVM_MODEL_CODE_ERROR;
+    const char *crs=sfcvm_configuration->model_crs;
+    if(crs[0] == '\0' || strlen(crs) >= SFCVM_NATIVE_CRS_MAX) return UCVM_MODEL_CODE_ERROR;
+
+    _extract_context(ctx, &job.ctx);
+    if(sfcvm_context_setparam(&job.ctx, INPUT_CRS, crs) != UCVM_MODEL_CODE_SUCCESS) return UCVM_MODEL_CODE_ERROR;
+    job.grid=grid;
+    job.z0=z0;
+    job.dz=dz;
+    job.nz=nz;
+    job.fields=fields;
+    job.enc=(enc != NULL) ? *enc : sfcvm_encoding_float32;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SFCVM_NATIVE_MAGIC, sizeof(hdr.magic));
+    hdr.version=SFCVM_NATIVE_VERSION;
+    hdr.nx=grid->nx;
+    hdr.ny=grid->ny;
+    hdr.nz=nz;
+    hdr.fields=fields;
+    hdr.gabbro=job.ctx.gabbro;
+    hdr.x0=grid->x0;
+    hdr.y0=grid->y0;
+    hdr.azimuth=grid->azimuth;
+    hdr.dx=grid->dx;
+    hdr.dy=grid->dy;
+    hdr.z0=z0;
+    hdr.dz=dz;
+    hdr.squash_min_elev=job.ctx.squash_min_elev;
+    hdr.nodata=-1.0;
+    hdr.encoding=job.enc.kind;
+    hdr.scale=job.enc.scale;
+    hdr.offset=job.enc.offset;
+    strcpy(hdr.crs, crs);
+
+    job.fd=open(file, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(job.fd < 0) return UCVM_MODEL_CODE_ERROR;
+    off_t size=(off_t)sizeof(hdr)+(off_t)sfcvm_encoded_size(fields, enc)*grid->nx*grid->ny*nz;
+    int rc=UCVM_MODEL_CODE_SUCCESS;
+    if(pwrite(job.fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || ftruncate(job.fd, size) != 0) {
+      rc=UCVM_MODEL_CODE_ERROR;
+    }
+
+    if(rc == UCVM_MODEL_CODE_SUCCESS) {
+      double *cost=sfcvm_tile_costs(&job.ctx, grid->ny, nworkers, _native_point, &job);
+      rc=sfcvm_parallel_run(grid->ny, cost, nworkers, _native_row, &job);
+      free(cost);
+    }
+    if(close(job.fd) != 0) rc=UCVM_MODEL_CODE_ERROR;
+    return rc;
+}
+
+/*
+ * Grid spacing of the source models along a path, horizontal and
+ * vertical, the finest of their data files. The horizontal spacing is
+ * the GRID resolution, or the grid height for files without a GRID.
+ */
+static void _path_spacing(double *hh, double *hv) {
+    hh[0]=hh[1]=hv[0]=hv[1]=0;
+    for(int t=0; t<sfcvm_configuration->data_cnt; t++) {
+      sfcvm_data_file_t *d=&sfcvm_configuration->data[t];
+      int m=(d->model == 0) ? 0 : 1;
+      if(d->gridheight <= 0) continue;
+      double h=(d->grid.dx > 0) ? fmin(d->grid.dx, d->grid.dy) : d->gridheight;
+      if(hv[m] == 0 || d->gridheight < hv[m]) hv[m]=d->gridheight;
+      if(hh[m] == 0 || h < hh[m]) hh[m]=h;
+    }
+    for(int m=0; m<2; m++) {
+      if(hv[m] > 0) continue;
+      hv[m]=(hv[1-m] > 0) ? hv[1-m] : SFCVM_PATH_STEP;
+      hh[m]=(hh[1-m] > 0) ? hh[1-m] : SFCVM_PATH_STEP;
+    }
+}
+
+/* Longest step along a unit vector, horizontal part uh and vertical uz, within one grid cell */
+static double _path_step(double hh, double hv, double uh, double uz) {
+    double step=HUGE_VAL;
+    if(uh > 0) step=hh/uh;
+    if(uz > 0 && hv/uz < step) step=hv/uz;
+    return step;
+}
+
+/*
+ * Queries n samples of a path in one batch. A run of samples on the
+ * same x, y, down a vertical ray for example, shares one column.
+ */
+static int _path_query(sfcvm_context_t *ctx, sfcvm_path_sample_t *smp, int n) {
+    if(n == 0) return UCVM_MODEL_CODE_SUCCESS;
+    if(n < 0) return UCVM_MODEL_CODE_ERROR;
+    int rc=UCVM_MODEL_CODE_ERROR;
+    double *lon=(double *)malloc(n*sizeof(double));
+    double *lat=(double *)malloc(n*sizeof(double));
+    double *depth=(double *)malloc(n*sizeof(double));
+    int *col=(int *)malloc(n*sizeof(int));
+    int *model_i=(int *)malloc(n*sizeof(int));
+    int *status=(int *)malloc(n*sizeof(int));
+    sfcvm_properties_t *data=(sfcvm_properties_t *)malloc(n*sizeof(sfcvm_properties_t));
+    if(lon == NULL || lat == NULL || depth == NULL || col == NULL || model_i == NULL || status == NULL ||
+       data == NULL) {
+      free(lon);
+      free(lat);
+      free(depth);
+      free(col);
+      free(model_i);
+      free(status);
+      free(data);
+      return UCVM_MODEL_CODE_ERROR;
+    }
+
+    // the first sample starts the first column
+    lon[0]=smp[0].x;
+    lat[0]=smp[0].y;
+    int ncols=1;
+    for(int i=0; i<n; i++) {
+      if(smp[i].x != lon[ncols-1] || smp[i].y != lat[ncols-1]) {
+        lon[ncols]=smp[i].x;
+        lat[ncols]=smp[i].y;
+        ncols++;
+      }
+      col[i]=ncols-1;
+      depth[i]=smp[i].depth;
+    }
+    sfcvm_columns_t *cols=sfcvm_columns_create(ctx, lon, lat, ncols);
+    if(cols != NULL) {
+      sfcvm_extra_t extra;
+      memset(&extra, 0, sizeof(extra));
+      extra.model_i=model_i;
+      extra.status=status;
+      rc=sfcvm_columns_query(cols, col, depth, data, &extra, n);
+    }
+    for(int i=0; i<n && rc == UCVM_MODEL_CODE_SUCCESS; i++) {
+      smp[i].vp=data[i].vp;
+      smp[i].vs=data[i].vs;
+      smp[i].rho=data[i].rho;
+      smp[i].model=(status[i] == SFCVM_STATUS_OUTSIDE || status[i] == SFCVM_STATUS_QUERY_ERROR) ? -1 : model_i[i];
+    }
+
+    sfcvm_columns_destroy(cols);
+    free(lon);
+    free(lat);
+    free(depth);
+    free(col);
+    free(model_i);
+    free(status);
+    free(data);
+    return rc;
+}
+
+/* Sample between two others, t of the way from a to b */
+static void _path_between(const sfcvm_path_sample_t *a, const sfcvm_path_sample_t *b, double t,
+                          sfcvm_path_sample_t *out) {
+    memset(out, 0, sizeof(sfcvm_path_sample_t));
+    out->s=a->s+t*(b->s-a->s);
+    out->x=a->x+t*(b->x-a->x);
+    out->y=a->y+t*(b->y-a->y);
+    out->depth=a->depth+t*(b->depth-a->depth);
+}
+
+/*
+ * Samples a path in two passes. The first steps along each segment at
+ * the spacing of the coarsest model, and the second fills in each
+ * interval that has an end in a finer model at that model's spacing, so
+ * samples are one grid cell apart in whichever model they fall in. Both
+ * passes are one batch each.
+ */
+static int _path_sample(sfcvm_context_t *ctx, const double *hh, const double *hv, const sfcvm_path_t *path,
+                        sfcvm_path_sample_t **samples, int *nsamples) {
+    const double *x=path->x, *y=path->y, *depth=path->depth;
+    double coarse_h=fmax(hh[0], hh[1]), coarse_v=fmax(hv[0], hv[1]);
+    int rc=UCVM_MODEL_CODE_ERROR;
+
+    *samples=NULL;
+    *nsamples=0;
+    if(path->nvert < 1) return rc;
+
+    int nc=1;
+    for(int v=1; v<path->nvert; v++) {
+      double dh=hypot(x[v]-x[v-1], y[v]-y[v-1]), dd=fabs(depth[v]-depth[v-1]), len=hypot(dh, dd);
+      if(len > 0) nc+=(int)fmax(1, ceil(len/_path_step(coarse_h, coarse_v, dh/len, dd/len)-1e-9));
+    }
+    sfcvm_path_sample_t *c=(sfcvm_path_sample_t *)malloc(nc*sizeof(sfcvm_path_sample_t));
+    int *sub=(int *)malloc(nc*sizeof(int));
+    if(c != NULL && sub != NULL) {
+      memset(&c[0], 0, sizeof(sfcvm_path_sample_t));
+      c[0].x=x[0];
+      c[0].y=y[0];
+      c[0].depth=depth[0];
+      int k=1;
+      for(int v=1; v<path->nvert; v++) {
+        double dh=hypot(x[v]-x[v-1], y[v]-y[v-1]), dd=fabs(depth[v]-depth[v-1]), len=hypot(dh, dd);
+        if(len == 0) continue;
+        int ns=(int)fmax(1, ceil(len/_path_step(coarse_h, coarse_v, dh/len, dd/len)-1e-9));
+        sfcvm_path_sample_t a=c[k-1], b=a;
+        b.x=x[v];
+        b.y=y[v];
+        b.depth=depth[v];
+        b.s=a.s+len;
+        for(int i=1; i<=ns; i++) _path_between(&a, &b, (double)i/ns, &c[k++]);
+      }
+      rc=_path_query(ctx, c, nc);
+    }
+
+    // intervals with an end in a model finer than the first pass
+    int nf=0;
+    for(int k=1; k<nc && rc == UCVM_MODEL_CODE_SUCCESS; k++) {
+      double ds=c[k].s-c[k-1].s;
+      double uh=hypot(c[k].x-c[k-1].x, c[k].y-c[k-1].y)/ds, uz=fabs(c[k].depth-c[k-1].depth)/ds;
+      double step=HUGE_VAL;
+      if(c[k-1].model >= 0) step=_path_step(hh[c[k-1].model], hv[c[k-1].model], uh, uz);
+      if(c[k].model >= 0) step=fmin(step, _path_step(hh[c[k].model], hv[c[k].model], uh, uz));
+      sub[k]=(step < ds) ? (int)ceil(ds/step-1e-9) : 1;
+      nf+=sub[k]-1;
+    }
+    sfcvm_path_sample_t *fine=NULL, *out=NULL;
+    if(rc == UCVM_MODEL_CODE_SUCCESS) {
+      fine=(sfcvm_path_sample_t *)malloc((nf > 0 ? nf : 1)*sizeof(sfcvm_path_sample_t));
+      out=(sfcvm_path_sample_t *)malloc((nc+nf)*sizeof(sfcvm_path_sample_t));
+      rc=UCVM_MODEL_CODE_ERROR;
+      if(fine != NULL && out != NULL) {
+        int f=0;
+        for(int k=1; k<nc; k++) {
+          for(int i=1; i<sub[k]; i++) _path_between(&c[k-1], &c[k], (double)i/sub[k], &fine[f++]);
+        }
+        rc=_path_query(ctx, fine, nf);
+      }
+    }
+
+    if(rc == UCVM_MODEL_CODE_SUCCESS) {
+      int n=0, f=0;
+      out[n++]=c[0];
+      for(int k=1; k<nc; k++) {
+        for(int i=1; i<sub[k]; i++) out[n++]=fine[f++];
+        out[n++]=c[k];
+      }
+      *samples=out;
+      *nsamples=n;
+    } else {
+      free(out);
+    }
+    free(c);
+    free(sub);
+    free(fine);
+    return rc;
+}
+
+/*
+ * Length and travel times of a sampled path, the slownesses are integrated
+ * with the trapezoidal rule over the intervals with both ends in the model.
+ */
+static void _path_integrate(const sfcvm_path_sample_t *smp, int n, sfcvm_path_result_t *result) {
+    int water=0;
+    memset(result, 0, sizeof(sfcvm_path_result_t));
+    result->nsamples=n;
+    if(n > 0) result->length=smp[n-1].s;
+    for(int k=1; k<n; k++) {
+      const sfcvm_path_sample_t *a=&smp[k-1], *b=&smp[k];
+      double ds=b->s-a->s;
+      if(a->model < 0 || b->model < 0 || a->vp <= 0 || b->vp <= 0 ||
+         a->vs <= NODATA_VALUE || b->vs <= NODATA_VALUE) {
+        result->outside+=ds;
+        continue;
+      }
+      result->tp+=ds*(1/a->vp+1/b->vp)/2;
+      if(a->vs > 0 && b->vs > 0) result->ts+=ds*(1/a->vs+1/b->vs)/2;
+        else water=1;
+    }
+    if(water) result->ts=-1;
+}
+
+/**
+ * Samples one path. Samples are one grid cell of the model they fall in
+ * apart, 25 m vertically in the detailed model and 125 m in the regional
+ * one for example, and every vertex is a sample.
+ *
+ * @param ctx Query context, NULL for the current model parameters.
+ * @param path The path.
+ * @param samples Returns the samples, to be freed by the caller, may be NULL.
+ * @param result Returns the length and travel times, may be NULL.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_path_sample(sfcvm_context_t *ctx, const sfcvm_path_t *path, sfcvm_path_sample_t **samples,
+                      sfcvm_path_result_t *result) {
+    sfcvm_context_t qctx;
+    sfcvm_path_sample_t *smp;
+    double hh[2], hv[2];
+    int n;
+
+    if(!sfcvm_is_initialized) return UCVM_MODEL_CODE_ERROR;
+    _extract_context(ctx, &qctx);
+    _path_spacing(hh, hv);
+    if(_path_sample(&qctx, hh, hv, path, &smp, &n) != UCVM_MODEL_CODE_SUCCESS) return UCVM_MODEL_CODE_ERROR;
+    if(result != NULL) _path_integrate(smp, n, result);
+    if(samples != NULL) *samples=smp;
+      else free(smp);
+    return UCVM_MODEL_CODE_SUCCESS;
+}
+
+typedef struct sfcvm_path_job_t {
+    sfcvm_context_t ctx;
+    double hh[2];
+    double hv[2];
+    const sfcvm_path_t *path;
+    int n;
+    sfcvm_path_result_t *result;
+} sfcvm_path_job_t;
+
+/* Traces the paths of one tile */
+static int _path_tile(long tile, void *arg) {
+    sfcvm_path_job_t *job=(sfcvm_path_job_t *)arg;
+    int first=(int)(tile*SFCVM_PATH_TILE);
+    int last=(first+SFCVM_PATH_TILE < job->n) ? first+SFCVM_PATH_TILE : job->n;
+
+    for(int p=first; p<last; p++) {
+      sfcvm_path_sample_t *smp;
+      int n;
+      if(_path_sample(&job->ctx, job->hh, job->hv, &job->path[p], &smp, &n) != UCVM_MODEL_CODE_SUCCESS) return 1;
+      _path_integrate(smp, n, &job->result[p]);
+      free(smp);
+    }
+    return 0;
+}
+
+/* Cost sample of a tile of paths, the middle vertex of one of them */
+static void _path_point(long tile, double f, void *arg, double *x, double *y) {
+    sfcvm_path_job_t *job=(sfcvm_path_job_t *)arg;
+    int first=(int)(tile*SFCVM_PATH_TILE);
+    int cnt=(first+SFCVM_PATH_TILE < job->n) ? SFCVM_PATH_TILE : job->n-first;
+    const sfcvm_path_t *p=&job->path[first+(int)(f*(cnt-1)+0.5)];
+    int v=(p->nvert > 0) ? p->nvert/2 : 0;
+    *x=(p->nvert > 0) ? p->x[v] : 0;
+    *y=(p->nvert > 0) ? p->y[v] : 0;
+}
+
+/**
+ * Lengths and P and S travel times of n paths, sampled as by
+ * sfcvm_path_sample. Tiles of paths go to the workers.
+ *
+ * @param ctx Query context, NULL for the current model parameters.
+ * @param path The paths.
+ * @param n Number of paths.
+ * @param result Returns n results.
+ * @param nworkers Number of worker processes, 1 runs in the caller.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_path_trace(sfcvm_context_t *ctx, const sfcvm_path_t *path, int n, sfcvm_path_result_t *result,
+                     int nworkers) {
+    sfcvm_path_job_t job;
+
+    if(!sfcvm_is_initialized || n <= 0) return UCVM_MODEL_CODE_ERROR;
+    _extract_context(ctx, &job.ctx);
+    _path_spacing(job.hh, job.hv);
+    job.path=path;
+    job.n=n;
+    job.result=result;
+
+    long ntiles=(n+SFCVM_PATH_TILE-1)/SFCVM_PATH_TILE;
+    int shared=(nworkers > 1 && ntiles > 1);
+    if(shared) {
+      job.result=(sfcvm_path_result_t *)sfcvm_parallel_alloc(n*sizeof(sfcvm_path_result_t));
+      if(job.result == NULL) return UCVM_MODEL_CODE_ERROR;
+    }
+
+    double *cost=sfcvm_tile_costs(&job.ctx, ntiles, nworkers, _path_point, &job);
+    int rc=sfcvm_parallel_run(ntiles, cost, nworkers, _path_tile, &job);
+    free(cost);
+    if(shared) {
+      if(rc == UCVM_MODEL_CODE_SUCCESS) memcpy(result, job.result, n*sizeof(sfcvm_path_result_t));
+      sfcvm_parallel_free(job.result);
+    }
+    return rc;
+}
+
+/**
+ * Writes a raster, the header and then its bands.
+ *
+ * @param file Output file name.
+ * @param hdr The header, nx, ny, fields and encoding give the size of data.
+ * @param data The bands.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_raster_write(const char *file, const sfcvm_raster_header_t *hdr, const void *data) {
+    sfcvm_encoding_t enc = { hdr->encoding, hdr->scale, hdr->offset };
+    size_t n=sfcvm_encoded_size(hdr->fields, &enc)*hdr->nx*hdr->ny;
+    FILE *fp=fopen(file, "wb");
+    if(fp == NULL) return UCVM_MODEL_CODE_ERROR;
+
+    int err=(fwrite(hdr, sizeof(sfcvm_raster_header_t), 1, fp) != 1);
+    if(!err && n > 0) err=(fwrite(data, 1, n, fp) != n);
+    if(fclose(fp) != 0) err=1;
+    return err ? UCVM_MODEL_CODE_ERROR : UCVM_MODEL_CODE_SUCCESS;
+}
+
+int sfcvm_raster_write_stations(const char *file, const double *lon, const double *lat, int n) {
+    FILE *fp=fopen(file, "ab");
+    if(fp == NULL) return UCVM_MODEL_CODE_ERROR;
+
+    int err=0;
+    for(int i=0; i<n && !err; i++) {
+      double ll[2]={ lon[i], lat[i] };
+      err=(fwrite(ll, sizeof(double), 2, fp) != 2);
+    }
+    if(fclose(fp) != 0) err=1;
+    return err ? UCVM_MODEL_CODE_ERROR : UCVM_MODEL_CODE_SUCCESS;
+}
@@ -0,0 +1,525 @@
+#ifndef SFCVM_EXTRACT_H
+#define SFCVM_EXTRACT_H
+
+/**
+ * @file sfcvm_extract.h
+ * @brief Extraction of regular products from an initialized SFCVM.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Each product is laid out on columns located once with
+ * sfcvm_columns_create, so the projection, data file routing and surface
+ * lookup of a location are shared by every value taken down it. Work is
+ * spread over forked workers with sfcvm_parallel_run.
+ *
+ */
+
+#include <stdint.h>
+#include "sfcvm.h"
+
+/** Fields an extraction can write, bands go in bit order */
+typedef enum { SFCVM_FIELD_VP = 1,
+               SFCVM_FIELD_VS = 2,
+               SFCVM_FIELD_RHO = 4,
+               SFCVM_FIELD_ZONE_ID = 8,
+               SFCVM_FIELD_VS30 = 16,     /* site parameters, per column */
+               SFCVM_FIELD_Z1P0 = 32,
+               SFCVM_FIELD_Z2P5 = 64 } sfcvm_field_t;
+
+/** Fields written when none are asked for */
+#define SFCVM_FIELDS_DEFAULT (SFCVM_FIELD_VP|SFCVM_FIELD_VS|SFCVM_FIELD_RHO)
+/** Every field of a point */
+#define SFCVM_FIELDS_ALL (SFCVM_FIELD_VP|SFCVM_FIELD_VS|SFCVM_FIELD_RHO|SFCVM_FIELD_ZONE_ID)
+/** The site parameters, bands of a site map */
+#define SFCVM_FIELDS_SITE (SFCVM_FIELD_VS30|SFCVM_FIELD_Z1P0|SFCVM_FIELD_Z2P5)
+
+/** Vs (m/s) whose first depth is Z1.0 */
+#define SFCVM_Z1P0_VS 1000.0
+/** Vs (m/s) whose first depth is Z2.5 */
+#define SFCVM_Z2P5_VS 2500.0
+
+/** How the bands of an extraction are stored */
+typedef enum { SFCVM_ENCODING_FLOAT32 = 0,  /* float32, outside points -1 */
+               SFCVM_ENCODING_UINT16        /* vp, vs and rho as uint16 with a scale and offset, zone_id as uint8 */
+             } sfcvm_encoding_kind_t;
+
+/** uint16 value of points outside of the model */
+#define SFCVM_UINT16_NODATA 65535
+/** uint8 value of points outside of the model, and of zone_ids over 254 */
+#define SFCVM_UINT8_NODATA 255
+
+/**
+ * Encoding of the bands of an extraction. With SFCVM_ENCODING_UINT16 a
+ * value v is stored as round((v-offset)/scale), clamped to 0..65534, so
+ * scale 1 and offset 0 give m/s and kg/m^3 to the unit.
+ */
+typedef struct sfcvm_encoding_t {
+	/** sfcvm_encoding_kind_t */
+	int kind;
+	/** Step of one uint16 unit */
+	double scale;
+	/** Value of uint16 0 */
+	double offset;
+} sfcvm_encoding_t;
+
+/** Raster file, see sfcvm_raster_header_t */
+#define SFCVM_RASTER_MAGIC "SFCVMRST"
+#define SFCVM_RASTER_VERSION 2
+
+/** What the axes of a raster are */
+typedef enum { SFCVM_RASTER_SLICE = 0,  /* x longitude, y latitude, at one z */
+               SFCVM_RASTER_SECTION,   /* x distance along a trace in meters, y depth or elevation */
+               SFCVM_RASTER_SITE       /* x longitude, y latitude, site parameters */
+             } sfcvm_raster_kind_t;
+
+/**
+ * Header of a raster file. The header is followed by one band per field,
+ * each ny rows of nx values in native byte order, row j at y0+j*dy and
+ * column i at x0+i*dx. Values are float32 unless the encoding says
+ * otherwise, see sfcvm_encoding_t. Points outside of the model hold -1,
+ * as sfcvm_query returns, or the nodata code of an integer band. A
+ * section is followed by the nx stations of its trace, lon/lat pairs of
+ * doubles.
+ */
+typedef struct sfcvm_raster_header_t {
+	/** SFCVM_RASTER_MAGIC, not terminated */
+	char magic[8];
+	/** SFCVM_RASTER_VERSION */
+	int32_t version;
+	/** sfcvm_raster_kind_t */
+	int32_t kind;
+	/** Columns */
+	int32_t nx;
+	/** Rows */
+	int32_t ny;
+	/** sfcvm_field_t bits of the bands */
+	int32_t fields;
+	/** SFCVM_ZMODE_DEPTH or SFCVM_ZMODE_ELEVATION */
+	int32_t zmode;
+	/** First column */
+	double x0;
+	/** Column spacing */
+	double dx;
+	/** First row */
+	double y0;
+	/** Row spacing */
+	double dy;
+	/** Depth or elevation of a slice */
+	double z;
+	/** Value of points outside of the model */
+	double nodata;
+	/** sfcvm_encoding_kind_t of the bands */
+	int32_t encoding;
+	/** Unused, 0 */
+	int32_t reserved;
+	/** Scale of uint16 bands */
+	double scale;
+	/** Offset of uint16 bands */
+	double offset;
+} sfcvm_raster_header_t;
+
+/** A horizontal lon/lat lattice at one depth or elevation */
+typedef struct sfcvm_slice_t {
+	/** Longitude of the first column */
+	double lon0;
+	/** Longitude spacing */
+	double dlon;
+	/** Number of columns */
+	int nx;
+	/** Latitude of the first row */
+	double lat0;
+	/** Latitude spacing */
+	double dlat;
+	/** Number of rows */
+	int ny;
+	/** Depth, or elevation, of the slice in meters */
+	double z;
+	/** SFCVM_ZMODE_DEPTH or SFCVM_ZMODE_ELEVATION */
+	int zmode;
+} sfcvm_slice_t;
+
+/** A vertical section under a lon/lat polyline */
+typedef struct sfcvm_section_t {
+	/** Longitudes of the vertices */
+	const double *lon;
+	/** Latitudes of the vertices */
+	const double *lat;
+	/** Number of vertices */
+	int nvert;
+	/** Distance between stations along the trace, in meters */
+	double spacing;
+	/** First depth, or elevation, in meters */
+	double z0;
+	/** Vertical spacing, in the direction of z */
+	double dz;
+	/** Number of depths */
+	int nz;
+	/** SFCVM_ZMODE_DEPTH or SFCVM_ZMODE_ELEVATION */
+	int zmode;
+} sfcvm_section_t;
+
+/**
+ * How the site parameters are searched for. Z1.0 and Z2.5 come out as
+ * sampling every dz meters from the surface down to zmax would find them.
+ */
+typedef struct sfcvm_site_opts_t {
+	/** Depth step the results are exact to, in meters */
+	double dz;
+	/** Deepest depth searched, in meters */
+	double zmax;
+	/** Layers of equal thickness in the Vs30 travel time average */
+	int vs30_layers;
+} sfcvm_site_opts_t;
+
+/** Defaults of sfcvm_site_opts_t */
+#define SFCVM_SITE_DZ 10.0
+#define SFCVM_SITE_ZMAX 10000.0
+#define SFCVM_SITE_VS30_LAYERS 30
+
+/** Site parameters of a location, -1 outside of the model or not reached by zmax */
+typedef struct sfcvm_site_t {
+	/** Travel time average of Vs over the top 30 m, in m/s */
+	double vs30;
+	/** Depth to Vs of SFCVM_Z1P0_VS, in meters */
+	double z1p0;
+	/** Depth to Vs of SFCVM_Z2P5_VS, in meters */
+	double z2p5;
+} sfcvm_site_t;
+
+/** A lon/lat lattice of columns at regular depths or elevations */
+typedef struct sfcvm_volume_t {
+	/** Longitude of the first column */
+	double lon0;
+	/** Longitude spacing */
+	double dlon;
+	/** Number of columns */
+	int nx;
+	/** Latitude of the first row */
+	double lat0;
+	/** Latitude spacing */
+	double dlat;
+	/** Number of rows */
+	int ny;
+	/** First depth, or elevation, in meters */
+	double z0;
+	/** Vertical spacing, in the direction of z */
+	double dz;
+	/** Number of levels */
+	int nz;
+	/** SFCVM_ZMODE_DEPTH or SFCVM_ZMODE_ELEVATION */
+	int zmode;
+} sfcvm_volume_t;
+
+/** Most histogram bins of a reduction */
+#define SFCVM_REDUCE_MAX_BINS 256
+
+/**
+ * Reduction of one field over a part of a volume. The histogram range is
+ * set by the caller, see sfcvm_reduction_init, values out of it are
+ * counted in the first or last bin. Points outside of the model, and
+ * NODATA_VALUE values of the model, are only counted in nodata.
+ */
+typedef struct sfcvm_reduction_t {
+	/** Lower end of the histogram */
+	double lo;
+	/** Upper end of the histogram */
+	double hi;
+	/** Number of histogram bins, 0 for none */
+	int nbins;
+	/** Points inside of the model */
+	long count;
+	/** Points outside of the model or without a value */
+	long nodata;
+	/** Smallest value, valid when count > 0 */
+	double min;
+	/** Largest value, valid when count > 0 */
+	double max;
+	/** Sum of the values */
+	double sum;
+	/** Histogram */
+	long bins[SFCVM_REDUCE_MAX_BINS];
+} sfcvm_reduction_t;
+
+/** Octree file, see sfcvm_octree_header_t */
+#define SFCVM_OCTREE_MAGIC "SFCVMOCT"
+#define SFCVM_OCTREE_VERSION 1
+/** Deepest octree level, ticks of a root cell fit in 20 bits */
+#define SFCVM_OCTREE_MAX_LEVEL 20
+
+/**
+ * An octree mesh over a box of root cells. x is easting and y northing,
+ * in meters in the input CRS of the query context, or in the UTM zone of
+ * the model without one. z is depth below the surface, positive down.
+ * A cell of edge h is split while h > max(Vs, vs_floor)/(fmax*ppw), Vs
+ * taken at its center, and its level is under max_level.
+ */
+typedef struct sfcvm_octree_t {
+	/** Easting of the west side */
+	double x0;
+	/** Northing of the south side */
+	double y0;
+	/** Depth of the top */
+	double z0;
+	/** Edge of a root cell, in meters */
+	double size;
+	/** Root cells along x */
+	int nx;
+	/** Root cells along y */
+	int ny;
+	/** Root cells along z */
+	int nz;
+	/** Deepest level, root cells are level 0 */
+	int max_level;
+	/** Highest frequency to resolve, in Hz */
+	double fmax;
+	/** Cells per shortest wavelength */
+	double ppw;
+	/** Vs the wavelength is taken at where Vs is lower, water for example */
+	double vs_floor;
+} sfcvm_octree_t;
+
+/**
+ * Header of an octree file. The header is followed by nleaves
+ * sfcvm_octant_t, root cell by root cell in x, then y, then z order and
+ * in Morton (z-curve) order of their corners within a root cell.
+ */
+typedef struct sfcvm_octree_header_t {
+	/** SFCVM_OCTREE_MAGIC, not terminated */
+	char magic[8];
+	/** SFCVM_OCTREE_VERSION */
+	int32_t version;
+	/** Root cells along x */
+	int32_t nx;
+	/** Root cells along y */
+	int32_t ny;
+	/** Root cells along z */
+	int32_t nz;
+	/** Deepest level, a tick is size/2^max_level */
+	int32_t max_level;
+	/** Unused */
+	int32_t pad;
+	/** Number of leaves */
+	int64_t nleaves;
+	/** Easting of the west side */
+	double x0;
+	/** Northing of the south side */
+	double y0;
+	/** Depth of the top */
+	double z0;
+	/** Edge of a root cell */
+	double size;
+	/** Highest frequency resolved */
+	double fmax;
+	/** Cells per shortest wavelength */
+	double ppw;
+} sfcvm_octree_header_t;
+
+/** A leaf of an octree file, values are -1 outside of the model */
+typedef struct sfcvm_octant_t {
+	/** Corner nearest the origin, in ticks from x0, y0 and z0 */
+	uint32_t x;
+	uint32_t y;
+	uint32_t z;
+	/** Level, the edge is 2^(max_level-level) ticks */
+	int32_t level;
+	/** Values at the center */
+	float vp;
+	float vs;
+	float rho;
+} sfcvm_octant_t;
+
+/**
+ * A hexahedral element by its 8 corners. Bit 0 of a corner index is the
+ * +x side, bit 1 the +y side and bit 2 the deeper side, so corners 0-3
+ * are the top face. x and y are in the input CRS of the query context,
+ * lon/lat or UTM without one, and depth is below the surface.
+ */
+typedef struct sfcvm_element_t {
+	double x[8];
+	double y[8];
+	double depth[8];
+} sfcvm_element_t;
+
+/** Highest sub-sampling order of an element, order^3 samples */
+#define SFCVM_CELL_MAX_ORDER 16
+
+/** Native lattice file, see sfcvm_native_header_t */
+#define SFCVM_NATIVE_MAGIC "SFCVMNAT"
+#define SFCVM_NATIVE_VERSION 2
+#define SFCVM_NATIVE_CRS_MAX 256
+
+/**
+ * Header of a native lattice file. Node (i, j) is at
+ * x0 + i*dx*cos(azimuth) + j*dy*sin(azimuth) east and
+ * y0 - i*dx*sin(azimuth) + j*dy*cos(azimuth) north in crs, level k at
+ * z0+k*dz below the surface. The header is followed by ny rows, each
+ * holding one band per field of nx columns of nz levels, level fastest.
+ * Levels are float32 or as the encoding gives, see sfcvm_encoding_t.
+ * Points outside of the model hold -1, or the nodata code of an integer
+ * band.
+ */
+typedef struct sfcvm_native_header_t {
+	/** SFCVM_NATIVE_MAGIC, not terminated */
+	char magic[8];
+	/** SFCVM_NATIVE_VERSION */
+	int32_t version;
+	/** Columns along x */
+	int32_t nx;
+	/** Columns along y */
+	int32_t ny;
+	/** Levels */
+	int32_t nz;
+	/** sfcvm_field_t bits of the bands */
+	int32_t fields;
+	/** 1 when the gabbro correction was applied */
+	int32_t gabbro;
+	/** Easting of node 0, 0 */
+	double x0;
+	/** Northing of node 0, 0 */
+	double y0;
+	/** Azimuth of the y axis, degrees clockwise from north */
+	double azimuth;
+	/** Spacing along x */
+	double dx;
+	/** Spacing along y */
+	double dy;
+	/** Depth of the first level */
+	double z0;
+	/** Level spacing */
+	double dz;
+	/** Squashing min elevation of the queries */
+	double squash_min_elev;
+	/** Value of points outside of the model */
+	double nodata;
+	/** sfcvm_encoding_kind_t of the bands */
+	int32_t encoding;
+	/** Unused, 0 */
+	int32_t reserved;
+	/** Scale of uint16 bands */
+	double scale;
+	/** Offset of uint16 bands */
+	double offset;
+	/** CRS of x and y, model_crs, terminated */
+	char crs[SFCVM_NATIVE_CRS_MAX];
+} sfcvm_native_header_t;
+
+/**
+ * A source-receiver path, straight between nvert vertices. x and y are
+ * in meters in the input CRS of the query context, UTM without one, and
+ * depth is below the surface.
+ */
+typedef struct sfcvm_path_t {
+	/** Number of vertices */
+	int nvert;
+	const double *x;
+	const double *y;
+	const double *depth;
+} sfcvm_path_t;
+
+/** A sample along a path, values are -1 outside of the model */
+typedef struct sfcvm_path_sample_t {
+	/** Distance from the first vertex */
+	double s;
+	double x;
+	double y;
+	double depth;
+	double vp;
+	double vs;
+	double rho;
+	/** Source model, 0 = detailed, 1 = regional, -1 = outside */
+	int model;
+} sfcvm_path_sample_t;
+
+/** Length and travel times of a path */
+typedef struct sfcvm_path_result_t {
+	/** Length of the path */
+	double length;
+	/** Length outside of the model, left out of the travel times */
+	double outside;
+	/** P travel time */
+	double tp;
+	/** S travel time, -1 if the path crosses water */
+	double ts;
+	/** Number of samples */
+	int nsamples;
+} sfcvm_path_result_t;
+
+/** Number of bands of a set of fields */
+int sfcvm_field_count(int fields);
+/** Parses a comma separated field list, vp,vs,rho,zone_id, returns 0 if it is not valid */
+int sfcvm_field_parse(const char *str);
+/** Parses float32 or uint16[,scale[,offset]], returns UCVM_MODEL_CODE_ERROR if it is not valid */
+int sfcvm_encoding_parse(const char *str, sfcvm_encoding_t *enc);
+/** Bytes of one point over all bands of the fields, enc NULL for float32 */
+size_t sfcvm_encoded_size(int fields, const sfcvm_encoding_t *enc);
+/** Records an encoding in a raster header, enc NULL for float32 */
+void sfcvm_raster_encoding(sfcvm_raster_header_t *hdr, const sfcvm_encoding_t *enc);
+
+/** Extracts a horizontal slice into nbands*ny*nx floats */
+int sfcvm_extract_slice(sfcvm_context_t *ctx, const sfcvm_slice_t *slice, int fields, float *out, int nworkers);
+/** Extracts a horizontal slice into nbands*ny*nx values of an encoding */
+int sfcvm_extract_slice_encoded(sfcvm_context_t *ctx, const sfcvm_slice_t *slice, int fields,
+                                const sfcvm_encoding_t *enc, void *out, int nworkers);
+/** Header of the raster of a slice */
+void sfcvm_slice_header(const sfcvm_slice_t *slice, int fields, sfcvm_raster_header_t *hdr);
+
+/** Stations of a section, returns how many there are, lon/lat may be NULL to count them */
+int sfcvm_section_stations(const sfcvm_section_t *section, double *lon, double *lat);
+/** Extracts a vertical section into nbands*nz*nstations floats */
+int sfcvm_extract_section(sfcvm_context_t *ctx, const sfcvm_section_t *section, int fields, float *out, int nworkers);
+/** Extracts a vertical section into nbands*nz*nstations values of an encoding */
+int sfcvm_extract_section_encoded(sfcvm_context_t *ctx, const sfcvm_section_t *section, int fields,
+                                  const sfcvm_encoding_t *enc, void *out, int nworkers);
+/** Header of the raster of a section */
+void sfcvm_section_header(const sfcvm_section_t *section, int fields, sfcvm_raster_header_t *hdr);
+
+/** Site parameters of n locations, opts NULL for the defaults */
+int sfcvm_site_params(sfcvm_context_t *ctx, const double *lon, const double *lat, int n,
+                      const sfcvm_site_opts_t *opts, sfcvm_site_t *site);
+/** Site parameters on a lon/lat lattice into 3*ny*nx floats, vs30, z1.0 and z2.5 */
+int sfcvm_extract_site_map(sfcvm_context_t *ctx, const sfcvm_slice_t *lattice, const sfcvm_site_opts_t *opts,
+                           float *out, int nworkers);
+/** Header of the raster of a site map */
+void sfcvm_site_map_header(const sfcvm_slice_t *lattice, sfcvm_raster_header_t *hdr);
+
+/** Clears a reduction and sets its histogram, nbins 0 for none */
+void sfcvm_reduction_init(sfcvm_reduction_t *red, double lo, double hi, int nbins);
+/** Depth bands of band_levels levels each in a volume, 0 for one band */
+int sfcvm_reduce_bands(const sfcvm_volume_t *vol, int band_levels);
+/** Reduces the fields of a volume into nbands*nfields reductions, red[band*nfields+field] */
+int sfcvm_reduce_volume(sfcvm_context_t *ctx, const sfcvm_volume_t *vol, int fields, int band_levels,
+                        sfcvm_reduction_t *red, int nworkers);
+/** Mean of a reduction, -1 when it has no points */
+double sfcvm_reduction_mean(const sfcvm_reduction_t *red);
+/** Percentile, 0 to 100, of a reduction from its histogram, -1 when it has no points */
+double sfcvm_reduction_percentile(const sfcvm_reduction_t *red, double pct);
+
+/** Builds an octree mesh refined on Vs and writes its leaves to a file */
+int sfcvm_extract_octree(sfcvm_context_t *ctx, const sfcvm_octree_t *oct, const char *file, int nworkers,
+                         long *nleaves);
+
+/** Sets an element to an axis aligned box */
+void sfcvm_element_box(sfcvm_element_t *el, double x0, double x1, double y0, double y1, double z0, double z1);
+/** Material of n elements averaged over order^3 sub-samples each */
+int sfcvm_cell_average(sfcvm_context_t *ctx, const sfcvm_element_t *el, int n, int order,
+                       sfcvm_properties_t *data, double *coverage, int nworkers);
+
+/** Lattice and grid height of a data file, by label, from its GRID */
+int sfcvm_native_grid(const char *label, sfcvm_grid_t *grid, double *gridheight);
+/** Writes the fields at the nodes of a lattice in model_crs, at nz levels below the surface */
+int sfcvm_extract_native(sfcvm_context_t *ctx, const sfcvm_grid_t *grid, double z0, double dz, int nz,
+                         int fields, const sfcvm_encoding_t *enc, const char *file, int nworkers);
+
+/** Samples one path at the grid spacing of the model along it */
+int sfcvm_path_sample(sfcvm_context_t *ctx, const sfcvm_path_t *path, sfcvm_path_sample_t **samples,
+                      sfcvm_path_result_t *result);
+/** Lengths and travel times of n paths */
+int sfcvm_path_trace(sfcvm_context_t *ctx, const sfcvm_path_t *path, int n, sfcvm_path_result_t *result,
+                     int nworkers);
+
+/** Writes a raster file */
+int sfcvm_raster_write(const char *file, const sfcvm_raster_header_t *hdr, const void *data);
+/** Appends the stations of a section to its raster file */
+int sfcvm_raster_write_stations(const char *file, const double *lon, const double *lat, int n);
+
+#endif
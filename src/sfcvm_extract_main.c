@@ -0,0 +1,651 @@
+/*
+ * @file sfcvm_extract_main.c
+ * @brief Command line front end of the SFCVM extraction engines.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Extracts regular products from SFCVM with forked workers sharing the
+ * loaded model, see sfcvm_extract.h.
+ *
+ *   sfcvm_extract -m slice -x -122.5,0.01,100 -y 37.5,0.01,100 -z 1000 -o vs1km.bin
+ *   sfcvm_extract -m section -p -122.5,37.6,-122.0,37.9 -s 200 -z 0,50,100 -o xsect.bin
+ *   sfcvm_extract -m site -x -122.5,0.01,100 -y 37.5,0.01,100 -d 10,8000 -o site.bin
+ *   sfcvm_extract -m stats -x -122.5,0.01,100 -y 37.5,0.01,100 -z 0,100,50 -b 10 -f vp,vs
+ *   sfcvm_extract -m octree -x 540000,8000,10 -y 4130000,8000,10 -z 0,8000,2 -F 2,8 -L 8 -o mesh.oct
+ *   sfcvm_extract -m cells -n 4 < boxes.in > cells.out
+ *   sfcvm_extract -m native -g sfcvm -z 0,25,80 -f vp,vs,rho,zone_id -o detailed.bin
+ *   sfcvm_extract -m paths < rays.in > times.out
+ *
+ */
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <math.h>
+#include "ucvm_model_dtypes.h"
+#include "sfcvm.h"
+#include "sfcvm_parallel.h"
+#include "sfcvm_extract.h"
+
+#define SFCVM_EXTRACT_MAX_JOBS 256
+/* Most vertices of a section polyline */
+#define SFCVM_EXTRACT_MAX_VERTICES 1000
+/* Histogram bins of the stats percentiles */
+#define SFCVM_EXTRACT_STATS_BINS 200
+
+/* Octree defaults, cells per wavelength, Vs floor and deepest level */
+#define SFCVM_EXTRACT_OCTREE_PPW 8.0
+#define SFCVM_EXTRACT_OCTREE_VS_FLOOR 100.0
+#define SFCVM_EXTRACT_OCTREE_LEVEL 10
+
+/* Default sub-samples per edge of a cell average */
+#define SFCVM_EXTRACT_CELL_ORDER 3
+
+/* Default histogram ranges of the stats fields, vp, vs, rho and zone_id */
+static const double sfcvm_extract_stats_range[4][2]={ {0, 10000}, {0, 6000}, {0, 4000}, {0, 200} };
+static const char* const sfcvm_extract_stats_names[4]={ "vp", "vs", "rho", "zone_id" };
+
+/* Usage function */
+void usage() {
+  printf("     sfcvm_extract - (c) SCEC\n");
+  printf("Extract products from SFCVM\n");
+  printf("\tusage: sfcvm_extract -m slice -x lon0,dlon,nx -y lat0,dlat,ny -z z\n");
+  printf("\t                     [-c ge/gd][-f fields][-e encoding][-j N] -o out.bin\n");
+  printf("\t       sfcvm_extract -m section -p lon,lat,lon,lat[,...] -s spacing -z z0,dz,nz\n");
+  printf("\t                     [-c ge/gd][-f fields][-e encoding][-j N] -o out.bin\n");
+  printf("\t       sfcvm_extract -m site -x lon0,dlon,nx -y lat0,dlat,ny [-d dz,zmax][-j N] -o out.bin\n");
+  printf("\t       sfcvm_extract -m stats -x lon0,dlon,nx -y lat0,dlat,ny -z z0,dz,nz [-b levels]\n");
+  printf("\t                     [-H lo,hi,nbins][-c ge/gd][-f fields][-j N][-o out.txt]\n");
+  printf("\t       sfcvm_extract -m octree -x x0,size,nx -y y0,size,ny -z z0,size,nz -F fmax[,ppw[,vsmin]]\n");
+  printf("\t                     [-L level][-j N] -o out.oct\n");
+  printf("\t       sfcvm_extract -m cells [-n order][-j N][-o out.txt] < boxes.in\n");
+  printf("\t       sfcvm_extract -m native -g label -z z0,dz,nz [-w i0,ni,j0,nj][-f fields][-e encoding]\n");
+  printf("\t                     [-j N] -o out.bin\n");
+  printf("\t       sfcvm_extract -m paths [-j N][-o out.txt] < paths.in\n\n");
+  printf("Flags:\n");
+  printf("\t-m product, slice is a lon/lat lattice at one depth or elevation,\n");
+  printf("\t   section is a vertical section under a polyline, site is a map of\n");
+  printf("\t   vs30, z1.0 and z2.5, stats are min, max, mean and percentiles\n");
+  printf("\t   over a volume, octree is a mesh refined to the shortest wavelength,\n");
+  printf("\t   cells are vp, vs and rho averaged over boxes read as lines of\n");
+  printf("\t   x0 x1 y0 y1 depth0 depth1, followed by the fraction in the model,\n");
+  printf("\t   native is the lattice of a data file at depths below the surface,\n");
+  printf("\t   paths are length, length outside, P and S travel time and samples\n");
+  printf("\t   of paths read as lines of UTM x y depth vertices\n\n");
+  printf("\t-x -y lattice, first value, spacing and count\n\n");
+  printf("\t-z depth (gd) or elevation (ge) of the slice in meters, or first, spacing\n");
+  printf("\t   and count of the section or volume depths\n\n");
+  printf("\t-p polyline vertices of the section\n\n");
+  printf("\t-s distance between section stations in meters\n\n");
+  printf("\t-d depth step and deepest depth of the z1.0/z2.5 search, default 10,10000\n\n");
+  printf("\t-b levels per depth band of the stats, default all levels in one band\n\n");
+  printf("\t-H histogram range and bins of the stats, the histogram is printed too\n\n");
+  printf("\t-F octree frequency in Hz, cells per wavelength (default 8) and Vs floor\n");
+  printf("\t   (default 100), the octree -x -y are UTM meters and -z depths, the spacing\n");
+  printf("\t   is the edge of the root cells\n\n");
+  printf("\t-L deepest octree level, default 10\n\n");
+  printf("\t-n sub-samples per edge of a cell, default 3\n\n");
+  printf("\t-g label of the data file whose GRID the native lattice is\n\n");
+  printf("\t-w window of the native lattice, first node and count along x and y\n\n");
+  printf("\t-f comma separated fields out of vp,vs,rho,zone_id, default vp,vs,rho\n\n");
+  printf("\t-e band encoding of slice, section and native, float32 (default) or\n");
+  printf("\t   uint16[,scale[,offset]] storing round((v-offset)/scale) with 65535 outside\n");
+  printf("\t   the model, default scale 1 and offset 0, and zone_id as uint8\n\n");
+  printf("\t-j number of forked worker processes, default $SFCVM_NUM_WORKERS or the cores\n\n");
+  printf("\t-o output raster, a sfcvm_raster_header_t and one band per field,\n");
+  printf("\t   stats, cells and paths are text and go to stdout by default\n\n");
+  printf("\t-h usage\n\n");
+}
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+/* Slice product */
+int _extract_slice(sfcvm_slice_t *slice, int fields, const sfcvm_encoding_t *enc, int njobs, const char *outfile) {
+        sfcvm_raster_header_t hdr;
+        size_t n=sfcvm_encoded_size(fields, enc)*slice->nx*slice->ny;
+        void *out=malloc(n);
+        if(out == NULL) {
+          fprintf(stderr,"sfcvm_extract: failed to allocate output\n");
+          return 1;
+        }
+        if(sfcvm_extract_slice_encoded(NULL, slice, fields, enc, out, njobs) != UCVM_MODEL_CODE_SUCCESS) {
+          fprintf(stderr,"sfcvm_extract: slice extraction failed\n");
+          free(out);
+          return 1;
+        }
+        sfcvm_slice_header(slice, fields, &hdr);
+        sfcvm_raster_encoding(&hdr, enc);
+        int rc=sfcvm_raster_write(outfile, &hdr, out);
+        if(rc != UCVM_MODEL_CODE_SUCCESS) fprintf(stderr,"sfcvm_extract: unable to write %s\n", outfile);
+        free(out);
+        return (rc == UCVM_MODEL_CODE_SUCCESS) ? 0 : 1;
+}
+
+/* Section product, the stations follow the bands */
+int _extract_section(sfcvm_section_t *section, int fields, const sfcvm_encoding_t *enc, int njobs,
+                     const char *outfile) {
+        sfcvm_raster_header_t hdr;
+        int ns=sfcvm_section_stations(section, NULL, NULL);
+        size_t n=sfcvm_encoded_size(fields, enc)*ns*section->nz;
+        void *out=malloc(n);
+        double *lon=(double *)malloc(ns*sizeof(double));
+        double *lat=(double *)malloc(ns*sizeof(double));
+        int rc=UCVM_MODEL_CODE_ERROR;
+        if(out == NULL || lon == NULL || lat == NULL) {
+          fprintf(stderr,"sfcvm_extract: failed to allocate output\n");
+          } else if(sfcvm_extract_section_encoded(NULL, section, fields, enc, out, njobs) != UCVM_MODEL_CODE_SUCCESS) {
+            fprintf(stderr,"sfcvm_extract: section extraction failed\n");
+          } else {
+            sfcvm_section_stations(section, lon, lat);
+            sfcvm_section_header(section, fields, &hdr);
+            sfcvm_raster_encoding(&hdr, enc);
+            rc=sfcvm_raster_write(outfile, &hdr, out);
+            if(rc == UCVM_MODEL_CODE_SUCCESS) rc=sfcvm_raster_write_stations(outfile, lon, lat, ns);
+            if(rc != UCVM_MODEL_CODE_SUCCESS) fprintf(stderr,"sfcvm_extract: unable to write %s\n", outfile);
+        }
+        free(out);
+        free(lon);
+        free(lat);
+        return (rc == UCVM_MODEL_CODE_SUCCESS) ? 0 : 1;
+}
+
+/* Site parameter map */
+int _extract_site(sfcvm_slice_t *lattice, sfcvm_site_opts_t *opts, int njobs, const char *outfile) {
+        sfcvm_raster_header_t hdr;
+        float *out=(float *)malloc((size_t)3*lattice->nx*lattice->ny*sizeof(float));
+        if(out == NULL) {
+          fprintf(stderr,"sfcvm_extract: failed to allocate output\n");
+          return 1;
+        }
+        if(sfcvm_extract_site_map(NULL, lattice, opts, out, njobs) != UCVM_MODEL_CODE_SUCCESS) {
+          fprintf(stderr,"sfcvm_extract: site map extraction failed\n");
+          free(out);
+          return 1;
+        }
+        sfcvm_site_map_header(lattice, &hdr);
+        int rc=sfcvm_raster_write(outfile, &hdr, out);
+        if(rc != UCVM_MODEL_CODE_SUCCESS) fprintf(stderr,"sfcvm_extract: unable to write %s\n", outfile);
+        free(out);
+        return (rc == UCVM_MODEL_CODE_SUCCESS) ? 0 : 1;
+}
+
+/* Volume stats, one line per band and field, then the histograms if asked for */
+int _extract_stats(sfcvm_volume_t *vol, int fields, int band_levels, double *hist, int njobs, const char *outfile) {
+        int fid[4], nf=0;
+        for(int i=0; i<4; i++) {
+          if(fields & (1<<i)) fid[nf++]=i;
+        }
+        int nb=sfcvm_reduce_bands(vol, band_levels);
+        int per=(band_levels > 0 && band_levels < vol->nz) ? band_levels : vol->nz;
+        sfcvm_reduction_t *red=(sfcvm_reduction_t *)malloc(nb*nf*sizeof(sfcvm_reduction_t));
+        FILE *fp=stdout;
+
+        if(red == NULL) {
+          fprintf(stderr,"sfcvm_extract: failed to allocate output\n");
+          return 1;
+        }
+        for(int r=0; r<nb*nf; r++) {
+          if(hist != NULL) sfcvm_reduction_init(&red[r], hist[0], hist[1], (int)hist[2]);
+            else sfcvm_reduction_init(&red[r], sfcvm_extract_stats_range[fid[r%nf]][0],
+                                      sfcvm_extract_stats_range[fid[r%nf]][1], SFCVM_EXTRACT_STATS_BINS);
+        }
+        if(sfcvm_reduce_volume(NULL, vol, fields, band_levels, red, njobs) != UCVM_MODEL_CODE_SUCCESS) {
+          fprintf(stderr,"sfcvm_extract: volume reduction failed\n");
+          free(red);
+          return 1;
+        }
+        if(outfile != NULL && (fp=fopen(outfile, "w")) == NULL) {
+          fprintf(stderr,"sfcvm_extract: unable to write %s\n", outfile);
+          free(red);
+          return 1;
+        }
+
+        fprintf(fp, "# z_first z_last field count nodata min max mean p1 p5 p50 p95 p99\n");
+        for(int r=0; r<nb*nf; r++) {
+          int first=(r/nf)*per;
+          int last=(first+per < vol->nz) ? first+per-1 : vol->nz-1;
+          fprintf(fp, "%.2f %.2f %s %ld %ld %.4f %.4f %.4f %.4f %.4f %.4f %.4f %.4f\n",
+                  vol->z0+first*vol->dz, vol->z0+last*vol->dz, sfcvm_extract_stats_names[fid[r%nf]],
+                  red[r].count, red[r].nodata, red[r].count ? red[r].min : -1.0, red[r].count ? red[r].max : -1.0,
+                  sfcvm_reduction_mean(&red[r]), sfcvm_reduction_percentile(&red[r], 1),
+                  sfcvm_reduction_percentile(&red[r], 5), sfcvm_reduction_percentile(&red[r], 50),
+                  sfcvm_reduction_percentile(&red[r], 95), sfcvm_reduction_percentile(&red[r], 99));
+        }
+        if(hist != NULL) {
+          fprintf(fp, "# z_first field bin_lo bin_hi count\n");
+          for(int r=0; r<nb*nf; r++) {
+            double w=(red[r].hi-red[r].lo)/red[r].nbins;
+            for(int k=0; k<red[r].nbins; k++) {
+              fprintf(fp, "%.2f %s %.4f %.4f %ld\n", vol->z0+(r/nf)*per*vol->dz, sfcvm_extract_stats_names[fid[r%nf]],
+                      red[r].lo+k*w, red[r].lo+(k+1)*w, red[r].bins[k]);
+            }
+          }
+        }
+
+        if(fp != stdout) fclose(fp);
+        free(red);
+        return 0;
+}
+
+/* Octree mesh */
+int _extract_octree(sfcvm_octree_t *oct, int njobs, const char *outfile) {
+        long nleaves;
+        if(sfcvm_extract_octree(NULL, oct, outfile, njobs, &nleaves) != UCVM_MODEL_CODE_SUCCESS) {
+          fprintf(stderr,"sfcvm_extract: octree extraction failed\n");
+          return 1;
+        }
+        fprintf(stderr,"sfcvm_extract: %ld leaves\n", nleaves);
+        return 0;
+}
+
+/* Cell averages of the boxes on stdin */
+int _extract_cells(int order, int njobs, const char *outfile) {
+        sfcvm_element_t *el=NULL;
+        int n=0, cap=0;
+        double b[6];
+        FILE *fp=stdout;
+
+        while(scanf("%lf %lf %lf %lf %lf %lf", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) == 6) {
+          if(n == cap) {
+            cap=(cap > 0) ? 2*cap : 1024;
+            sfcvm_element_t *e=(sfcvm_element_t *)realloc(el, cap*sizeof(sfcvm_element_t));
+            if(e == NULL) {
+              fprintf(stderr,"sfcvm_extract: failed to allocate input\n");
+              free(el);
+              return 1;
+            }
+            el=e;
+          }
+          sfcvm_element_box(&el[n++], b[0], b[1], b[2], b[3], b[4], b[5]);
+        }
+        if(n == 0) {
+          free(el);
+          return 0;
+        }
+
+        sfcvm_properties_t *data=(sfcvm_properties_t *)malloc(n*sizeof(sfcvm_properties_t));
+        double *coverage=(double *)malloc(n*sizeof(double));
+        int rc=1;
+        if(data == NULL || coverage == NULL) {
+          fprintf(stderr,"sfcvm_extract: failed to allocate output\n");
+          } else if(sfcvm_cell_average(NULL, el, n, order, data, coverage, njobs) != UCVM_MODEL_CODE_SUCCESS) {
+            fprintf(stderr,"sfcvm_extract: cell average failed\n");
+          } else if(outfile != NULL && (fp=fopen(outfile, "w")) == NULL) {
+            fprintf(stderr,"sfcvm_extract: unable to write %s\n", outfile);
+          } else {
+            for(int i=0; i<n; i++) {
+              fprintf(fp, "%.4f %.4f %.4f %.4f\n", data[i].vp, data[i].vs, data[i].rho, coverage[i]);
+            }
+            if(fp != stdout) fclose(fp);
+            rc=0;
+        }
+        free(el);
+        free(data);
+        free(coverage);
+        return rc;
+}
+
+/* Native lattice of a data file */
+int _extract_native(const char *label, int *window, double z0, double dz, int nz, int fields,
+                    const sfcvm_encoding_t *enc, int njobs, const char *outfile) {
+        sfcvm_grid_t grid;
+        double gridheight;
+        if(sfcvm_native_grid(label, &grid, &gridheight) != UCVM_MODEL_CODE_SUCCESS) {
+          fprintf(stderr,"sfcvm_extract: no data file %s with a GRID\n", label);
+          return 1;
+        }
+        if(window != NULL) {
+          if(window[0] < 0 || window[1] < 1 || window[0]+window[1] > grid.nx ||
+             window[2] < 0 || window[3] < 1 || window[2]+window[3] > grid.ny) {
+            fprintf(stderr,"sfcvm_extract: window is off the %dx%d lattice of %s\n", grid.nx, grid.ny, label);
+            return 1;
+          }
+          // move the origin to the first node of the window
+          double az=grid.azimuth*M_PI/180, u=window[0]*grid.dx, v=window[2]*grid.dy;
+          grid.x0+=u*cos(az)+v*sin(az);
+          grid.y0+=-u*sin(az)+v*cos(az);
+          grid.nx=window[1];
+          grid.ny=window[3];
+        }
+        if(gridheight > 0 && fmod(dz, gridheight) != 0) {
+          fprintf(stderr,"sfcvm_extract: %g m levels are off the %g m grid of %s\n", dz, gridheight, label);
+        }
+        if(sfcvm_extract_native(NULL, &grid, z0, dz, nz, fields, enc, outfile, njobs) != UCVM_MODEL_CODE_SUCCESS) {
+          fprintf(stderr,"sfcvm_extract: native extraction failed\n");
+          return 1;
+        }
+        return 0;
+}
+
+/* Travel times of the paths on stdin, a line of x y depth triples per path */
+int _extract_paths(int njobs, const char *outfile) {
+        sfcvm_path_t *path=NULL;
+        double *vert=NULL;
+        int *first=NULL;
+        int n=0, cap=0, nv=0, vcap=0, rc=1;
+        char *line=NULL;
+        size_t len=0;
+        FILE *fp=stdout;
+
+        while(getline(&line, &len, stdin) > 0) {
+          char *p=line, *end;
+          int k=0;
+          if(n == cap) {
+            cap=(cap > 0) ? 2*cap : 1024;
+            int *f=(int *)realloc(first, (cap+1)*sizeof(int));
+            if(f == NULL) break;
+            first=f;
+          }
+          first[n]=nv;
+          for(double v=strtod(p, &end); end != p; v=strtod(p, &end)) {
+            if(3*nv+k == vcap) {
+              vcap=(vcap > 0) ? 2*vcap : 3*4096;
+              double *d=(double *)realloc(vert, vcap*sizeof(double));
+              if(d == NULL) break;
+              vert=d;
+            }
+            vert[3*nv+k]=v;
+            if(++k == 3) {
+              k=0;
+              nv++;
+            }
+            p=end;
+          }
+          if(nv > first[n]) n++;
+        }
+        free(line);
+        if(n == 0) {
+          free(vert);
+          free(first);
+          return 0;
+        }
+
+        // vertices are x y depth triples, each path takes a strided view of them
+        double *x=(double *)malloc(nv*sizeof(double));
+        double *y=(double *)malloc(nv*sizeof(double));
+        double *depth=(double *)malloc(nv*sizeof(double));
+        path=(sfcvm_path_t *)malloc(n*sizeof(sfcvm_path_t));
+        sfcvm_path_result_t *result=(sfcvm_path_result_t *)malloc(n*sizeof(sfcvm_path_result_t));
+        if(x == NULL || y == NULL || depth == NULL || path == NULL || result == NULL) {
+          fprintf(stderr,"sfcvm_extract: failed to allocate paths\n");
+        } else {
+          for(int v=0; v<nv; v++) {
+            x[v]=vert[3*v];
+            y[v]=vert[3*v+1];
+            depth[v]=vert[3*v+2];
+          }
+          first[n]=nv;
+          for(int i=0; i<n; i++) {
+            path[i].nvert=first[i+1]-first[i];
+            path[i].x=&x[first[i]];
+            path[i].y=&y[first[i]];
+            path[i].depth=&depth[first[i]];
+          }
+          if(sfcvm_path_trace(NULL, path, n, result, njobs) != UCVM_MODEL_CODE_SUCCESS) {
+            fprintf(stderr,"sfcvm_extract: path tracing failed\n");
+            } else if(outfile != NULL && (fp=fopen(outfile, "w")) == NULL) {
+              fprintf(stderr,"sfcvm_extract: unable to write %s\n", outfile);
+            } else {
+              for(int i=0; i<n; i++) {
+                fprintf(fp, "%.4f %.4f %.6f %.6f %d\n", result[i].length, result[i].outside,
+                        result[i].tp, result[i].ts, result[i].nsamples);
+              }
+              if(fp != stdout) fclose(fp);
+              rc=0;
+          }
+        }
+        free(vert);
+        free(first);
+        free(x);
+        free(y);
+        free(depth);
+        free(path);
+        free(result);
+        return rc;
+}
+
+/* Parses lon,lat,lon,lat,... into the vertices, returns their number */
+int _parse_polyline(char *str, double *lon, double *lat) {
+        int n=0, k=0;
+        for(char *tok=strtok(str, ","); tok != NULL; tok=strtok(NULL, ",")) {
+          if(n >= SFCVM_EXTRACT_MAX_VERTICES) return 0;
+          if(k == 0) lon[n]=atof(tok);
+            else lat[n++]=atof(tok);
+          k=!k;
+        }
+        return k ? 0 : n;
+}
+
+/**
+ * Extracts one product from SFCVM.
+ *
+ * @param argc The number of arguments.
+ * @param argv The argument strings.
+ * @return A zero value indicating success.
+ */
+int main(int argc, char* const argv[]) {
+
+        sfcvm_slice_t slice;
+        sfcvm_section_t section;
+        sfcvm_site_opts_t site_opts;
+        sfcvm_volume_t vol;
+        sfcvm_octree_t oct;
+        double hist[3];
+        int hist_set=0;
+        int band_levels=0;
+        int order=SFCVM_EXTRACT_CELL_ORDER;
+        char *label=NULL;
+        int window[4];
+        int window_set=0;
+        double plon[SFCVM_EXTRACT_MAX_VERTICES], plat[SFCVM_EXTRACT_MAX_VERTICES];
+        char *mode=NULL;
+        char *outfile=NULL;
+        int fields=SFCVM_FIELDS_DEFAULT;
+        sfcvm_encoding_t enc = { SFCVM_ENCODING_FLOAT32, 1.0, 0.0 };
+        int njobs=sfcvm_parallel_workers();
+        int gridset=0;
+        int rc=1;
+        int opt;
+
+        memset(&slice, 0, sizeof(slice));
+        memset(&section, 0, sizeof(section));
+        slice.zmode=SFCVM_ZMODE_DEPTH;
+        site_opts.dz=SFCVM_SITE_DZ;
+        site_opts.zmax=SFCVM_SITE_ZMAX;
+        site_opts.vs30_layers=SFCVM_SITE_VS30_LAYERS;
+        memset(&oct, 0, sizeof(oct));
+        oct.ppw=SFCVM_EXTRACT_OCTREE_PPW;
+        oct.vs_floor=SFCVM_EXTRACT_OCTREE_VS_FLOOR;
+        oct.max_level=SFCVM_EXTRACT_OCTREE_LEVEL;
+
+        /* Parse options */
+        while ((opt = getopt(argc, argv, "hm:x:y:z:p:s:d:b:H:F:L:n:g:w:c:f:e:j:o:")) != -1) {
+          switch (opt) {
+          case 'm':
+            mode=optarg;
+            break;
+          case 'x':
+            if(sscanf(optarg, "%lf,%lf,%d", &slice.lon0, &slice.dlon, &slice.nx) == 3) gridset |= 1;
+            break;
+          case 'y':
+            if(sscanf(optarg, "%lf,%lf,%d", &slice.lat0, &slice.dlat, &slice.ny) == 3) gridset |= 2;
+            break;
+          case 'z':
+            if(sscanf(optarg, "%lf,%lf,%d", &section.z0, &section.dz, &section.nz) == 3) gridset |= 8;
+            if(sscanf(optarg, "%lf", &slice.z) == 1) gridset |= 4;
+            break;
+          case 'p':
+            section.lon=plon;
+            section.lat=plat;
+            section.nvert=_parse_polyline(optarg, plon, plat);
+            if(section.nvert > 0) gridset |= 16;
+            break;
+          case 's':
+            if(sscanf(optarg, "%lf", &section.spacing) == 1 && section.spacing > 0) gridset |= 32;
+            break;
+          case 'd':
+            if(sscanf(optarg, "%lf,%lf", &site_opts.dz, &site_opts.zmax) != 2 || site_opts.dz <= 0) {
+              usage();
+              exit(1);
+            }
+            break;
+          case 'b':
+            band_levels=atoi(optarg);
+            break;
+          case 'H':
+            if(sscanf(optarg, "%lf,%lf,%lf", &hist[0], &hist[1], &hist[2]) != 3 || hist[1] <= hist[0] ||
+               hist[2] < 1 || hist[2] > SFCVM_REDUCE_MAX_BINS) {
+              usage();
+              exit(1);
+            }
+            hist_set=1;
+            break;
+          case 'F':
+            if(sscanf(optarg, "%lf,%lf,%lf", &oct.fmax, &oct.ppw, &oct.vs_floor) < 1 || oct.fmax <= 0 || oct.ppw <= 0) {
+              usage();
+              exit(1);
+            }
+            break;
+          case 'L':
+            oct.max_level=atoi(optarg);
+            break;
+          case 'n':
+            order=atoi(optarg);
+            if(order < 1 || order > SFCVM_CELL_MAX_ORDER) {
+              usage();
+              exit(1);
+            }
+            break;
+          case 'g':
+            label=optarg;
+            break;
+          case 'w':
+            if(sscanf(optarg, "%d,%d,%d,%d", &window[0], &window[1], &window[2], &window[3]) != 4) {
+              usage();
+              exit(1);
+            }
+            window_set=1;
+            break;
+          case 'c':
+            if (strcasecmp(optarg, "gd") == 0) {
+              slice.zmode = SFCVM_ZMODE_DEPTH;
+            } else if (strcasecmp(optarg, "ge") == 0) {
+              slice.zmode = SFCVM_ZMODE_ELEVATION;
+            }
+            break;
+          case 'f':
+            fields=sfcvm_field_parse(optarg);
+            if(fields == 0) {
+              fprintf(stderr,"sfcvm_extract: unknown field in %s\n", optarg);
+              exit(1);
+            }
+            break;
+          case 'e':
+            if(sfcvm_encoding_parse(optarg, &enc) != UCVM_MODEL_CODE_SUCCESS) {
+              fprintf(stderr,"sfcvm_extract: unknown encoding %s\n", optarg);
+              exit(1);
+            }
+            break;
+          case 'j':
+            njobs=atoi(optarg);
+            if(njobs < 1) njobs=1;
+            if(njobs > SFCVM_EXTRACT_MAX_JOBS) njobs=SFCVM_EXTRACT_MAX_JOBS;
+            break;
+          case 'o':
+            outfile=optarg;
+            break;
+          case 'h':
+            usage();
+            exit(0);
+            break;
+          default: /* '?' */
+            usage();
+            exit(1);
+          }
+        }
+        if(mode == NULL || (outfile == NULL && strcmp(mode, "stats") != 0 && strcmp(mode, "cells") != 0 &&
+                             strcmp(mode, "paths") != 0)) {
+          usage();
+          exit(1);
+        }
+
+	// Initialize the model.
+        // try to use Use UCVM_INSTALL_PATH
+        char *envstr=getenv("UCVM_INSTALL_PATH");
+        if(envstr != NULL) {
+	   assert(sfcvm_init(envstr, "sfcvm") == 0);
+           } else {
+	     assert(sfcvm_init("..", "sfcvm") == 0);
+        }
+
+        if(strcmp(mode, "slice") == 0) {
+          if(gridset != 7) {
+            usage();
+            exit(1);
+          }
+          rc=_extract_slice(&slice, fields, &enc, njobs, outfile);
+          } else if(strcmp(mode, "section") == 0) {
+            if((gridset & (8|16|32)) != (8|16|32)) {
+              usage();
+              exit(1);
+            }
+            section.zmode=slice.zmode;
+            rc=_extract_section(&section, fields, &enc, njobs, outfile);
+          } else if(strcmp(mode, "site") == 0) {
+            if((gridset & 3) != 3) {
+              usage();
+              exit(1);
+            }
+            rc=_extract_site(&slice, &site_opts, njobs, outfile);
+          } else if(strcmp(mode, "stats") == 0) {
+            if((gridset & (1|2|8)) != (1|2|8)) {
+              usage();
+              exit(1);
+            }
+            vol.lon0=slice.lon0;
+            vol.dlon=slice.dlon;
+            vol.nx=slice.nx;
+            vol.lat0=slice.lat0;
+            vol.dlat=slice.dlat;
+            vol.ny=slice.ny;
+            vol.z0=section.z0;
+            vol.dz=section.dz;
+            vol.nz=section.nz;
+            vol.zmode=slice.zmode;
+            rc=_extract_stats(&vol, fields, band_levels, hist_set ? hist : NULL, njobs, outfile);
+          } else if(strcmp(mode, "octree") == 0) {
+            if((gridset & (1|2|8)) != (1|2|8) || oct.fmax <= 0 ||
+               slice.dlon != section.dz || slice.dlat != section.dz) {
+              usage();
+              exit(1);
+            }
+            oct.x0=slice.lon0;
+            oct.y0=slice.lat0;
+            oct.z0=section.z0;
+            oct.size=section.dz;
+            oct.nx=slice.nx;
+            oct.ny=slice.ny;
+            oct.nz=section.nz;
+            rc=_extract_octree(&oct, njobs, outfile);
+          } else if(strcmp(mode, "cells") == 0) {
+            rc=_extract_cells(order, njobs, outfile);
+          } else if(strcmp(mode, "native") == 0) {
+            if(label == NULL || !(gridset & 8)) {
+              usage();
+              exit(1);
+            }
+            rc=_extract_native(label, window_set ? window : NULL, section.z0, section.dz, section.nz, fields, &enc,
+                               njobs, outfile);
+          } else if(strcmp(mode, "paths") == 0) {
+            rc=_extract_paths(njobs, outfile);
+          } else {
+            fprintf(stderr,"sfcvm_extract: unknown product %s\n", mode);
+        }
+
+	assert(sfcvm_finalize() == 0);
+	return rc;
+}
@@ -0,0 +1,344 @@
+/*
+ * @file sfcvm_extract_mpi.c
+ * @brief MPI parallel volume extraction through libsfcvm.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Extracts a regular lon/lat/depth grid, or a binary point file, across
+ * MPI ranks and writes vp, vs, rho (3 doubles per point) into a single
+ * output file with collective MPI-IO.
+ *
+ * Grid output is ordered column by column with depth fastest,
+ *    index = ((iy * nx) + ix) * nz + iz
+ * so every rank owns one contiguous range of columns and of the file.
+ * A point file holds 3 doubles per point (lon lat depth, as sfcvm_point_t)
+ * and the output keeps its order.
+ *
+ * Work is split by estimated cost rather than by point count: each rank
+ * classifies an equal share of the columns (or blocks of points) from the
+ * model surface, the costs are gathered, and the ranges are cut at equal
+ * shares of the total cost, see sfcvm_point_cost. Columns under water
+ * pay for the step down search and are weighted accordingly.
+ *
+ *   mpirun -np 4 sfcvm_extract_mpi -x -122.5,0.01,100 -y 37.5,0.01,100 -z 0,100,50 -o out.bin
+ *
+ */
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <mpi.h>
+#include "ucvm_model_dtypes.h"
+#include "sfcvm.h"
+#include "sfcvm_parallel.h"
+
+/* number of points queried and written at a time */
+#define EXTRACT_BATCH 4096
+/* points of a point file that share one cost estimate */
+#define EXTRACT_POINT_BLOCK 64
+
+typedef struct extract_grid_t {
+        double lon0, dlon;
+        double lat0, dlat;
+        double z0, dz;
+        int nx, ny, nz;
+} extract_grid_t;
+
+int extract_rank=0;
+int extract_size=1;
+
+/* Usage function */
+void usage() {
+  if(extract_rank != 0) return;
+  printf("     sfcvm_extract_mpi - (c) SCEC\n");
+  printf("Extract a volume from SFCVM across MPI ranks\n");
+  printf("\tusage: sfcvm_extract_mpi [-x lon0,dlon,nx -y lat0,dlat,ny -z z0,dz,nz | -p points.bin]\n");
+  printf("\t                         [-c ge/gd] -o out.bin\n\n");
+  printf("Flags:\n");
+  printf("\t-x -y -z regular grid, z is depth (gd) or elevation (ge)\n\n");
+  printf("\t-p binary point file, 3 doubles lon lat z per point\n\n");
+  printf("\t-o output file, 3 doubles vp vs rho per point\n\n");
+  printf("\t-h usage\n\n");
+}
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+/**
+ * Cuts nunits work units into contiguous per-rank ranges of equal cost.
+ * Every rank estimates an equal share of the units, then all costs are
+ * gathered so every rank computes the same cut.
+ *
+ * @param nunits Number of work units.
+ * @param unit_lonlat Returns the location representing a unit.
+ * @param arg Passed to unit_lonlat.
+ * @param first Returns the first unit of this rank.
+ * @param last Returns one past the last unit of this rank.
+ * @return 0 on success, 1 when the buffers could not be allocated.
+ */
+int _partition(long nunits, void (*unit_lonlat)(long, void *, double *, double *), void *arg,
+               long *first, long *last) {
+        int *counts=(int *)malloc(extract_size*sizeof(int));
+        int *displs=(int *)malloc(extract_size*sizeof(int));
+        double *cost=(double *)malloc(nunits*sizeof(double));
+        if(counts == NULL || displs == NULL || cost == NULL) {
+          free(counts);
+          free(displs);
+          free(cost);
+          return 1;
+        }
+
+        for(int r=0; r<extract_size; r++) {
+          long u0=nunits*r/extract_size;
+          long u1=nunits*(r+1)/extract_size;
+          displs[r]=(int)u0;
+          counts[r]=(int)(u1-u0);
+        }
+        for(long u=displs[extract_rank]; u<displs[extract_rank]+counts[extract_rank]; u++) {
+          double lon, lat;
+          unit_lonlat(u, arg, &lon, &lat);
+          cost[u]=sfcvm_point_cost(lon, lat);
+        }
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                       cost, counts, displs, MPI_DOUBLE, MPI_COMM_WORLD);
+
+        double total=0;
+        for(long u=0; u<nunits; u++) total += cost[u];
+        if(total <= 0) total=1;
+
+        // unit u goes to the rank whose share holds the middle of its cost
+        double sum=0;
+        *first=nunits;
+        *last=nunits;
+        for(long u=0; u<nunits; u++) {
+          int r=(int)((sum + cost[u]/2) / total * extract_size);
+          if(r >= extract_size) r=extract_size-1;
+          if(r == extract_rank && *first == nunits) *first=u;
+          if(r > extract_rank) { *last=u; break; }
+          sum += cost[u];
+        }
+        if(*first == nunits) *last=nunits;
+
+        free(counts);
+        free(displs);
+        free(cost);
+        return 0;
+}
+
+void _grid_lonlat(long u, void *arg, double *lon, double *lat) {
+        extract_grid_t *g=(extract_grid_t *)arg;
+        *lon=g->lon0 + (u % g->nx) * g->dlon;
+        *lat=g->lat0 + (u / g->nx) * g->dlat;
+}
+
+void _points_lonlat(long u, void *arg, double *lon, double *lat) {
+        sfcvm_point_t pt;
+        MPI_File fh=*(MPI_File *)arg;
+        MPI_Status status;
+        int got=0;
+        if(MPI_File_read_at(fh, (MPI_Offset)u*EXTRACT_POINT_BLOCK*sizeof(sfcvm_point_t),
+                            &pt, 3, MPI_DOUBLE, &status) != MPI_SUCCESS ||
+           MPI_Get_count(&status, MPI_DOUBLE, &got) != MPI_SUCCESS || got != 3) {
+          fprintf(stderr,"[%d] failed to read point %ld\n", extract_rank, u*EXTRACT_POINT_BLOCK);
+          MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        *lon=pt.longitude;
+        *lat=pt.latitude;
+}
+
+/* Queries a batch and packs vp, vs, rho for output, the surface is looked up once per column */
+void _query_batch(sfcvm_point_t *pts, sfcvm_properties_t *props, double *out, int cnt, int zmode) {
+        if(zmode == UCVM_MODEL_COORD_GEO_ELEV) {
+          double surface=0, top;
+          int found=0;
+          for(int i=0; i<cnt; i++) {
+            if(i == 0 || pts[i].longitude != pts[i-1].longitude || pts[i].latitude != pts[i-1].latitude) {
+              found=(sfcvm_getsurface(pts[i].longitude, pts[i].latitude, &surface, &top) == 0);
+            }
+            if(found) pts[i].depth = surface - pts[i].depth;
+          }
+        }
+        if(sfcvm_query(pts, props, cnt) != UCVM_MODEL_CODE_SUCCESS) {
+          fprintf(stderr,"[%d] query failed\n", extract_rank);
+          MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        for(int i=0; i<cnt; i++) {
+          out[3*i]=props[i].vp;
+          out[3*i+1]=props[i].vs;
+          out[3*i+2]=props[i].rho;
+        }
+}
+
+/**
+ * Extracts a grid or point file across MPI ranks.
+ *
+ * @param argc The number of arguments.
+ * @param argv The argument strings.
+ * @return A zero value indicating success.
+ */
+int main(int argc, char **argv) {
+
+        extract_grid_t grid;
+        char *pointfile=NULL;
+        char *outfile=NULL;
+        int zmode=UCVM_MODEL_COORD_GEO_DEPTH;
+        int gridset=0;
+        int opt;
+
+        MPI_Init(&argc, &argv);
+        MPI_Comm_rank(MPI_COMM_WORLD, &extract_rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &extract_size);
+
+        memset(&grid, 0, sizeof(grid));
+        /* Parse options */
+        while ((opt = getopt(argc, argv, "hx:y:z:p:o:c:")) != -1) {
+          switch (opt) {
+          case 'x':
+            if(sscanf(optarg, "%lf,%lf,%d", &grid.lon0, &grid.dlon, &grid.nx) == 3) gridset |= 1;
+            break;
+          case 'y':
+            if(sscanf(optarg, "%lf,%lf,%d", &grid.lat0, &grid.dlat, &grid.ny) == 3) gridset |= 2;
+            break;
+          case 'z':
+            if(sscanf(optarg, "%lf,%lf,%d", &grid.z0, &grid.dz, &grid.nz) == 3) gridset |= 4;
+            break;
+          case 'p':
+            pointfile=optarg;
+            break;
+          case 'o':
+            outfile=optarg;
+            break;
+          case 'c':
+            if (strcasecmp(optarg, "gd") == 0) {
+              zmode = UCVM_MODEL_COORD_GEO_DEPTH;
+            } else if (strcasecmp(optarg, "ge") == 0) {
+              zmode = UCVM_MODEL_COORD_GEO_ELEV;
+            }
+            break;
+          case 'h':
+          default: /* '?' */
+            usage();
+            MPI_Finalize();
+            exit(opt == 'h' ? 0 : 1);
+          }
+        }
+        if(outfile == NULL || (gridset != 7 && pointfile == NULL)) {
+          usage();
+          MPI_Finalize();
+          exit(1);
+        }
+
+        char *envstr=getenv("UCVM_INSTALL_PATH");
+        int rc;
+        if(envstr != NULL) {
+          rc=sfcvm_init(envstr, "sfcvm");
+          } else {
+            rc=sfcvm_init("..", "sfcvm");
+        }
+        if(rc != UCVM_MODEL_CODE_SUCCESS) {
+          fprintf(stderr,"[%d] failed to load the model\n", extract_rank);
+          MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        double t0=MPI_Wtime();
+
+        MPI_File in=MPI_FILE_NULL;
+        MPI_File out;
+        long npoints, first, last;
+        long pfirst, plast;
+        if(pointfile != NULL) {
+          MPI_Offset sz;
+          if(MPI_File_open(MPI_COMM_WORLD, pointfile, MPI_MODE_RDONLY, MPI_INFO_NULL, &in) != MPI_SUCCESS) {
+            if(extract_rank == 0) fprintf(stderr,"unable to open %s\n", pointfile);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+          }
+          MPI_File_get_size(in, &sz);
+          npoints=sz/sizeof(sfcvm_point_t);
+          long nblocks=(npoints+EXTRACT_POINT_BLOCK-1)/EXTRACT_POINT_BLOCK;
+          if(_partition(nblocks, _points_lonlat, &in, &first, &last) != 0) {
+            fprintf(stderr,"[%d] failed to partition the points\n", extract_rank);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+          }
+          pfirst=first*EXTRACT_POINT_BLOCK;
+          plast=last*EXTRACT_POINT_BLOCK;
+          if(plast > npoints) plast=npoints;
+          if(pfirst > npoints) pfirst=npoints;
+          } else {
+            npoints=(long)grid.nx*grid.ny*grid.nz;
+            if(_partition((long)grid.nx*grid.ny, _grid_lonlat, &grid, &first, &last) != 0) {
+              fprintf(stderr,"[%d] failed to partition the grid\n", extract_rank);
+              MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            pfirst=first*grid.nz;
+            plast=last*grid.nz;
+        }
+
+        if(MPI_File_open(MPI_COMM_WORLD, outfile, MPI_MODE_CREATE|MPI_MODE_WRONLY,
+                         MPI_INFO_NULL, &out) != MPI_SUCCESS) {
+          if(extract_rank == 0) fprintf(stderr,"unable to open %s\n", outfile);
+          MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        MPI_File_set_size(out, (MPI_Offset)npoints*3*sizeof(double));
+
+        // collective writes need the same number of calls on every rank
+        long mybatches=(plast-pfirst+EXTRACT_BATCH-1)/EXTRACT_BATCH;
+        long nbatches;
+        MPI_Allreduce(&mybatches, &nbatches, 1, MPI_LONG, MPI_MAX, MPI_COMM_WORLD);
+
+        sfcvm_point_t *pts=(sfcvm_point_t *)malloc(EXTRACT_BATCH*sizeof(sfcvm_point_t));
+        sfcvm_properties_t *props=(sfcvm_properties_t *)malloc(EXTRACT_BATCH*sizeof(sfcvm_properties_t));
+        double *buf=(double *)malloc(EXTRACT_BATCH*3*sizeof(double));
+        if(pts == NULL || props == NULL || buf == NULL) {
+          fprintf(stderr,"[%d] failed to allocate buffers\n", extract_rank);
+          MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        double tq=MPI_Wtime();
+        long p=pfirst;
+        for(long b=0; b<nbatches; b++) {
+          int cnt=0;
+          if(p < plast) {
+            cnt=(plast-p < EXTRACT_BATCH) ? (int)(plast-p) : EXTRACT_BATCH;
+            if(pointfile != NULL) {
+              MPI_Status status;
+              int got=0;
+              if(MPI_File_read_at(in, (MPI_Offset)p*sizeof(sfcvm_point_t), pts,
+                                  cnt*3, MPI_DOUBLE, &status) != MPI_SUCCESS ||
+                 MPI_Get_count(&status, MPI_DOUBLE, &got) != MPI_SUCCESS || got != cnt*3) {
+                fprintf(stderr,"[%d] failed to read points %ld to %ld\n", extract_rank, p, p+cnt);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+              }
+              } else {
+                for(int i=0; i<cnt; i++) {
+                  long col=(p+i)/grid.nz;
+                  _grid_lonlat(col, &grid, &pts[i].longitude, &pts[i].latitude);
+                  pts[i].depth=grid.z0 + ((p+i) % grid.nz) * grid.dz;
+                }
+            }
+            _query_batch(pts, props, buf, cnt, zmode);
+          }
+          MPI_File_write_at_all(out, (MPI_Offset)p*3*sizeof(double), buf,
+                                cnt*3, MPI_DOUBLE, MPI_STATUS_IGNORE);
+          p += cnt;
+        }
+        double t1=MPI_Wtime();
+
+        MPI_File_close(&out);
+        if(in != MPI_FILE_NULL) MPI_File_close(&in);
+
+        double mine=t1-tq, tmin, tmax;
+        MPI_Reduce(&mine, &tmin, 1, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&mine, &tmax, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        if(extract_rank == 0) {
+          printf("sfcvm_extract_mpi: %ld points on %d ranks, partition %.2fs, query min %.2fs max %.2fs\n",
+                 npoints, extract_size, tq-t0, tmin, tmax);
+        }
+
+        free(pts);
+        free(props);
+        free(buf);
+        sfcvm_finalize();
+        MPI_Finalize();
+        return 0;
+}
@@ -0,0 +1,293 @@
+/**
+ * @file sfcvm_parallel.c
+ * @brief Forked worker pool with work stealing over tiles.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Workers are forked after sfcvm_init, so they inherit the loaded model.
+ * Data files still closed are opened first with sfcvm_preload.
+ * Statistics counters updated inside workers stay in the workers.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "ucvm_model_dtypes.h"
+#include "sfcvm.h"
+#include "sfcvm_parallel.h"
+
+extern int sfcvm_water_max_step_limit;
+
+/* Shared between the parent and its workers */
+typedef struct sfcvm_parallel_state_t {
+    /* next entry of the tile order to hand out */
+    volatile long next;
+    /* set by a worker whose tile failed */
+    volatile int failed;
+} sfcvm_parallel_state_t;
+
+typedef struct sfcvm_tile_cost_t {
+    double cost;
+    long tile;
+} sfcvm_tile_cost_t;
+
+/* Most expensive first, ties in tile order */
+static int _compare_tile_cost(const void *a, const void *b) {
+    const sfcvm_tile_cost_t *ta=(const sfcvm_tile_cost_t *)a;
+    const sfcvm_tile_cost_t *tb=(const sfcvm_tile_cost_t *)b;
+    if(ta->cost > tb->cost) return -1;
+    if(ta->cost < tb->cost) return 1;
+    return (ta->tile < tb->tile) ? -1 : (ta->tile > tb->tile);
+}
+
+void *sfcvm_parallel_alloc(size_t size) {
+    size_t *ptr=(size_t *)mmap(NULL, size+sizeof(double), PROT_READ|PROT_WRITE,
+                               MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if(ptr == MAP_FAILED) return NULL;
+    ptr[0]=size+sizeof(double);
+    return (char *)ptr+sizeof(double);
+}
+
+void sfcvm_parallel_free(void *ptr) {
+    if(ptr == NULL) return;
+    size_t *base=(size_t *)((char *)ptr-sizeof(double));
+    munmap(base, base[0]);
+}
+
+int sfcvm_parallel_workers() {
+    char *envstr=getenv("SFCVM_NUM_WORKERS");
+    int n=(envstr != NULL) ? atoi(envstr) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return (n < 1) ? 1 : n;
+}
+
+/**
+ * Runs fn over tiles 0..ntiles-1 on forked workers. Each worker takes the
+ * next tile off a shared counter until none are left, so a worker stuck
+ * on an expensive tile does not hold up the rest. With cost estimates the
+ * tiles are handed out most expensive first, which keeps the tail short.
+ *
+ * @param ntiles Number of tiles.
+ * @param cost Estimated cost per tile, or NULL to run them in order.
+ * @param nworkers Number of workers, 1 runs in the calling process.
+ * @param fn Called for each tile.
+ * @param arg Passed to fn.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_parallel_run(long ntiles, const double *cost, int nworkers, sfcvm_tile_fn_t fn, void *arg) {
+    long *order=(long *)malloc((ntiles > 0 ? ntiles : 1)*sizeof(long));
+    int rc=UCVM_MODEL_CODE_SUCCESS;
+
+    if(order == NULL) return UCVM_MODEL_CODE_ERROR;
+    for(long t=0; t<ntiles; t++) order[t]=t;
+    if(cost != NULL && ntiles > 1) {
+      sfcvm_tile_cost_t *tc=(sfcvm_tile_cost_t *)malloc(ntiles*sizeof(sfcvm_tile_cost_t));
+      if(tc != NULL) {
+        for(long t=0; t<ntiles; t++) { tc[t].cost=cost[t]; tc[t].tile=t; }
+        qsort(tc, ntiles, sizeof(sfcvm_tile_cost_t), _compare_tile_cost);
+        for(long t=0; t<ntiles; t++) order[t]=tc[t].tile;
+        free(tc);
+      }
+    }
+
+    if(nworkers > ntiles) nworkers=(int)ntiles;
+    if(nworkers <= 1) {
+      for(long t=0; t<ntiles && rc == UCVM_MODEL_CODE_SUCCESS; t++) {
+        if(fn(order[t], arg)) rc=UCVM_MODEL_CODE_ERROR;
+      }
+      free(order);
+      return rc;
+    }
+
+    sfcvm_parallel_state_t *state=(sfcvm_parallel_state_t *)sfcvm_parallel_alloc(sizeof(sfcvm_parallel_state_t));
+    pid_t *pids=(pid_t *)malloc(nworkers*sizeof(pid_t));
+    if(state == NULL || pids == NULL) {
+      free(order);
+      free(pids);
+      sfcvm_parallel_free(state);
+      return UCVM_MODEL_CODE_ERROR;
+    }
+    state->next=0;
+    state->failed=0;
+
+    // data files opened on first use would be opened again in every worker
+    if(sfcvm_is_initialized) sfcvm_preload();
+
+    fflush(stdout);
+    fflush(stderr);
+    for(int k=0; k<nworkers; k++) {
+      pids[k]=fork();
+      if(pids[k] == 0) {
+        long t;
+        while((t=__sync_fetch_and_add(&state->next, 1)) < ntiles && !state->failed) {
+          if(fn(order[t], arg)) state->failed=1;
+        }
+        _exit(0);
+      }
+      if(pids[k] < 0) {
+        perror("sfcvm_parallel_run: fork");
+        state->failed=1;
+        nworkers=k;
+        break;
+      }
+    }
+    for(int k=0; k<nworkers; k++) {
+      int status;
+      if(waitpid(pids[k], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        state->failed=1;
+      }
+    }
+    if(state->failed) rc=UCVM_MODEL_CODE_ERROR;
+
+    free(pids);
+    free(order);
+    sfcvm_parallel_free(state);
+    return rc;
+}
+
+/*
+ * Cost of a point from its surface lookup, rc the result of
+ * sfcvm_getsurface or sfcvm_columns_surface
+ */
+static double _surface_cost(int rc, double surface) {
+    if(rc != 0) return SFCVM_COST_OUTSIDE;
+    if(surface < 0) return SFCVM_COST_LAND + sfcvm_water_max_step_limit/2.0;
+    return SFCVM_COST_LAND;
+}
+
+/**
+ * Estimated relative cost of querying at a location, from the cheap
+ * bathymetry classification. Points under water (zSurf < 0) may need the
+ * step down search of up to sfcvm_water_max_step_limit extra queries,
+ * half of that is charged on average.
+ *
+ * @param longitude Longitude of the point.
+ * @param latitude Latitude of the point.
+ * @return Cost relative to a land point.
+ */
+double sfcvm_point_cost(double longitude, double latitude) {
+    double surface=0, top;
+    return _surface_cost(sfcvm_getsurface(longitude, latitude, &surface, &top), surface);
+}
+
+/**
+ * Estimated cost of each tile, the sum of sfcvm_point_cost over
+ * SFCVM_COST_SAMPLES locations spread through it. The locations are
+ * found in one batch with sfcvm_columns_create, so they may be in any
+ * input CRS the context takes. One worker runs the tiles in order
+ * anyway, so no estimate is made for it.
+ *
+ * @param ctx Query context, NULL for the current model parameters.
+ * @param ntiles Number of tiles.
+ * @param nworkers Number of workers the tiles will run on.
+ * @param fn Gives the sampled locations of a tile.
+ * @param arg Passed to fn.
+ * @return ntiles costs to pass to sfcvm_parallel_run and free, or NULL.
+ */
+double *sfcvm_tile_costs(sfcvm_context_t *ctx, long ntiles, int nworkers, sfcvm_tile_point_fn_t fn, void *arg) {
+    if(nworkers <= 1 || ntiles <= 1 || ntiles > INT_MAX/SFCVM_COST_SAMPLES) return NULL;
+
+    int n=(int)ntiles*SFCVM_COST_SAMPLES;
+    double *cost=(double *)malloc(ntiles*sizeof(double));
+    double *x=(double *)malloc(n*sizeof(double));
+    double *y=(double *)malloc(n*sizeof(double));
+    sfcvm_context_t *def=(ctx == NULL) ? sfcvm_context_create() : NULL;
+    if(cost == NULL || x == NULL || y == NULL || (ctx == NULL && def == NULL)) {
+      free(cost);
+      free(x);
+      free(y);
+      sfcvm_context_destroy(def);
+      return NULL;
+    }
+
+    for(long t=0; t<ntiles; t++) {
+      for(int k=0; k<SFCVM_COST_SAMPLES; k++) {
+        int i=(int)t*SFCVM_COST_SAMPLES+k;
+        fn(t, (double)k/(SFCVM_COST_SAMPLES-1), arg, &x[i], &y[i]);
+      }
+    }
+    sfcvm_columns_t *cols=sfcvm_columns_create((ctx != NULL) ? ctx : def, x, y, n);
+    if(cols != NULL) {
+      for(long t=0; t<ntiles; t++) {
+        cost[t]=0;
+        for(int k=0; k<SFCVM_COST_SAMPLES; k++) {
+          double surface=0, top;
+          int rc=sfcvm_columns_surface(cols, (int)t*SFCVM_COST_SAMPLES+k, &surface, &top);
+          cost[t]+=_surface_cost(rc, surface);
+        }
+      }
+    } else {
+      free(cost);
+      cost=NULL;
+    }
+
+    sfcvm_columns_destroy(cols);
+    sfcvm_context_destroy(def);
+    free(x);
+    free(y);
+    return cost;
+}
+
+typedef struct sfcvm_query_tiles_t {
+    sfcvm_point_t *points;
+    sfcvm_properties_t *data;
+    int numpoints;
+} sfcvm_query_tiles_t;
+
+static void _query_points_point(long tile, double f, void *arg, double *x, double *y) {
+    sfcvm_query_tiles_t *q=(sfcvm_query_tiles_t *)arg;
+    int start=(int)tile*SFCVM_PARALLEL_TILE;
+    int cnt=q->numpoints-start;
+    if(cnt > SFCVM_PARALLEL_TILE) cnt=SFCVM_PARALLEL_TILE;
+    int i=start+(int)(f*(cnt-1)+0.5);
+    *x=q->points[i].longitude;
+    *y=q->points[i].latitude;
+}
+
+static int _query_points_tile(long tile, void *arg) {
+    sfcvm_query_tiles_t *q=(sfcvm_query_tiles_t *)arg;
+    int start=(int)tile*SFCVM_PARALLEL_TILE;
+    int cnt=q->numpoints-start;
+    if(cnt > SFCVM_PARALLEL_TILE) cnt=SFCVM_PARALLEL_TILE;
+    return sfcvm_query(&q->points[start], &q->data[start], cnt);
+}
+
+/**
+ * Queries SFCVM at the given points across forked workers. Tiles of
+ * SFCVM_PARALLEL_TILE points are stolen dynamically, the tiles estimated
+ * to hold the most water points first, so runs of expensive water points
+ * spread over the pool.
+ *
+ * @param points The points at which the queries will be made.
+ * @param data The data that will be returned (Vp, Vs, density).
+ * @param numpoints The total number of points to query.
+ * @param nworkers Number of worker processes.
+ * @return UCVM_MODEL_CODE_SUCCESS or UCVM_MODEL_CODE_ERROR.
+ */
+int sfcvm_query_parallel(sfcvm_point_t *points, sfcvm_properties_t *data, int numpoints, int nworkers) {
+    long ntiles=(numpoints+SFCVM_PARALLEL_TILE-1)/SFCVM_PARALLEL_TILE;
+    if(nworkers <= 1 || ntiles <= 1) {
+      return sfcvm_query(points, data, numpoints);
+    }
+
+    sfcvm_query_tiles_t q;
+    q.points=points;
+    q.numpoints=numpoints;
+    q.data=(sfcvm_properties_t *)sfcvm_parallel_alloc(numpoints*sizeof(sfcvm_properties_t));
+    if(q.data == NULL) return UCVM_MODEL_CODE_ERROR;
+
+    double *cost=sfcvm_tile_costs(NULL, ntiles, nworkers, _query_points_point, &q);
+    int rc=sfcvm_parallel_run(ntiles, cost, nworkers, _query_points_tile, &q);
+    free(cost);
+    if(rc == UCVM_MODEL_CODE_SUCCESS) {
+      memcpy(data, q.data, numpoints*sizeof(sfcvm_properties_t));
+    }
+    sfcvm_parallel_free(q.data);
+    return rc;
+}
@@ -0,0 +1,52 @@
+#ifndef SFCVM_PARALLEL_H
+#define SFCVM_PARALLEL_H
+
+/**
+ * @file sfcvm_parallel.h
+ * @brief Process level parallelism over an initialized SFCVM.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * The geomodelgrids query objects are not thread safe, so work is spread
+ * over forked worker processes that share the loaded model copy-on-write.
+ * Workers take small tiles off a shared counter (work stealing), in order
+ * of decreasing estimated cost when costs are given, and write results
+ * into memory from sfcvm_parallel_alloc.
+ *
+ */
+
+#include <stddef.h>
+#include "sfcvm.h"
+
+/** Points per tile in sfcvm_query_parallel */
+#define SFCVM_PARALLEL_TILE 256
+
+/** Relative cost of a point outside the model, it fails on the surface lookup */
+#define SFCVM_COST_OUTSIDE 0.5
+/** Relative cost of a land point, one model query */
+#define SFCVM_COST_LAND 1.0
+/** Locations sampled per tile by sfcvm_tile_costs */
+#define SFCVM_COST_SAMPLES 3
+
+/** Work function, called once per tile in some worker, returns 0 on success */
+typedef int (*sfcvm_tile_fn_t)(long tile, void *arg);
+/** Location a fraction f, 0 to 1, of the way through a tile, in the input CRS of the context */
+typedef void (*sfcvm_tile_point_fn_t)(long tile, double f, void *arg, double *x, double *y);
+
+/** Runs fn over ntiles tiles on nworkers forked workers */
+int sfcvm_parallel_run(long ntiles, const double *cost, int nworkers, sfcvm_tile_fn_t fn, void *arg);
+/** Allocates memory that workers write and the caller reads back */
+void *sfcvm_parallel_alloc(size_t size);
+/** Frees memory from sfcvm_parallel_alloc */
+void sfcvm_parallel_free(void *ptr);
+/** Default number of workers, $SFCVM_NUM_WORKERS or the number of cores */
+int sfcvm_parallel_workers();
+
+/** Estimated relative cost of querying at a location */
+double sfcvm_point_cost(double longitude, double latitude);
+/** Estimated cost per tile for sfcvm_parallel_run, NULL when the tiles can run in order */
+double *sfcvm_tile_costs(sfcvm_context_t *ctx, long ntiles, int nworkers, sfcvm_tile_point_fn_t fn, void *arg);
+/** Queries a batch of points across nworkers worker processes */
+int sfcvm_query_parallel(sfcvm_point_t *points, sfcvm_properties_t *data, int numpoints, int nworkers);
+
+#endif
@@ -0,0 +1,253 @@
+/**
+ * @file sfcvm_proj.c
+ * @brief Transverse Mercator projection of point batches, without PROJ.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Series from Karney, "Transverse Mercator with an accuracy of a few
+ * nanometers", J. Geodesy 85 (2011), truncated at n^4.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "ucvm_model_dtypes.h"
+#include "sfcvm_proj.h"
+
+#define SFCVM_DEG2RAD (M_PI/180.0)
+
+/* GRS80, the NAD83 ellipsoid, and WGS84 */
+#define SFCVM_GRS80_A 6378137.0
+#define SFCVM_GRS80_F (1.0/298.257222101)
+#define SFCVM_WGS84_F (1.0/298.257223563)
+
+/* Conformal latitude, as the series argument xi' at the central meridian */
+static double _conformal(double e, double phi) {
+    double s=sin(phi);
+    return atan(sinh(atanh(s)-e*atanh(e*s)));
+}
+
+/**
+ * Sets up a transverse Mercator projection.
+ *
+ * @param tm The projection to set up.
+ * @param a Semi-major axis of the ellipsoid, in meters.
+ * @param f Flattening of the ellipsoid.
+ * @param lat0 Latitude of origin, in degrees.
+ * @param lon0 Central meridian, in degrees.
+ * @param k0 Scale on the central meridian.
+ * @param x0 False easting, in meters.
+ * @param y0 False northing, in meters.
+ */
+void sfcvm_tmerc_setup(sfcvm_tmerc_t *tm, double a, double f, double lat0, double lon0,
+                       double k0, double x0, double y0) {
+    double n=f/(2.0-f);
+    double n2=n*n, n3=n2*n, n4=n3*n;
+
+    tm->e=sqrt(f*(2.0-f));
+    tm->kA=k0*a/(1.0+n)*(1.0+n2/4.0+n4/64.0);
+    tm->alpha[0]=n/2.0-2.0*n2/3.0+5.0*n3/16.0+41.0*n4/180.0;
+    tm->alpha[1]=13.0*n2/48.0-3.0*n3/5.0+557.0*n4/1440.0;
+    tm->alpha[2]=61.0*n3/240.0-103.0*n4/140.0;
+    tm->alpha[3]=49561.0*n4/161280.0;
+    tm->beta[0]=n/2.0-2.0*n2/3.0+37.0*n3/96.0-n4/360.0;
+    tm->beta[1]=n2/48.0+n3/15.0-437.0*n4/1440.0;
+    tm->beta[2]=17.0*n3/480.0-37.0*n4/840.0;
+    tm->beta[3]=4397.0*n4/161280.0;
+    tm->lon0=lon0*SFCVM_DEG2RAD;
+    tm->x0=x0;
+
+    // northing of the latitude of origin, on the central meridian
+    double xi=_conformal(tm->e, lat0*SFCVM_DEG2RAD);
+    double m0=xi;
+    for(int j=0; j<4; j++) m0+=tm->alpha[j]*sin(2*(j+1)*xi);
+    tm->y0=y0-tm->kA*m0;
+}
+
+/**
+ * Sets up a projection from a PROJ string. Only what the SFCVM model
+ * and UTM use is understood: +proj=tmerc with +lat_0 +lon_0 +k +x_0 +y_0,
+ * or +proj=utm with +zone and +south, on the GRS80 or WGS84 ellipsoid
+ * (+datum=NAD83/WGS84 or +ellps=GRS80/WGS84) in meters.
+ *
+ * @param tm The projection to set up.
+ * @param crs The PROJ string.
+ * @return UCVM_MODEL_CODE_SUCCESS, or UCVM_MODEL_CODE_ERROR for anything else.
+ */
+int sfcvm_tmerc_parse(sfcvm_tmerc_t *tm, const char *crs) {
+    double lat0=0, lon0=0, k0=1.0, x0=0, y0=0, f=SFCVM_GRS80_F;
+    int tmerc=0, utm=0, zone=0, south=0;
+    char buf[1000];
+    char *save=NULL;
+
+    if(crs == NULL || strlen(crs) >= sizeof(buf)) return UCVM_MODEL_CODE_ERROR;
+    strcpy(buf, crs);
+    for(char *tok=strtok_r(buf, " \t", &save); tok != NULL; tok=strtok_r(NULL, " \t", &save)) {
+      char *val=strchr(tok, '=');
+      if(val != NULL) *val++='\0';
+      if(strcmp(tok, "+proj") == 0 && val != NULL) {
+        tmerc=(strcmp(val, "tmerc") == 0);
+        utm=(strcmp(val, "utm") == 0);
+        if(!tmerc && !utm) return UCVM_MODEL_CODE_ERROR;
+      } else if(strcmp(tok, "+lat_0") == 0 && val != NULL) {
+        lat0=atof(val);
+      } else if(strcmp(tok, "+lon_0") == 0 && val != NULL) {
+        lon0=atof(val);
+      } else if((strcmp(tok, "+k") == 0 || strcmp(tok, "+k_0") == 0) && val != NULL) {
+        k0=atof(val);
+      } else if(strcmp(tok, "+x_0") == 0 && val != NULL) {
+        x0=atof(val);
+      } else if(strcmp(tok, "+y_0") == 0 && val != NULL) {
+        y0=atof(val);
+      } else if(strcmp(tok, "+zone") == 0 && val != NULL) {
+        zone=atoi(val);
+      } else if(strcmp(tok, "+south") == 0) {
+        south=1;
+      } else if((strcmp(tok, "+datum") == 0 || strcmp(tok, "+ellps") == 0) && val != NULL) {
+        if(strcmp(val, "NAD83") == 0 || strcmp(val, "GRS80") == 0) {
+          f=SFCVM_GRS80_F;
+          } else if(strcmp(val, "WGS84") == 0) {
+            f=SFCVM_WGS84_F;
+          } else {
+            return UCVM_MODEL_CODE_ERROR;
+        }
+      } else if(strcmp(tok, "+units") == 0 && val != NULL) {
+        if(strcmp(val, "m") != 0) return UCVM_MODEL_CODE_ERROR;
+      } else if(strcmp(tok, "+type") == 0 || strcmp(tok, "+no_defs") == 0) {
+        // nothing to do
+      } else {
+        return UCVM_MODEL_CODE_ERROR;
+      }
+    }
+
+    if(utm) {
+      if(zone < 1 || zone > 60) return UCVM_MODEL_CODE_ERROR;
+      lat0=0;
+      lon0=-183.0+6.0*zone;
+      k0=0.9996;
+      x0=500000.0;
+      y0=south ? 10000000.0 : 0;
+      } else if(!tmerc) {
+        return UCVM_MODEL_CODE_ERROR;
+    }
+    sfcvm_tmerc_setup(tm, SFCVM_GRS80_A, f, lat0, lon0, k0, x0, y0);
+    return UCVM_MODEL_CODE_SUCCESS;
+}
+
+/**
+ * Sets up from the CRS names callers are likely to pass: EPSG:4326 and
+ * EPSG:4269 for lon/lat, the UTM zones of NAD83 (EPSG:26901-26923) and of
+ * WGS84 (EPSG:32601-32660, 32701-32760), and PROJ strings for tmerc, utm
+ * and longlat. Anything else is SFCVM_CRS_KIND_OTHER, left to PROJ.
+ *
+ * @param tm Set up for SFCVM_CRS_KIND_TMERC.
+ * @param crs The CRS.
+ * @return A sfcvm_crs_kind_t.
+ */
+int sfcvm_crs_parse(sfcvm_tmerc_t *tm, const char *crs) {
+    char buf[64];
+    int code;
+
+    if(crs == NULL) return SFCVM_CRS_KIND_OTHER;
+    if(strncasecmp(crs, "EPSG:", 5) == 0) {
+      char *end;
+      code=(int)strtol(crs+5, &end, 10);
+      if(*end != '\0') return SFCVM_CRS_KIND_OTHER;
+      if(code == 4326 || code == 4269) return SFCVM_CRS_KIND_GEOGRAPHIC;
+      if(code >= 26901 && code <= 26923) {
+        sprintf(buf, "+proj=utm +zone=%d +datum=NAD83", code-26900);
+        } else if(code >= 32601 && code <= 32660) {
+          sprintf(buf, "+proj=utm +zone=%d +datum=WGS84", code-32600);
+        } else if(code >= 32701 && code <= 32760) {
+          sprintf(buf, "+proj=utm +zone=%d +south +datum=WGS84", code-32700);
+        } else {
+          return SFCVM_CRS_KIND_OTHER;
+      }
+      return sfcvm_tmerc_parse(tm, buf) == UCVM_MODEL_CODE_SUCCESS ? SFCVM_CRS_KIND_TMERC : SFCVM_CRS_KIND_OTHER;
+    }
+    if(strstr(crs, "+proj=longlat") != NULL || strstr(crs, "+proj=latlong") != NULL) {
+      // only a plain lon/lat on one of the two datums the library takes as one
+      if(strstr(crs, "+towgs84") != NULL || strstr(crs, "+pm") != NULL) return SFCVM_CRS_KIND_OTHER;
+      if(strstr(crs, "+datum=") != NULL && strstr(crs, "+datum=WGS84") == NULL && strstr(crs, "+datum=NAD83") == NULL) {
+        return SFCVM_CRS_KIND_OTHER;
+      }
+      return SFCVM_CRS_KIND_GEOGRAPHIC;
+    }
+    return sfcvm_tmerc_parse(tm, crs) == UCVM_MODEL_CODE_SUCCESS ? SFCVM_CRS_KIND_TMERC : SFCVM_CRS_KIND_OTHER;
+}
+
+/**
+ * Projects a batch of points. The setup is shared by the whole batch,
+ * each point costs a handful of transcendental calls.
+ *
+ * @param tm The projection.
+ * @param lon Longitudes, in degrees.
+ * @param lat Latitudes, in degrees.
+ * @param x Eastings returned, in meters.
+ * @param y Northings returned, in meters.
+ * @param n Number of points.
+ */
+void sfcvm_tmerc_forward(const sfcvm_tmerc_t *tm, const double *lon, const double *lat,
+                         double *x, double *y, int n) {
+    for(int i=0; i<n; i++) {
+      double phi=lat[i]*SFCVM_DEG2RAD;
+      double lam=remainder(lon[i]*SFCVM_DEG2RAD-tm->lon0, 2*M_PI);
+      double s=sin(phi);
+      double t=sinh(atanh(s)-tm->e*atanh(tm->e*s));
+      double c=cos(lam);
+      double xip=atan2(t, c);
+      double etap=asinh(sin(lam)/hypot(t, c));
+      double xi=xip, eta=etap;
+      for(int j=0; j<4; j++) {
+        double k=2.0*(j+1);
+        xi+=tm->alpha[j]*sin(k*xip)*cosh(k*etap);
+        eta+=tm->alpha[j]*cos(k*xip)*sinh(k*etap);
+      }
+      x[i]=tm->x0+tm->kA*eta;
+      y[i]=tm->y0+tm->kA*xi;
+    }
+}
+
+/**
+ * Projects a batch of points back to lon/lat. The conformal latitude is
+ * turned into the geodetic one with Newton's method on tan(latitude),
+ * two or three steps reach full double precision.
+ *
+ * @param tm The projection.
+ * @param x Eastings, in meters.
+ * @param y Northings, in meters.
+ * @param lon Longitudes returned, in degrees.
+ * @param lat Latitudes returned, in degrees.
+ * @param n Number of points.
+ */
+void sfcvm_tmerc_inverse(const sfcvm_tmerc_t *tm, const double *x, const double *y,
+                         double *lon, double *lat, int n) {
+    double e2=tm->e*tm->e;
+    for(int i=0; i<n; i++) {
+      double xi=(y[i]-tm->y0)/tm->kA;
+      double eta=(x[i]-tm->x0)/tm->kA;
+      double xip=xi, etap=eta;
+      for(int j=0; j<4; j++) {
+        double k=2.0*(j+1);
+        xip-=tm->beta[j]*sin(k*xi)*cosh(k*eta);
+        etap-=tm->beta[j]*cos(k*xi)*sinh(k*eta);
+      }
+      double se=sinh(etap), cx=cos(xip);
+      double taup=sin(xip)/hypot(se, cx);
+      double tau=taup/(1.0-e2);
+      for(int it=0; it<5; it++) {
+        double t1=hypot(1.0, tau);
+        double sig=sinh(tm->e*atanh(tm->e*tau/t1));
+        double taui=tau*hypot(1.0, sig)-sig*t1;
+        double dtau=(taup-taui)/hypot(1.0, taui)*(1.0+(1.0-e2)*tau*tau)/((1.0-e2)*t1);
+        tau+=dtau;
+        if(fabs(dtau) < 1.0e-14*(1.0+fabs(tau))) break;
+      }
+      lat[i]=atan(tau)/SFCVM_DEG2RAD;
+      lon[i]=(tm->lon0+atan2(se, cx))/SFCVM_DEG2RAD;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef SFCVM_PROJ_H
+#define SFCVM_PROJ_H
+
+/**
+ * @file sfcvm_proj.h
+ * @brief Transverse Mercator projection of point batches, without PROJ.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Uses the Krueger series to fourth order in the third flattening, which
+ * is good to well under a millimeter within a few thousand km of the
+ * central meridian. Longitude and latitude are taken on the ellipsoid of
+ * the projection, WGS84 and NAD83 are not told apart, the same as PROJ
+ * going from EPSG:4326 to NAD83 without a datum grid.
+ *
+ */
+
+/** A transverse Mercator projection, from sfcvm_tmerc_setup or sfcvm_tmerc_parse */
+typedef struct sfcvm_tmerc_t {
+	/** Central meridian, in radians */
+	double lon0;
+	/** False easting, in meters */
+	double x0;
+	/** False northing, less the northing of the latitude of origin */
+	double y0;
+	/** First eccentricity */
+	double e;
+	/** Scale on the central meridian times the rectifying radius */
+	double kA;
+	/** Series coefficients, forward */
+	double alpha[4];
+	/** Series coefficients, inverse */
+	double beta[4];
+} sfcvm_tmerc_t;
+
+/** What sfcvm_crs_parse made of a CRS */
+typedef enum { SFCVM_CRS_KIND_OTHER = 0,     /* not known to the library */
+               SFCVM_CRS_KIND_GEOGRAPHIC,    /* lon/lat in degrees, WGS84 or NAD83 */
+               SFCVM_CRS_KIND_TMERC          /* easting/northing in a transverse Mercator */
+             } sfcvm_crs_kind_t;
+
+/** Sets up a projection, angles in degrees */
+void sfcvm_tmerc_setup(sfcvm_tmerc_t *tm, double a, double f, double lat0, double lon0,
+                       double k0, double x0, double y0);
+/** Sets up a projection from a +proj=tmerc or +proj=utm string */
+int sfcvm_tmerc_parse(sfcvm_tmerc_t *tm, const char *crs);
+/** Sets up from an EPSG code or PROJ string, returns a sfcvm_crs_kind_t */
+int sfcvm_crs_parse(sfcvm_tmerc_t *tm, const char *crs);
+/** Projects n lon/lat points, in degrees, to x/y in meters */
+void sfcvm_tmerc_forward(const sfcvm_tmerc_t *tm, const double *lon, const double *lat,
+                         double *x, double *y, int n);
+/** Projects n x/y points, in meters, back to lon/lat in degrees */
+void sfcvm_tmerc_inverse(const sfcvm_tmerc_t *tm, const double *x, const double *y,
+                         double *lon, double *lat, int n);
+
+#endif
@@ -15,8 +15,34 @@
 #include <assert.h>
 #include "ucvm_model_dtypes.h"
 #include "sfcvm.h"
+#ifndef SFCVM_CLIENT
+#include "sfcvm_parallel.h"
+#endif
+
+#define SFCVM_QUERY_MAX_JOBS 256
+/* number of input lines handed to the workers at a time */
+#define SFCVM_QUERY_CHUNK 100000
+
+/* outcome of one input point */
+typedef enum { QUERY_PRINT = 0,  /* print the result */
+               QUERY_SKIP,       /* no output, outside of the model surface */
+               QUERY_BAD } query_rc_t;
+
+/* record a worker sends back to the parent for each of its points */
+typedef struct query_result_t {
+        int rc;
+        sfcvm_point_t pt;
+        sfcvm_properties_t ret;
+        int zone_id;
+        int model_i;
+        double mu;
+        double lambda;
+} query_result_t;
 
 int sfcvm_debug=0;
+int sfcvm_zone_output=0;
+int sfcvm_stats_output=0;
+int sfcvm_derived_output=0;
 
 int _compare_double(double f1, double f2) {
   double precision = 0.00001;
@@ -31,8 +57,12 @@ int _compare_double(double f1, double f2) {
 void usage() {
   printf("     sfcvm_query - (c) SCEC\n");
   printf("Extract velocities from a SFCVM\n");
-  printf("\tusage: sfcvm_query [-c ge/gd][-d][-h] < file.in\n\n");
+  printf("\tusage: sfcvm_query [-c ge/gd][-j N][-z][-e][-s][-d][-h] < file.in\n\n");
   printf("Flags:\n");
+  printf("\t-j number of forked worker processes sharing the loaded model\n\n");
+  printf("\t-z also output zone_id and source model (0 detailed, 1 regional)\n\n");
+  printf("\t-e also output mu and lambda, and qp and qs when the config sets qsvs\n\n");
+  printf("\t-s print init timings and query counters to stderr at the end\n\n");
   printf("\t-d enable debug/verbose mode\n\n");
   printf("\t-h usage\n\n");
   printf("Output format is:\n");
@@ -43,6 +73,183 @@ void usage() {
 extern char *optarg;
 extern int optind, opterr, optopt;
 
+/* Queries one input point, converts elevation to depth first if needed */
+int _query_point(sfcvm_point_t *pt, int zmode, sfcvm_properties_t *ret, int *zone_id, int *model_i,
+                 double *mu, double *lambda) {
+        sfcvm_extra_t extra;
+        int rc;
+
+//  need to convert to depth since geomodelgrid got squashing
+        if(zmode == UCVM_MODEL_COORD_GEO_ELEV ) {
+          double elev=pt->depth;
+          double surface;
+          double top;
+
+          rc=sfcvm_getsurface(pt->longitude, pt->latitude, &surface, &top);
+          if(rc == 1) {
+            return QUERY_SKIP;
+          }
+
+          // reset it
+          pt->depth = surface - elev;
+
+          if(sfcvm_debug) {
+            fprintf(stderr, "  calling : surface is %f, initial elevation %f using > depth(%f)\n",
+                   surface, elev, pt->depth);
+          }
+        }
+
+        memset(&extra, 0, sizeof(extra));
+        extra.zone_id=zone_id;
+        extra.model_i=model_i;
+        extra.mu=mu;
+        extra.lambda=lambda;
+        ret->qp=ret->qs=-1;
+        rc=sfcvm_query_extra(pt, ret, &extra, 1);
+        return (rc == 0) ? QUERY_PRINT : QUERY_BAD;
+}
+
+void _print_point(sfcvm_point_t *pt, sfcvm_properties_t *ret, int zone_id, int model_i, double mu, double lambda,
+                  int rc) {
+        if(rc == QUERY_PRINT) {
+          printf("vs:%lf vp:%lf rho:%lf",ret->vs, ret->vp, ret->rho);
+          if(sfcvm_zone_output) printf(" zone_id:%d model:%d", zone_id, model_i);
+          if(sfcvm_derived_output) printf(" mu:%lf lambda:%lf qp:%lf qs:%lf", mu, lambda, ret->qp, ret->qs);
+          printf("\n");
+          } else if(rc == QUERY_BAD) {
+            printf("BAD: %lf %lf %lf\n",pt->longitude, pt->latitude, pt->depth);
+        }
+}
+
+/* Reads the next input point, returns 1 at end of input */
+int _read_point(sfcvm_point_t *pt) {
+        char line[1001];
+        while (fgets(line, 1000, stdin) != NULL) {
+
+           if(sfcvm_debug) {
+             fprintf(stderr,"LINE: (%s)",line);
+           }
+
+           if(line[0]=='#') continue; // comment line
+           if (sscanf(line,"%lf %lf %lf",
+                   &pt->longitude,&pt->latitude,&pt->depth) == 3) {
+             return 0;
+           }
+           break;
+        }
+        return 1;
+}
+
+int _query_serial(int zmode) {
+        sfcvm_point_t pt;
+        sfcvm_properties_t ret;
+        int zone_id, model_i;
+        double mu, lambda;
+
+        while (_read_point(&pt) == 0) {
+           int rc=_query_point(&pt, zmode, &ret, &zone_id, &model_i, &mu, &lambda);
+           _print_point(&pt, &ret, zone_id, model_i, mu, lambda, rc);
+        }
+        return 0;
+}
+
+#ifndef SFCVM_CLIENT
+typedef struct query_chunk_t {
+        sfcvm_point_t *pts;
+        query_result_t *res;
+        int cnt;
+        int zmode;
+} query_chunk_t;
+
+void _query_tile_point(long tile, double f, void *arg, double *x, double *y) {
+        query_chunk_t *chunk=(query_chunk_t *)arg;
+        int start=(int)tile*SFCVM_PARALLEL_TILE;
+        int cnt=chunk->cnt-start;
+        if(cnt > SFCVM_PARALLEL_TILE) cnt=SFCVM_PARALLEL_TILE;
+        int i=start+(int)(f*(cnt-1)+0.5);
+        *x=chunk->pts[i].longitude;
+        *y=chunk->pts[i].latitude;
+}
+
+int _query_tile(long tile, void *arg) {
+        query_chunk_t *chunk=(query_chunk_t *)arg;
+        int end=(int)(tile+1)*SFCVM_PARALLEL_TILE;
+        if(end > chunk->cnt) end=chunk->cnt;
+        for(int i=(int)tile*SFCVM_PARALLEL_TILE; i<end; i++) {
+          chunk->res[i].pt=chunk->pts[i];
+          chunk->res[i].rc=_query_point(&chunk->res[i].pt, chunk->zmode, &chunk->res[i].ret,
+                                        &chunk->res[i].zone_id, &chunk->res[i].model_i,
+                                        &chunk->res[i].mu, &chunk->res[i].lambda);
+        }
+        return 0;
+}
+
+/**
+ * Forked mode, the model is already loaded so each worker shares it
+ * copy-on-write. Input is read a chunk at a time and cut into small
+ * tiles, workers steal tiles until the chunk is done, the tiles estimated
+ * to hold water points first, so runs of costly water points do not leave
+ * the other workers idle. Results land in
+ * shared memory and are printed in input order.
+ *
+ * @param zmode UCVM_MODEL_COORD_GEO_DEPTH or UCVM_MODEL_COORD_GEO_ELEV
+ * @param njobs Number of worker processes
+ * @return 0 on success
+ */
+int _query_forked(int zmode, int njobs) {
+        query_chunk_t chunk;
+        int eof=0;
+
+        chunk.zmode=zmode;
+        chunk.pts=(sfcvm_point_t *)malloc(SFCVM_QUERY_CHUNK*sizeof(sfcvm_point_t));
+        chunk.res=(query_result_t *)sfcvm_parallel_alloc(SFCVM_QUERY_CHUNK*sizeof(query_result_t));
+        if(chunk.pts == NULL || chunk.res == NULL) {
+          fprintf(stderr,"sfcvm_query: failed to allocate input buffer\n");
+          return 1;
+        }
+
+        while(!eof) {
+          chunk.cnt=0;
+          while(chunk.cnt < SFCVM_QUERY_CHUNK) {
+            if(_read_point(&chunk.pts[chunk.cnt])) { eof=1; break; }
+            chunk.cnt++;
+          }
+          if(chunk.cnt == 0) break;
+
+          long ntiles=(chunk.cnt+SFCVM_PARALLEL_TILE-1)/SFCVM_PARALLEL_TILE;
+          double *cost=sfcvm_tile_costs(NULL, ntiles, njobs, _query_tile_point, &chunk);
+          int rc=sfcvm_parallel_run(ntiles, cost, njobs, _query_tile, &chunk);
+          free(cost);
+          if(rc != UCVM_MODEL_CODE_SUCCESS) {
+            fprintf(stderr,"sfcvm_query: a worker failed\n");
+            return 1;
+          }
+          for(int i=0; i<chunk.cnt; i++) {
+            _print_point(&chunk.res[i].pt, &chunk.res[i].ret, chunk.res[i].zone_id,
+                         chunk.res[i].model_i, chunk.res[i].mu, chunk.res[i].lambda, chunk.res[i].rc);
+          }
+        }
+
+        free(chunk.pts);
+        sfcvm_parallel_free(chunk.res);
+        return 0;
+}
+#endif
+
+/* Init stage timings and counters, counters of -j workers are not included */
+void _print_stats() {
+        sfcvm_stats_t stats;
+        if(sfcvm_get_stats(&stats) != 0) return;
+        fprintf(stderr,"init (%s): config %.6f s, files %.6f s, index %.6f s, open %.6f s, snapshot %.6f s, total %.6f s\n",
+                stats.init_from_snapshot ? "snapshot" : "config", stats.init_config_s, stats.init_files_s,
+                stats.init_index_s, stats.init_open_s, stats.init_snapshot_s, stats.init_total_s);
+        fprintf(stderr,"query objects opened: %d of %d, %.6f s after init\n",
+                stats.objects_opened, stats.objects_total, stats.lazy_open_s);
+        fprintf(stderr,"queries: %ld, gabbro %ld, water %ld, water step %ld, water limit %ld, max step %d, fast fail %ld\n",
+                stats.query_count, stats.gabbro_count, stats.water_count, stats.water_step_count,
+                stats.water_limit_count, stats.water_max_step, stats.fastfail_count);
+}
+
 /**
  * Initializes and SFCVM in standalone mode with ucvm plugin 
  * api.
@@ -53,17 +260,20 @@ extern int optind, opterr, optopt;
  */
 int main(int argc, char* const argv[]) {
 
-	// Declare the structures.
-	sfcvm_point_t pt;
-	sfcvm_properties_t ret;
         int zmode=UCVM_MODEL_COORD_GEO_DEPTH;
+        int njobs=1;
         int rc;
         int opt;
 
 
         /* Parse options */
-        while ((opt = getopt(argc, argv, "dhc:")) != -1) {
+        while ((opt = getopt(argc, argv, "dhzesc:j:")) != -1) {
           switch (opt) {
+          case 'j':
+            njobs=atoi(optarg);
+            if(njobs < 1) njobs=1;
+            if(njobs > SFCVM_QUERY_MAX_JOBS) njobs=SFCVM_QUERY_MAX_JOBS;
+            break;
           case 'c':
             if (strcasecmp(optarg, "gd") == 0) {
               zmode = UCVM_MODEL_COORD_GEO_DEPTH;
@@ -71,6 +281,15 @@ int main(int argc, char* const argv[]) {
               zmode = UCVM_MODEL_COORD_GEO_ELEV;
             }
             break;
+          case 'z':
+            sfcvm_zone_output=1;
+            break;
+          case 'e':
+            sfcvm_derived_output=1;
+            break;
+          case 's':
+            sfcvm_stats_output=1;
+            break;
           case 'd':
             sfcvm_debug=1;
             break;
@@ -96,51 +315,22 @@ int main(int argc, char* const argv[]) {
         }
 	printf("Loaded the model successfully.\n");
 
-        char line[1001];
-        while (fgets(line, 1000, stdin) != NULL) {
-
-           if(sfcvm_debug) {
-             fprintf(stderr,"LINE: (%s)",line);
-           }
-
-           if(line[0]=='#') continue; // comment line
-           if (sscanf(line,"%lf %lf %lf",
-                   &pt.longitude,&pt.latitude,&pt.depth) == 3) {
-
-//  need to convert to depth since geomodelgrid got squashing
-              if(zmode == UCVM_MODEL_COORD_GEO_ELEV ) {
-                double elev=pt.depth;
-                double surface;
-                double top;
-                void *error_handler;
-                
-                rc=sfcvm_getsurface(pt.longitude, pt.latitude, &surface, &top);
-                if(rc == 1) {
-                  continue;
-                }			 
-
-                // reset it
-                pt.depth = surface - elev;
-
-                if(sfcvm_debug) {
-                  fprintf(stderr, "  calling : surface is %f, initial elevation %f using > depth(%f)\n",
-                         surface, elev, pt.depth);
-                }
-              }
-
-	      rc=sfcvm_query(&pt, &ret, 1);
-              if(rc == 0) {
-                printf("vs:%lf vp:%lf rho:%lf\n",ret.vs, ret.vp, ret.rho);
-                } else {
-                   printf("BAD: %lf %lf %lf\n",pt.longitude, pt.latitude, pt.depth);
-              }
-              } else {
-                 break;
-           }
+#ifdef SFCVM_CLIENT
+        // built on libsfcvm_client, the daemon has its own workers
+        if(njobs > 1) fprintf(stderr,"sfcvm_query: -j is served by the sfcvmd workers, querying in one process\n");
+        rc=_query_serial(zmode);
+#else
+        if(njobs > 1) {
+          rc=_query_forked(zmode, njobs);
+          } else {
+            rc=_query_serial(zmode);
         }
+#endif
+
+        if(sfcvm_stats_output) _print_stats();
 
 	assert(sfcvm_finalize() == 0);
 	printf("Model closed successfully.\n");
 
-	return 0;
+	return rc;
 }
@@ -0,0 +1,645 @@
+/*
+ * @file sfcvmd.c
+ * @brief Long running SFCVM query daemon.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Loads the model once and serves batched binary query requests over
+ * a Unix domain socket. After sfcvm_init the daemon forks a pool of
+ * workers that share the loaded model copy-on-write. The parent polls
+ * every client connection and hands each request batch, with the client
+ * socket, to whichever worker is free, so batches of many clients share
+ * the pool and a connection holds a worker only while its batch runs.
+ * Each connection keeps its own sfcvm_context_t in the parent, setparam
+ * from one client never leaks into another.
+ *
+ * Clients link libsfcvm_client.a, see sfcvm_client.c.
+ *
+ */
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "ucvm_model_dtypes.h"
+#include "sfcvm.h"
+#include "sfcvmd.h"
+
+#define SFCVMD_MAX_WORKERS 256
+/* Most client connections open at once */
+#define SFCVMD_MAX_CLIENTS 1024
+/* Longest wait in poll, workers that exited or could not be forked are retried after it */
+#define SFCVMD_RESPAWN_MS 1000
+
+int sfcvmd_debug=0;
+
+/* Query settings of one connection, handed to the worker with each batch */
+typedef struct sfcvmd_state_t {
+  sfcvm_context_t ctx;
+  /* UCVM settings kept as libsfcvm keeps them, see sfcvmd_param_t */
+  int zmode;
+  int force_depth;
+  int plugin;
+} sfcvmd_state_t;
+
+/* A client connection */
+typedef struct sfcvmd_conn_t {
+  /* -1 for a free slot */
+  int fd;
+  /* a worker is serving the request in hdr */
+  int busy;
+  /* hdr waits for a free worker */
+  int pending;
+  /* bytes of hdr read so far, the parent never waits on a client for the rest */
+  size_t got;
+  sfcvmd_header_t hdr;
+  sfcvmd_state_t state;
+} sfcvmd_conn_t;
+
+/* A worker process */
+typedef struct sfcvmd_worker_t {
+  /* -1 while it needs to be forked */
+  pid_t pid;
+  /* parent end of its socket pair */
+  int fd;
+  /* connection being served, -1 when idle */
+  int conn;
+} sfcvmd_worker_t;
+
+/* Batch handed to a worker, the client socket travels alongside */
+typedef struct sfcvmd_job_t {
+  sfcvmd_header_t hdr;
+  sfcvm_context_t ctx;
+} sfcvmd_job_t;
+
+sfcvmd_conn_t sfcvmd_conns[SFCVMD_MAX_CLIENTS];
+sfcvmd_worker_t sfcvmd_workers[SFCVMD_MAX_WORKERS];
+int sfcvmd_nworkers=1;
+
+/* Usage function */
+void usage() {
+  printf("     sfcvmd - (c) SCEC\n");
+  printf("Serve SFCVM queries over a Unix domain socket\n");
+  printf("\tusage: sfcvmd [-s socket][-j workers][-d][-h]\n\n");
+  printf("Flags:\n");
+  printf("\t-s socket path, default $SFCVMD_SOCKET or %s\n\n", SFCVMD_DEFAULT_SOCKET);
+  printf("\t-j number of worker processes, default 1\n\n");
+  printf("\t-d enable debug/verbose mode\n\n");
+  printf("\t-h usage\n\n");
+  exit (0);
+}
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+void _sfcvmd_stop(int sig) {
+  sfcvmd_done=1;
+}
+
+/* Only there to wake the parent out of poll when a worker exits */
+void _sfcvmd_child(int sig) {
+}
+
+/* Reply with a bare header carrying a return code */
+int _sfcvmd_reply(int fd, int op, int count, int rc) {
+  sfcvmd_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic=SFCVMD_MAGIC;
+  hdr.op=op;
+  hdr.count=count;
+  hdr.param=rc;
+  return sfcvmd_writen(fd, &hdr, sizeof(hdr));
+}
+
+/**
+ * Serves one batch whose header the parent has read, the points follow
+ * on the client socket.
+ *
+ * @param fd The client socket.
+ * @param hdr The request header.
+ * @param ctx The connection's context.
+ * @param pts Scratch buffer of SFCVMD_MAX_BATCH points.
+ * @param props Scratch buffer of SFCVMD_MAX_BATCH properties.
+ * @param surfs Scratch buffer of SFCVMD_MAX_BATCH surfaces.
+ * @param extras Scratch buffer of SFCVMD_MAX_BATCH extra records.
+ * @param slots Scratch buffer of 3*SFCVMD_MAX_BATCH ints.
+ * @return 0, or 1 when the connection broke.
+ */
+int _sfcvmd_serve(int fd, const sfcvmd_header_t *hdr, sfcvm_context_t *ctx, sfcvm_point_t *pts,
+                  sfcvm_properties_t *props, sfcvmd_surface_t *surfs, sfcvmd_extra_t *extras, int *slots) {
+  sfcvm_extra_t extra;
+  int rc;
+
+  if(sfcvmd_readn(fd, pts, hdr->count*sizeof(sfcvm_point_t))) return 1;
+
+  switch(hdr->op) {
+    case SFCVMD_OP_QUERY:
+      rc=sfcvm_context_query(ctx, pts, props, hdr->count);
+      return _sfcvmd_reply(fd, hdr->op, hdr->count, rc) ||
+             sfcvmd_writen(fd, props, hdr->count*sizeof(sfcvm_properties_t));
+    case SFCVMD_OP_QUERY_EXTRA:
+      memset(&extra, 0, sizeof(extra));
+      extra.zone_id=&slots[0];
+      extra.model_i=&slots[SFCVMD_MAX_BATCH];
+      extra.status=&slots[2*SFCVMD_MAX_BATCH];
+      rc=sfcvm_context_query_extra(ctx, pts, props, &extra, hdr->count);
+      for(int i=0; i<hdr->count; i++) {
+        extras[i].zone_id=extra.zone_id[i];
+        extras[i].model_i=extra.model_i[i];
+        extras[i].status=extra.status[i];
+        extras[i].pad=0;
+      }
+      return _sfcvmd_reply(fd, hdr->op, hdr->count, rc) ||
+             sfcvmd_writen(fd, props, hdr->count*sizeof(sfcvm_properties_t)) ||
+             sfcvmd_writen(fd, extras, hdr->count*sizeof(sfcvmd_extra_t));
+    default:
+      for(int i=0; i<hdr->count; i++) {
+        surfs[i].rc=sfcvm_getsurface(pts[i].longitude, pts[i].latitude, &surfs[i].surface, &surfs[i].top);
+      }
+      return _sfcvmd_reply(fd, hdr->op, hdr->count, UCVM_MODEL_CODE_SUCCESS) ||
+             sfcvmd_writen(fd, surfs, hdr->count*sizeof(sfcvmd_surface_t));
+  }
+}
+
+/* Receives a job and the client socket that comes with it, returns the socket or -1 */
+int _sfcvmd_recv_job(int wfd, sfcvmd_job_t *job) {
+  char cbuf[CMSG_SPACE(sizeof(int))];
+  struct iovec iov;
+  struct msghdr msg;
+  ssize_t n;
+
+  iov.iov_base=job;
+  iov.iov_len=sizeof(sfcvmd_job_t);
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov=&iov;
+  msg.msg_iovlen=1;
+  msg.msg_control=cbuf;
+  msg.msg_controllen=sizeof(cbuf);
+  do {
+    n=recvmsg(wfd, &msg, 0);
+  } while(n < 0 && errno == EINTR && !sfcvmd_done);
+  if(n <= 0) return -1;
+
+  struct cmsghdr *cm=CMSG_FIRSTHDR(&msg);
+  if(cm == NULL || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) return -1;
+  int fd;
+  memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+  // the socket came with the first byte, the rest of a short read follows it
+  if((size_t)n < sizeof(sfcvmd_job_t) && sfcvmd_readn(wfd, (char *)job+n, sizeof(sfcvmd_job_t)-n)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* Sends a job to a worker with the client socket */
+int _sfcvmd_send_job(int wfd, const sfcvmd_job_t *job, int fd) {
+  char cbuf[CMSG_SPACE(sizeof(int))];
+  struct iovec iov;
+  struct msghdr msg;
+  ssize_t n;
+
+  memset(cbuf, 0, sizeof(cbuf));
+  iov.iov_base=(void *)job;
+  iov.iov_len=sizeof(sfcvmd_job_t);
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov=&iov;
+  msg.msg_iovlen=1;
+  msg.msg_control=cbuf;
+  msg.msg_controllen=sizeof(cbuf);
+  struct cmsghdr *cm=CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level=SOL_SOCKET;
+  cm->cmsg_type=SCM_RIGHTS;
+  cm->cmsg_len=CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+  do {
+    n=sendmsg(wfd, &msg, 0);
+  } while(n < 0 && errno == EINTR && !sfcvmd_done);
+  if(n <= 0) return 1;
+  return ((size_t)n < sizeof(sfcvmd_job_t)) ? sfcvmd_writen(wfd, (const char *)job+n, sizeof(sfcvmd_job_t)-n) : 0;
+}
+
+/* Worker process, serves the batches the parent hands it until told to stop */
+int _sfcvmd_worker(int wfd) {
+  sfcvm_point_t *pts=(sfcvm_point_t *)malloc(SFCVMD_MAX_BATCH*sizeof(sfcvm_point_t));
+  sfcvm_properties_t *props=(sfcvm_properties_t *)malloc(SFCVMD_MAX_BATCH*sizeof(sfcvm_properties_t));
+  sfcvmd_surface_t *surfs=(sfcvmd_surface_t *)malloc(SFCVMD_MAX_BATCH*sizeof(sfcvmd_surface_t));
+  sfcvmd_extra_t *extras=(sfcvmd_extra_t *)malloc(SFCVMD_MAX_BATCH*sizeof(sfcvmd_extra_t));
+  int *slots=(int *)malloc(3*SFCVMD_MAX_BATCH*sizeof(int));
+  if(pts == NULL || props == NULL || surfs == NULL || extras == NULL || slots == NULL) {
+    fprintf(stderr,"sfcvmd: failed to allocate query buffers\n");
+    return 1;
+  }
+
+  while(!sfcvmd_done) {
+    sfcvmd_job_t job;
+    int fd=_sfcvmd_recv_job(wfd, &job);
+    if(fd < 0) break;
+    int broken=_sfcvmd_serve(fd, &job.hdr, &job.ctx, pts, props, surfs, extras, slots);
+    close(fd);
+    if(sfcvmd_writen(wfd, &broken, sizeof(broken))) break;
+  }
+
+  free(pts);
+  free(props);
+  free(surfs);
+  free(extras);
+  free(slots);
+  return 0;
+}
+
+/* Forks worker w, returns its pid or -1 */
+pid_t _sfcvmd_spawn(int lfd, int w) {
+  int sv[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+    perror("sfcvmd: socketpair");
+    return -1;
+  }
+  pid_t pid=fork();
+  if(pid == 0) {
+    // the worker only talks to the parent and to the clients it is handed
+    close(lfd);
+    close(sv[0]);
+    for(int i=0; i<SFCVMD_MAX_CLIENTS; i++) {
+      if(sfcvmd_conns[i].fd >= 0) close(sfcvmd_conns[i].fd);
+    }
+    for(int i=0; i<sfcvmd_nworkers; i++) {
+      if(sfcvmd_workers[i].fd >= 0) close(sfcvmd_workers[i].fd);
+    }
+    exit(_sfcvmd_worker(sv[1]));
+  }
+  close(sv[1]);
+  if(pid < 0) {
+    perror("sfcvmd: fork");
+    close(sv[0]);
+    return -1;
+  }
+  sfcvmd_workers[w].pid=pid;
+  sfcvmd_workers[w].fd=sv[0];
+  sfcvmd_workers[w].conn=-1;
+  return pid;
+}
+
+/*
+ * Switches a client socket between the parent, which must not block on
+ * it, and a worker, which reads the batch and writes the reply in one go
+ */
+int _sfcvmd_nonblocking(int fd, int on) {
+  int flags=fcntl(fd, F_GETFL);
+  if(flags < 0) return 1;
+  flags=on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+  return fcntl(fd, F_SETFL, flags) < 0;
+}
+
+/* Closes a connection and frees its slot */
+void _sfcvmd_drop(int c) {
+  close(sfcvmd_conns[c].fd);
+  sfcvmd_conns[c].fd=-1;
+  sfcvmd_conns[c].busy=0;
+  sfcvmd_conns[c].pending=0;
+  sfcvmd_conns[c].got=0;
+}
+
+/* Forgets a worker that exited, the connection it was serving is in an unknown state */
+void _sfcvmd_lost(int w) {
+  if(sfcvmd_workers[w].conn >= 0) _sfcvmd_drop(sfcvmd_workers[w].conn);
+  if(sfcvmd_workers[w].fd >= 0) close(sfcvmd_workers[w].fd);
+  sfcvmd_workers[w].pid=-1;
+  sfcvmd_workers[w].fd=-1;
+  sfcvmd_workers[w].conn=-1;
+}
+
+/* Takes a SETPARAM on a connection's state, as sfcvm_setparam and sfcvm_context_setparam take it */
+int _sfcvmd_setparam(sfcvmd_state_t *st, int param, double value) {
+  switch(param) {
+    case GABBRO:
+    case FAST_FAIL:
+      return sfcvm_context_setparam(&st->ctx, param, (int)value);
+    case INPUT_CRS:
+      // a string does not fit the header
+      return UCVM_MODEL_CODE_ERROR;
+    case SFCVMD_PARAM_QUERY_MODE:
+      if((int)value == UCVM_MODEL_COORD_GEO_DEPTH) st->zmode=SFCVM_ZMODE_DEPTH;
+      if((int)value == UCVM_MODEL_COORD_GEO_ELEV && !st->plugin) st->zmode=SFCVM_ZMODE_ELEVATION;
+      return UCVM_MODEL_CODE_SUCCESS;
+    case SFCVMD_PARAM_FORCE_DEPTH:
+      st->force_depth=(int)value;
+      return UCVM_MODEL_CODE_SUCCESS;
+    case SFCVMD_PARAM_PLUGIN_MODE:
+      st->plugin=1;
+      st->zmode=SFCVM_ZMODE_DEPTH;
+      return UCVM_MODEL_CODE_SUCCESS;
+    default:
+      return sfcvm_context_setparam(&st->ctx, param, value);
+  }
+}
+
+/* Takes a new client, its state starts from the current model parameters */
+void _sfcvmd_accept(int lfd) {
+  int fd=accept(lfd, NULL, NULL);
+  if(fd < 0) {
+    if(errno != EINTR) perror("sfcvmd: accept");
+    return;
+  }
+  if(_sfcvmd_nonblocking(fd, 1)) {
+    perror("sfcvmd: fcntl");
+    close(fd);
+    return;
+  }
+  for(int c=0; c<SFCVMD_MAX_CLIENTS; c++) {
+    if(sfcvmd_conns[c].fd >= 0) continue;
+    sfcvm_context_t *ctx=sfcvm_context_create();
+    if(ctx == NULL) break;
+    memset(&sfcvmd_conns[c], 0, sizeof(sfcvmd_conn_t));
+    sfcvmd_conns[c].fd=fd;
+    sfcvmd_conns[c].state.ctx=*ctx;
+    sfcvmd_conns[c].state.zmode=SFCVM_ZMODE_DEPTH;
+    sfcvm_context_destroy(ctx);
+    return;
+  }
+  if(sfcvmd_debug) fprintf(stderr,"sfcvmd: no room for another client\n");
+  close(fd);
+}
+
+/*
+ * Reads what has arrived of the next request header of a connection.
+ * Once the header is complete, setparam is answered here and batches
+ * wait for a worker.
+ */
+void _sfcvmd_request(int c) {
+  sfcvmd_conn_t *conn=&sfcvmd_conns[c];
+  sfcvmd_header_t *hdr=&conn->hdr;
+
+  ssize_t n=read(conn->fd, (char *)hdr+conn->got, sizeof(sfcvmd_header_t)-conn->got);
+  if(n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) return;
+  if(n <= 0) {
+    _sfcvmd_drop(c);
+    return;
+  }
+  conn->got+=n;
+  if(conn->got < sizeof(sfcvmd_header_t)) return;
+  conn->got=0;
+
+  if(hdr->op == SFCVMD_OP_CLOSE) {
+    _sfcvmd_drop(c);
+    return;
+  }
+  if(hdr->magic != SFCVMD_MAGIC || hdr->count < 0 || hdr->count > SFCVMD_MAX_BATCH) {
+    if(sfcvmd_debug) fprintf(stderr,"sfcvmd: bad request header, closing\n");
+    _sfcvmd_drop(c);
+    return;
+  }
+  switch(hdr->op) {
+    case SFCVMD_OP_QUERY:
+    case SFCVMD_OP_QUERY_EXTRA:
+    case SFCVMD_OP_GETSURFACE:
+      conn->pending=1;
+      break;
+    case SFCVMD_OP_SETPARAM:
+      if(_sfcvmd_reply(conn->fd, hdr->op, 0, _sfcvmd_setparam(&conn->state, hdr->param, hdr->value))) _sfcvmd_drop(c);
+      break;
+    default:
+      if(_sfcvmd_reply(conn->fd, hdr->op, 0, UCVM_MODEL_CODE_ERROR)) _sfcvmd_drop(c);
+      break;
+  }
+}
+
+/* Hands waiting batches to idle workers, oldest connection slot after the last one served first */
+void _sfcvmd_dispatch() {
+  static int next=0;
+
+  for(int w=0; w<sfcvmd_nworkers; w++) {
+    if(sfcvmd_workers[w].fd < 0 || sfcvmd_workers[w].conn >= 0) continue;
+    int c, k;
+    for(k=0; k<SFCVMD_MAX_CLIENTS; k++) {
+      c=(next+k)%SFCVMD_MAX_CLIENTS;
+      if(sfcvmd_conns[c].fd >= 0 && sfcvmd_conns[c].pending) break;
+    }
+    if(k == SFCVMD_MAX_CLIENTS) return;
+    next=(c+1)%SFCVMD_MAX_CLIENTS;
+
+    sfcvmd_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.hdr=sfcvmd_conns[c].hdr;
+    job.ctx=sfcvmd_conns[c].state.ctx;
+    sfcvmd_conns[c].pending=0;
+    if(_sfcvmd_nonblocking(sfcvmd_conns[c].fd, 0) ||
+       _sfcvmd_send_job(sfcvmd_workers[w].fd, &job, sfcvmd_conns[c].fd)) {
+      _sfcvmd_drop(c);
+      continue;
+    }
+    sfcvmd_conns[c].busy=1;
+    sfcvmd_workers[w].conn=c;
+  }
+}
+
+/* A worker finished its batch, its connection goes back to being polled */
+void _sfcvmd_finished(int w) {
+  int broken;
+  if(sfcvmd_readn(sfcvmd_workers[w].fd, &broken, sizeof(broken))) {
+    // the worker went away, it is reaped and replaced once it has exited
+    if(sfcvmd_workers[w].conn >= 0) _sfcvmd_drop(sfcvmd_workers[w].conn);
+    close(sfcvmd_workers[w].fd);
+    sfcvmd_workers[w].fd=-1;
+    sfcvmd_workers[w].conn=-1;
+    return;
+  }
+  int c=sfcvmd_workers[w].conn;
+  sfcvmd_workers[w].conn=-1;
+  if(c < 0) return;
+  if(broken || _sfcvmd_nonblocking(sfcvmd_conns[c].fd, 1)) {
+    _sfcvmd_drop(c);
+    } else {
+      sfcvmd_conns[c].busy=0;
+  }
+}
+
+/* Reaps exited workers and forks the missing ones, returns 0 if a fork failed */
+int _sfcvmd_supervise(int lfd) {
+  pid_t pid;
+  int ok=1;
+
+  while((pid=waitpid(-1, NULL, WNOHANG)) > 0) {
+    for(int w=0; w<sfcvmd_nworkers; w++) {
+      if(sfcvmd_workers[w].pid != pid) continue;
+      if(sfcvmd_debug) fprintf(stderr,"sfcvmd: worker %d exited, restarting\n", (int)pid);
+      _sfcvmd_lost(w);
+    }
+  }
+  for(int w=0; w<sfcvmd_nworkers && !sfcvmd_done; w++) {
+    if(sfcvmd_workers[w].pid <= 0 && _sfcvmd_spawn(lfd, w) < 0) ok=0;
+  }
+  return ok;
+}
+
+/* Stops the workers and closes the clients */
+void _sfcvmd_shutdown() {
+  for(int w=0; w<sfcvmd_nworkers; w++) {
+    if(sfcvmd_workers[w].fd >= 0) close(sfcvmd_workers[w].fd);
+    if(sfcvmd_workers[w].pid > 0) kill(sfcvmd_workers[w].pid, SIGTERM);
+  }
+  while(wait(NULL) > 0 || errno == EINTR);
+  for(int c=0; c<SFCVMD_MAX_CLIENTS; c++) {
+    if(sfcvmd_conns[c].fd >= 0) _sfcvmd_drop(c);
+  }
+}
+
+/**
+ * Loads SFCVM once and serves it to clients.
+ *
+ * @param argc The number of arguments.
+ * @param argv The argument strings.
+ * @return A zero value indicating success.
+ */
+int main(int argc, char* const argv[]) {
+
+        char *sockpath=getenv("SFCVMD_SOCKET");
+        struct pollfd fds[1+SFCVMD_MAX_WORKERS+SFCVMD_MAX_CLIENTS];
+        int who[1+SFCVMD_MAX_WORKERS+SFCVMD_MAX_CLIENTS];
+        int opt;
+
+        if(sockpath == NULL) sockpath=SFCVMD_DEFAULT_SOCKET;
+
+        /* Parse options */
+        while ((opt = getopt(argc, argv, "dhs:j:")) != -1) {
+          switch (opt) {
+          case 's':
+            sockpath=optarg;
+            break;
+          case 'j':
+            sfcvmd_nworkers=atoi(optarg);
+            if(sfcvmd_nworkers < 1) sfcvmd_nworkers=1;
+            if(sfcvmd_nworkers > SFCVMD_MAX_WORKERS) sfcvmd_nworkers=SFCVMD_MAX_WORKERS;
+            break;
+          case 'd':
+            sfcvmd_debug=1;
+            break;
+          case 'h':
+            usage();
+            exit(0);
+            break;
+          default: /* '?' */
+            usage();
+            exit(1);
+          }
+        }
+
+        struct sockaddr_un addr;
+        if(strlen(sockpath) >= sizeof(addr.sun_path)) {
+          fprintf(stderr,"sfcvmd: socket path too long, %s\n", sockpath);
+          return 1;
+        }
+
+	// Initialize the model once, workers inherit it.
+        char *envstr=getenv("UCVM_INSTALL_PATH");
+        int rc;
+        if(envstr != NULL) {
+	   rc=sfcvm_init(envstr, "sfcvm");
+           } else {
+	     rc=sfcvm_init("..", "sfcvm");
+        }
+        // open every data file before forking so the workers share them
+        if(rc == UCVM_MODEL_CODE_SUCCESS) rc=sfcvm_preload();
+        if(rc != UCVM_MODEL_CODE_SUCCESS) {
+          fprintf(stderr,"sfcvmd: failed to load the model\n");
+          return 1;
+        }
+
+        int lfd=socket(AF_UNIX, SOCK_STREAM, 0);
+        if(lfd < 0) {
+          perror("sfcvmd: socket");
+          return 1;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family=AF_UNIX;
+        strcpy(addr.sun_path, sockpath);
+        unlink(sockpath);
+        if(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 64) < 0) {
+          perror("sfcvmd: bind");
+          return 1;
+        }
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler=_sfcvmd_stop;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+        sa.sa_handler=_sfcvmd_child;
+        sigaction(SIGCHLD, &sa, NULL);
+        signal(SIGPIPE, SIG_IGN);
+
+        for(int c=0; c<SFCVMD_MAX_CLIENTS; c++) sfcvmd_conns[c].fd=-1;
+        for(int w=0; w<sfcvmd_nworkers; w++) {
+          sfcvmd_workers[w].pid=-1;
+          sfcvmd_workers[w].fd=-1;
+          sfcvmd_workers[w].conn=-1;
+        }
+        // a pool that cannot be forked at startup will not come up later either
+        if(!_sfcvmd_supervise(lfd)) {
+          fprintf(stderr,"sfcvmd: failed to start the workers\n");
+          _sfcvmd_shutdown();
+          close(lfd);
+          unlink(sockpath);
+          return 1;
+        }
+        printf("sfcvmd: serving on %s with %d worker(s)\n", sockpath, sfcvmd_nworkers);
+        fflush(stdout);
+
+        // keep the pool at full strength and feed it until asked to stop
+        while(!sfcvmd_done) {
+          _sfcvmd_supervise(lfd);
+          _sfcvmd_dispatch();
+
+          int nfds=0;
+          fds[nfds].fd=lfd;
+          fds[nfds].events=POLLIN;
+          who[nfds++]=0;
+          for(int w=0; w<sfcvmd_nworkers; w++) {
+            if(sfcvmd_workers[w].fd < 0) continue;
+            fds[nfds].fd=sfcvmd_workers[w].fd;
+            fds[nfds].events=POLLIN;
+            who[nfds++]=1+w;
+          }
+          for(int c=0; c<SFCVMD_MAX_CLIENTS; c++) {
+            if(sfcvmd_conns[c].fd < 0 || sfcvmd_conns[c].busy || sfcvmd_conns[c].pending) continue;
+            fds[nfds].fd=sfcvmd_conns[c].fd;
+            fds[nfds].events=POLLIN;
+            who[nfds++]=-1-c;
+          }
+
+          // wake up now and then to reap and refork workers whatever the signals did
+          int n=poll(fds, nfds, SFCVMD_RESPAWN_MS);
+          if(n < 0) {
+            if(errno == EINTR) continue;
+            perror("sfcvmd: poll");
+            break;
+          }
+          for(int i=0; i<nfds && !sfcvmd_done; i++) {
+            if(fds[i].revents == 0) continue;
+            if(who[i] == 0) {
+              _sfcvmd_accept(lfd);
+              } else if(who[i] > 0) {
+                _sfcvmd_finished(who[i]-1);
+              } else if(sfcvmd_conns[-1-who[i]].fd >= 0) {
+                _sfcvmd_request(-1-who[i]);
+            }
+          }
+        }
+
+        _sfcvmd_shutdown();
+        close(lfd);
+        unlink(sockpath);
+	sfcvm_finalize();
+
+	return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef SFCVMD_H
+#define SFCVMD_H
+
+/**
+ * @file sfcvmd.h
+ * @brief Wire protocol shared by the sfcvmd query daemon and its client library.
+ * @author - SCEC
+ * @version 1.0
+ *
+ * Every message is a sfcvmd_header_t optionally followed by count records.
+ * Requests and replies use host byte order, both ends live on one machine.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
+
+/** "SFCD" */
+#define SFCVMD_MAGIC 0x53464344
+/** Socket used when SFCVMD_SOCKET is not set in the environment */
+#define SFCVMD_DEFAULT_SOCKET "/tmp/sfcvmd.sock"
+/** Largest number of records in one message, clients split bigger batches */
+#define SFCVMD_MAX_BATCH 65536
+
+typedef enum { SFCVMD_OP_QUERY = 1,       /* sfcvm_point_t in, sfcvm_properties_t out */
+               SFCVMD_OP_SETPARAM = 2,    /* param and value in the header */
+               SFCVMD_OP_GETSURFACE = 3,  /* sfcvm_point_t in, sfcvmd_surface_t out */
+               SFCVMD_OP_CLOSE = 4,
+               SFCVMD_OP_QUERY_EXTRA = 5  /* sfcvm_point_t in, sfcvm_properties_t then sfcvmd_extra_t out */
+             } sfcvmd_op_t;
+
+/** SETPARAM params past sfcvm_model_param_t, the UCVM settings libsfcvm keeps in sfcvm_setparam */
+typedef enum { SFCVMD_PARAM_QUERY_MODE = 100,   /* UCVM_MODEL_COORD_GEO_DEPTH or UCVM_MODEL_COORD_GEO_ELEV */
+               SFCVMD_PARAM_FORCE_DEPTH,        /* UCVM_MODEL_PARAM_FORCE_DEPTH_ABOVE_SURF */
+               SFCVMD_PARAM_PLUGIN_MODE         /* UCVM_MODEL_PARAM_PLUGIN_MODE, depth mode from then on */
+             } sfcvmd_param_t;
+
+/** Message header */
+typedef struct sfcvmd_header_t {
+	uint32_t magic;
+	/** One of sfcvmd_op_t */
+	int32_t op;
+	/** Number of records following the header */
+	int32_t count;
+	/** sfcvm_model_param_t for SETPARAM, return code in replies */
+	int32_t param;
+	/** Parameter value for SETPARAM */
+	double value;
+} sfcvmd_header_t;
+
+/** Reply record of a GETSURFACE request */
+typedef struct sfcvmd_surface_t {
+	double surface;
+	double top;
+	int32_t rc;
+	int32_t pad;
+} sfcvmd_surface_t;
+
+/** Reply record of a QUERY_EXTRA request, the sfcvm_extra_t slots of one point */
+typedef struct sfcvmd_extra_t {
+	int32_t zone_id;
+	int32_t model_i;
+	int32_t status;
+	int32_t pad;
+} sfcvmd_extra_t;
+
+/** Set by the daemon's signal handler, reads and writes interrupted after it give up */
+extern volatile sig_atomic_t sfcvmd_done;
+
+/** Reads exactly len bytes, returns 0 on success */
+int sfcvmd_readn(int fd, void *buf, size_t len);
+/** Writes exactly len bytes, returns 0 on success */
+int sfcvmd_writen(int fd, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,38 @@
+/**
+ * @file sfcvmd_proto.c
+ * @brief Socket helpers shared by sfcvmd and libsfcvm_client.
+ * @author - SCEC
+ * @version 1.0
+ *
+ */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "sfcvmd.h"
+
+volatile sig_atomic_t sfcvmd_done=0;
+
+int sfcvmd_readn(int fd, void *buf, size_t len) {
+    char *p=(char *)buf;
+    while(len > 0) {
+      ssize_t n=read(fd, p, len);
+      if(n < 0 && errno == EINTR && !sfcvmd_done) continue;
+      if(n <= 0) return 1;
+      p += n;
+      len -= n;
+    }
+    return 0;
+}
+
+int sfcvmd_writen(int fd, const void *buf, size_t len) {
+    const char *p=(const char *)buf;
+    while(len > 0) {
+      ssize_t n=write(fd, p, len);
+      if(n < 0 && errno == EINTR && !sfcvmd_done) continue;
+      if(n <= 0) return 1;
+      p += n;
+      len -= n;
+    }
+    return 0;
+}
@@ -5,6 +5,7 @@
        model_init, model_setparam, model_query, model_finalize
 **/
 
+#define _DEFAULT_SOURCE  /* Required for mkdtemp, symlink and realpath */
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -12,7 +13,12 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <assert.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include "sfcvm.h"
+#include "sfcvm_proj.h"
+#include "sfcvm_extract.h"
+#include "sfcvm_parallel.h"
 #include "unittest_defs.h"
 #include "test_helper.h"
 #include "test_sfcvm_exec.h"
@@ -169,6 +175,1666 @@ int test_query_by_elevation()
   }
 }
 
+// a context with its own squashing min elevation should agree with the
+// same value set on the live model through setparam, without re-init
+int test_context_query()
+{
+  printf("\nTest: sfcvm_context_query() against sfcvm_setparam()\n");
+
+  sfcvm_point_t pt;
+  sfcvm_properties_t expect;
+  sfcvm_properties_t ctx_ret;
+  sfcvm_properties_t ret;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+  sfcvm_context_t *ctx=sfcvm_context_create();
+  if (test_assert_int(sfcvm_context_setparam(ctx, SQUASH_MIN_ELEV, -5000.0), 0) != 0) {
+      return(1);
+  }
+  if (test_assert_int(sfcvm_context_query(ctx, &pt, &ctx_ret, 1), 0) != 0) {
+      return(1);
+  }
+
+  char blob[]="{ \"SQUASH_MIN_ELEV\" : -5000.0 }";
+  if (test_assert_int(sfcvm_setparam(0, UCVM_MODEL_PARAM_CONF_BLOB, blob), 0) != 0) {
+      return(1);
+  }
+  if (test_assert_int(model_query(&pt, &ret, 1), 0) != 0) {
+      return(1);
+  }
+
+  sfcvm_context_destroy(ctx);
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if ( test_assert_double(ret.vs, ctx_ret.vs) ||
+       test_assert_double(ret.vp, ctx_ret.vp) ||
+       test_assert_double(ret.rho, ctx_ret.rho) ) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+// the extra outputs must not change the velocities, a point inside the
+// model has a zone_id, a source model and an OK status, a point far
+// outside is reported as such
+int test_query_extra()
+{
+  printf("\nTest: sfcvm_query_extra() against model_query()\n");
+
+  sfcvm_point_t pt;
+  sfcvm_properties_t expect;
+  sfcvm_properties_t extra_ret;
+  sfcvm_properties_t ret;
+  sfcvm_extra_t extra;
+  int zone_id=-1;
+  int model_i=-1;
+  int status=-1;
+  sfcvm_point_t out_pt;
+  sfcvm_properties_t out_ret;
+  int out_status=-1;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+  memset(&extra, 0, sizeof(extra));
+  extra.zone_id=&zone_id;
+  extra.model_i=&model_i;
+  extra.status=&status;
+  if (test_assert_int(sfcvm_query_extra(&pt, &extra_ret, &extra, 1), 0) != 0) {
+      return(1);
+  }
+
+  // far outside of the model surface
+  out_pt.longitude=-100.0;
+  out_pt.latitude=20.0;
+  out_pt.depth=0.0;
+  extra.zone_id=NULL;
+  extra.model_i=NULL;
+  extra.status=&out_status;
+  if (test_assert_int(sfcvm_query_extra(&out_pt, &out_ret, &extra, 1), 0) != 0) {
+      return(1);
+  }
+  if (test_assert_int(model_query(&pt, &ret, 1), 0) != 0) {
+      return(1);
+  }
+
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if ( test_assert_double(ret.vs, extra_ret.vs) ||
+       test_assert_double(ret.vp, extra_ret.vp) ||
+       test_assert_double(ret.rho, extra_ret.rho) ||
+       zone_id < 0 || model_i < 0 || model_i > 1 ||
+       (status != SFCVM_STATUS_OK && status != SFCVM_STATUS_GABBRO_APPLIED) ||
+       test_assert_int(out_status, SFCVM_STATUS_OUTSIDE) ) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_tmerc_forward()
+{
+  printf("\nTest: sfcvm_tmerc_forward() against published values\n");
+
+  sfcvm_tmerc_t tm;
+  double lon=-73.5, lat=40.5;
+  double x, y;
+  double mlon=-123.0, mlat=35.0;
+  double mx, my;
+
+// Snyder, Map Projections - A Working Manual, p. 269, Clarke 1866
+  sfcvm_tmerc_setup(&tm, 6378206.4, 1.0/294.9786982, 0.0, -75.0, 0.9996, 0.0, 0.0);
+  sfcvm_tmerc_forward(&tm, &lon, &lat, &x, &y, 1);
+
+// the model origin of the CRS maps to 0,0
+  if (test_assert_int(sfcvm_tmerc_parse(&tm,
+          "+proj=tmerc +datum=NAD83 +lon_0=-123.0 +lat_0=35.0 +k=0.9996 +units=m +type=crs"), 0) != 0) {
+      return(1);
+  }
+  sfcvm_tmerc_forward(&tm, &mlon, &mlat, &mx, &my, 1);
+
+  if ( fabs(x-127106.5) > 0.1 || fabs(y-4484124.4) > 0.1 ||
+       fabs(mx) > 1.0e-6 || fabs(my) > 1.0e-6 ||
+       sfcvm_tmerc_parse(&tm, "+proj=lcc +datum=NAD83") == 0 ) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_input_crs()
+{
+  printf("\nTest: sfcvm_context_query() with INPUT_CRS against lon/lat\n");
+
+  sfcvm_point_t pt;
+  sfcvm_point_t utm_pt;
+  sfcvm_properties_t expect;
+  sfcvm_properties_t utm_ret;
+  sfcvm_properties_t ret;
+  sfcvm_tmerc_t tm;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+// the same point in UTM zone 10, easting in longitude and northing in latitude
+  utm_pt=pt;
+  sfcvm_crs_parse(&tm, "EPSG:26910");
+  sfcvm_tmerc_forward(&tm, &pt.longitude, &pt.latitude, &utm_pt.longitude, &utm_pt.latitude, 1);
+
+  sfcvm_context_t *ctx=sfcvm_context_create();
+  if (test_assert_int(sfcvm_context_setparam(ctx, INPUT_CRS, "EPSG:26910"), 0) != 0) {
+      return(1);
+  }
+  if (test_assert_int(sfcvm_context_query(ctx, &utm_pt, &utm_ret, 1), 0) != 0) {
+      return(1);
+  }
+  if (test_assert_int(model_query(&pt, &ret, 1), 0) != 0) {
+      return(1);
+  }
+
+  sfcvm_context_destroy(ctx);
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if ( test_assert_double(ret.vs, utm_ret.vs) ||
+       test_assert_double(ret.vp, utm_ret.vp) ||
+       test_assert_double(ret.rho, utm_ret.rho) ) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_extract_slice()
+{
+  printf("\nTest: sfcvm_extract_slice() against model_query\n");
+
+  sfcvm_point_t pt;
+  sfcvm_properties_t expect;
+  sfcvm_properties_t ret;
+  sfcvm_slice_t slice;
+  float out[3*4*3];
+  int fail=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+// 4x3 lattice around the depth test point, on two workers
+  memset(&slice, 0, sizeof(slice));
+  slice.lon0=pt.longitude-0.02;
+  slice.dlon=0.01;
+  slice.nx=4;
+  slice.lat0=pt.latitude-0.01;
+  slice.dlat=0.01;
+  slice.ny=3;
+  slice.z=pt.depth;
+  slice.zmode=SFCVM_ZMODE_DEPTH;
+  if (test_assert_int(sfcvm_extract_slice(NULL, &slice, SFCVM_FIELDS_DEFAULT, out, 2), 0) != 0) {
+      return(1);
+  }
+
+  for(int j=0; j<slice.ny && !fail; j++) {
+    for(int i=0; i<slice.nx && !fail; i++) {
+      sfcvm_point_t p=pt;
+      p.longitude=slice.lon0+i*slice.dlon;
+      p.latitude=slice.lat0+j*slice.dlat;
+      if (test_assert_int(model_query(&p, &ret, 1), 0) != 0) {
+          return(1);
+      }
+      int k=j*slice.nx+i;
+      fail=test_assert_double(out[k], ret.vp) ||
+           test_assert_double(out[12+k], ret.vs) ||
+           test_assert_double(out[24+k], ret.rho);
+    }
+  }
+
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_extract_section()
+{
+  printf("\nTest: sfcvm_extract_section() against model_query\n");
+
+  sfcvm_point_t pt;
+  sfcvm_properties_t expect;
+  sfcvm_properties_t ret;
+  sfcvm_section_t section;
+  double lon[2], lat[2];
+  double slon[8], slat[8];
+  float out[3*8*4];
+  int fail=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+// 8 stations 560 m apart going east from the depth test point, 4 depths each
+  lon[0]=pt.longitude;
+  lat[0]=pt.latitude;
+  lon[1]=pt.longitude+0.05;
+  lat[1]=pt.latitude;
+  memset(&section, 0, sizeof(section));
+  section.lon=lon;
+  section.lat=lat;
+  section.nvert=2;
+  section.spacing=560;
+  section.z0=pt.depth;
+  section.dz=250;
+  section.nz=4;
+  section.zmode=SFCVM_ZMODE_DEPTH;
+  if (test_assert_int(sfcvm_section_stations(&section, slon, slat), 8) != 0) {
+      return(1);
+  }
+  if (test_assert_int(sfcvm_extract_section(NULL, &section, SFCVM_FIELDS_DEFAULT, out, 1), 0) != 0) {
+      return(1);
+  }
+
+  for(int j=0; j<section.nz && !fail; j++) {
+    for(int i=0; i<8 && !fail; i++) {
+      sfcvm_point_t p;
+      p.longitude=slon[i];
+      p.latitude=slat[i];
+      p.depth=section.z0+j*section.dz;
+      if (test_assert_int(model_query(&p, &ret, 1), 0) != 0) {
+          return(1);
+      }
+      int k=j*8+i;
+      fail=test_assert_double(out[k], ret.vp) ||
+           test_assert_double(out[32+k], ret.vs) ||
+           test_assert_double(out[64+k], ret.rho);
+    }
+  }
+
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_site_params()
+{
+  printf("\nTest: sfcvm_site_params() against sampling with model_query\n");
+
+  sfcvm_point_t pt;
+  sfcvm_properties_t expect;
+  sfcvm_properties_t ret;
+  sfcvm_site_opts_t opts;
+  sfcvm_site_t site;
+  double tt=0.0, z1p0=-1.0, z2p5=-1.0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+  opts.dz=50;
+  opts.zmax=6000;
+  opts.vs30_layers=SFCVM_SITE_VS30_LAYERS;
+  if (test_assert_int(sfcvm_site_params(NULL, &pt.longitude, &pt.latitude, 1, &opts, &site), 0) != 0) {
+      return(1);
+  }
+
+// Travel time over the top 30 m, then every dz down the column
+  for(int k=0; k<opts.vs30_layers; k++) {
+    pt.depth=(k+0.5)*30.0/opts.vs30_layers;
+    if (test_assert_int(model_query(&pt, &ret, 1), 0) != 0) {
+        return(1);
+    }
+    tt+=(30.0/opts.vs30_layers)/ret.vs;
+  }
+  for(int k=0; k*opts.dz <= opts.zmax && z2p5 < 0; k++) {
+    pt.depth=k*opts.dz;
+    if (test_assert_int(model_query(&pt, &ret, 1), 0) != 0) {
+        return(1);
+    }
+    if(z1p0 < 0 && ret.vs >= SFCVM_Z1P0_VS) z1p0=pt.depth;
+    if(z2p5 < 0 && ret.vs >= SFCVM_Z2P5_VS) z2p5=pt.depth;
+  }
+
+  int fail=test_assert_double(site.vs30, 30.0/tt) ||
+           test_assert_double(site.z1p0, z1p0) ||
+           test_assert_double(site.z2p5, z2p5);
+
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_reduce_volume()
+{
+  printf("\nTest: sfcvm_reduce_volume() against model_query\n");
+
+  sfcvm_point_t pt;
+  sfcvm_properties_t expect;
+  sfcvm_properties_t ret;
+  sfcvm_volume_t vol;
+  sfcvm_reduction_t red[2*2];
+  int fail=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+// 3x2 columns around the depth test point, 4 depths in 2 bands, vp and vs
+  memset(&vol, 0, sizeof(vol));
+  vol.lon0=pt.longitude-0.01;
+  vol.dlon=0.01;
+  vol.nx=3;
+  vol.lat0=pt.latitude;
+  vol.dlat=0.01;
+  vol.ny=2;
+  vol.z0=pt.depth;
+  vol.dz=250;
+  vol.nz=4;
+  vol.zmode=SFCVM_ZMODE_DEPTH;
+  for(int r=0; r<4; r++) sfcvm_reduction_init(&red[r], 0, 8000, 64);
+  if (test_assert_int(sfcvm_reduce_volume(NULL, &vol, SFCVM_FIELD_VP|SFCVM_FIELD_VS, 2, red, 2), 0) != 0) {
+      return(1);
+  }
+
+  for(int b=0; b<2 && !fail; b++) {
+    double vpmin=1e30, vpmax=-1e30, vpsum=0, vsmin=1e30, vsmax=-1e30, vssum=0;
+    long vsbins=0;
+    for(int j=0; j<vol.ny; j++) {
+      for(int i=0; i<vol.nx; i++) {
+        for(int k=2*b; k<2*b+2; k++) {
+          sfcvm_point_t p;
+          p.longitude=vol.lon0+i*vol.dlon;
+          p.latitude=vol.lat0+j*vol.dlat;
+          p.depth=vol.z0+k*vol.dz;
+          if (test_assert_int(model_query(&p, &ret, 1), 0) != 0) {
+              return(1);
+          }
+          if(ret.vp < vpmin) vpmin=ret.vp;
+          if(ret.vp > vpmax) vpmax=ret.vp;
+          if(ret.vs < vsmin) vsmin=ret.vs;
+          if(ret.vs > vsmax) vsmax=ret.vs;
+          vpsum+=ret.vp;
+          vssum+=ret.vs;
+        }
+      }
+    }
+    for(int k=0; k<red[2*b+1].nbins; k++) vsbins+=red[2*b+1].bins[k];
+    fail=test_assert_int(red[2*b].count, 12) ||
+         test_assert_double(red[2*b].min, vpmin) ||
+         test_assert_double(red[2*b].max, vpmax) ||
+         test_assert_double(sfcvm_reduction_mean(&red[2*b]), vpsum/12) ||
+         test_assert_double(red[2*b+1].min, vsmin) ||
+         test_assert_double(red[2*b+1].max, vsmax) ||
+         test_assert_double(sfcvm_reduction_mean(&red[2*b+1]), vssum/12) ||
+         test_assert_int(vsbins, 12);
+  }
+
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_extract_octree()
+{
+  printf("\nTest: sfcvm_extract_octree() against sfcvm_context_query\n");
+
+  sfcvm_point_t pt;
+  sfcvm_point_t cpt;
+  sfcvm_properties_t expect;
+  sfcvm_properties_t ret;
+  sfcvm_tmerc_t tm;
+  sfcvm_octree_t oct;
+  sfcvm_octree_header_t hdr;
+  sfcvm_octant_t leaf;
+  const char *file="test_octree.oct";
+  long nleaves;
+  double volume=0;
+  int fail=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+// one 1 km root cell in UTM zone 10 around the depth test point, on two workers
+  sfcvm_crs_parse(&tm, "EPSG:26910");
+  cpt=pt;
+  sfcvm_tmerc_forward(&tm, &pt.longitude, &pt.latitude, &cpt.longitude, &cpt.latitude, 1);
+  sfcvm_context_t *ctx=sfcvm_context_create();
+  if (test_assert_int(sfcvm_context_setparam(ctx, INPUT_CRS, "EPSG:26910"), 0) != 0) {
+      return(1);
+  }
+  memset(&oct, 0, sizeof(oct));
+  oct.x0=cpt.longitude-500;
+  oct.y0=cpt.latitude-500;
+  oct.z0=pt.depth-500;
+  oct.size=1000;
+  oct.nx=oct.ny=oct.nz=1;
+  oct.max_level=3;
+  oct.fmax=1;
+  oct.ppw=8;
+  oct.vs_floor=100;
+  if (test_assert_int(sfcvm_extract_octree(ctx, &oct, file, 2, &nleaves), 0) != 0) {
+      return(1);
+  }
+
+// every leaf holds the values at its center and is fine enough or at the deepest level
+  FILE *fp=fopen(file, "rb");
+  if(fp == NULL || fread(&hdr, sizeof(hdr), 1, fp) != 1) {
+      return(1);
+  }
+  fail=test_assert_int(hdr.nleaves, nleaves) || test_assert_int(nleaves > 1, 1);
+  double tick=oct.size/(1<<oct.max_level);
+  for(long i=0; i<nleaves && !fail; i++) {
+    if(fread(&leaf, sizeof(leaf), 1, fp) != 1) {
+      fail=1;
+      break;
+    }
+    double e=(1<<(oct.max_level-leaf.level))*tick;
+    cpt.longitude=oct.x0+leaf.x*tick+e/2;
+    cpt.latitude=oct.y0+leaf.y*tick+e/2;
+    cpt.depth=oct.z0+leaf.z*tick+e/2;
+    if (test_assert_int(sfcvm_context_query(ctx, &cpt, &ret, 1), 0) != 0) {
+        return(1);
+    }
+    volume+=e*e*e;
+    fail=test_assert_double(leaf.vp, (float)ret.vp) ||
+         test_assert_double(leaf.vs, (float)ret.vs) ||
+         test_assert_int(leaf.level == oct.max_level || e <= ret.vs/(oct.fmax*oct.ppw), 1);
+  }
+  fclose(fp);
+  unlink(file);
+  fail=fail || test_assert_double(volume, 1.0e9);
+
+  sfcvm_context_destroy(ctx);
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_cell_average()
+{
+  printf("\nTest: sfcvm_cell_average() against model_query\n");
+
+  sfcvm_point_t pt;
+  sfcvm_properties_t expect;
+  sfcvm_properties_t ret;
+  sfcvm_properties_t avg;
+  sfcvm_element_t el;
+  double coverage;
+  double rho=0, imu=0, im=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+// a box around the depth test point, 2x2x2 samples of equal weight
+  sfcvm_element_box(&el, pt.longitude-0.005, pt.longitude+0.005, pt.latitude-0.005, pt.latitude+0.005,
+                    pt.depth-250, pt.depth+250);
+  if (test_assert_int(sfcvm_cell_average(NULL, &el, 1, 2, &avg, &coverage, 1), 0) != 0) {
+      return(1);
+  }
+
+  for(int k=0; k<8; k++) {
+    sfcvm_point_t p;
+    p.longitude=pt.longitude+((k&1) ? 0.0025 : -0.0025);
+    p.latitude=pt.latitude+((k&2) ? 0.0025 : -0.0025);
+    p.depth=pt.depth+((k&4) ? 125 : -125);
+    if (test_assert_int(model_query(&p, &ret, 1), 0) != 0) {
+        return(1);
+    }
+    rho+=ret.rho/8;
+    imu+=1/(8*ret.rho*ret.vs*ret.vs);
+    im+=1/(8*ret.rho*ret.vp*ret.vp);
+  }
+
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if ( test_assert_double(avg.rho, rho) ||
+       test_assert_double(avg.vs, sqrt(1/imu/rho)) ||
+       test_assert_double(avg.vp, sqrt(1/im/rho)) ||
+       test_assert_double(coverage, 1.0) ) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_extract_native()
+{
+  printf("\nTest: sfcvm_extract_native() against sfcvm_context_query\n");
+
+  sfcvm_point_t pt;
+  sfcvm_point_t cpt;
+  sfcvm_properties_t expect;
+  sfcvm_properties_t ret;
+  sfcvm_tmerc_t tm;
+  sfcvm_grid_t grid;
+  sfcvm_native_header_t hdr;
+  const char *file="test_native.bin";
+  float val[3*3*4];
+  int fail=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+// a 3x2 lattice turned by 30 degrees at the depth test point, on two workers
+  if (test_assert_int(sfcvm_tmerc_parse(&tm, sfcvm_configuration->model_crs), 0) != 0) {
+      return(1);
+  }
+  cpt=pt;
+  sfcvm_tmerc_forward(&tm, &pt.longitude, &pt.latitude, &cpt.longitude, &cpt.latitude, 1);
+  memset(&grid, 0, sizeof(grid));
+  grid.x0=cpt.longitude;
+  grid.y0=cpt.latitude;
+  grid.azimuth=30;
+  grid.dx=grid.dy=100;
+  grid.nx=3;
+  grid.ny=2;
+  sfcvm_context_t *ctx=sfcvm_context_create();
+  if (test_assert_int(sfcvm_context_setparam(ctx, INPUT_CRS, sfcvm_configuration->model_crs), 0) != 0) {
+      return(1);
+  }
+  if (test_assert_int(sfcvm_extract_native(ctx, &grid, pt.depth, 25, 4, SFCVM_FIELDS_DEFAULT, NULL, file, 2), 0) != 0) {
+      return(1);
+  }
+
+// every node holds the values queried at its model_crs coordinates
+  FILE *fp=fopen(file, "rb");
+  if(fp == NULL || fread(&hdr, sizeof(hdr), 1, fp) != 1) {
+      return(1);
+  }
+  fail=test_assert_int(memcmp(hdr.magic, SFCVM_NATIVE_MAGIC, 8), 0) ||
+       test_assert_int(hdr.nx*hdr.ny*hdr.nz, 24);
+  double az=grid.azimuth*M_PI/180;
+  for(int j=0; j<grid.ny && !fail; j++) {
+    if(fread(val, sizeof(float), 3*3*4, fp) != 3*3*4) {
+      fail=1;
+      break;
+    }
+    for(int i=0; i<grid.nx && !fail; i++) {
+      for(int k=0; k<4 && !fail; k++) {
+        cpt.longitude=grid.x0+i*grid.dx*cos(az)+j*grid.dy*sin(az);
+        cpt.latitude=grid.y0-i*grid.dx*sin(az)+j*grid.dy*cos(az);
+        cpt.depth=pt.depth+k*25;
+        if (test_assert_int(sfcvm_context_query(ctx, &cpt, &ret, 1), 0) != 0) {
+            return(1);
+        }
+        fail=test_assert_double(val[(0*3+i)*4+k], (float)ret.vp) ||
+             test_assert_double(val[(1*3+i)*4+k], (float)ret.vs) ||
+             test_assert_double(val[(2*3+i)*4+k], (float)ret.rho);
+      }
+    }
+  }
+  fclose(fp);
+  unlink(file);
+
+  sfcvm_context_destroy(ctx);
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_path_sample()
+{
+  printf("\nTest: sfcvm_path_sample() against sfcvm_context_query\n");
+
+  sfcvm_point_t pt;
+  sfcvm_point_t cpt;
+  sfcvm_properties_t expect;
+  sfcvm_properties_t ret;
+  sfcvm_tmerc_t tm;
+  sfcvm_path_sample_t *smp;
+  sfcvm_path_result_t res;
+  sfcvm_path_result_t traced[2];
+  double x[2], y[2], depth[2];
+  double tp=0;
+  int fail=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+// a slanted ray from the depth test point, 400 m east and 300 m down
+  sfcvm_crs_parse(&tm, "EPSG:26910");
+  sfcvm_tmerc_forward(&tm, &pt.longitude, &pt.latitude, &x[0], &y[0], 1);
+  x[1]=x[0]+400;
+  y[1]=y[0];
+  depth[0]=pt.depth;
+  depth[1]=pt.depth+300;
+  sfcvm_path_t path={ 2, x, y, depth };
+  sfcvm_context_t *ctx=sfcvm_context_create();
+  if (test_assert_int(sfcvm_context_setparam(ctx, INPUT_CRS, "EPSG:26910"), 0) != 0 ||
+      test_assert_int(sfcvm_path_sample(ctx, &path, &smp, &res), 0) != 0 ||
+      test_assert_int(sfcvm_path_trace(ctx, &path, 1, traced, 1), 0) != 0) {
+      return(1);
+  }
+
+// every sample holds the values at its point, and the ends are the vertices
+  fail=test_assert_double(res.length, 500.0) ||
+       test_assert_int(res.nsamples > 2, 1) ||
+       test_assert_double(smp[res.nsamples-1].x, x[1]) ||
+       test_assert_double(smp[res.nsamples-1].depth, depth[1]);
+  for(int i=0; i<res.nsamples && !fail; i++) {
+    cpt.longitude=smp[i].x;
+    cpt.latitude=smp[i].y;
+    cpt.depth=smp[i].depth;
+    if (test_assert_int(sfcvm_context_query(ctx, &cpt, &ret, 1), 0) != 0) {
+        return(1);
+    }
+    fail=test_assert_double(smp[i].vp, ret.vp) ||
+         test_assert_double(smp[i].vs, ret.vs);
+    if(i > 0) tp+=(smp[i].s-smp[i-1].s)*(1/smp[i].vp+1/smp[i-1].vp)/2;
+  }
+  fail=fail || test_assert_double(res.tp, tp) ||
+       test_assert_double(traced[0].tp, res.tp) ||
+       test_assert_int(traced[0].nsamples, res.nsamples);
+  free(smp);
+
+  sfcvm_context_destroy(ctx);
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_derived_params()
+{
+  printf("\nTest: sfcvm_context_query_extra() derived outputs against model_query\n");
+
+  sfcvm_point_t pt;
+  sfcvm_properties_t expect;
+  sfcvm_properties_t ret;
+  sfcvm_properties_t derived;
+  sfcvm_extra_t extra;
+  double mu=0, lambda=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+  if (test_assert_int(model_query(&pt, &ret, 1), 0) != 0) {
+      return(1);
+  }
+
+// a floor above the Vs of the point raises it at its Vp/Vs ratio
+  double vs_floor=ret.vs+100;
+  sfcvm_context_t *ctx=sfcvm_context_create();
+  memset(&extra, 0, sizeof(extra));
+  extra.mu=&mu;
+  extra.lambda=&lambda;
+  if (test_assert_int(sfcvm_context_setparam(ctx, VS_FLOOR, vs_floor), 0) != 0 ||
+      test_assert_int(sfcvm_context_setparam(ctx, QS_VS, 0.05), 0) != 0 ||
+      test_assert_int(sfcvm_context_setparam(ctx, QP_QS, 2.0), 0) != 0 ||
+      test_assert_int(sfcvm_context_query_extra(ctx, &pt, &derived, &extra, 1), 0) != 0) {
+      return(1);
+  }
+  sfcvm_context_destroy(ctx);
+
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if ( test_assert_double(derived.vs, vs_floor) ||
+       test_assert_double(derived.vp, ret.vp*vs_floor/ret.vs) ||
+       test_assert_double(derived.rho, ret.rho) ||
+       test_assert_double(derived.qs, 0.05*vs_floor) ||
+       test_assert_double(derived.qp, 0.1*vs_floor) ||
+       test_assert_double(mu, ret.rho*vs_floor*vs_floor) ||
+       test_assert_double(lambda, ret.rho*(derived.vp*derived.vp-2*vs_floor*vs_floor)) ) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_extract_encoded()
+{
+  printf("\nTest: sfcvm_extract_slice_encoded() uint16 against float32\n");
+
+  sfcvm_point_t pt;
+  sfcvm_properties_t expect;
+  sfcvm_slice_t slice;
+  sfcvm_encoding_t enc;
+  float out[4*4*3];
+  uint8_t packed[(3*2+1)*4*3];
+  int fail=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+// the 4x3 lattice of test_extract_slice, as float32 and as uint16 in 2 m/s steps from 100
+  memset(&slice, 0, sizeof(slice));
+  slice.lon0=pt.longitude-0.02;
+  slice.dlon=0.01;
+  slice.nx=4;
+  slice.lat0=pt.latitude-0.01;
+  slice.dlat=0.01;
+  slice.ny=3;
+  slice.z=pt.depth;
+  slice.zmode=SFCVM_ZMODE_DEPTH;
+  if (test_assert_int(sfcvm_encoding_parse("uint16,2,100", &enc), 0) != 0 ||
+      test_assert_int(sfcvm_encoded_size(SFCVM_FIELDS_ALL, &enc), sizeof(packed)/12) != 0 ||
+      test_assert_int(sfcvm_extract_slice(NULL, &slice, SFCVM_FIELDS_ALL, out, 2), 0) != 0 ||
+      test_assert_int(sfcvm_extract_slice_encoded(NULL, &slice, SFCVM_FIELDS_ALL, &enc, packed, 2), 0) != 0) {
+      return(1);
+  }
+
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  uint16_t band[12];
+  for(int b=0; b<3 && !fail; b++) {
+    memcpy(band, &packed[b*sizeof(band)], sizeof(band));
+    for(int k=0; k<12 && !fail; k++) {
+      double v=out[b*12+k];
+      int want=(v < 0) ? SFCVM_UINT16_NODATA : (v < 100) ? 0 : (int)floor((v-100)/2+0.5);
+      fail=test_assert_int(band[k], want);
+    }
+  }
+  for(int k=0; k<12 && !fail; k++) {
+    int zone=(int)out[36+k];
+    fail=test_assert_int(packed[3*sizeof(band)+k], (zone < 0 || zone > 254) ? SFCVM_UINT8_NODATA : zone);
+  }
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+typedef struct test_order_job_t {
+  sfcvm_point_t *pts;
+  sfcvm_properties_t *data;
+  int n;
+} test_order_job_t;
+
+int _test_order_tile(long tile, void *arg)
+{
+  test_order_job_t *job=(test_order_job_t *)arg;
+  int first=(int)tile*SFCVM_PARALLEL_TILE;
+  int cnt=(job->n-first < SFCVM_PARALLEL_TILE) ? job->n-first : SFCVM_PARALLEL_TILE;
+  return sfcvm_query(&job->pts[first], &job->data[first], cnt);
+}
+
+int test_parallel_order()
+{
+  printf("\nTest: tiles ordered by cost against tiles in order\n");
+
+  sfcvm_point_t pt;
+  sfcvm_properties_t expect;
+  sfcvm_volume_t vol;
+  sfcvm_reduction_t red1[3], red4[3];
+  test_order_job_t job;
+  int nx=37, ny=35, n=nx*ny;
+  long ntiles=(n+SFCVM_PARALLEL_TILE-1)/SFCVM_PARALLEL_TILE;
+  double cost[ntiles];
+  int fail=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+// a lattice from the depth test point west over the bay, land and water tiles
+  sfcvm_point_t *pts=(sfcvm_point_t *)malloc(n*sizeof(sfcvm_point_t));
+  sfcvm_properties_t *serial=(sfcvm_properties_t *)calloc(n, sizeof(sfcvm_properties_t));
+  sfcvm_properties_t *par=(sfcvm_properties_t *)calloc(n, sizeof(sfcvm_properties_t));
+  job.pts=pts;
+  job.n=n;
+  job.data=(sfcvm_properties_t *)sfcvm_parallel_alloc(n*sizeof(sfcvm_properties_t));
+  if(pts == NULL || serial == NULL || par == NULL || job.data == NULL) {
+      return(1);
+  }
+  for(int j=0; j<ny; j++) {
+    for(int i=0; i<nx; i++) {
+      pts[j*nx+i].longitude=pt.longitude-i*0.01;
+      pts[j*nx+i].latitude=pt.latitude+j*0.01;
+      pts[j*nx+i].depth=500;
+    }
+  }
+  if (test_assert_int(sfcvm_query(pts, serial, n), 0) != 0) {
+      return(1);
+  }
+
+// estimated costs, then the tiles last first, on 4 workers and in the caller
+  fail=test_assert_int(sfcvm_query_parallel(pts, par, n, 4), 0) ||
+       test_assert_int(memcmp(serial, par, n*sizeof(sfcvm_properties_t)), 0);
+  for(long t=0; t<ntiles; t++) cost[t]=t;
+  for(int w=4; w>=1 && !fail; w-=3) {
+    memset(job.data, 0, n*sizeof(sfcvm_properties_t));
+    fail=test_assert_int(sfcvm_parallel_run(ntiles, cost, w, _test_order_tile, &job), 0) ||
+         test_assert_int(memcmp(serial, job.data, n*sizeof(sfcvm_properties_t)), 0);
+  }
+
+// a reduction merges its tiles in order whatever order they ran in
+  memset(&vol, 0, sizeof(vol));
+  vol.lon0=pt.longitude-(nx-1)*0.01;
+  vol.dlon=0.01;
+  vol.nx=nx;
+  vol.lat0=pt.latitude;
+  vol.dlat=0.01;
+  vol.ny=ny;
+  vol.z0=0;
+  vol.dz=500;
+  vol.nz=4;
+  vol.zmode=SFCVM_ZMODE_DEPTH;
+  for(int r=0; r<3; r++) {
+    sfcvm_reduction_init(&red1[r], 0, 8000, 64);
+    sfcvm_reduction_init(&red4[r], 0, 8000, 64);
+  }
+  if(!fail) {
+    fail=test_assert_int(sfcvm_reduce_volume(NULL, &vol, SFCVM_FIELDS_DEFAULT, 0, red1, 1), 0) ||
+         test_assert_int(sfcvm_reduce_volume(NULL, &vol, SFCVM_FIELDS_DEFAULT, 0, red4, 4), 0) ||
+         test_assert_int(memcmp(red1, red4, sizeof(red1)), 0);
+  }
+
+  // Close the model.
+  assert(model_finalize() == 0);
+  sfcvm_parallel_free(job.data);
+  free(pts);
+  free(serial);
+  free(par);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_water_batch()
+{
+  printf("\nTest: sfcvm_query() batch step down under water against point by point\n");
+
+  sfcvm_point_t pts[64];
+  sfcvm_properties_t batch[64], single[64];
+  int n=64, water=0;
+  int fail=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+// points under San Francisco Bay near the San Mateo bridge, from the water surface down
+  for(int i=0; i<n; i++) {
+    double surface, top;
+    pts[i].longitude=-122.20+(i%8)*0.005;
+    pts[i].latitude=37.58+(i/8)*0.005;
+    pts[i].depth=(i%4)*5;
+    if(sfcvm_getsurface(pts[i].longitude, pts[i].latitude, &surface, &top) == 0 && surface < 0) water++;
+  }
+  memset(batch, 0, sizeof(batch));
+  memset(single, 0, sizeof(single));
+  fail=test_assert_int(water > 0, 1) ||
+       test_assert_int(sfcvm_query(pts, batch, n), 0);
+  for(int i=0; i<n && !fail; i++) {
+    fail=test_assert_int(sfcvm_query(&pts[i], &single[i], 1), 0);
+  }
+  if(!fail) {
+    fail=test_assert_int(memcmp(batch, single, sizeof(batch)), 0);
+  }
+
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+int test_query_error_reset()
+{
+  printf("\nTest: sfcvm_query() batch with failing points against point by point\n");
+
+  sfcvm_point_t pts[64];
+  sfcvm_properties_t batch[64], single[64];
+  int n=64;
+  int fail=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+// every third point is below the model and fails, the others are under water
+  for(int i=0; i<n; i++) {
+    pts[i].longitude=-122.20+(i%8)*0.005;
+    pts[i].latitude=37.58+(i/8)*0.005;
+    pts[i].depth=(i%3 == 0) ? 200000 : (i%3)*5;
+  }
+  memset(batch, 0, sizeof(batch));
+  memset(single, 0, sizeof(single));
+  // the good points one by one before anything has failed, then the failing ones
+  for(int i=0; i<n; i++) {
+    if(i%3 != 0) sfcvm_query(&pts[i], &single[i], 1);
+  }
+  for(int i=0; i<n; i++) {
+    if(i%3 == 0) sfcvm_query(&pts[i], &single[i], 1);
+  }
+  // a failed query must not leave its error status to the points after it
+  fail=test_assert_int(sfcvm_query(pts, batch, n), 0) ||
+       test_assert_int(single[1].vs > 0, 1) ||
+       test_assert_int(memcmp(batch, single, sizeof(batch)), 0);
+
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+// fast fail answers points outside every footprint without a query and
+// leaves the points inside alone
+int test_fastfail()
+{
+  printf("\nTest: sfcvm_context_query_extra() with FAST_FAIL against without\n");
+
+  sfcvm_point_t pt;
+  sfcvm_properties_t expect;
+  sfcvm_point_t pts[8];
+  sfcvm_properties_t slow[8], fast[8];
+  int slow_st[8], fast_st[8];
+  sfcvm_extra_t extra;
+  sfcvm_stats_t before, after;
+  int n=8, nout=3;
+  int fail=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  if( get_depth_test_point(&pt,&expect) != 0) {
+      return(1);
+  }
+
+// inside the regional bounding box but outside its footprint, at two
+// corners, and far away, then land and water points inside
+  double lon[8]={ -119.5, -126.0, -118.0, pt.longitude, pt.longitude-0.05, -122.20, -122.40, -122.30 };
+  double lat[8]={ 41.0, 35.5, 34.0, pt.latitude, pt.latitude+0.05, 37.58, 37.80, 38.00 };
+  for(int i=0; i<n; i++) {
+    pts[i].longitude=lon[i];
+    pts[i].latitude=lat[i];
+    pts[i].depth=pt.depth;
+  }
+  memset(slow, 0, sizeof(slow));
+  memset(fast, 0, sizeof(fast));
+  memset(&extra, 0, sizeof(extra));
+
+  sfcvm_context_t *ctx=sfcvm_context_create();
+  extra.status=slow_st;
+  fail=test_assert_int(sfcvm_context_setparam(ctx, FAST_FAIL, 0), 0) ||
+       test_assert_int(sfcvm_context_query_extra(ctx, pts, slow, &extra, n), 0);
+  extra.status=fast_st;
+  if(!fail) {
+    fail=test_assert_int(sfcvm_context_setparam(ctx, FAST_FAIL, 1), 0) ||
+         test_assert_int(sfcvm_get_stats(&before), 0) ||
+         test_assert_int(sfcvm_context_query_extra(ctx, pts, fast, &extra, n), 0) ||
+         test_assert_int(sfcvm_get_stats(&after), 0) ||
+         test_assert_int((int)(after.fastfail_count-before.fastfail_count), nout);
+  }
+  for(int i=0; i<nout && !fail; i++) {
+    fail=test_assert_int(fast_st[i], SFCVM_STATUS_OUTSIDE) ||
+         test_assert_double(fast[i].vp, -1) ||
+         test_assert_double(fast[i].vs, -1) ||
+         test_assert_double(fast[i].rho, -1);
+  }
+  for(int i=nout; i<n && !fail; i++) {
+    fail=test_assert_int(fast_st[i], slow_st[i]) ||
+         test_assert_int(memcmp(&fast[i], &slow[i], sizeof(sfcvm_properties_t)), 0);
+  }
+
+  sfcvm_context_destroy(ctx);
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+/* Copies the file src to dst. Returns 0 on success. */
+int _copy_file(const char *src, const char *dst)
+{
+  char buf[4096];
+  size_t n;
+
+  FILE *in=fopen(src, "r");
+  FILE *out=fopen(dst, "w");
+  int rc=(in == NULL || out == NULL);
+  while(!rc && (n=fread(buf, 1, sizeof(buf), in)) > 0) {
+    if(fwrite(buf, 1, n, out) != n) rc=1;
+  }
+  if(in != NULL) fclose(in);
+  if(out != NULL && fclose(out) != 0) rc=1;
+  return rc;
+}
+
+/*
+ * Installs conf as the config of a model in a new directory, its data
+ * files linked to those of the installed model, so sfcvm_init(dir, "sfcvm")
+ * loads it. Returns 0 on success.
+ */
+int _model_install(const char *base, const char *conf, char *dir, char *cfg, char *data)
+{
+  char path[PATH_MAX], src[PATH_MAX];
+
+  strcpy(dir, "./sfcvm_model.XXXXXX");
+  sprintf(path, "%s/model/sfcvm/data/sfcvm", base);
+  if(realpath(path, src) == NULL || mkdtemp(dir) == NULL) return 1;
+  sprintf(path, "%s/model", dir);
+  mkdir(path, 0755);
+  sprintf(path, "%s/model/sfcvm", dir);
+  mkdir(path, 0755);
+  sprintf(path, "%s/model/sfcvm/data", dir);
+  if(mkdir(path, 0755) != 0) return 1;
+  sprintf(data, "%s/model/sfcvm/data/sfcvm", dir);
+  if(symlink(src, data) != 0) return 1;
+
+  sprintf(cfg, "%s/model/sfcvm/data/config", dir);
+  return _copy_file(conf, cfg);
+}
+
+void _model_remove(const char *dir, const char *cfg, const char *data)
+{
+  char path[PATH_MAX];
+
+  unlink(cfg);
+  unlink(data);
+  sprintf(path, "%s/model/sfcvm/data", dir);
+  rmdir(path);
+  sprintf(path, "%s/model/sfcvm", dir);
+  rmdir(path);
+  sprintf(path, "%s/model", dir);
+  rmdir(path);
+  rmdir(dir);
+}
+
+/* Queries pts with fast fail off and on, with every extra output */
+int _tiles_query(sfcvm_point_t *pts, int n, sfcvm_properties_t *data, int *zone_id, int *model_i, int *status)
+{
+  sfcvm_extra_t extra;
+  int rc=1;
+
+  memset(data, 0, 2*n*sizeof(sfcvm_properties_t));
+  memset(&extra, 0, sizeof(extra));
+  sfcvm_context_t *ctx=sfcvm_context_create();
+  if(ctx == NULL) return 1;
+  for(int ff=0; ff<2; ff++) {
+    extra.zone_id=&zone_id[ff*n];
+    extra.model_i=&model_i[ff*n];
+    extra.status=&status[ff*n];
+    rc=sfcvm_context_setparam(ctx, FAST_FAIL, ff) ||
+       sfcvm_context_query_extra(ctx, pts, &data[ff*n], &extra, n);
+    if(rc) break;
+  }
+  sfcvm_context_destroy(ctx);
+  return rc;
+}
+
+// the model split into tiles answers as the two data files do, on either
+// side of the tile edges, below the detailed model and outside
+int test_tiles()
+{
+  printf("\nTest: sfcvm_context_query_extra() on a tiled config against two data files\n");
+
+  int nx=25, ny=24, nz=3, n=nx*ny*nz;
+  double depth[3]={ 500, 8000, 30000 };
+  char dir[PATH_MAX], cfg[PATH_MAX], data[PATH_MAX];
+  int fail=0;
+
+  sfcvm_point_t *pts=(sfcvm_point_t *)malloc(n*sizeof(sfcvm_point_t));
+  sfcvm_properties_t *two=(sfcvm_properties_t *)malloc(2*n*sizeof(sfcvm_properties_t));
+  sfcvm_properties_t *tiled=(sfcvm_properties_t *)malloc(2*n*sizeof(sfcvm_properties_t));
+  int *out=(int *)malloc(12*n*sizeof(int));
+  if(pts == NULL || two == NULL || tiled == NULL || out == NULL) {
+      return(1);
+  }
+
+// a lattice over the detailed model and past it, every point at three depths
+  for(int j=0; j<ny; j++) {
+    for(int i=0; i<nx; i++) {
+      for(int k=0; k<nz; k++) {
+        sfcvm_point_t *p=&pts[(j*nx+i)*nz+k];
+        p->longitude=-123.6+i*0.1;
+        p->latitude=36.4+j*0.1;
+        p->depth=depth[k];
+      }
+    }
+  }
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  const char *base=(envstr != NULL) ? envstr : "..";
+  if (test_assert_int(model_init(base, "sfcvm"), 0) != 0) {
+    return(1);
+  }
+  fail=test_assert_int(_tiles_query(pts, n, two, out, &out[2*n], &out[4*n]), 0);
+  assert(model_finalize() == 0);
+
+  if(!fail) {
+    fail=test_assert_int(_model_install(base, "./inputs/sfcvm_tiles.conf", dir, cfg, data), 0);
+  }
+  if(!fail) {
+    fail=test_assert_int(model_init(dir, "sfcvm"), 0);
+    if(!fail) {
+      fail=test_assert_int(sfcvm_configuration->data_cnt, 4) ||
+           test_assert_int(_tiles_query(pts, n, tiled, &out[6*n], &out[8*n], &out[10*n]), 0);
+      assert(model_finalize() == 0);
+    }
+  }
+  _model_remove(dir, cfg, data);
+
+  if(!fail) {
+    fail=test_assert_int(memcmp(two, tiled, 2*n*sizeof(sfcvm_properties_t)), 0) ||
+         test_assert_int(memcmp(out, &out[6*n], 6*n*sizeof(int)), 0);
+  }
+
+  free(pts);
+  free(two);
+  free(tiled);
+  free(out);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+// a job that stays in the detailed model leaves the regional one closed,
+// the first regional point opens it
+int test_lazy_open()
+{
+  printf("\nTest: sfcvm_query() opens the regional model on its first point\n");
+
+  sfcvm_point_t pts[3];
+  sfcvm_properties_t data[3];
+  sfcvm_stats_t detailed, regional;
+  int fail=0;
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+// land points in the detailed model, then one west of it in the regional model
+  double lon[3]={ -122.25, -121.941, -122.00 };
+  double lat[3]={ 37.85, 37.455, 37.70 };
+  for(int i=0; i<3; i++) {
+    pts[i].longitude=lon[i];
+    pts[i].latitude=lat[i];
+    pts[i].depth=1000;
+  }
+  fail=test_assert_int(sfcvm_query(pts, data, 3), 0) ||
+       test_assert_int(sfcvm_get_stats(&detailed), 0) ||
+       test_assert_int(detailed.objects_opened > 0, 1) ||
+       test_assert_int(detailed.objects_opened < detailed.objects_total, 1);
+
+  pts[0].longitude=-123.3;
+  pts[0].latitude=37.0;
+  if(!fail) {
+    fail=test_assert_int(sfcvm_query(pts, data, 1), 0) ||
+         test_assert_int(data[0].vs > 0, 1) ||
+         test_assert_int(sfcvm_get_stats(&regional), 0) ||
+         test_assert_int(regional.objects_opened > detailed.objects_opened, 1) ||
+         test_assert_int(regional.objects_opened <= regional.objects_total, 1);
+  }
+
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+/*
+ * The gabbro correction as sfcvm computed it point by point before the
+ * batch pass, in m/s and kg/m^3. Returns 0 below 7.75 km, where it is
+ * not applied.
+ */
+int _baseline_gabbro(double elevation, double *vp, double *vs, double *rho)
+{
+  double delta=(5.7-4.2)/7.75;
+  double depth=(elevation == 0.0) ? 0.0 : ((0.0-elevation)/1000);
+  if(depth >= 7.750) return 0;
+  double v=4.2+depth*delta;
+  *vp=v*1000;
+  *vs=(0.7858-(1.2344*v)+(0.7949*v*v)-(0.1238*v*v*v)+(0.0064*v*v*v*v))*1000;
+  *rho=(2.4372+(0.0761*v))*1000;
+  return 1;
+}
+
+// the gabbro correction matches the point by point formula, and is only
+// applied to the gabbro zone_id of its own model
+int test_gabbro()
+{
+  printf("\nTest: sfcvm_context_query_extra() with GABBRO on against the point by point formula\n");
+
+  // San Leandro and Logan gabbro in the detailed model, GV gabbro in the regional one
+  double lon0[3]={ -122.16, -121.62, -122.60 };
+  double lat0[3]={ 37.68, 36.84, 39.40 };
+  double depth[3]={ 500, 4000, 9000 };
+  int na=3, nx=10, ny=10, nz=3, n=na*nx*ny*nz;
+  int applied[2]={ 0, 0 };
+  sfcvm_extra_t extra;
+  int fail=0;
+
+  sfcvm_point_t *pts=(sfcvm_point_t *)malloc(n*sizeof(sfcvm_point_t));
+  sfcvm_properties_t *off=(sfcvm_properties_t *)malloc(n*sizeof(sfcvm_properties_t));
+  sfcvm_properties_t *on=(sfcvm_properties_t *)malloc(n*sizeof(sfcvm_properties_t));
+  int *out=(int *)malloc(4*n*sizeof(int));
+  if(pts == NULL || off == NULL || on == NULL || out == NULL) {
+      return(1);
+  }
+  int *zone_id=out, *model_i=&out[n], *off_st=&out[2*n], *on_st=&out[3*n];
+
+  for(int a=0; a<na; a++) {
+    for(int j=0; j<ny; j++) {
+      for(int i=0; i<nx; i++) {
+        for(int k=0; k<nz; k++) {
+          sfcvm_point_t *p=&pts[((a*ny+j)*nx+i)*nz+k];
+          p->longitude=lon0[a]+i*0.03;
+          p->latitude=lat0[a]+j*0.03;
+          p->depth=depth[k];
+        }
+      }
+    }
+  }
+
+// Initialize the model, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  if(envstr != NULL) {
+    if (test_assert_int(model_init(envstr, "sfcvm"), 0) != 0) {
+      return(1);
+    }
+  } else if (test_assert_int(model_init("..", "sfcvm"), 0) != 0) {
+    return(1);
+  }
+
+  memset(off, 0, n*sizeof(sfcvm_properties_t));
+  memset(on, 0, n*sizeof(sfcvm_properties_t));
+  memset(&extra, 0, sizeof(extra));
+  sfcvm_context_t *ctx=sfcvm_context_create();
+  extra.zone_id=zone_id;
+  extra.model_i=model_i;
+  extra.status=off_st;
+  fail=test_assert_int(sfcvm_context_setparam(ctx, GABBRO, 0), 0) ||
+       test_assert_int(sfcvm_context_query_extra(ctx, pts, off, &extra, n), 0);
+  memset(&extra, 0, sizeof(extra));
+  extra.status=on_st;
+  if(!fail) {
+    fail=test_assert_int(sfcvm_context_setparam(ctx, GABBRO, 1), 0) ||
+         test_assert_int(sfcvm_context_query_extra(ctx, pts, on, &extra, n), 0);
+  }
+
+  for(int i=0; i<n && !fail; i++) {
+    double surface, top, vp, vs, rho;
+    // water points are stepped down, away from their own depth
+    if(sfcvm_getsurface(pts[i].longitude, pts[i].latitude, &surface, &top) != 0 || surface < 0) continue;
+    if(off_st[i] == SFCVM_STATUS_OUTSIDE || off_st[i] == SFCVM_STATUS_QUERY_ERROR) continue;
+    int gabbro=(model_i[i] == 0 && (zone_id[i] == 4 || zone_id[i] == 5)) ||
+               (model_i[i] == 1 && zone_id[i] == 3);
+    if(gabbro && _baseline_gabbro(-pts[i].depth, &vp, &vs, &rho)) {
+      applied[model_i[i]]++;
+      fail=test_assert_int(off_st[i], SFCVM_STATUS_OK) ||
+           test_assert_int(on_st[i], SFCVM_STATUS_GABBRO_APPLIED) ||
+           test_assert_double(on[i].vp, vp) ||
+           test_assert_double(on[i].vs, vs) ||
+           test_assert_double(on[i].rho, rho);
+    } else {
+      fail=test_assert_int(on_st[i] != SFCVM_STATUS_GABBRO_APPLIED, 1) ||
+           test_assert_int(on_st[i], off_st[i]) ||
+           test_assert_int(memcmp(&on[i], &off[i], sizeof(sfcvm_properties_t)), 0);
+    }
+  }
+  if(!fail) {
+    fail=test_assert_int(applied[0] > 0, 1) ||
+         test_assert_int(applied[1] > 0, 1);
+  }
+
+  sfcvm_context_destroy(ctx);
+  // Close the model.
+  assert(model_finalize() == 0);
+
+  free(pts);
+  free(off);
+  free(on);
+  free(out);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
+/* Inits the model in dir and queries n points, init_from_snapshot returned in snap */
+int _snapshot_query(const char *dir, sfcvm_point_t *pts, sfcvm_properties_t *data, int n, int *snap)
+{
+  sfcvm_stats_t stats;
+
+  memset(data, 0, n*sizeof(sfcvm_properties_t));
+  if(model_init(dir, "sfcvm") != 0) return 1;
+  int rc=sfcvm_get_stats(&stats) || sfcvm_query(pts, data, n);
+  *snap=stats.init_from_snapshot;
+  assert(model_finalize() == 0);
+  return rc;
+}
+
+// an init from the snapshot answers as the config does, and a config
+// rewritten with the same size in the same second makes it stale
+int test_snapshot()
+{
+  printf("\nTest: sfcvm_init() from $SFCVM_INIT_SNAPSHOT against the config\n");
+
+  int nx=20, ny=20, n=nx*ny;
+  char dir[PATH_MAX], cfg[PATH_MAX], data[PATH_MAX], conf[PATH_MAX], snapfile[PATH_MAX];
+  sfcvm_point_t pts[400];
+  sfcvm_properties_t fromcfg[400], fromsnap[400];
+  int snap[3]={ 1, 0, 1 };
+  int fail=0;
+
+  for(int j=0; j<ny; j++) {
+    for(int i=0; i<nx; i++) {
+      pts[j*nx+i].longitude=-122.8+i*0.1;
+      pts[j*nx+i].latitude=36.6+j*0.1;
+      pts[j*nx+i].depth=(i+j)*250;
+    }
+  }
+
+// Install a copy of the model config, try to use Use UCVM_INSTALL_PATH
+  char *envstr=getenv("UCVM_INSTALL_PATH");
+  const char *base=(envstr != NULL) ? envstr : "..";
+  sprintf(conf, "%s/model/sfcvm/data/config", base);
+  if (test_assert_int(_model_install(base, conf, dir, cfg, data), 0) != 0) {
+    _model_remove(dir, cfg, data);
+    return(1);
+  }
+  sprintf(snapfile, "%s/sfcvm.snap", dir);
+  setenv("SFCVM_INIT_SNAPSHOT", snapfile, 1);
+
+  // the first init writes the snapshot, the second loads it
+  fail=test_assert_int(_snapshot_query(dir, pts, fromcfg, n, &snap[0]), 0) ||
+       test_assert_int(snap[0], 0) ||
+       test_assert_int(_snapshot_query(dir, pts, fromsnap, n, &snap[1]), 0) ||
+       test_assert_int(snap[1], 1) ||
+       test_assert_int(memcmp(fromcfg, fromsnap, sizeof(fromcfg)), 0);
+
+  // same content, so same size, most likely within the same second
+  if(!fail) {
+    fail=test_assert_int(_copy_file(conf, cfg), 0) ||
+         test_assert_int(_snapshot_query(dir, pts, fromsnap, n, &snap[2]), 0) ||
+         test_assert_int(snap[2], 0) ||
+         test_assert_int(memcmp(fromcfg, fromsnap, sizeof(fromcfg)), 0);
+  }
+
+  unsetenv("SFCVM_INIT_SNAPSHOT");
+  unlink(snapfile);
+  _model_remove(dir, cfg, data);
+
+  if (fail) {
+     printf("FAIL\n");
+     return(1);
+     } else {
+       printf("PASS\n");
+       return(0);
+  }
+}
+
 
 int suite_sfcvm_exec(const char *xmldir)
 {
@@ -179,7 +1845,7 @@ int suite_sfcvm_exec(const char *xmldir)
   /* Setup test suite */
   strcpy(suite.suite_name, "suite_sfcvm_exec");
 
-  suite.num_tests = 4;
+  suite.num_tests = 26;
   suite.tests = malloc(suite.num_tests * sizeof(test_t));
   if (suite.tests == NULL) {
     fprintf(stderr, "Failed to alloc test structure\n");
@@ -204,6 +1870,94 @@ int suite_sfcvm_exec(const char *xmldir)
   suite.tests[3].test_func = &test_query_by_elevation;
   suite.tests[3].elapsed_time = 0.0;
 
+  strcpy(suite.tests[4].test_name, "test_context_query");
+  suite.tests[4].test_func = &test_context_query;
+  suite.tests[4].elapsed_time = 0.0;
+
+  strcpy(suite.tests[5].test_name, "test_query_extra");
+  suite.tests[5].test_func = &test_query_extra;
+  suite.tests[5].elapsed_time = 0.0;
+
+  strcpy(suite.tests[6].test_name, "test_tmerc_forward");
+  suite.tests[6].test_func = &test_tmerc_forward;
+  suite.tests[6].elapsed_time = 0.0;
+
+  strcpy(suite.tests[7].test_name, "test_input_crs");
+  suite.tests[7].test_func = &test_input_crs;
+  suite.tests[7].elapsed_time = 0.0;
+
+  strcpy(suite.tests[8].test_name, "test_extract_slice");
+  suite.tests[8].test_func = &test_extract_slice;
+  suite.tests[8].elapsed_time = 0.0;
+
+  strcpy(suite.tests[9].test_name, "test_extract_section");
+  suite.tests[9].test_func = &test_extract_section;
+  suite.tests[9].elapsed_time = 0.0;
+
+  strcpy(suite.tests[10].test_name, "test_site_params");
+  suite.tests[10].test_func = &test_site_params;
+  suite.tests[10].elapsed_time = 0.0;
+
+  strcpy(suite.tests[11].test_name, "test_reduce_volume");
+  suite.tests[11].test_func = &test_reduce_volume;
+  suite.tests[11].elapsed_time = 0.0;
+
+  strcpy(suite.tests[12].test_name, "test_extract_octree");
+  suite.tests[12].test_func = &test_extract_octree;
+  suite.tests[12].elapsed_time = 0.0;
+
+  strcpy(suite.tests[13].test_name, "test_cell_average");
+  suite.tests[13].test_func = &test_cell_average;
+  suite.tests[13].elapsed_time = 0.0;
+
+  strcpy(suite.tests[14].test_name, "test_extract_native");
+  suite.tests[14].test_func = &test_extract_native;
+  suite.tests[14].elapsed_time = 0.0;
+
+  strcpy(suite.tests[15].test_name, "test_path_sample");
+  suite.tests[15].test_func = &test_path_sample;
+  suite.tests[15].elapsed_time = 0.0;
+
+  strcpy(suite.tests[16].test_name, "test_derived_params");
+  suite.tests[16].test_func = &test_derived_params;
+  suite.tests[16].elapsed_time = 0.0;
+
+  strcpy(suite.tests[17].test_name, "test_extract_encoded");
+  suite.tests[17].test_func = &test_extract_encoded;
+  suite.tests[17].elapsed_time = 0.0;
+
+  strcpy(suite.tests[18].test_name, "test_parallel_order");
+  suite.tests[18].test_func = &test_parallel_order;
+  suite.tests[18].elapsed_time = 0.0;
+
+  strcpy(suite.tests[19].test_name, "test_water_batch");
+  suite.tests[19].test_func = &test_water_batch;
+  suite.tests[19].elapsed_time = 0.0;
+
+  strcpy(suite.tests[20].test_name, "test_query_error_reset");
+  suite.tests[20].test_func = &test_query_error_reset;
+  suite.tests[20].elapsed_time = 0.0;
+
+  strcpy(suite.tests[21].test_name, "test_fastfail");
+  suite.tests[21].test_func = &test_fastfail;
+  suite.tests[21].elapsed_time = 0.0;
+
+  strcpy(suite.tests[22].test_name, "test_tiles");
+  suite.tests[22].test_func = &test_tiles;
+  suite.tests[22].elapsed_time = 0.0;
+
+  strcpy(suite.tests[23].test_name, "test_lazy_open");
+  suite.tests[23].test_func = &test_lazy_open;
+  suite.tests[23].elapsed_time = 0.0;
+
+  strcpy(suite.tests[24].test_name, "test_gabbro");
+  suite.tests[24].test_func = &test_gabbro;
+  suite.tests[24].elapsed_time = 0.0;
+
+  strcpy(suite.tests[25].test_name, "test_snapshot");
+  suite.tests[25].test_func = &test_snapshot;
+  suite.tests[25].elapsed_time = 0.0;
+
   if (test_run_suite(&suite) != 0) {
     fprintf(stderr, "Failed to execute tests\n");
     return(1);